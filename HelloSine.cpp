@@ -1,12 +1,17 @@
 //-----------------------------------------------------------------------------
 // name: HelloSine.cpp
 // desc: hello sine wave, real-time
+//       (HelloSine <file> also records the input to a .wav/.caf/raw file)
+//       On the way out it reports the strongest frequency it played.
 //
 // author: Ge Wang (ge@ccrma.stanford.edu)
 //   date: fall 2011
 //   uses: RtAudio by Gary Scavone
 //-----------------------------------------------------------------------------
 #include "RtAudio.h"
+#include "RtRecorder.h"
+#include "RtBufferTuner.h"
+#include "RtAnalyzer.h"
 #include <math.h>
 #include <iostream>
 #include <cstdlib>
@@ -15,9 +20,9 @@ using namespace std;
 
 
 // our datetype
-#define SAMPLE double
+#define SAMPLE float
 // corresponding format for RtAudio
-#define MY_FORMAT RTAUDIO_FLOAT64
+#define MY_FORMAT RTAUDIO_FLOAT32
 // sample rate
 #define MY_SRATE 44100
 // number of channels
@@ -26,9 +31,13 @@ using namespace std;
 #define MY_PIE 3.14159265358979
 
 // global for frequency
-SAMPLE g_freq;
+double g_freq;
 // globla sample number variable
-SAMPLE g_t = 0;
+double g_t = 0;
+// records the input when a file name is given
+RtRecorder g_recorder;
+// spectrum of what we play, computed on its own thread
+RtAnalyzer g_analyzer;
 
 
 
@@ -76,6 +85,9 @@ SAMPLE g_t = 0;
         // debug print something out per callback
         cerr << ".";
 
+        // hand the input to the recorder (does nothing unless it is open)
+        g_recorder.write( inputBuffer, numFrames );
+
         // cast!
         SAMPLE * buffy = (SAMPLE *)outputBuffer;
 
@@ -83,16 +95,15 @@ SAMPLE g_t = 0;
         for( int i = 0; i < numFrames; i++ )
         {
             // generate signal
-            buffy[i*MY_CHANNELS] = ::sin( 2 * MY_PIE * g_freq * g_t / MY_SRATE );
-
-            // copy into other channels
-            for( int j = 1; j < MY_CHANNELS; j++ )
-                buffy[i*MY_CHANNELS+j] = buffy[i*MY_CHANNELS];
+            buffy[i] = ::sin( 2 * MY_PIE * g_freq * g_t / MY_SRATE );
 
             // increment sample number
             g_t += 1.0;
         }
 
+        // hand the output to the analyzer (just a copy)
+        g_analyzer.write( buffy, numFrames );
+
         return 0;
     }
 
@@ -107,10 +118,12 @@ int main( int argc, char ** argv )
 {
     // instantiate RtAudio object
     RtAudio adac;
+    // picks the buffer size while the stream runs
+    RtBufferTuner tuner( adac );
     // variables
     unsigned int bufferBytes = 0;
     // frame size
-    unsigned int bufferFrames = 512;
+    unsigned int bufferFrames = 0;
     
     // check for audio devices
     if( adac.getDeviceCount() < 1 )
@@ -134,22 +147,41 @@ int main( int argc, char ** argv )
     
     // create stream options
     RtAudio::StreamOptions options;
+    // the callback renders one channel, which RtAudio copies to all
+    // of the output channels
+    options.outputRouting.assign( MY_CHANNELS, 1.0 );
 
 
     /*
      *   here is where the different callbacks will be triggered via the different args...
      */
 
-    if (argc == 1) {
+    if (argc == 1 || argc == 2) {
         // user sets the frequency
         g_freq = getInteger("Enter frequency (20-20K):  ", 20, 20000);
 
+        // record the input if asked to
+        if( argc == 2 )
+        {
+            try {
+                g_recorder.open( argv[1], MY_CHANNELS, MY_SRATE, MY_FORMAT );
+            }
+            catch( RtError& e )
+            {
+                cout << e.getMessage() << endl;
+                exit( 1 );
+            }
+        }
+
          
         // go for it
         try {
-            // open a stream
-            adac.openStream( &oParams, &iParams, MY_FORMAT, MY_SRATE, 
- 		    &bufferFrames, &callmeBasic, (void *)&bufferBytes, &options );
+            // analyze the one channel we render
+            g_analyzer.open( 1, MY_SRATE, MY_FORMAT );
+
+            // open a stream, starting at the smallest buffer size
+            tuner.openStream( &oParams, &iParams, MY_FORMAT, MY_SRATE,
+                              &callmeBasic, (void *)&bufferBytes, &options );
         }
         catch( RtError& e )
         {
@@ -159,6 +191,7 @@ int main( int argc, char ** argv )
         }
 
         // compute
+        bufferFrames = tuner.getBufferFrames();
         bufferBytes = bufferFrames * MY_CHANNELS * sizeof(SAMPLE);
 
         // test RtAudio functionality for reporting latency.
@@ -168,7 +201,7 @@ int main( int argc, char ** argv )
         try {
         
             // start stream
-            adac.startStream();
+            tuner.startStream();
 
             // get input
             char input;
@@ -177,16 +210,45 @@ int main( int argc, char ** argv )
             std::cin.get(input);
         
             // stop the stream.
-            adac.stopStream();
+            tuner.stopStream();
         }
         catch( RtError& e )
         {
             // print error message
             cout << e.getMessage() << endl;
         }
+        // report what the tuner settled on
+        cout << "buffer frames: " << tuner.getBufferFrames() << " ("
+             << tuner.getRetuneCount() << " retunes, "
+             << tuner.getXrunCount() << " xruns)" << endl;
         // close if open
-        if( adac.isStreamOpen() )
-            adac.closeStream();
+        tuner.closeStream();
+
+        // the strongest frequency in the last spectrum
+        vector<float> magnitude;
+        if( g_analyzer.getSpectrum( 0, magnitude ) )
+        {
+            unsigned int peak = 0;
+            for( unsigned int k = 1; k < magnitude.size(); k++ )
+                if( magnitude[k] > magnitude[peak] ) peak = k;
+            cout << "played " << g_analyzer.getBinFrequency( peak ) << " Hz at "
+                 << 20 * log10( magnitude[peak] + 1e-12 ) << " dBFS" << endl;
+        }
+        g_analyzer.close();
+
+        // finish the recording
+        if( g_recorder.isOpen() )
+        {
+            try {
+                g_recorder.close();
+            }
+            catch( RtError& e )
+            {
+                cout << e.getMessage() << endl;
+            }
+            cout << "recorded " << g_recorder.getFramesRecorded() << " frames ("
+                 << g_recorder.getDroppedFrames() << " dropped)" << endl;
+        }
     
         // done
         return 0;
@@ -1,20 +1,26 @@
 //-----------------------------------------------------------------------------
 // Name: Log.cpp
 // This program is meant to take the logarithm of every sample of a sound file,
-// with the purpose of smoothing it.
+// with the purpose of smoothing it.  Given an impulse response as a second
+// file, it also plays the input through it (e.g. the reverb of a room).
 //-----------------------------------------------------------------------------
 #include "RtAudio.h"
+#include "RtFilePlayer.h"
+#include "RtConvolver.h"
+#include "RtMeter.h"
 #include <math.h>
+#include <unistd.h>
+#include <algorithm>
 #include <iostream>
 #include <cstdlib>
 #include <sstream>
 using namespace std;
 
 
-// our datetype
-#define SAMPLE double
+// our datetype (callmeLog() takes either float type, see main())
+#define SAMPLE float
 // corresponding format for RtAudio
-#define MY_FORMAT RTAUDIO_FLOAT64
+#define MY_FORMAT RTAUDIO_FLOAT32
 // sample rate
 #define MY_SRATE 44100
 // number of channels
@@ -23,9 +29,19 @@ using namespace std;
 #define MY_PIE 3.14159265358979
 
 // global for frequency
-SAMPLE g_freq;
+double g_freq;
 // globla sample number variable
-SAMPLE g_t = 0;
+double g_t = 0;
+// streams the sound file from disk
+RtFilePlayer g_player( MY_CHANNELS );
+// strength of the log curve
+#define MY_LOG_AMOUNT 20.0
+// convolves the input with the impulse response, if one is given
+RtConvolver g_convolver( MY_CHANNELS );
+// level of the convolved input
+#define MY_WET 0.5
+// levels and loudness of the output
+RtMeter g_meter( MY_CHANNELS, MY_SRATE );
 
 
 
@@ -62,6 +78,30 @@ SAMPLE g_t = 0;
 
 
 
+/* vector< vector<float> > loadImpulse(const char *filename);
+ *
+ * Reads a whole sound file into memory, one vector per channel.
+ * The player decodes it on its own thread; we just collect the frames.
+ */
+    vector< vector<float> > loadImpulse(const char *filename) {
+        RtFilePlayer player( MY_CHANNELS );
+        player.open( filename );
+        vector< vector<float> > impulse( MY_CHANNELS, vector<float>( player.getLength() ) );
+        vector<float *> out( MY_CHANNELS );
+        while( !player.isFinished() ) {
+            unsigned long long pos = player.getPosition();
+            unsigned int n = (unsigned int) min( player.getBufferedFrames(), 4096ULL );
+            if( n == 0 ) { usleep( 1000 ); continue; }
+            for( int j = 0; j < MY_CHANNELS; j++ )
+                out[j] = &impulse[j][pos];
+            player.process( NULL, &out[0], n );
+        }
+        return impulse;
+    }
+
+
+
+
 
     //-----------------------------------------------------------------------------
     // name: callmeBasic()
@@ -96,6 +136,44 @@ SAMPLE g_t = 0;
 
 
 
+    //-----------------------------------------------------------------------------
+    // name: callmeLog()
+    // desc: audio callback.  Plays the file and takes the log of every sample.
+    //       T is float or double, whichever the devices handle natively.
+    //-----------------------------------------------------------------------------
+    template <class T>
+    int callmeLog( void * outputBuffer, void * inputBuffer, unsigned int numFrames,
+                double streamTime, RtAudioStreamStatus status, void * data )
+    {
+        // cast!
+        T * buffy = (T *)outputBuffer;
+
+        // the next frames of the file (read ahead by the player's own thread)
+        g_player.render( buffy, numFrames, RtAudioFormatOf<T>::value );
+
+        // log of every sample, keeping the sign (all in T, no double round trip)
+        const T amount = MY_LOG_AMOUNT;
+        const T scale = 1 / ::log( 1 + amount );
+        for( int i = 0; i < numFrames * MY_CHANNELS; i++ )
+        {
+            T x = buffy[i];
+            T y = ::log( 1 + amount * ::fabs( x ) ) * scale;
+            buffy[i] = ( x < 0 ) ? -y : y;
+        }
+
+        // the input through the impulse response (tail computed on other threads)
+        if( inputBuffer )
+            g_convolver.mix( buffy, inputBuffer, numFrames, RtAudioFormatOf<T>::value, MY_WET );
+
+        // measure what goes out
+        g_meter.process( buffy, numFrames, RtAudioFormatOf<T>::value );
+
+        return 0;
+    }
+
+
+
+
 //-----------------------------------------------------------------------------
 // name: main()
 // desc: entry point
@@ -108,6 +186,8 @@ int main( int argc, char ** argv )
     unsigned int bufferBytes = 0;
     // frame size
     unsigned int bufferFrames = 512;
+    // sample format of the stream
+    RtAudioFormat format = MY_FORMAT;
 
     // check for audio devices
     if( adac.getDeviceCount() < 1 )
@@ -131,18 +211,42 @@ int main( int argc, char ** argv )
 
     // create stream options
     RtAudio::StreamOptions options;
+    // line the input up with the output, sample for sample
+    options.flags |= RTAUDIO_ALIGN_DUPLEX;
 
 
     /*
      *   here is where the different callbacks will be triggered via the different args...
      */
 
-    if (argc == 2) {
+    if (argc == 2 || argc == 3) {
         // go for it
         try {
+            // load the impulse response
+            if( argc == 3 ) {
+                g_convolver.load( loadImpulse( argv[2] ) );
+                cout << "impulse response: " << g_convolver.getLength() << " frames in "
+                     << g_convolver.getLevelCount() << " levels" << endl;
+            }
+
+            // open the file
+            g_player.open( argv[1] );
+            if( g_player.getSampleRate() != MY_SRATE )
+                cout << "warning: " << argv[1] << " is at " << g_player.getSampleRate()
+                     << " Hz, playing at " << MY_SRATE << " Hz" << endl;
+
+            // process in float or double, whichever the devices handle natively
+            format = RtAudio::negotiateFormat( adac.getDeviceInfo( oParams.deviceId ).nativeFormats |
+                                               adac.getDeviceInfo( iParams.deviceId ).nativeFormats,
+                                               RTAUDIO_FLOAT32 | RTAUDIO_FLOAT64 );
+
             // open a stream
-            adac.openStream( &oParams, &iParams, MY_FORMAT, MY_SRATE,
-            &bufferFrames, &callmeBasic, (void *)&bufferBytes, &options );
+            if( format == RTAUDIO_FLOAT32 )
+                adac.openStream( &oParams, &iParams, format, MY_SRATE,
+                &bufferFrames, &callmeLog<float>, (void *)&bufferBytes, &options );
+            else
+                adac.openStream( &oParams, &iParams, format, MY_SRATE,
+                &bufferFrames, &callmeLog<double>, (void *)&bufferBytes, &options );
         }
         catch( RtError& e )
         {
@@ -152,7 +256,7 @@ int main( int argc, char ** argv )
         }
 
         // compute
-        bufferBytes = bufferFrames * MY_CHANNELS * sizeof(SAMPLE);
+        bufferBytes = bufferFrames * MY_CHANNELS * ( format == RTAUDIO_FLOAT32 ? sizeof(float) : sizeof(double) );
 
         // test RtAudio functionality for reporting latency.
         cout << "stream latency: " << adac.getStreamLatency() << " frames" << endl;
@@ -169,6 +273,13 @@ int main( int argc, char ** argv )
          << bufferFrames << ")" << endl;
             std::cin.get(input);
 
+            // measured while running: input captured -> output played
+            cout << "duplex latency: " << adac.getStreamDuplexLatency() << " frames" << endl;
+            if( g_convolver.getLateCount() > 0 )
+                cout << "convolution tail late " << g_convolver.getLateCount() << " times" << endl;
+            cout << "output peak: " << g_meter.getMaxPeak() << " dBFS, integrated loudness: "
+                 << g_meter.getIntegrated() << " LUFS" << endl;
+
             // stop the stream.
             adac.stopStream();
         }
@@ -184,7 +295,7 @@ int main( int argc, char ** argv )
         // done
         return 0;
     } else {
-        cout << "Must have one extra argument, the file name." << endl;
+        cout << "Usage: Log file [impulse-response-file]" << endl;
         exit(1);
     }
 
@@ -0,0 +1,208 @@
+/************************************************************************/
+/*! \class RtAnalyzer
+    \brief Spectrum analyzer tap for RtAudio streams.
+
+    See RtAnalyzer.h for an overview.
+*/
+/************************************************************************/
+
+#include "RtAnalyzer.h"
+#include <unistd.h>
+#include <math.h>
+#include <algorithm>
+
+RtAnalyzer :: RtAnalyzer( void )
+  : channels_( 0 ), sampleRate_( 0 ), format_( 0 ), frameBytes_( 0 ), fftSize_( 0 ), hop_( 0 ),
+    sleepMicroseconds_( 0 ), frames_( 0 ), sinceHop_( 0 ), latest_( -1 ), open_( false ),
+    stop_( false ), spectra_( 0 ), droppedFrames_( 0 )
+{
+  for ( int i=0; i<2; i++ ) {
+    snapshotFrame_[i] = 0;
+    sequence_[i].store( 0 );
+  }
+}
+
+RtAnalyzer :: ~RtAnalyzer( void )
+{
+  close();
+}
+
+void RtAnalyzer :: open( unsigned int channels, unsigned int sampleRate, RtAudioFormat format,
+                         unsigned int fftSize, unsigned int hop, double ringSeconds )
+{
+  if ( open_ )
+    throw RtError( "RtAnalyzer::open: the analyzer is already open.", RtError::INVALID_USE );
+
+  unsigned int sampleBytes;
+  if ( format == RTAUDIO_FLOAT32 ) sampleBytes = 4;
+  else if ( format == RTAUDIO_FLOAT64 ) sampleBytes = 8;
+  else
+    throw RtError( "RtAnalyzer::open: unsupported sample format.", RtError::INVALID_PARAMETER );
+  if ( channels == 0 || sampleRate == 0 || ringSeconds <= 0.0 )
+    throw RtError( "RtAnalyzer::open: invalid channel count, sample rate or ring size.", RtError::INVALID_PARAMETER );
+  if ( fftSize < 16 || ( fftSize & ( fftSize - 1 ) ) != 0 )
+    throw RtError( "RtAnalyzer::open: the FFT size must be a power of two of at least 16.", RtError::INVALID_PARAMETER );
+  if ( hop == 0 ) hop = fftSize / 4;
+
+  channels_ = channels;
+  sampleRate_ = sampleRate;
+  format_ = format;
+  frameBytes_ = channels * sampleBytes;
+  fftSize_ = fftSize;
+  hop_ = hop;
+
+  // The ring must hold a few hops, or the analysis could never keep up.
+  size_t ringBytes = (size_t) ( ringSeconds * sampleRate ) * frameBytes_;
+  if ( !ring_.resize( std::max( ringBytes, (size_t) 4 * hop * frameBytes_ ) ) )
+    throw RtError( "RtAnalyzer::open: error allocating buffer memory.", RtError::MEMORY_ERROR );
+
+  // Let the analysis thread wake up about twice per hop.
+  double seconds = (double) hop / sampleRate / 2.0;
+  sleepMicroseconds_ = (unsigned int) ( 1000000.0 * std::min( std::max( seconds, 0.001 ), 0.1 ) );
+
+  fft_.setSize( fftSize );
+  unsigned int bins = getBins();
+  chunk_.resize( (size_t) hop * frameBytes_ );
+  history_.assign( (size_t) channels * fftSize, 0.0 );
+  window_.resize( fftSize );
+  for ( unsigned int i=0; i<fftSize; i++ )
+    window_[i] = (float) ( 0.5 - 0.5 * cos( 2.0 * M_PI * i / fftSize ) );
+  windowed_.resize( fftSize );
+  re_.resize( bins );
+  im_.resize( bins );
+  for ( int i=0; i<2; i++ ) {
+    snapshot_[i].assign( (size_t) channels * bins, 0.0 );
+    snapshotFrame_[i] = 0;
+  }
+  latest_ = -1;
+  frames_ = 0;
+  sinceHop_ = 0;
+
+  stop_ = false;
+  spectra_ = 0;
+  droppedFrames_ = 0;
+  if ( pthread_create( &thread_, NULL, analysisThread, this ) )
+    throw RtError( "RtAnalyzer::open: error creating analysis thread.", RtError::THREAD_ERROR );
+  open_ = true;
+}
+
+bool RtAnalyzer :: write( const void *buffer, unsigned int nFrames )
+{
+  if ( !open_ ) return false;
+
+  size_t bytes = (size_t) nFrames * frameBytes_;
+  if ( ring_.writeAvailable() < bytes ) {
+    droppedFrames_.fetch_add( nFrames, std::memory_order_relaxed );
+    return false;
+  }
+
+  ring_.write( buffer, bytes );
+  return true;
+}
+
+void RtAnalyzer :: close( void )
+{
+  if ( !open_ ) return;
+
+  open_ = false;
+  stop_ = true;
+  pthread_join( thread_, NULL );
+}
+
+bool RtAnalyzer :: getSpectrum( unsigned int channel, std::vector<float> &magnitude,
+                                unsigned long long *frame ) const
+{
+  if ( channel >= channels_ ) return false;
+
+  // The analysis thread writes the other snapshot, so this loop only
+  // repeats if it completes two spectra while one is being copied.
+  unsigned int bins = getBins();
+  std::vector<float> copy( bins );
+  while ( true ) {
+    int index = latest_.load( std::memory_order_acquire );
+    if ( index < 0 ) return false;
+    unsigned int sequence = sequence_[index].load( std::memory_order_acquire );
+    if ( sequence & 1 ) continue;
+    std::copy( snapshot_[index].begin() + channel * bins, snapshot_[index].begin() + ( channel + 1 ) * bins,
+               copy.begin() );
+    unsigned long long copyFrame = snapshotFrame_[index];
+    std::atomic_thread_fence( std::memory_order_acquire );
+    if ( sequence_[index].load( std::memory_order_relaxed ) != sequence ) continue;
+
+    magnitude.swap( copy );
+    if ( frame ) *frame = copyFrame;
+    return true;
+  }
+}
+
+void *RtAnalyzer :: analysisThread( void *ptr )
+{
+  ( (RtAnalyzer *) ptr )->analysisLoop();
+  return 0;
+}
+
+void RtAnalyzer :: analysisLoop( void )
+{
+  unsigned int mask = fftSize_ - 1;
+
+  while ( !stop_ ) {
+    size_t available;
+    while ( !stop_ && ( available = ring_.readAvailable() / frameBytes_ ) > 0 ) {
+      // Read up to the next hop, and spread the frames over the
+      // channel histories.
+      unsigned int count = (unsigned int) std::min( available, (size_t) ( hop_ - sinceHop_ ) );
+      ring_.read( &chunk_[0], (size_t) count * frameBytes_ );
+      for ( unsigned int c=0; c<channels_; c++ ) {
+        float *history = &history_[c * fftSize_];
+        if ( format_ == RTAUDIO_FLOAT32 ) {
+          const float *in = (const float *) &chunk_[0] + c;
+          for ( unsigned int i=0; i<count; i++ ) history[( frames_ + i ) & mask] = in[i * channels_];
+        }
+        else {
+          const double *in = (const double *) &chunk_[0] + c;
+          for ( unsigned int i=0; i<count; i++ ) history[( frames_ + i ) & mask] = (float) in[i * channels_];
+        }
+      }
+      frames_ += count;
+      sinceHop_ += count;
+      if ( sinceHop_ == hop_ ) {
+        analyze();
+        sinceHop_ = 0;
+      }
+    }
+
+    usleep( sleepMicroseconds_ );
+  }
+}
+
+void RtAnalyzer :: analyze( void )
+{
+  unsigned int mask = fftSize_ - 1;
+  unsigned int bins = getBins();
+
+  // A full-scale sine has a peak of fftSize / 4 with the Hann window.
+  float scale = 4.0f / fftSize_;
+
+  int index = 1 - std::max( latest_.load( std::memory_order_relaxed ), 0 );
+  unsigned int sequence = sequence_[index].load( std::memory_order_relaxed );
+  sequence_[index].store( sequence + 1, std::memory_order_relaxed );
+  std::atomic_thread_fence( std::memory_order_release );
+
+  for ( unsigned int c=0; c<channels_; c++ ) {
+    // The oldest frame of the window is at frames_ & mask.
+    const float *history = &history_[c * fftSize_];
+    unsigned int first = (unsigned int) ( frames_ & mask );
+    for ( unsigned int i=0; i<fftSize_; i++ )
+      windowed_[i] = history[( first + i ) & mask] * window_[i];
+    fft_.forward( &windowed_[0], &re_[0], &im_[0] );
+
+    float *magnitude = &snapshot_[index][c * bins];
+    for ( unsigned int k=0; k<bins; k++ )
+      magnitude[k] = scale * sqrtf( re_[k] * re_[k] + im_[k] * im_[k] );
+  }
+  snapshotFrame_[index] = frames_;
+
+  sequence_[index].store( sequence + 2, std::memory_order_release );
+  latest_.store( index, std::memory_order_release );
+  spectra_.fetch_add( 1, std::memory_order_relaxed );
+}
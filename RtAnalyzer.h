@@ -0,0 +1,145 @@
+/************************************************************************/
+/*! \class RtAnalyzer
+    \brief Spectrum analyzer tap for RtAudio streams.
+
+    RtAnalyzer computes the spectra of the buffers an audio callback
+    produces or receives, without doing any of the work in the
+    callback.  The callback passes each interleaved buffer to write(),
+    which only copies it into a lock-free ring.  An analysis thread
+    empties the ring, and every \c hop frames it computes a windowed
+    FFT (Hann window) of the last \c fftSize frames of each channel.
+
+    The magnitude spectra are published as a snapshot, which is
+    double buffered: the analysis thread fills one buffer while
+    readers copy the other.  getSpectrum() may be called from any
+    thread (e.g. a user interface) at any rate, and always returns a
+    complete snapshot.
+
+    If the analysis thread falls behind by more than the ring size,
+    whole buffers are dropped and counted (see getDroppedFrames()).
+    The callback never blocks.
+*/
+/************************************************************************/
+
+/*!
+  \file RtAnalyzer.h
+ */
+
+#ifndef __RTANALYZER_H
+#define __RTANALYZER_H
+
+#include "RtAudio.h"
+#include "RtRingBuffer.h"
+#include "RtFft.h"
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+class RtAnalyzer
+{
+ public:
+
+  //! The default constructor.
+  RtAnalyzer( void );
+
+  //! The destructor closes an open analyzer.
+  ~RtAnalyzer( void );
+
+  //! Sets up the analysis and starts the analysis thread.
+  /*!
+    \c format is the sample format of the buffers passed to write(),
+    RTAUDIO_FLOAT32 or RTAUDIO_FLOAT64.  \c fftSize is the length of
+    the analysis window, a power of two of at least 16, and \c hop
+    the number of frames between two spectra (\c fftSize / 4 if zero).
+    \c ringSeconds sets how far the analysis thread may fall behind
+    before buffers are dropped.  An RtError is thrown if the analyzer
+    is already open (type = RtError::INVALID_USE), for invalid
+    parameters (type = RtError::INVALID_PARAMETER), or if the
+    analysis thread cannot be started (type = RtError::THREAD_ERROR).
+  */
+  void open( unsigned int channels, unsigned int sampleRate, RtAudioFormat format,
+             unsigned int fftSize = 4096, unsigned int hop = 0, double ringSeconds = 1.0 );
+
+  //! Queues \c nFrames interleaved frames for analysis.
+  /*!
+    Intended to be called from the audio callback: it never blocks
+    and makes no system calls.  If the ring does not have room for
+    the whole buffer, the buffer is dropped and false is returned.
+    Nothing is done if the analyzer is not open.
+  */
+  bool write( const void *buffer, unsigned int nFrames );
+
+  //! Stops the analysis thread.
+  void close( void );
+
+  //! Returns true while the analyzer is open.
+  bool isOpen( void ) const { return open_; };
+
+  //! Copies the latest magnitude spectrum of \c channel into \c magnitude.
+  /*!
+    \c magnitude is resized to getBins() values.  The magnitudes are
+    linear and scaled so that a full-scale sine reads 1.0 at its
+    frequency.  If \c frame is not NULL, it receives the number of
+    frames analyzed up to the end of the window.  Returns false (and
+    leaves \c magnitude unchanged) if no spectrum has been computed
+    yet or \c channel is invalid.
+  */
+  bool getSpectrum( unsigned int channel, std::vector<float> &magnitude,
+                    unsigned long long *frame = NULL ) const;
+
+  //! Returns the number of bins of a spectrum, fftSize / 2 + 1.
+  unsigned int getBins( void ) const { return fftSize_ / 2 + 1; };
+
+  //! Returns the center frequency of \c bin in Hz.
+  double getBinFrequency( unsigned int bin ) const { return (double) bin * sampleRate_ / fftSize_; };
+
+  //! Returns the number of spectra computed so far.
+  unsigned long long getSpectrumCount( void ) const { return spectra_.load(); };
+
+  //! Returns the number of frames dropped because the ring was full.
+  unsigned long long getDroppedFrames( void ) const { return droppedFrames_.load(); };
+
+ protected:
+
+  static void *analysisThread( void *ptr );
+  void analysisLoop( void );
+  void analyze( void );
+
+  RtRingBuffer ring_;
+  RtFft fft_;
+  unsigned int channels_;
+  unsigned int sampleRate_;
+  RtAudioFormat format_;
+  unsigned int frameBytes_;
+  unsigned int fftSize_;
+  unsigned int hop_;
+  unsigned int sleepMicroseconds_;
+
+  // Analysis thread state: the raw frames read from the ring, the last
+  // fftSize frames of each channel [channel][fftSize] as a ring
+  // indexed by frame number, and the work buffers of the transform.
+  std::vector<char> chunk_;
+  std::vector<float> history_;
+  std::vector<float> window_;
+  std::vector<float> windowed_;
+  std::vector<float> re_;
+  std::vector<float> im_;
+  unsigned long long frames_;
+  unsigned int sinceHop_;
+
+  // Two snapshots [channel][bin].  The sequence count of a snapshot
+  // is odd while the analysis thread writes it, and latest_ is the
+  // index of the most recently completed one.
+  std::vector<float> snapshot_[2];
+  unsigned long long snapshotFrame_[2];
+  std::atomic<unsigned int> sequence_[2];
+  std::atomic<int> latest_;
+
+  pthread_t thread_;
+  std::atomic<bool> open_;
+  std::atomic<bool> stop_;
+  std::atomic<unsigned long long> spectra_;
+  std::atomic<unsigned long long> droppedFrames_;
+};
+
+#endif
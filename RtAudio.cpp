@@ -46,6 +46,15 @@
 #include <cstring>
 #include <climits>
 
+#if defined(__WINDOWS_DS__) || defined(__WINDOWS_ASIO__)
+  #include <malloc.h>
+#else
+  #include <alloca.h>
+#endif
+
+// Default amount of callback thread stack locked with RTAUDIO_LOCK_MEMORY.
+#define RTAUDIO_LOCK_STACK_BYTES ( 128 * 1024 )
+
 // Static variable definitions.
 const unsigned int RtApi::MAX_SAMPLE_RATES = 14;
 const unsigned int RtApi::SAMPLE_RATES[] = {
@@ -69,6 +78,20 @@ const unsigned int RtApi::SAMPLE_RATES[] = {
   #define MUTEX_DESTROY(A)    abs(*A) // dummy definitions
 #endif
 
+#if defined(__LINUX_ALSA__) || defined(__LINUX_OSS__)
+#include <time.h>
+
+// Returns the CPU time used by the calling thread in seconds, used to
+// measure buffers.  It is the time SCHED_DEADLINE charges against the
+// runtime, so waiting in blocking reads or writes does not count.
+static double threadCpuSeconds( void )
+{
+  struct timespec now;
+  clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now );
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+#endif
+
 // *************************************************** //
 //
 // RtAudio definitions.
@@ -104,41 +127,82 @@ void RtAudio :: getCompiledApi( std::vector<RtAudio::Api> &apis ) throw()
 #endif
 }
 
-void RtAudio :: openRtApi( RtAudio::Api api )
+RtAudioFormat RtAudio :: negotiateFormat( RtAudioFormat nativeFormats, RtAudioFormat formats ) throw()
+{
+  // The formats from the narrowest to the widest.  Of two formats of
+  // the same width, the later one is preferred.
+  static const RtAudioFormat order[] = { RTAUDIO_SINT8, RTAUDIO_SINT16, RTAUDIO_SINT24_PACKED,
+                                         RTAUDIO_SINT24, RTAUDIO_SINT32, RTAUDIO_FLOAT32,
+                                         RTAUDIO_FLOAT64 };
+  static const unsigned int bytes[] = { 1, 2, 3, 4, 4, 4, 8 };
+  const unsigned int nFormats = sizeof( order ) / sizeof( order[0] );
+
+  // A native format the client can process needs no conversion.  Of
+  // several, the widest keeps the most of the device resolution.
+  RtAudioFormat exact = 0;
+  for ( unsigned int i=0; i<nFormats; i++ )
+    if ( formats & nativeFormats & order[i] ) exact = order[i];
+  if ( exact ) return exact;
+
+  // Otherwise the narrowest format as wide as the widest native one.
+  unsigned int needed = 0;
+  for ( unsigned int i=0; i<nFormats; i++ )
+    if ( nativeFormats & order[i] ) needed = bytes[i];
+
+  unsigned int width = 0;
+  RtAudioFormat result = 0;
+  for ( unsigned int i=0; i<nFormats; i++ ) {
+    if ( !( formats & order[i] ) ) continue;
+    if ( result && width >= needed && bytes[i] > width ) break;
+    result = order[i];
+    width = bytes[i];
+  }
+  return result;
+}
+
+RtApi *RtAudio :: createRtApi( RtAudio::Api api )
 {
 #if defined(__UNIX_JACK__)
   if ( api == UNIX_JACK )
-    rtapi_ = new RtApiJack();
+    return new RtApiJack();
 #endif
 #if defined(__LINUX_ALSA__)
   if ( api == LINUX_ALSA )
-    rtapi_ = new RtApiAlsa();
+    return new RtApiAlsa();
 #endif
 #if defined(__LINUX_OSS__)
   if ( api == LINUX_OSS )
-    rtapi_ = new RtApiOss();
+    return new RtApiOss();
 #endif
 #if defined(__WINDOWS_ASIO__)
   if ( api == WINDOWS_ASIO )
-    rtapi_ = new RtApiAsio();
+    return new RtApiAsio();
 #endif
 #if defined(__WINDOWS_DS__)
   if ( api == WINDOWS_DS )
-    rtapi_ = new RtApiDs();
+    return new RtApiDs();
 #endif
 #if defined(__MACOSX_CORE__)
   if ( api == MACOSX_CORE )
-    rtapi_ = new RtApiCore();
+    return new RtApiCore();
 #endif
 #if defined(__RTAUDIO_DUMMY__)
   if ( api == RTAUDIO_DUMMY )
-    rtapi_ = new RtApiDummy();
+    return new RtApiDummy();
 #endif
+  return 0;
+}
+
+void RtAudio :: openRtApi( RtAudio::Api api )
+{
+  rtapi_ = createRtApi( api );
 }
 
 RtAudio :: RtAudio( RtAudio::Api api ) throw()
 {
   rtapi_ = 0;
+  showWarnings_ = true;
+  typedCallback_ = 0;
 
   if ( api != UNSPECIFIED ) {
     // Attempt to open the specified API.
@@ -170,7 +234,10 @@ RtAudio :: RtAudio( RtAudio::Api api ) throw()
 
 RtAudio :: ~RtAudio() throw()
 {
+  for ( unsigned int i=0; i<streams_.size(); i++ )
+    delete streams_[i];
   delete rtapi_;
+  delete typedCallback_;
 }
 
 void RtAudio :: openStream( RtAudio::StreamParameters *outputParameters,
@@ -185,6 +252,91 @@ void RtAudio :: openStream( RtAudio::StreamParameters *outputParameters,
                              userData, options );
 }
 
+RtAudio::StreamHandle RtAudio :: addStream( RtAudio::StreamParameters *outputParameters,
+                                            RtAudio::StreamParameters *inputParameters,
+                                            RtAudioFormat format, unsigned int sampleRate,
+                                            unsigned int *bufferFrames,
+                                            RtAudioCallback callback, void *userData,
+                                            RtAudio::StreamOptions *options )
+{
+  RtApi *api = createRtApi( rtapi_->getCurrentApi() );
+  if ( api == 0 )
+    throw( RtError( "RtAudio::addStream: unable to create stream instance!", RtError::MEMORY_ERROR ) );
+
+  api->showWarnings( showWarnings_ );
+  try {
+    api->openStream( outputParameters, inputParameters, format,
+                     sampleRate, bufferFrames, callback,
+                     userData, options );
+  }
+  catch ( RtError & ) {
+    delete api;
+    throw;
+  }
+
+  // Reuse the slot of a closed stream if there is one.
+  unsigned int i;
+  for ( i=0; i<streams_.size(); i++ )
+    if ( streams_[i] == 0 ) break;
+  if ( i == streams_.size() ) streams_.push_back( api );
+  else streams_[i] = api;
+  return i + 1;
+}
+
+void RtAudio :: closeStream( StreamHandle stream ) throw()
+{
+  if ( stream == 0 ) {
+    rtapi_->closeStream();
+    return;
+  }
+
+  RtApi *api = getStreamApi( stream );
+  if ( api == 0 ) {
+    if ( showWarnings_ )
+      std::cerr << "\nRtAudio::closeStream: invalid stream handle!\n" << std::endl;
+    return;
+  }
+
+  api->closeStream();
+  delete api;
+  streams_[stream-1] = 0;
+}
+
+bool RtAudio :: isStreamOpen( StreamHandle stream ) const throw()
+{
+  RtApi *api = getStreamApi( stream );
+  return api && api->isStreamOpen();
+}
+
+bool RtAudio :: isStreamRunning( StreamHandle stream ) const throw()
+{
+  RtApi *api = getStreamApi( stream );
+  return api && api->isStreamRunning();
+}
+
+void RtAudio :: showWarnings( bool value ) throw()
+{
+  showWarnings_ = value;
+  rtapi_->showWarnings( value );
+  for ( unsigned int i=0; i<streams_.size(); i++ )
+    if ( streams_[i] ) streams_[i]->showWarnings( value );
+}
+
+RtApi *RtAudio :: getStreamApi( StreamHandle stream ) const
+{
+  if ( stream == 0 ) return rtapi_;
+  if ( stream > streams_.size() ) return 0;
+  return streams_[stream-1];
+}
+
+RtApi *RtAudio :: verifyStreamHandle( StreamHandle stream )
+{
+  RtApi *api = getStreamApi( stream );
+  if ( api == 0 )
+    throw( RtError( "RtAudio: invalid stream handle!", RtError::INVALID_USE ) );
+  return api;
+}
+
 // *************************************************** //
 //
 // Public RtApi definitions (see end of file for
@@ -259,6 +411,42 @@ void RtApi :: openStream( RtAudio::StreamParameters *oParams,
     }
   }
 
+  if ( options && ( options->aggregateOutputs.size() || options->aggregateInputs.size() ) ) {
+    if ( getCurrentApi() != RtAudio::LINUX_ALSA ) {
+      errorText_ = "RtApi::openStream: aggregate devices are only supported by the ALSA API.";
+      error( RtError::INVALID_USE );
+    }
+
+    if ( ( options->aggregateOutputs.size() && oParams == NULL ) ||
+         ( options->aggregateInputs.size() && iParams == NULL ) ) {
+      errorText_ = "RtApi::openStream: aggregate devices require a main device in the same direction.";
+      error( RtError::INVALID_USE );
+    }
+
+    for ( int mode=0; mode<2; mode++ ) {
+      std::vector<RtAudio::StreamParameters> &aggregate = ( mode == OUTPUT ) ? options->aggregateOutputs : options->aggregateInputs;
+      for ( unsigned int i=0; i<aggregate.size(); i++ ) {
+        if ( aggregate[i].deviceId >= nDevices || aggregate[i].nChannels < 1 ) {
+          errorText_ = "RtApi::openStream: aggregate device parameter value is invalid.";
+          error( RtError::INVALID_USE );
+        }
+      }
+    }
+  }
+
+  if ( options && ( options->outputRouting.size() || options->inputRouting.size() ) ) {
+    if ( options->aggregateOutputs.size() || options->aggregateInputs.size() ) {
+      errorText_ = "RtApi::openStream: routing matrices cannot be combined with aggregate devices.";
+      error( RtError::INVALID_USE );
+    }
+
+    if ( ( options->outputRouting.size() && ( oChannels == 0 || options->outputRouting.size() % oChannels ) ) ||
+         ( options->inputRouting.size() && ( iChannels == 0 || options->inputRouting.size() % iChannels ) ) ) {
+      errorText_ = "RtApi::openStream: the size of a routing matrix must be a multiple of its nChannels value.";
+      error( RtError::INVALID_USE );
+    }
+  }
+
   clearStreamInfo();
   bool result;
 
@@ -279,10 +467,27 @@ void RtApi :: openStream( RtAudio::StreamParameters *oParams,
     }
   }
 
+  if ( options ) {
+    if ( ( oChannels > 0 && options->outputRouting.size() && setRouting( OUTPUT, options->outputRouting ) == FAILURE ) ||
+         ( iChannels > 0 && options->inputRouting.size() && setRouting( INPUT, options->inputRouting ) == FAILURE ) ) {
+      closeStream();
+      error( RtError::MEMORY_ERROR );
+    }
+  }
+
+  if ( options && options->flags & ( RTAUDIO_DITHER | RTAUDIO_NOISE_SHAPING ) && oChannels > 0 )
+    setDither( options->flags & RTAUDIO_NOISE_SHAPING );
+
   stream_.callbackInfo.callback = (void *) callback;
   stream_.callbackInfo.userData = userData;
 
   if ( options ) options->numberOfBuffers = stream_.nBuffers;
+
+  if ( options && ( options->flags & RTAUDIO_LOCK_MEMORY ) ) {
+    stream_.lockStackBytes = options->lockStackBytes ? options->lockStackBytes : RTAUDIO_LOCK_STACK_BYTES;
+    lockStreamMemory( options );
+  }
+
   stream_.state = STREAM_STOPPED;
 }
 
@@ -369,6 +574,33 @@ unsigned int RtApi :: getStreamSampleRate( void )
  return stream_.sampleRate;
 }
 
+RtAudio::ThreadInfo RtApi :: getStreamThreadInfo( void )
+{
+  verifyStream();
+
+#if defined(__LINUX_ALSA__) || defined(__LINUX_OSS__)
+  // The callback thread updates the information with SCHEDULE_DEADLINE.
+  MUTEX_LOCK( &stream_.mutex );
+  RtAudio::ThreadInfo info = stream_.threadInfo;
+  MUTEX_UNLOCK( &stream_.mutex );
+  return info;
+#else
+  return stream_.threadInfo;
+#endif
+}
+
+unsigned long RtApi :: getStreamDroppedFrames( void )
+{
+  verifyStream();
+  return stream_.droppedFrames;
+}
+
+long RtApi :: getStreamDuplexLatency( void )
+{
+  verifyStream();
+  return stream_.duplexLatency;
+}
+
 
 // *************************************************** //
 //
@@ -1197,9 +1429,7 @@ bool RtApiCore :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
   // Allocate necessary internal buffers.
   unsigned long bufferBytes;
   bufferBytes = stream_.nUserChannels[mode] * *bufferSize * formatBytes( stream_.userFormat );
-  //  stream_.userBuffer[mode] = (char *) calloc( bufferBytes, 1 );
-  stream_.userBuffer[mode] = (char *) malloc( bufferBytes * sizeof(char) );
-  memset( stream_.userBuffer[mode], 0, bufferBytes * sizeof(char) );
+  stream_.userBuffer[mode] = allocateBuffer( bufferBytes );
   if ( stream_.userBuffer[mode] == NULL ) {
     errorText_ = "RtApiCore::probeDeviceOpen: error allocating user buffer memory.";
     goto error;
@@ -1221,8 +1451,8 @@ bool RtApiCore :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
 
     if ( makeBuffer ) {
       bufferBytes *= *bufferSize;
-      if ( stream_.deviceBuffer ) free( stream_.deviceBuffer );
-      stream_.deviceBuffer = (char *) calloc( bufferBytes, 1 );
+      if ( stream_.deviceBuffer ) freeBuffer( stream_.deviceBuffer );
+      stream_.deviceBuffer = allocateBuffer( bufferBytes );
       if ( stream_.deviceBuffer == NULL ) {
         errorText_ = "RtApiCore::probeDeviceOpen: error allocating device buffer memory.";
         goto error;
@@ -1277,13 +1507,13 @@ bool RtApiCore :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -1323,13 +1553,13 @@ void RtApiCore :: closeStream( void )
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -1469,6 +1699,8 @@ bool RtApiCore :: callbackEvent( AudioDeviceID deviceId,
     return FAILURE;
   }
 
+  if ( stream_.lockStackBytes && !stream_.stackLocked ) lockCallbackStack();
+
   CallbackInfo *info = (CallbackInfo *) &stream_.callbackInfo;
   CoreHandle *handle = (CoreHandle *) stream_.apiHandle;
 
@@ -2141,7 +2373,7 @@ bool RtApiJack :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
   // Allocate necessary internal buffers.
   unsigned long bufferBytes;
   bufferBytes = stream_.nUserChannels[mode] * *bufferSize * formatBytes( stream_.userFormat );
-  stream_.userBuffer[mode] = (char *) calloc( bufferBytes, 1 );
+  stream_.userBuffer[mode] = allocateBuffer( bufferBytes );
   if ( stream_.userBuffer[mode] == NULL ) {
     errorText_ = "RtApiJack::probeDeviceOpen: error allocating user buffer memory.";
     goto error;
@@ -2162,8 +2394,8 @@ bool RtApiJack :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
 
     if ( makeBuffer ) {
       bufferBytes *= *bufferSize;
-      if ( stream_.deviceBuffer ) free( stream_.deviceBuffer );
-      stream_.deviceBuffer = (char *) calloc( bufferBytes, 1 );
+      if ( stream_.deviceBuffer ) freeBuffer( stream_.deviceBuffer );
+      stream_.deviceBuffer = allocateBuffer( bufferBytes );
       if ( stream_.deviceBuffer == NULL ) {
         errorText_ = "RtApiJack::probeDeviceOpen: error allocating device buffer memory.";
         goto error;
@@ -2231,13 +2463,13 @@ bool RtApiJack :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -2271,13 +2503,13 @@ void RtApiJack :: closeStream( void )
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -2438,6 +2670,8 @@ bool RtApiJack :: callbackEvent( unsigned long nframes )
     return FAILURE;
   }
 
+  if ( stream_.lockStackBytes && !stream_.stackLocked ) lockCallbackStack();
+
   CallbackInfo *info = (CallbackInfo *) &stream_.callbackInfo;
   JackHandle *handle = (JackHandle *) stream_.apiHandle;
 
@@ -3016,7 +3250,7 @@ bool RtApiAsio :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
   // Allocate necessary internal buffers
   unsigned long bufferBytes;
   bufferBytes = stream_.nUserChannels[mode] * *bufferSize * formatBytes( stream_.userFormat );
-  stream_.userBuffer[mode] = (char *) calloc( bufferBytes, 1 );
+  stream_.userBuffer[mode] = allocateBuffer( bufferBytes );
   if ( stream_.userBuffer[mode] == NULL ) {
     errorText_ = "RtApiAsio::probeDeviceOpen: error allocating user buffer memory.";
     goto error;
@@ -3035,8 +3269,8 @@ bool RtApiAsio :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
 
     if ( makeBuffer ) {
       bufferBytes *= *bufferSize;
-      if ( stream_.deviceBuffer ) free( stream_.deviceBuffer );
-      stream_.deviceBuffer = (char *) calloc( bufferBytes, 1 );
+      if ( stream_.deviceBuffer ) freeBuffer( stream_.deviceBuffer );
+      stream_.deviceBuffer = allocateBuffer( bufferBytes );
       if ( stream_.deviceBuffer == NULL ) {
         errorText_ = "RtApiAsio::probeDeviceOpen: error allocating device buffer memory.";
         goto error;
@@ -3089,13 +3323,13 @@ bool RtApiAsio :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -3128,13 +3362,13 @@ void RtApiAsio :: closeStream()
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -3265,6 +3499,8 @@ bool RtApiAsio :: callbackEvent( long bufferIndex )
     return FAILURE;
   }
 
+  if ( stream_.lockStackBytes && !stream_.stackLocked ) lockCallbackStack();
+
   CallbackInfo *info = (CallbackInfo *) &stream_.callbackInfo;
   AsioHandle *handle = (AsioHandle *) stream_.apiHandle;
 
@@ -4229,7 +4465,7 @@ bool RtApiDs :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigned
 
   // Allocate necessary internal buffers
   long bufferBytes = stream_.nUserChannels[mode] * *bufferSize * formatBytes( stream_.userFormat );
-  stream_.userBuffer[mode] = (char *) calloc( bufferBytes, 1 );
+  stream_.userBuffer[mode] = allocateBuffer( bufferBytes );
   if ( stream_.userBuffer[mode] == NULL ) {
     errorText_ = "RtApiDs::probeDeviceOpen: error allocating user buffer memory.";
     goto error;
@@ -4248,8 +4484,8 @@ bool RtApiDs :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigned
 
     if ( makeBuffer ) {
       bufferBytes *= *bufferSize;
-      if ( stream_.deviceBuffer ) free( stream_.deviceBuffer );
-      stream_.deviceBuffer = (char *) calloc( bufferBytes, 1 );
+      if ( stream_.deviceBuffer ) freeBuffer( stream_.deviceBuffer );
+      stream_.deviceBuffer = allocateBuffer( bufferBytes );
       if ( stream_.deviceBuffer == NULL ) {
         errorText_ = "RtApiDs::probeDeviceOpen: error allocating device buffer memory.";
         goto error;
@@ -4332,13 +4568,13 @@ bool RtApiDs :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigned
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -4385,13 +4621,13 @@ void RtApiDs :: closeStream()
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -4598,6 +4834,8 @@ void RtApiDs :: callbackEvent()
     return;
   }
 
+  if ( stream_.lockStackBytes && !stream_.stackLocked ) lockCallbackStack();
+
   CallbackInfo *info = (CallbackInfo *) &stream_.callbackInfo;
   DsHandle *handle = (DsHandle *) stream_.apiHandle;
 
@@ -5143,6 +5381,14 @@ static const char* getErrorString( int code )
 
 #include <alsa/asoundlib.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fstream>
+#include <map>
 
   // A structure to hold various information related to the ALSA API
   // implementation.
@@ -5152,332 +5398,780 @@ struct AlsaHandle {
   bool xrun[2];
   pthread_cond_t runnable_cv;
   bool runnable;
+  int controlFd;                       // eventfd used to wake the callback thread
+  int timerFd;                         // timerfd for timer scheduling, or -1
+  snd_pcm_uframes_t hwBufferFrames[2]; // total hardware buffer size per direction
+  snd_pcm_uframes_t wakeAhead;         // output queued beyond one buffer at wakeup
+  std::vector<struct pollfd> pollFds;  // control and pcm (or timer) descriptors
+  std::vector<struct pollfd> waitFds;  // the subset of pollFds polled by waitForDevices()
+  unsigned int pcmFdOffset[2];
+  unsigned int pcmFdCount[2];
+  bool sharedThread;                   // serviced by the shared callback thread
+  bool stopRequested;                  // callback returned 1, stop from the shared thread
+  std::vector<char> silence;           // one buffer of output silence for (re)starts
+  long roundTrip;                      // largest duplex latency measured since the start
+  int inputDrop;                       // 1: input lost in a recovery, 2: first buffer after it read
+  bool inputOverflow;                  // the lost input was an overflow of the input device
+  unsigned long droppedInput;          // frames of input lost, reported with inputDrop
+  bool align;                          // RTAUDIO_ALIGN_DUPLEX
+  unsigned long alignFrames;           // delay added to the input for alignment
+  std::vector<char> alignBuffer;       // input carried over to the next buffer
 
   AlsaHandle()
-    :synchronized(false), runnable(false) { xrun[0] = false; xrun[1] = false; }
+    :synchronized(false), runnable(false), controlFd(-1), timerFd(-1), wakeAhead(0), sharedThread(false),
+     stopRequested(false), roundTrip(0), inputDrop(0), inputOverflow(false), droppedInput(0), align(false), alignFrames(0)
+  { xrun[0] = false; xrun[1] = false; hwBufferFrames[0] = 0; hwBufferFrames[1] = 0;
+    pcmFdOffset[0] = 0; pcmFdOffset[1] = 0; pcmFdCount[0] = 0; pcmFdCount[1] = 0; }
 };
 
-extern "C" void *alsaCallbackHandler( void * ptr );
+// Rebuild the descriptor set the callback thread polls on.  The
+// control eventfd always comes first.  In timer scheduling mode the
+// timerfd replaces the pcm descriptors.
+static void setupAlsaPollDescriptors( AlsaHandle *apiInfo )
+{
+  struct pollfd pfd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  apiInfo->pollFds.clear();
+  pfd.fd = apiInfo->controlFd;
+  apiInfo->pollFds.push_back( pfd );
+  if ( apiInfo->timerFd >= 0 ) {
+    pfd.fd = apiInfo->timerFd;
+    apiInfo->pollFds.push_back( pfd );
+    return;
+  }
 
-RtApiAlsa :: RtApiAlsa()
+  for ( int i=0; i<2; i++ ) {
+    apiInfo->pcmFdOffset[i] = apiInfo->pollFds.size();
+    apiInfo->pcmFdCount[i] = 0;
+    if ( apiInfo->handles[i] == 0 ) continue;
+    int count = snd_pcm_poll_descriptors_count( apiInfo->handles[i] );
+    if ( count <= 0 ) continue;
+    apiInfo->pollFds.resize( apiInfo->pcmFdOffset[i] + count );
+    apiInfo->pcmFdCount[i] = snd_pcm_poll_descriptors( apiInfo->handles[i],
+                                                       &apiInfo->pollFds[ apiInfo->pcmFdOffset[i] ], count );
+  }
+  apiInfo->waitFds.reserve( apiInfo->pollFds.size() );
+}
+
+// Append the descriptors to wait on to fds: the timerfd in timer
+// scheduling mode, and otherwise the pcm descriptors of the
+// directions still short of a buffer (see framesUntilReady()).  A
+// direction that is already ready is left out, since its descriptors
+// would make poll() return at once.  offset[i] receives the position
+// of the descriptors of direction i in fds.
+static void appendAlsaWaitDescriptors( AlsaHandle *apiInfo, const bool *waiting,
+                                       std::vector<struct pollfd> &fds, unsigned int *offset )
 {
-  // Nothing to do here.
+  if ( apiInfo->timerFd >= 0 ) {
+    fds.push_back( apiInfo->pollFds[1] );
+    return;
+  }
+
+  for ( int i=0; i<2; i++ ) {
+    offset[i] = fds.size();
+    if ( !waiting[i] ) continue;
+    std::vector<struct pollfd>::const_iterator first = apiInfo->pollFds.begin() + apiInfo->pcmFdOffset[i];
+    fds.insert( fds.end(), first, first + apiInfo->pcmFdCount[i] );
+  }
 }
 
-RtApiAlsa :: ~RtApiAlsa()
+// Streams opened with the RTAUDIO_SHARED_THREAD flag do not get a
+// callback thread of their own.  They register here instead, and a
+// single thread polls the devices of all registered streams and runs
+// the callbacks of those that are ready.  Callbacks are run with the
+// mutex held, so a stream cannot be unregistered (and then closed)
+// while its callback is in progress.  A stream whose callback asks
+// for a stop is stopped (and drained) after the mutex is released, so
+// that the other streams are not held up; unregistering it waits
+// until the stop is done.  The thread is started by the first
+// registration and exits once the last stream is unregistered.
+struct AlsaSharedThread {
+  pthread_mutex_t mutex;
+  pthread_cond_t stopped;  // signalled when the streams being stopped are done
+  std::vector<RtApiAlsa *> streams;
+  std::vector<AlsaHandle *> handles;
+  std::vector<RtApiAlsa *> stopping;  // streams being stopped without the mutex
+  int controlFd;  // eventfd used to make the thread rebuild its poll set
+  bool running;
+  RtAudio::ThreadInfo threadInfo;  // scheduling granted to the thread
+
+  AlsaSharedThread()
+    :controlFd(-1), running(false) { pthread_mutex_init( &mutex, NULL ); pthread_cond_init( &stopped, NULL ); }
+};
+
+static AlsaSharedThread alsaSharedThread;
+
+extern "C" void *alsaSharedCallbackHandler( void *ptr );
+
+// Interrupt a callback thread sleeping in poll().
+static void wakeAlsaCallbackThread( AlsaHandle *apiInfo )
 {
-  if ( stream_.state != STREAM_CLOSED ) closeStream();
+  uint64_t value = 1;
+  int fd = -1;
+  if ( apiInfo ) fd = apiInfo->sharedThread ? alsaSharedThread.controlFd : apiInfo->controlFd;
+  if ( fd >= 0 )
+    if ( write( fd, &value, sizeof( value ) ) < 0 ) {}
 }
 
-unsigned int RtApiAlsa :: getDeviceCount( void )
+// Add a stream to the shared callback thread, starting the thread if
+// necessary.  Returns false if the thread could not be started.  If
+// the thread was started, *started is set to true and *thread to its
+// id, so that the caller can set its scheduling.
+static bool registerAlsaSharedStream( RtApiAlsa *object, AlsaHandle *apiInfo,
+                                      bool *started, pthread_t *thread )
 {
-  unsigned nDevices = 0;
-  int result, subdevice, card;
-  char name[64];
-  snd_ctl_t *handle;
+  *started = false;
+  MUTEX_LOCK( &alsaSharedThread.mutex );
+  if ( alsaSharedThread.controlFd < 0 )
+    alsaSharedThread.controlFd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  if ( alsaSharedThread.controlFd < 0 ) {
+    MUTEX_UNLOCK( &alsaSharedThread.mutex );
+    return false;
+  }
 
-  // Count cards and devices
-  card = -1;
-  snd_card_next( &card );
-  while ( card >= 0 ) {
-    sprintf( name, "hw:%d", card );
-    result = snd_ctl_open( &handle, name, 0 );
-    if ( result < 0 ) {
-      errorStream_ << "RtApiAlsa::getDeviceCount: control open, card = " << card << ", " << snd_strerror( result ) << ".";
-      errorText_ = errorStream_.str();
-      error( RtError::WARNING );
-      goto nextcard;
+  if ( !alsaSharedThread.running ) {
+    pthread_attr_t attr;
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+    int result = pthread_create( thread, &attr, alsaSharedCallbackHandler, NULL );
+    pthread_attr_destroy( &attr );
+    if ( result ) {
+      MUTEX_UNLOCK( &alsaSharedThread.mutex );
+      return false;
     }
-    subdevice = -1;
-    while( 1 ) {
-      result = snd_ctl_pcm_next_device( handle, &subdevice );
-      if ( result < 0 ) {
-        errorStream_ << "RtApiAlsa::getDeviceCount: control next device, card = " << card << ", " << snd_strerror( result ) << ".";
-        errorText_ = errorStream_.str();
-        error( RtError::WARNING );
-        break;
-      }
-      if ( subdevice < 0 )
-        break;
-      nDevices++;
+    alsaSharedThread.running = true;
+    *started = true;
+  }
+
+  alsaSharedThread.streams.push_back( object );
+  alsaSharedThread.handles.push_back( apiInfo );
+  MUTEX_UNLOCK( &alsaSharedThread.mutex );
+  wakeAlsaCallbackThread( apiInfo );
+  return true;
+}
+
+// Remove a stream from the shared callback thread, waiting for a stop
+// the thread has in progress on it.  Once this returns the thread no
+// longer touches the stream.
+static void unregisterAlsaSharedStream( RtApiAlsa *object )
+{
+  MUTEX_LOCK( &alsaSharedThread.mutex );
+  bool stopping = true;
+  while ( stopping ) {
+    stopping = false;
+    for ( unsigned int i=0; i<alsaSharedThread.stopping.size(); i++ )
+      if ( alsaSharedThread.stopping[i] == object ) stopping = true;
+    if ( stopping ) pthread_cond_wait( &alsaSharedThread.stopped, &alsaSharedThread.mutex );
+  }
+  for ( unsigned int i=0; i<alsaSharedThread.streams.size(); i++ ) {
+    if ( alsaSharedThread.streams[i] == object ) {
+      alsaSharedThread.streams.erase( alsaSharedThread.streams.begin() + i );
+      alsaSharedThread.handles.erase( alsaSharedThread.handles.begin() + i );
+      break;
     }
-  nextcard:
-    snd_ctl_close( handle );
-    snd_card_next( &card );
   }
+  MUTEX_UNLOCK( &alsaSharedThread.mutex );
 
-  return nDevices;
+  uint64_t value = 1;
+  if ( write( alsaSharedThread.controlFd, &value, sizeof( value ) ) < 0 ) {}
 }
 
-RtAudio::DeviceInfo RtApiAlsa :: getDeviceInfo( unsigned int device )
+static void closeAlsaHandle( AlsaHandle *apiInfo )
 {
-  RtAudio::DeviceInfo info;
-  info.probed = false;
+  pthread_cond_destroy( &apiInfo->runnable_cv );
+  if ( apiInfo->handles[0] ) snd_pcm_close( apiInfo->handles[0] );
+  if ( apiInfo->handles[1] ) snd_pcm_close( apiInfo->handles[1] );
+  if ( apiInfo->controlFd >= 0 ) close( apiInfo->controlFd );
+  if ( apiInfo->timerFd >= 0 ) close( apiInfo->timerFd );
+  delete apiInfo;
+}
 
-  unsigned nDevices = 0;
-  int result, subdevice, card;
-  char name[64];
-  snd_ctl_t *chandle;
+// Drift compensation settings for the additional devices of an
+// aggregate stream.  Levels are measured in stream buffers.  The
+// controller gains give a critically damped loop with a time
+// constant of about 200 buffers, and the ratio is limited to
+// +/-0.2% (crystal tolerances are well below that).
+static const double ALSA_AGGREGATE_PREFILL = 1.5;    // initial FIFO level
+static const unsigned int ALSA_AGGREGATE_FIFO = 8;   // FIFO capacity
+static const double ALSA_AGGREGATE_SMOOTHING = 0.02; // level low-pass coefficient
+static const double ALSA_AGGREGATE_KP = 0.005;
+static const double ALSA_AGGREGATE_KI = 0.00000625;
+static const double ALSA_AGGREGATE_MAX_DEVIATION = 0.002;
+
+// An additional device of an aggregate stream.  It runs on its own
+// clock, so its data passes through a FIFO of float frames at the
+// stream rate and a linear interpolating resampler whose ratio is
+// steered to hold the latency through the FIFO and the device at the
+// value measured after the device was started.  Output devices resample
+// from the FIFO, input devices resample into it.  All transfers are
+// made in blocks of one stream buffer so that convertBuffer() can be
+// used between the user, block and device buffers.
+struct RtApiAlsa::AggregateDevice {
+  snd_pcm_t *handle;
+  unsigned int channels;        // channels taken from or given to the user buffer
+  unsigned int deviceChannels;
+  unsigned int periods;         // hardware buffer size, in stream buffers
+  unsigned long hwBufferFrames;
+  char *deviceBuffer;           // one buffer in the device format
+  std::vector<float> block;     // one buffer of float frames
+  ConvertInfo userConvert;      // user buffer <-> block
+  ConvertInfo deviceConvert;    // block <-> device buffer
+
+  std::vector<float> fifo;
+  unsigned int fifoFrames;      // capacity
+  unsigned int fifoRead;        // index of the oldest frame
+  unsigned int fifoCount;
+
+  std::vector<float> previous;  // last input frame of the resampler
+  std::vector<float> sample;
+  double position;              // output position after the previous frame
+  double ratio;                 // input frames per output frame
+  double level;                 // smoothed FIFO plus device level
+  double target;
+  bool locked;                  // target measured
+  double integral;
+
+  AggregateDevice()
+    :handle(0), channels(0), deviceChannels(0), periods(0), hwBufferFrames(0), deviceBuffer(0),
+     fifoFrames(0), fifoRead(0), fifoCount(0), position(0.0), ratio(1.0), level(0.0),
+     target(0.0), locked(false), integral(0.0) {}
+
+  // Empty the FIFO, prefill it with silence and reset the resampler
+  // and the controller.
+  void reset( unsigned int bufferSize )
+  {
+    fifo.assign( fifo.size(), 0.0f );
+    previous.assign( channels, 0.0f );
+    fifoRead = 0;
+    fifoCount = (unsigned int) ( ALSA_AGGREGATE_PREFILL * bufferSize );
+    position = 0.0;
+    ratio = 1.0;
+    locked = false;
+    integral = 0.0;
+  }
 
-  // Count cards and devices
-  card = -1;
-  snd_card_next( &card );
-  while ( card >= 0 ) {
-    sprintf( name, "hw:%d", card );
-    result = snd_ctl_open( &chandle, name, SND_CTL_NONBLOCK );
-    if ( result < 0 ) {
-      errorStream_ << "RtApiAlsa::getDeviceInfo: control open, card = " << card << ", " << snd_strerror( result ) << ".";
-      errorText_ = errorStream_.str();
-      error( RtError::WARNING );
-      goto nextcard;
+  float *frame( unsigned int index ) { return &fifo[ ( ( fifoRead + index ) % fifoFrames ) * channels ]; }
+
+  void pushFrame( const float *in )
+  {
+    if ( fifoCount == fifoFrames ) { // overflow ... drop the oldest frame
+      fifoRead = ( fifoRead + 1 ) % fifoFrames;
+      fifoCount--;
     }
-    subdevice = -1;
-    while( 1 ) {
-      result = snd_ctl_pcm_next_device( chandle, &subdevice );
-      if ( result < 0 ) {
-        errorStream_ << "RtApiAlsa::getDeviceInfo: control next device, card = " << card << ", " << snd_strerror( result ) << ".";
-        errorText_ = errorStream_.str();
-        error( RtError::WARNING );
-        break;
-      }
-      if ( subdevice < 0 ) break;
-      if ( nDevices == device ) {
-        sprintf( name, "hw:%d,%d", card, subdevice );
-        goto foundDevice;
+    float *out = frame( fifoCount );
+    for ( unsigned int j=0; j<channels; j++ ) out[j] = in[j];
+    fifoCount++;
+  }
+
+  bool popFrame( float *out )
+  {
+    if ( fifoCount == 0 ) return false;
+    float *in = frame( 0 );
+    for ( unsigned int j=0; j<channels; j++ ) out[j] = in[j];
+    fifoRead = ( fifoRead + 1 ) % fifoFrames;
+    fifoCount--;
+    return true;
+  }
+
+  // Produce nFrames device frames from the FIFO.  An empty FIFO
+  // repeats the last frame.
+  void resampleFromFifo( float *out, unsigned int nFrames )
+  {
+    for ( unsigned int i=0; i<nFrames; i++ ) {
+      while ( position >= 1.0 ) {
+        popFrame( &previous[0] );
+        position -= 1.0;
       }
-      nDevices++;
+      const float *next = fifoCount ? frame( 0 ) : &previous[0];
+      for ( unsigned int j=0; j<channels; j++ )
+        out[j] = previous[j] + (float) position * ( next[j] - previous[j] );
+      out += channels;
+      position += ratio;
     }
-  nextcard:
-    snd_ctl_close( chandle );
-    snd_card_next( &card );
   }
 
-  if ( nDevices == 0 ) {
-    errorText_ = "RtApiAlsa::getDeviceInfo: no devices found!";
-    error( RtError::INVALID_USE );
+  // Resample nFrames device frames into the FIFO.
+  void resampleToFifo( const float *in, unsigned int nFrames )
+  {
+    for ( unsigned int i=0; i<nFrames; i++ ) {
+      while ( position < 1.0 ) {
+        for ( unsigned int j=0; j<channels; j++ )
+          sample[j] = previous[j] + (float) position * ( in[j] - previous[j] );
+        pushFrame( &sample[0] );
+        position += ratio;
+      }
+      position -= 1.0;
+      for ( unsigned int j=0; j<channels; j++ ) previous[j] = in[j];
+      in += channels;
+    }
   }
 
-  if ( device >= nDevices ) {
-    errorText_ = "RtApiAlsa::getDeviceInfo: device ID is invalid!";
-    error( RtError::INVALID_USE );
+  // Update the resampling ratio once per stream buffer.  The level is
+  // the FIFO content plus the frames queued in the device (output) or
+  // captured but not yet read (input), which stays continuous when the
+  // device makes more or fewer transfers than usual in one buffer.  It
+  // is low-pass filtered to remove the device pointer jitter before
+  // it drives the PI controller.  A level above target means the
+  // device consumes (or produces) too slowly relative to the stream,
+  // which both directions correct by raising the ratio.
+  void updateRatio( unsigned int bufferSize, unsigned long queued )
+  {
+    double measured = (double) ( fifoCount + queued ) / bufferSize;
+    if ( !locked ) {
+      target = measured;
+      level = measured;
+      locked = true;
+    }
+    level += ALSA_AGGREGATE_SMOOTHING * ( measured - level );
+    double error = level - target;
+    double deviation = ALSA_AGGREGATE_KP * error + ALSA_AGGREGATE_KI * ( integral + error );
+    if ( deviation > ALSA_AGGREGATE_MAX_DEVIATION )
+      deviation = ALSA_AGGREGATE_MAX_DEVIATION;
+    else if ( deviation < -ALSA_AGGREGATE_MAX_DEVIATION )
+      deviation = -ALSA_AGGREGATE_MAX_DEVIATION;
+    else
+      integral += error; // only integrate while not saturated
+    ratio = 1.0 + deviation;
   }
+};
 
- foundDevice:
+// A structure to hold the enumeration information for one ALSA pcm
+// device.  The key is built from the card id string (which, unlike
+// the card index, is stable across reboots and hotplug events) and
+// the device number, and it is used to look up probed capabilities.
+struct AlsaDevice {
+  std::string name;   // "hw:card,device" name passed to snd_pcm_open
+  std::string key;    // "cardId,device"
+  int card;
+  int subdevice;
+
+  AlsaDevice()
+    :card(-1), subdevice(-1) {}
+};
 
-  // If a stream is already open, we cannot probe the stream devices.
-  // Thus, use the saved results.
-  if ( stream_.state != STREAM_CLOSED &&
-       ( stream_.device[0] == device || stream_.device[1] == device ) ) {
-    if ( device >= devices_.size() ) {
-      errorText_ = "RtApiAlsa::getDeviceInfo: device ID was not present before stream was opened.";
-      error( RtError::WARNING );
-      return info;
-    }
-    return devices_[ device ];
+// Probing a pcm device (opening it and testing every rate and format)
+// is slow, so the device list and the probed capabilities are cached
+// and shared by all RtApiAlsa instances.  The device list is only
+// rebuilt when the set of sound cards changes.  If the
+// RTAUDIO_ALSA_DEVICE_CACHE environment variable names a file, the
+// capabilities are also persisted there between program runs.
+// Capabilities are only trusted while their card keeps the identity
+// (long name and components) it had when they were probed, since a
+// card id can be reused by different hardware.
+struct AlsaDeviceCache {
+  pthread_mutex_t mutex;
+  std::string signature;  // card indices and /dev/snd mtime at last scan
+  std::vector<AlsaDevice> devices;
+  std::map<std::string, RtAudio::DeviceInfo> capabilities;
+  std::map<std::string, std::string> cards;  // card id -> identity
+  bool fileLoaded;
+
+  AlsaDeviceCache()
+    :fileLoaded(false) { pthread_mutex_init( &mutex, NULL ); }
+};
+
+static AlsaDeviceCache alsaDeviceCache;
+
+static const char *alsaDeviceCacheFile( void )
+{
+  const char *path = getenv( "RTAUDIO_ALSA_DEVICE_CACHE" );
+  if ( path && *path ) return path;
+  return 0;
+}
+
+// Read persisted capabilities.  A "card" line holds a card id and
+// the card identity.  Every other line holds a device key, the
+// output, input and duplex channel counts, the native format mask,
+// a comma-separated rate list and the device name.  Must be called
+// with the cache mutex held.
+static void loadAlsaDeviceCache( void )
+{
+  alsaDeviceCache.fileLoaded = true;
+  const char *path = alsaDeviceCacheFile();
+  if ( !path ) return;
+
+  std::ifstream file( path );
+  std::string line;
+  while ( std::getline( file, line ) ) {
+    std::istringstream fields( line );
+    std::string key, rates;
+    if ( line.compare( 0, 5, "card " ) == 0 ) {
+      fields.ignore( 5 );
+      if ( !( fields >> key ) ) continue;
+      fields >> std::ws;
+      std::getline( fields, alsaDeviceCache.cards[key] );
+      continue;
+    }
+    RtAudio::DeviceInfo info;
+    if ( !( fields >> key >> info.outputChannels >> info.inputChannels
+            >> info.duplexChannels >> info.nativeFormats >> rates ) ) continue;
+    std::istringstream rateList( rates );
+    unsigned int rate;
+    while ( rateList >> rate ) {
+      info.sampleRates.push_back( rate );
+      if ( rateList.peek() == ',' ) rateList.ignore();
+    }
+    fields >> std::ws;
+    std::getline( fields, info.name );
+    info.probed = true;
+    alsaDeviceCache.capabilities[key] = info;
   }
+}
 
-  int openMode = SND_PCM_ASYNC;
-  snd_pcm_stream_t stream;
-  snd_pcm_info_t *pcminfo;
-  snd_pcm_info_alloca( &pcminfo );
+// Write the capability cache back to disk.  The file is replaced
+// atomically so that concurrent readers never see a partial file.
+// Must be called with the cache mutex held.
+static void saveAlsaDeviceCache( void )
+{
+  const char *path = alsaDeviceCacheFile();
+  if ( !path ) return;
+
+  std::string tmpPath = std::string( path ) + ".tmp";
+  std::ofstream file( tmpPath.c_str() );
+  if ( !file ) return;
+  std::map<std::string, std::string>::const_iterator card;
+  for ( card = alsaDeviceCache.cards.begin(); card != alsaDeviceCache.cards.end(); ++card )
+    file << "card " << card->first << ' ' << card->second << '\n';
+  std::map<std::string, RtAudio::DeviceInfo>::const_iterator it;
+  for ( it = alsaDeviceCache.capabilities.begin(); it != alsaDeviceCache.capabilities.end(); ++it ) {
+    const RtAudio::DeviceInfo &info = it->second;
+    file << it->first << ' ' << info.outputChannels << ' ' << info.inputChannels << ' '
+         << info.duplexChannels << ' ' << info.nativeFormats << ' ';
+    for ( unsigned int i=0; i<info.sampleRates.size(); i++ )
+      file << ( i ? "," : "" ) << info.sampleRates[i];
+    file << ' ' << info.name << '\n';
+  }
+  file.close();
+  if ( file ) rename( tmpPath.c_str(), path );
+  else unlink( tmpPath.c_str() );
+}
+
+// The capabilities found by opening a pcm device in one direction.
+struct AlsaPcmCaps {
+  unsigned int channels;
+  std::vector<unsigned int> sampleRates;
+  RtAudioFormat nativeFormats;
+
+  AlsaPcmCaps()
+    :channels(0), nativeFormats(0) {}
+};
+
+// Open a pcm device once and read its channel count, supported rates
+// and formats.  Returns false and fills errorText on failure.
+static bool probeAlsaPcm( const char *name, snd_pcm_stream_t stream,
+                          const unsigned int *rates, unsigned int nRates,
+                          AlsaPcmCaps &caps, std::string &errorText )
+{
+  std::ostringstream errorStream;
   snd_pcm_t *phandle;
   snd_pcm_hw_params_t *params;
   snd_pcm_hw_params_alloca( &params );
 
-  // First try for playback
-  stream = SND_PCM_STREAM_PLAYBACK;
-  snd_pcm_info_set_device( pcminfo, subdevice );
-  snd_pcm_info_set_subdevice( pcminfo, 0 );
-  snd_pcm_info_set_stream( pcminfo, stream );
-
-  result = snd_ctl_pcm_info( chandle, pcminfo );
+  int result = snd_pcm_open( &phandle, name, stream, SND_PCM_ASYNC | SND_PCM_NONBLOCK );
   if ( result < 0 ) {
-    // Device probably doesn't support playback.
-    goto captureProbe;
-  }
-
-  result = snd_pcm_open( &phandle, name, stream, openMode | SND_PCM_NONBLOCK );
-  if ( result < 0 ) {
-    errorStream_ << "RtApiAlsa::getDeviceInfo: snd_pcm_open error for device (" << name << "), " << snd_strerror( result ) << ".";
-    errorText_ = errorStream_.str();
-    error( RtError::WARNING );
-    goto captureProbe;
+    errorStream << "RtApiAlsa::getDeviceInfo: snd_pcm_open error for device (" << name << "), " << snd_strerror( result ) << ".";
+    errorText = errorStream.str();
+    return false;
   }
 
   // The device is open ... fill the parameter structure.
   result = snd_pcm_hw_params_any( phandle, params );
   if ( result < 0 ) {
     snd_pcm_close( phandle );
-    errorStream_ << "RtApiAlsa::getDeviceInfo: snd_pcm_hw_params error for device (" << name << "), " << snd_strerror( result ) << ".";
-    errorText_ = errorStream_.str();
-    error( RtError::WARNING );
-    goto captureProbe;
+    errorStream << "RtApiAlsa::getDeviceInfo: snd_pcm_hw_params error for device (" << name << "), " << snd_strerror( result ) << ".";
+    errorText = errorStream.str();
+    return false;
   }
 
-  // Get output channel information.
-  unsigned int value;
-  result = snd_pcm_hw_params_get_channels_max( params, &value );
+  result = snd_pcm_hw_params_get_channels_max( params, &caps.channels );
   if ( result < 0 ) {
     snd_pcm_close( phandle );
-    errorStream_ << "RtApiAlsa::getDeviceInfo: error getting device (" << name << ") output channels, " << snd_strerror( result ) << ".";
-    errorText_ = errorStream_.str();
-    error( RtError::WARNING );
-    goto captureProbe;
+    errorStream << "RtApiAlsa::getDeviceInfo: error getting device (" << name << ") channels, " << snd_strerror( result ) << ".";
+    errorText = errorStream.str();
+    return false;
   }
-  info.outputChannels = value;
-  snd_pcm_close( phandle );
 
- captureProbe:
-  // Now try for capture
-  stream = SND_PCM_STREAM_CAPTURE;
-  snd_pcm_info_set_stream( pcminfo, stream );
-
-  result = snd_ctl_pcm_info( chandle, pcminfo );
-  snd_ctl_close( chandle );
-  if ( result < 0 ) {
-    // Device probably doesn't support capture.
-    if ( info.outputChannels == 0 ) return info;
-    goto probeParameters;
+  // Test our discrete set of sample rate values.
+  for ( unsigned int i=0; i<nRates; i++ ) {
+    if ( snd_pcm_hw_params_test_rate( phandle, params, rates[i], 0 ) == 0 )
+      caps.sampleRates.push_back( rates[i] );
   }
 
-  result = snd_pcm_open( &phandle, name, stream, openMode | SND_PCM_NONBLOCK);
-  if ( result < 0 ) {
-    errorStream_ << "RtApiAlsa::getDeviceInfo: snd_pcm_open error for device (" << name << "), " << snd_strerror( result ) << ".";
-    errorText_ = errorStream_.str();
-    error( RtError::WARNING );
-    if ( info.outputChannels == 0 ) return info;
-    goto probeParameters;
-  }
+  // Probe the supported data formats ... we don't care about endian-ness just yet
+  if ( snd_pcm_hw_params_test_format( phandle, params, SND_PCM_FORMAT_S8 ) == 0 )
+    caps.nativeFormats |= RTAUDIO_SINT8;
+  if ( snd_pcm_hw_params_test_format( phandle, params, SND_PCM_FORMAT_S16 ) == 0 )
+    caps.nativeFormats |= RTAUDIO_SINT16;
+  if ( snd_pcm_hw_params_test_format( phandle, params, SND_PCM_FORMAT_S24 ) == 0 )
+    caps.nativeFormats |= RTAUDIO_SINT24;
+  if ( snd_pcm_hw_params_test_format( phandle, params, SND_PCM_FORMAT_S24_3LE ) == 0 )
+    caps.nativeFormats |= RTAUDIO_SINT24_PACKED;
+  if ( snd_pcm_hw_params_test_format( phandle, params, SND_PCM_FORMAT_S32 ) == 0 )
+    caps.nativeFormats |= RTAUDIO_SINT32;
+  if ( snd_pcm_hw_params_test_format( phandle, params, SND_PCM_FORMAT_FLOAT ) == 0 )
+    caps.nativeFormats |= RTAUDIO_FLOAT32;
+  if ( snd_pcm_hw_params_test_format( phandle, params, SND_PCM_FORMAT_FLOAT64 ) == 0 )
+    caps.nativeFormats |= RTAUDIO_FLOAT64;
 
-  // The device is open ... fill the parameter structure.
-  result = snd_pcm_hw_params_any( phandle, params );
-  if ( result < 0 ) {
-    snd_pcm_close( phandle );
-    errorStream_ << "RtApiAlsa::getDeviceInfo: snd_pcm_hw_params error for device (" << name << "), " << snd_strerror( result ) << ".";
-    errorText_ = errorStream_.str();
-    error( RtError::WARNING );
-    if ( info.outputChannels == 0 ) return info;
-    goto probeParameters;
-  }
+  snd_pcm_close( phandle );
+  return true;
+}
 
-  result = snd_pcm_hw_params_get_channels_max( params, &value );
-  if ( result < 0 ) {
-    snd_pcm_close( phandle );
-    errorStream_ << "RtApiAlsa::getDeviceInfo: error getting device (" << name << ") input channels, " << snd_strerror( result ) << ".";
-    errorText_ = errorStream_.str();
-    error( RtError::WARNING );
-    if ( info.outputChannels == 0 ) return info;
-    goto probeParameters;
-  }
-  info.inputChannels = value;
-  snd_pcm_close( phandle );
+extern "C" void *alsaCallbackHandler( void * ptr );
 
-  // If device opens for both playback and capture, we determine the channels.
-  if ( info.outputChannels > 0 && info.inputChannels > 0 )
-    info.duplexChannels = (info.outputChannels > info.inputChannels) ? info.inputChannels : info.outputChannels;
+RtApiAlsa :: RtApiAlsa()
+{
+  // Nothing to do here.
+}
 
-  // ALSA doesn't provide default devices so we'll use the first available one.
-  if ( device == 0 && info.outputChannels > 0 )
-    info.isDefaultOutput = true;
-  if ( device == 0 && info.inputChannels > 0 )
-    info.isDefaultInput = true;
+RtApiAlsa :: ~RtApiAlsa()
+{
+  if ( stream_.state != STREAM_CLOSED ) closeStream();
+}
 
- probeParameters:
-  // At this point, we just need to figure out the supported data
-  // formats and sample rates.  We'll proceed by opening the device in
-  // the direction with the maximum number of channels, or playback if
-  // they are equal.  This might limit our sample rate options, but so
-  // be it.
+void RtApiAlsa :: scanDevices( void )
+{
+  // Build a cheap signature of the current card set.  Listing card
+  // indices does not open any device and the /dev/snd modification
+  // time changes whenever a card is added or removed.
+  std::ostringstream signature;
+  int card = -1;
+  snd_card_next( &card );
+  while ( card >= 0 ) {
+    signature << card << ' ';
+    snd_card_next( &card );
+  }
+  struct stat devStat;
+  if ( stat( "/dev/snd", &devStat ) == 0 )
+    signature << devStat.st_mtime;
 
-  if ( info.outputChannels >= info.inputChannels )
-    stream = SND_PCM_STREAM_PLAYBACK;
-  else
-    stream = SND_PCM_STREAM_CAPTURE;
-  snd_pcm_info_set_stream( pcminfo, stream );
+  MUTEX_LOCK( &alsaDeviceCache.mutex );
+  if ( !alsaDeviceCache.fileLoaded ) loadAlsaDeviceCache();
+  if ( signature.str() == alsaDeviceCache.signature ) {
+    MUTEX_UNLOCK( &alsaDeviceCache.mutex );
+    return;
+  }
 
-  result = snd_pcm_open( &phandle, name, stream, openMode | SND_PCM_NONBLOCK);
-  if ( result < 0 ) {
-    errorStream_ << "RtApiAlsa::getDeviceInfo: snd_pcm_open error for device (" << name << "), " << snd_strerror( result ) << ".";
-    errorText_ = errorStream_.str();
-    error( RtError::WARNING );
-    return info;
+  // Rebuild the device list.
+  std::vector<AlsaDevice> &devices = alsaDeviceCache.devices;
+  std::map<std::string, std::string> cards;
+  devices.clear();
+  int result, subdevice;
+  char name[64];
+  snd_ctl_t *handle;
+  snd_ctl_card_info_t *cardinfo;
+  snd_ctl_card_info_alloca( &cardinfo );
+
+  card = -1;
+  snd_card_next( &card );
+  while ( card >= 0 ) {
+    sprintf( name, "hw:%d", card );
+    result = snd_ctl_open( &handle, name, SND_CTL_NONBLOCK );
+    if ( result < 0 ) {
+      errorStream_ << "RtApiAlsa::getDeviceCount: control open, card = " << card << ", " << snd_strerror( result ) << ".";
+      errorText_ = errorStream_.str();
+      error( RtError::WARNING );
+      goto nextcard;
+    }
+    {
+      std::string cardId = name, identity;
+      if ( snd_ctl_card_info( handle, cardinfo ) == 0 ) {
+        cardId = snd_ctl_card_info_get_id( cardinfo );
+        identity = std::string( snd_ctl_card_info_get_longname( cardinfo ) ) + " | " +
+          snd_ctl_card_info_get_components( cardinfo );
+      }
+      cards[cardId] = identity;
+      subdevice = -1;
+      while( 1 ) {
+        result = snd_ctl_pcm_next_device( handle, &subdevice );
+        if ( result < 0 ) {
+          errorStream_ << "RtApiAlsa::getDeviceCount: control next device, card = " << card << ", " << snd_strerror( result ) << ".";
+          errorText_ = errorStream_.str();
+          error( RtError::WARNING );
+          break;
+        }
+        if ( subdevice < 0 )
+          break;
+        AlsaDevice device;
+        sprintf( name, "hw:%d,%d", card, subdevice );
+        device.name = name;
+        std::ostringstream key;
+        key << cardId << ',' << subdevice;
+        device.key = key.str();
+        device.card = card;
+        device.subdevice = subdevice;
+        devices.push_back( device );
+      }
+    }
+    snd_ctl_close( handle );
+  nextcard:
+    snd_card_next( &card );
   }
 
-  // The device is open ... fill the parameter structure.
-  result = snd_pcm_hw_params_any( phandle, params );
-  if ( result < 0 ) {
-    snd_pcm_close( phandle );
-    errorStream_ << "RtApiAlsa::getDeviceInfo: snd_pcm_hw_params error for device (" << name << "), " << snd_strerror( result ) << ".";
-    errorText_ = errorStream_.str();
-    error( RtError::WARNING );
-    return info;
+  // Drop the capabilities of cards that are gone or whose identity
+  // differs from the one they were probed with (at the last scan, or
+  // in the cache file at the first one), so they are probed again.
+  bool dropped = false;
+  std::map<std::string, RtAudio::DeviceInfo>::iterator it = alsaDeviceCache.capabilities.begin();
+  while ( it != alsaDeviceCache.capabilities.end() ) {
+    std::string cardId = it->first.substr( 0, it->first.rfind( ',' ) );
+    std::map<std::string, std::string>::const_iterator now = cards.find( cardId );
+    std::map<std::string, std::string>::const_iterator before = alsaDeviceCache.cards.find( cardId );
+    if ( now == cards.end() || before == alsaDeviceCache.cards.end() || now->second != before->second ) {
+      alsaDeviceCache.capabilities.erase( it++ );
+      dropped = true;
+    }
+    else ++it;
   }
+  alsaDeviceCache.cards = cards;
+  if ( dropped ) saveAlsaDeviceCache();
 
-  // Test our discrete set of sample rate values.
-  info.sampleRates.clear();
-  for ( unsigned int i=0; i<MAX_SAMPLE_RATES; i++ ) {
-    if ( snd_pcm_hw_params_test_rate( phandle, params, SAMPLE_RATES[i], 0 ) == 0 )
-      info.sampleRates.push_back( SAMPLE_RATES[i] );
+  alsaDeviceCache.signature = signature.str();
+  MUTEX_UNLOCK( &alsaDeviceCache.mutex );
+}
+
+unsigned int RtApiAlsa :: getDeviceCount( void )
+{
+  scanDevices();
+
+  MUTEX_LOCK( &alsaDeviceCache.mutex );
+  unsigned int nDevices = alsaDeviceCache.devices.size();
+  MUTEX_UNLOCK( &alsaDeviceCache.mutex );
+
+  return nDevices;
+}
+
+RtAudio::DeviceInfo RtApiAlsa :: getDeviceInfo( unsigned int device )
+{
+  RtAudio::DeviceInfo info;
+  info.probed = false;
+
+  scanDevices();
+
+  MUTEX_LOCK( &alsaDeviceCache.mutex );
+  unsigned int nDevices = alsaDeviceCache.devices.size();
+  AlsaDevice alsaDevice;
+  bool cached = false;
+  if ( device < nDevices ) {
+    alsaDevice = alsaDeviceCache.devices[device];
+    std::map<std::string, RtAudio::DeviceInfo>::const_iterator it;
+    it = alsaDeviceCache.capabilities.find( alsaDevice.key );
+    if ( it != alsaDeviceCache.capabilities.end() ) {
+      info = it->second;
+      cached = true;
+    }
   }
-  if ( info.sampleRates.size() == 0 ) {
-    snd_pcm_close( phandle );
-    errorStream_ << "RtApiAlsa::getDeviceInfo: no supported sample rates found for device (" << name << ").";
-    errorText_ = errorStream_.str();
-    error( RtError::WARNING );
-    return info;
+  MUTEX_UNLOCK( &alsaDeviceCache.mutex );
+
+  if ( nDevices == 0 ) {
+    errorText_ = "RtApiAlsa::getDeviceInfo: no devices found!";
+    error( RtError::INVALID_USE );
   }
 
-  // Probe the supported data formats ... we don't care about endian-ness just yet
-  snd_pcm_format_t format;
-  info.nativeFormats = 0;
-  format = SND_PCM_FORMAT_S8;
-  if ( snd_pcm_hw_params_test_format( phandle, params, format ) == 0 )
-    info.nativeFormats |= RTAUDIO_SINT8;
-  format = SND_PCM_FORMAT_S16;
-  if ( snd_pcm_hw_params_test_format( phandle, params, format ) == 0 )
-    info.nativeFormats |= RTAUDIO_SINT16;
-  format = SND_PCM_FORMAT_S24;
-  if ( snd_pcm_hw_params_test_format( phandle, params, format ) == 0 )
-    info.nativeFormats |= RTAUDIO_SINT24;
-  format = SND_PCM_FORMAT_S32;
-  if ( snd_pcm_hw_params_test_format( phandle, params, format ) == 0 )
-    info.nativeFormats |= RTAUDIO_SINT32;
-  format = SND_PCM_FORMAT_FLOAT;
-  if ( snd_pcm_hw_params_test_format( phandle, params, format ) == 0 )
-    info.nativeFormats |= RTAUDIO_FLOAT32;
-  format = SND_PCM_FORMAT_FLOAT64;
-  if ( snd_pcm_hw_params_test_format( phandle, params, format ) == 0 )
-    info.nativeFormats |= RTAUDIO_FLOAT64;
+  if ( device >= nDevices ) {
+    errorText_ = "RtApiAlsa::getDeviceInfo: device ID is invalid!";
+    error( RtError::INVALID_USE );
+  }
 
-  // Check that we have at least one supported format
-  if ( info.nativeFormats == 0 ) {
-    errorStream_ << "RtApiAlsa::getDeviceInfo: pcm device (" << name << ") data format not supported by RtAudio.";
-    errorText_ = errorStream_.str();
+  if ( cached ) goto setDefaults;
+
+  // If a stream is already open, we cannot probe the stream devices.
+  // Their capabilities are cached before opening, so we only get here
+  // if the cache was invalidated by a hotplug event.
+  if ( stream_.state != STREAM_CLOSED &&
+       ( stream_.device[0] == device || stream_.device[1] == device ) ) {
+    errorText_ = "RtApiAlsa::getDeviceInfo: device ID was not present before stream was opened.";
     error( RtError::WARNING );
     return info;
   }
 
-  // Get the device name
-  char *cardname;
-  result = snd_card_get_name( card, &cardname );
-  if ( result >= 0 )
-    sprintf( name, "hw:%s,%d", cardname, subdevice );
-  info.name = name;
+  {
+    int result;
+    snd_ctl_t *chandle;
+    char name[64];
+    sprintf( name, "hw:%d", alsaDevice.card );
+    result = snd_ctl_open( &chandle, name, SND_CTL_NONBLOCK );
+    if ( result < 0 ) {
+      errorStream_ << "RtApiAlsa::getDeviceInfo: control open, card = " << alsaDevice.card << ", " << snd_strerror( result ) << ".";
+      errorText_ = errorStream_.str();
+      error( RtError::WARNING );
+      return info;
+    }
 
-  // That's all ... close the device and return
-  snd_pcm_close( phandle );
-  info.probed = true;
-  return info;
-}
+    // Find which directions the device supports and probe each of them
+    // with a single open.
+    snd_pcm_info_t *pcminfo;
+    snd_pcm_info_alloca( &pcminfo );
+    snd_pcm_info_set_device( pcminfo, alsaDevice.subdevice );
+    snd_pcm_info_set_subdevice( pcminfo, 0 );
+
+    AlsaPcmCaps caps[2];
+    bool supported[2] = { false, false };
+    snd_pcm_stream_t streams[2] = { SND_PCM_STREAM_PLAYBACK, SND_PCM_STREAM_CAPTURE };
+    for ( int i=0; i<2; i++ ) {
+      snd_pcm_info_set_stream( pcminfo, streams[i] );
+      // A failure here probably means the device doesn't support this direction.
+      if ( snd_ctl_pcm_info( chandle, pcminfo ) < 0 ) continue;
+      supported[i] = probeAlsaPcm( alsaDevice.name.c_str(), streams[i], SAMPLE_RATES,
+                                   MAX_SAMPLE_RATES, caps[i], errorText_ );
+      if ( !supported[i] ) error( RtError::WARNING );
+    }
+    snd_ctl_close( chandle );
 
-void RtApiAlsa :: saveDeviceInfo( void )
-{
-  devices_.clear();
+    if ( !supported[0] && !supported[1] ) return info;
+    info.outputChannels = caps[0].channels;
+    info.inputChannels = caps[1].channels;
 
-  unsigned int nDevices = getDeviceCount();
-  devices_.resize( nDevices );
-  for ( unsigned int i=0; i<nDevices; i++ )
-    devices_[i] = getDeviceInfo( i );
+    // If device opens for both playback and capture, we determine the channels.
+    if ( info.outputChannels > 0 && info.inputChannels > 0 )
+      info.duplexChannels = (info.outputChannels > info.inputChannels) ? info.inputChannels : info.outputChannels;
+
+    // Report the rates and formats of the direction with the maximum
+    // number of channels, or playback if they are equal.  This might
+    // limit our sample rate options, but so be it.
+    AlsaPcmCaps &probed = ( info.outputChannels >= info.inputChannels ) ? caps[0] : caps[1];
+    info.sampleRates = probed.sampleRates;
+    info.nativeFormats = probed.nativeFormats;
+
+    if ( info.sampleRates.size() == 0 ) {
+      errorStream_ << "RtApiAlsa::getDeviceInfo: no supported sample rates found for device (" << alsaDevice.name << ").";
+      errorText_ = errorStream_.str();
+      error( RtError::WARNING );
+      return info;
+    }
+
+    // Check that we have at least one supported format
+    if ( info.nativeFormats == 0 ) {
+      errorStream_ << "RtApiAlsa::getDeviceInfo: pcm device (" << alsaDevice.name << ") data format not supported by RtAudio.";
+      errorText_ = errorStream_.str();
+      error( RtError::WARNING );
+      return info;
+    }
+
+    // Get the device name
+    char *cardname;
+    result = snd_card_get_name( alsaDevice.card, &cardname );
+    if ( result >= 0 ) {
+      sprintf( name, "hw:%s,%d", cardname, alsaDevice.subdevice );
+      free( cardname );
+    }
+    else
+      sprintf( name, "%s", alsaDevice.name.c_str() );
+    info.name = name;
+    info.probed = true;
+
+    MUTEX_LOCK( &alsaDeviceCache.mutex );
+    alsaDeviceCache.capabilities[alsaDevice.key] = info;
+    saveAlsaDeviceCache();
+    MUTEX_UNLOCK( &alsaDeviceCache.mutex );
+  }
+
+ setDefaults:
+  // ALSA doesn't provide default devices so we'll use the first available one.
+  info.isDefaultOutput = ( device == 0 && info.outputChannels > 0 );
+  info.isDefaultInput = ( device == 0 && info.inputChannels > 0 );
+  return info;
 }
 
 bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigned int channels,
@@ -5493,40 +6187,22 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
 
   // I'm not using the "plug" interface ... too much inconsistent behavior.
 
-  unsigned nDevices = 0;
-  int result, subdevice, card;
+  int result;
   char name[64];
-  snd_ctl_t *chandle;
+
+  // The getDeviceInfo() function will not work for a device that is
+  // already open.  Thus, we'll make sure its capabilities are cached
+  // before opening a stream.  This also refreshes the device list.
+  this->getDeviceInfo( device );
 
   if ( options && options->flags & RTAUDIO_ALSA_USE_DEFAULT )
     snprintf(name, sizeof(name), "%s", "default");
   else {
-    // Count cards and devices
-    card = -1;
-    snd_card_next( &card );
-    while ( card >= 0 ) {
-      sprintf( name, "hw:%d", card );
-      result = snd_ctl_open( &chandle, name, SND_CTL_NONBLOCK );
-      if ( result < 0 ) {
-        errorStream_ << "RtApiAlsa::probeDeviceOpen: control open, card = " << card << ", " << snd_strerror( result ) << ".";
-        errorText_ = errorStream_.str();
-        return FAILURE;
-      }
-      subdevice = -1;
-      while( 1 ) {
-        result = snd_ctl_pcm_next_device( chandle, &subdevice );
-        if ( result < 0 ) break;
-        if ( subdevice < 0 ) break;
-        if ( nDevices == device ) {
-          sprintf( name, "hw:%d,%d", card, subdevice );
-          snd_ctl_close( chandle );
-          goto foundDevice;
-        }
-        nDevices++;
-      }
-      snd_ctl_close( chandle );
-      snd_card_next( &card );
-    }
+    MUTEX_LOCK( &alsaDeviceCache.mutex );
+    unsigned int nDevices = alsaDeviceCache.devices.size();
+    if ( device < nDevices )
+      snprintf( name, sizeof(name), "%s", alsaDeviceCache.devices[device].name.c_str() );
+    MUTEX_UNLOCK( &alsaDeviceCache.mutex );
 
     if ( nDevices == 0 ) {
       // This should not happen because a check is made before this function is called.
@@ -5541,14 +6217,6 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
     }
   }
 
- foundDevice:
-
-  // The getDeviceInfo() function will not work for a device that is
-  // already open.  Thus, we'll probe the system before opening a
-  // stream and save the results for use by getDeviceInfo().
-  if ( mode == OUTPUT || ( mode == INPUT && stream_.mode != OUTPUT ) ) // only do once
-    this->saveDeviceInfo();
-
   snd_pcm_stream_t stream;
   if ( mode == OUTPUT )
     stream = SND_PCM_STREAM_PLAYBACK;
@@ -5622,6 +6290,8 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
     deviceFormat = SND_PCM_FORMAT_S16;
   else if ( format == RTAUDIO_SINT24 )
     deviceFormat = SND_PCM_FORMAT_S24;
+  else if ( format == RTAUDIO_SINT24_PACKED )
+    deviceFormat = SND_PCM_FORMAT_S24_3LE;
   else if ( format == RTAUDIO_SINT32 )
     deviceFormat = SND_PCM_FORMAT_S32;
   else if ( format == RTAUDIO_FLOAT32 )
@@ -5659,6 +6329,12 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
     goto setFormat;
   }
 
+  deviceFormat = SND_PCM_FORMAT_S24_3LE;
+  if ( snd_pcm_hw_params_test_format(phandle, hw_params, deviceFormat ) == 0 ) {
+    stream_.deviceFormat[mode] = RTAUDIO_SINT24_PACKED;
+    goto setFormat;
+  }
+
   deviceFormat = SND_PCM_FORMAT_S16;
   if ( snd_pcm_hw_params_test_format(phandle, hw_params, deviceFormat ) == 0 ) {
     stream_.deviceFormat[mode] = RTAUDIO_SINT16;
@@ -5765,6 +6441,7 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
     errorText_ = errorStream_.str();
     return FAILURE;
   }
+  snd_pcm_uframes_t hwBufferFrames = periodSize * periods;
 
   // If attempting to setup a duplex stream, the bufferSize parameter
   // MUST be the same in both directions!
@@ -5789,6 +6466,7 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
   fprintf(stderr, "\nRtApiAlsa: dump hardware params after installation:\n\n");
   snd_pcm_hw_params_dump( hw_params, out );
 #endif
+  snd_pcm_hw_params_get_buffer_size( hw_params, &hwBufferFrames );
 
   // Set the software configuration to fill buffers with zeros and prevent device stopping on xruns.
   snd_pcm_sw_params_t *sw_params = NULL;
@@ -5798,8 +6476,13 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
   snd_pcm_sw_params_set_stop_threshold( phandle, sw_params, ULONG_MAX );
   snd_pcm_sw_params_set_silence_threshold( phandle, sw_params, 0 );
 
-  // The following two settings were suggested by Theo Veenker
-  //snd_pcm_sw_params_set_avail_min( phandle, sw_params, *bufferSize );
+  // Status timestamps, so that the time a device spent stopped in an
+  // xrun can be measured (see recoverXruns()).
+  snd_pcm_sw_params_set_tstamp_mode( phandle, sw_params, SND_PCM_TSTAMP_ENABLE );
+
+  // The callback thread polls the device and only transfers data once
+  // a whole buffer can be read or written.
+  snd_pcm_sw_params_set_avail_min( phandle, sw_params, *bufferSize );
   //snd_pcm_sw_params_set_xfer_align( phandle, sw_params, 1 );
 
   // here are two options for a fix
@@ -5831,6 +6514,19 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
        stream_.nUserChannels[mode] > 1 )
     stream_.doConvertBuffer[mode] = true;
 
+  // The channels of any additional (aggregate) devices follow those of
+  // this device in the user buffer, which is then always converted.
+  unsigned int aggregateChannels = 0;
+  if ( options ) {
+    std::vector<RtAudio::StreamParameters> &aggregate = ( mode == OUTPUT ) ? options->aggregateOutputs : options->aggregateInputs;
+    for ( unsigned int i=0; i<aggregate.size(); i++ )
+      aggregateChannels += aggregate[i].nChannels;
+  }
+  if ( aggregateChannels > 0 ) {
+    stream_.nUserChannels[mode] = channels + aggregateChannels;
+    stream_.doConvertBuffer[mode] = true;
+  }
+
   // Allocate the ApiHandle if necessary and then save.
   AlsaHandle *apiInfo = 0;
   if ( stream_.apiHandle == 0 ) {
@@ -5850,16 +6546,43 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
     stream_.apiHandle = (void *) apiInfo;
     apiInfo->handles[0] = 0;
     apiInfo->handles[1] = 0;
+
+    apiInfo->sharedThread = ( options && options->flags & RTAUDIO_SHARED_THREAD );
+    if ( !apiInfo->sharedThread ) {
+      apiInfo->controlFd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+      if ( apiInfo->controlFd < 0 ) {
+        errorText_ = "RtApiAlsa::probeDeviceOpen: error creating control eventfd.";
+        goto error;
+      }
+    }
+
+    if ( apiInfo->sharedThread && options->flags & RTAUDIO_ALSA_TIMER_SCHEDULING ) {
+      errorText_ = "RtApiAlsa::probeDeviceOpen: timer scheduling is not available with a shared callback thread.";
+      error( RtError::WARNING );
+    }
+    else if ( options && options->flags & RTAUDIO_ALSA_TIMER_SCHEDULING ) {
+      apiInfo->timerFd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+      if ( apiInfo->timerFd < 0 ) {
+        errorText_ = "RtApiAlsa::probeDeviceOpen: error creating scheduling timerfd.";
+        goto error;
+      }
+      apiInfo->wakeAhead = options->wakeAheadFrames;
+      if ( apiInfo->wakeAhead == 0 ) apiInfo->wakeAhead = *bufferSize;
+    }
   }
   else {
     apiInfo = (AlsaHandle *) stream_.apiHandle;
   }
   apiInfo->handles[mode] = phandle;
+  apiInfo->hwBufferFrames[mode] = hwBufferFrames;
+  setupAlsaPollDescriptors( apiInfo );
+  if ( mode == OUTPUT )
+    apiInfo->silence.assign( stream_.nDeviceChannels[0] * *bufferSize * formatBytes( stream_.deviceFormat[0] ), 0 );
 
   // Allocate necessary internal buffers.
   unsigned long bufferBytes;
   bufferBytes = stream_.nUserChannels[mode] * *bufferSize * formatBytes( stream_.userFormat );
-  stream_.userBuffer[mode] = (char *) calloc( bufferBytes, 1 );
+  stream_.userBuffer[mode] = allocateBuffer( bufferBytes );
   if ( stream_.userBuffer[mode] == NULL ) {
     errorText_ = "RtApiAlsa::probeDeviceOpen: error allocating user buffer memory.";
     goto error;
@@ -5878,8 +6601,8 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
 
     if ( makeBuffer ) {
       bufferBytes *= *bufferSize;
-      if ( stream_.deviceBuffer ) free( stream_.deviceBuffer );
-      stream_.deviceBuffer = (char *) calloc( bufferBytes, 1 );
+      if ( stream_.deviceBuffer ) freeBuffer( stream_.deviceBuffer );
+      stream_.deviceBuffer = allocateBuffer( bufferBytes );
       if ( stream_.deviceBuffer == NULL ) {
         errorText_ = "RtApiAlsa::probeDeviceOpen: error allocating device buffer memory.";
         goto error;
@@ -5895,6 +6618,14 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
   // Setup the buffer conversion information structure.
   if ( stream_.doConvertBuffer[mode] ) setConvertInfo( mode, firstChannel );
 
+  if ( aggregateChannels > 0 ) {
+    // Only the first channels of the user buffer belong to this device.
+    if ( stream_.convertInfo[mode].channels > (int) channels )
+      stream_.convertInfo[mode].channels = channels;
+    if ( openAggregateDevices( mode, channels, options ) == FAILURE )
+      goto error;
+  }
+
   // Setup thread if necessary.
   if ( stream_.mode == OUTPUT && mode == INPUT ) {
     // We had already set up an output stream.
@@ -5907,6 +6638,8 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
       errorText_ = "RtApiAlsa::probeDeviceOpen: unable to synchronize input and output devices.";
       error( RtError::WARNING );
     }
+
+    if ( options && options->flags & RTAUDIO_ALIGN_DUPLEX ) apiInfo->align = true;
   }
   else {
     stream_.mode = mode;
@@ -5914,32 +6647,30 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
     // Setup callback thread.
     stream_.callbackInfo.object = (void *) this;
 
-    // Set the thread attributes for joinable and realtime scheduling
-    // priority (optional).  The higher priority will only take affect
-    // if the program is run as root or suid. Note, under Linux
-    // processes with CAP_SYS_NICE privilege, a user can change
-    // scheduling policy and priority (thus need not be root). See
-    // POSIX "capabilities".
+    if ( apiInfo->sharedThread ) {
+      bool started;
+      pthread_t thread;
+      if ( registerAlsaSharedStream( this, apiInfo, &started, &thread ) == false ) {
+        errorText_ = "RtApiAlsa::error starting shared callback thread!";
+        goto error;
+      }
+
+      // The shared thread keeps the scheduling of the stream that
+      // started it.  Our stream is registered, so the thread is alive.
+      // It serves several periods, so SCHED_DEADLINE is not used.
+      if ( started ) setCallbackThreadAttributes( thread, options );
+      stream_.deadline = false;
+      MUTEX_LOCK( &alsaSharedThread.mutex );
+      if ( started ) alsaSharedThread.threadInfo = stream_.threadInfo;
+      else stream_.threadInfo = alsaSharedThread.threadInfo;
+      MUTEX_UNLOCK( &alsaSharedThread.mutex );
+      return SUCCESS;
+    }
+
+    // Set the thread attributes for joinable.
     pthread_attr_t attr;
     pthread_attr_init( &attr );
     pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_JOINABLE );
-#ifdef SCHED_RR // Undefined with some OSes (eg: NetBSD 1.6.x with GNU Pthread)
-    if ( options && options->flags & RTAUDIO_SCHEDULE_REALTIME ) {
-      struct sched_param param;
-      int priority = options->priority;
-      int min = sched_get_priority_min( SCHED_RR );
-      int max = sched_get_priority_max( SCHED_RR );
-      if ( priority < min ) priority = min;
-      else if ( priority > max ) priority = max;
-      param.sched_priority = priority;
-      pthread_attr_setschedparam( &attr, &param );
-      pthread_attr_setschedpolicy( &attr, SCHED_RR );
-    }
-    else
-      pthread_attr_setschedpolicy( &attr, SCHED_OTHER );
-#else
-    pthread_attr_setschedpolicy( &attr, SCHED_OTHER );
-#endif
 
     stream_.callbackInfo.isRunning = true;
     result = pthread_create( &stream_.callbackInfo.thread, &attr, alsaCallbackHandler, &stream_.callbackInfo );
@@ -5949,28 +6680,29 @@ bool RtApiAlsa :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigne
       errorText_ = "RtApiAlsa::error creating callback thread!";
       goto error;
     }
+
+    // Set the realtime scheduling priority and CPU affinity (optional).
+    setCallbackThreadAttributes( stream_.callbackInfo.thread, options );
   }
 
   return SUCCESS;
 
  error:
+  closeAggregateDevices();
   if ( apiInfo ) {
-    pthread_cond_destroy( &apiInfo->runnable_cv );
-    if ( apiInfo->handles[0] ) snd_pcm_close( apiInfo->handles[0] );
-    if ( apiInfo->handles[1] ) snd_pcm_close( apiInfo->handles[1] );
-    delete apiInfo;
+    closeAlsaHandle( apiInfo );
     stream_.apiHandle = 0;
   }
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -5986,14 +6718,19 @@ void RtApiAlsa :: closeStream()
   }
 
   AlsaHandle *apiInfo = (AlsaHandle *) stream_.apiHandle;
-  stream_.callbackInfo.isRunning = false;
-  MUTEX_LOCK( &stream_.mutex );
-  if ( stream_.state == STREAM_STOPPED ) {
-    apiInfo->runnable = true;
-    pthread_cond_signal( &apiInfo->runnable_cv );
+  if ( apiInfo->sharedThread )
+    unregisterAlsaSharedStream( this );
+  else {
+    stream_.callbackInfo.isRunning = false;
+    MUTEX_LOCK( &stream_.mutex );
+    if ( stream_.state == STREAM_STOPPED ) {
+      apiInfo->runnable = true;
+      pthread_cond_signal( &apiInfo->runnable_cv );
+    }
+    MUTEX_UNLOCK( &stream_.mutex );
+    wakeAlsaCallbackThread( apiInfo );
+    pthread_join( stream_.callbackInfo.thread, NULL );
   }
-  MUTEX_UNLOCK( &stream_.mutex );
-  pthread_join( stream_.callbackInfo.thread, NULL );
 
   if ( stream_.state == STREAM_RUNNING ) {
     stream_.state = STREAM_STOPPED;
@@ -6003,23 +6740,21 @@ void RtApiAlsa :: closeStream()
       snd_pcm_drop( apiInfo->handles[1] );
   }
 
+  closeAggregateDevices();
   if ( apiInfo ) {
-    pthread_cond_destroy( &apiInfo->runnable_cv );
-    if ( apiInfo->handles[0] ) snd_pcm_close( apiInfo->handles[0] );
-    if ( apiInfo->handles[1] ) snd_pcm_close( apiInfo->handles[1] );
-    delete apiInfo;
+    closeAlsaHandle( apiInfo );
     stream_.apiHandle = 0;
   }
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -6068,12 +6803,33 @@ void RtApiAlsa :: startStream()
     }
   }
 
+  // Linked devices are started by filling the output, so that input
+  // and output begin at the same frame.
+  apiInfo->roundTrip = 0;
+  apiInfo->inputDrop = 0;
+  apiInfo->inputOverflow = false;
+  apiInfo->droppedInput = 0;
+  if ( apiInfo->align )
+    apiInfo->alignBuffer.assign( 2 * stream_.nUserChannels[1] * stream_.bufferSize * formatBytes( stream_.userFormat ), 0 );
+  if ( stream_.mode == DUPLEX && apiInfo->synchronized ) {
+    result = writeOutputSilence();
+    if ( result < 0 ) {
+      errorStream_ << "RtApiAlsa::startStream: error starting pcm devices, " << snd_strerror( result ) << ".";
+      errorText_ = errorStream_.str();
+      goto unlock;
+    }
+  }
+
+  result = startAggregateDevices();
+  if ( result < 0 ) goto unlock;
+
   stream_.state = STREAM_RUNNING;
 
  unlock:
   apiInfo->runnable = true;
   pthread_cond_signal( &apiInfo->runnable_cv );
   MUTEX_UNLOCK( &stream_.mutex );
+  if ( apiInfo->sharedThread ) wakeAlsaCallbackThread( apiInfo );
 
   if ( result >= 0 ) return;
   error( RtError::SYSTEM_ERROR );
@@ -6089,6 +6845,7 @@ void RtApiAlsa :: stopStream()
   }
 
   stream_.state = STREAM_STOPPED;
+  wakeAlsaCallbackThread( (AlsaHandle *) stream_.apiHandle );
   MUTEX_LOCK( &stream_.mutex );
 
   //if ( stream_.state == STREAM_STOPPED ) {
@@ -6121,6 +6878,7 @@ void RtApiAlsa :: stopStream()
   }
 
  unlock:
+  stopAggregateDevices();
   stream_.state = STREAM_STOPPED;
   MUTEX_UNLOCK( &stream_.mutex );
 
@@ -6138,6 +6896,7 @@ void RtApiAlsa :: abortStream()
   }
 
   stream_.state = STREAM_STOPPED;
+  wakeAlsaCallbackThread( (AlsaHandle *) stream_.apiHandle );
   MUTEX_LOCK( &stream_.mutex );
 
   //if ( stream_.state == STREAM_STOPPED ) {
@@ -6167,6 +6926,7 @@ void RtApiAlsa :: abortStream()
   }
 
  unlock:
+  stopAggregateDevices();
   stream_.state = STREAM_STOPPED;
   MUTEX_UNLOCK( &stream_.mutex );
 
@@ -6174,9 +6934,559 @@ void RtApiAlsa :: abortStream()
   error( RtError::SYSTEM_ERROR );
 }
 
-void RtApiAlsa :: callbackEvent()
+bool RtApiAlsa :: openAggregateDevices( StreamMode mode, unsigned int userOffset,
+                                        RtAudio::StreamOptions *options )
+{
+  // Open the additional devices of an aggregate stream.  Their
+  // channels follow userOffset in the user buffer.  The devices are
+  // non-blocking because they are serviced from the callback thread
+  // of the main device without being polled.
+
+  std::vector<RtAudio::StreamParameters> &devices = ( mode == OUTPUT ) ? options->aggregateOutputs : options->aggregateInputs;
+  snd_pcm_stream_t stream = ( mode == OUTPUT ) ? SND_PCM_STREAM_PLAYBACK : SND_PCM_STREAM_CAPTURE;
+  static const snd_pcm_format_t alsaFormats[] = { SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S32,
+                                                  SND_PCM_FORMAT_S24, SND_PCM_FORMAT_S16 };
+  static const RtAudioFormat formats[] = { RTAUDIO_FLOAT32, RTAUDIO_SINT32,
+                                           RTAUDIO_SINT24, RTAUDIO_SINT16 };
+  snd_pcm_hw_params_t *hw_params;
+  snd_pcm_hw_params_alloca( &hw_params );
+  snd_pcm_sw_params_t *sw_params;
+  snd_pcm_sw_params_alloca( &sw_params );
+  unsigned int bufferSize = stream_.bufferSize;
+
+  for ( unsigned int i=0; i<devices.size(); i++ ) {
+    this->getDeviceInfo( devices[i].deviceId );
+    std::string name;
+    MUTEX_LOCK( &alsaDeviceCache.mutex );
+    if ( devices[i].deviceId < alsaDeviceCache.devices.size() )
+      name = alsaDeviceCache.devices[ devices[i].deviceId ].name;
+    MUTEX_UNLOCK( &alsaDeviceCache.mutex );
+    if ( name.empty() ) {
+      errorText_ = "RtApiAlsa::probeDeviceOpen: aggregate device ID is invalid!";
+      return FAILURE;
+    }
+
+    AggregateDevice *aggregate = 0;
+    try {
+      aggregate = new AggregateDevice;
+    }
+    catch ( std::bad_alloc& ) {
+      errorText_ = "RtApiAlsa::probeDeviceOpen: error allocating aggregate device memory.";
+      return FAILURE;
+    }
+    aggregate_[mode].push_back( aggregate );
+
+    int result = snd_pcm_open( &aggregate->handle, name.c_str(), stream, SND_PCM_NONBLOCK );
+    if ( result < 0 ) {
+      aggregate->handle = 0;
+      errorStream_ << "RtApiAlsa::probeDeviceOpen: aggregate pcm device (" << name << ") won't open, " << snd_strerror( result ) << ".";
+      errorText_ = errorStream_.str();
+      return FAILURE;
+    }
+
+    // The device must run at the stream rate and buffer size exactly;
+    // only the clock drift is resampled.
+    snd_pcm_t *handle = aggregate->handle;
+    snd_pcm_format_t deviceFormat = SND_PCM_FORMAT_UNKNOWN;
+    RtAudioFormat format = 0;
+    unsigned int channels = devices[i].nChannels + devices[i].firstChannel;
+    unsigned int value = 0;
+    int dir = 0;
+    result = snd_pcm_hw_params_any( handle, hw_params );
+    if ( result >= 0 )
+      result = snd_pcm_hw_params_set_access( handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED );
+    if ( result >= 0 ) {
+      for ( unsigned int k=0; k<4; k++ ) {
+        if ( snd_pcm_hw_params_test_format( handle, hw_params, alsaFormats[k] ) == 0 ) {
+          deviceFormat = alsaFormats[k];
+          format = formats[k];
+          break;
+        }
+      }
+      if ( format == 0 ) result = -EINVAL;
+    }
+    if ( result >= 0 )
+      result = snd_pcm_hw_params_set_format( handle, hw_params, deviceFormat );
+    if ( result >= 0 )
+      result = snd_pcm_hw_params_get_channels_min( hw_params, &value );
+    if ( result >= 0 ) {
+      if ( value > channels ) channels = value;
+      result = snd_pcm_hw_params_set_channels( handle, hw_params, channels );
+    }
+    if ( result >= 0 )
+      result = snd_pcm_hw_params_set_rate( handle, hw_params, stream_.sampleRate, 0 );
+    if ( result >= 0 )
+      result = snd_pcm_hw_params_set_period_size( handle, hw_params, bufferSize, 0 );
+    if ( result >= 0 ) {
+      value = stream_.nBuffers;
+      result = snd_pcm_hw_params_set_periods_near( handle, hw_params, &value, &dir );
+    }
+    if ( result >= 0 )
+      result = snd_pcm_hw_params( handle, hw_params );
+    if ( result < 0 ) {
+      errorStream_ << "RtApiAlsa::probeDeviceOpen: unable to configure aggregate device (" << name << ") for " << channels << " channels, " << stream_.sampleRate << " Hz and " << bufferSize << " frames per buffer, " << snd_strerror( result ) << ".";
+      errorText_ = errorStream_.str();
+      return FAILURE;
+    }
+
+    snd_pcm_uframes_t hwBufferFrames = 0;
+    snd_pcm_hw_params_get_buffer_size( hw_params, &hwBufferFrames );
+    aggregate->hwBufferFrames = hwBufferFrames;
+    aggregate->periods = hwBufferFrames / bufferSize;
+    if ( aggregate->periods < 2 ) aggregate->periods = 2;
+
+    // The device is started explicitly (see startAggregateDevices()) and
+    // stops on an xrun so that it can be restarted in a known state.
+    snd_pcm_sw_params_current( handle, sw_params );
+    snd_pcm_uframes_t boundary;
+    snd_pcm_sw_params_get_boundary( sw_params, &boundary );
+    snd_pcm_sw_params_set_start_threshold( handle, sw_params, boundary );
+    snd_pcm_sw_params_set_stop_threshold( handle, sw_params, hwBufferFrames );
+    snd_pcm_sw_params_set_avail_min( handle, sw_params, bufferSize );
+    result = snd_pcm_sw_params( handle, sw_params );
+    if ( result < 0 ) {
+      errorStream_ << "RtApiAlsa::probeDeviceOpen: error installing software configuration on aggregate device (" << name << "), " << snd_strerror( result ) << ".";
+      errorText_ = errorStream_.str();
+      return FAILURE;
+    }
+
+    aggregate->channels = devices[i].nChannels;
+    aggregate->deviceChannels = channels;
+    aggregate->deviceBuffer = allocateBuffer( channels * bufferSize * formatBytes( format ) );
+    if ( aggregate->deviceBuffer == NULL ) {
+      errorText_ = "RtApiAlsa::probeDeviceOpen: error allocating aggregate device buffer memory.";
+      return FAILURE;
+    }
+    aggregate->block.resize( aggregate->channels * bufferSize );
+    aggregate->sample.resize( aggregate->channels );
+    aggregate->fifoFrames = ALSA_AGGREGATE_FIFO * bufferSize;
+    aggregate->fifo.resize( aggregate->fifoFrames * aggregate->channels );
+    aggregate->reset( bufferSize );
+
+    // Set up the conversions between the user buffer and the block,
+    // and between the block and the device buffer.
+    ConvertInfo &user = aggregate->userConvert;
+    ConvertInfo &dev = aggregate->deviceConvert;
+    user.channels = dev.channels = aggregate->channels;
+    int userJump = stream_.userInterleaved ? stream_.nUserChannels[mode] : 1;
+    for ( unsigned int k=0; k<aggregate->channels; k++ ) {
+      int userIndex = userOffset + k;
+      if ( !stream_.userInterleaved ) userIndex *= bufferSize;
+      if ( mode == OUTPUT ) {
+        user.inOffset.push_back( userIndex );
+        user.outOffset.push_back( k );
+        dev.inOffset.push_back( k );
+        dev.outOffset.push_back( devices[i].firstChannel + k );
+      }
+      else {
+        dev.inOffset.push_back( devices[i].firstChannel + k );
+        dev.outOffset.push_back( k );
+        user.inOffset.push_back( k );
+        user.outOffset.push_back( userIndex );
+      }
+    }
+    if ( mode == OUTPUT ) {
+      user.inJump = userJump;
+      user.outJump = aggregate->channels;
+      user.inFormat = stream_.userFormat;
+      user.outFormat = RTAUDIO_FLOAT32;
+      dev.inJump = aggregate->channels;
+      dev.outJump = channels;
+      dev.inFormat = RTAUDIO_FLOAT32;
+      dev.outFormat = format;
+    }
+    else {
+      dev.inJump = channels;
+      dev.outJump = aggregate->channels;
+      dev.inFormat = format;
+      dev.outFormat = RTAUDIO_FLOAT32;
+      user.inJump = aggregate->channels;
+      user.outJump = userJump;
+      user.inFormat = RTAUDIO_FLOAT32;
+      user.outFormat = stream_.userFormat;
+    }
+
+    userOffset += aggregate->channels;
+  }
+
+  return SUCCESS;
+}
+
+void RtApiAlsa :: closeAggregateDevices()
+{
+  for ( int mode=0; mode<2; mode++ ) {
+    for ( unsigned int i=0; i<aggregate_[mode].size(); i++ ) {
+      AggregateDevice *aggregate = aggregate_[mode][i];
+      if ( aggregate->handle ) snd_pcm_close( aggregate->handle );
+      if ( aggregate->deviceBuffer ) freeBuffer( aggregate->deviceBuffer );
+      delete aggregate;
+    }
+    aggregate_[mode].clear();
+  }
+}
+
+int RtApiAlsa :: startAggregateDevices()
+{
+  // Output devices are started with one buffer of silence queued so
+  // that they hold between one and two buffers in steady state.
+  for ( int mode=0; mode<2; mode++ ) {
+    for ( unsigned int i=0; i<aggregate_[mode].size(); i++ ) {
+      AggregateDevice *aggregate = aggregate_[mode][i];
+      aggregate->reset( stream_.bufferSize );
+      snd_pcm_drop( aggregate->handle );
+      int result = snd_pcm_prepare( aggregate->handle );
+      if ( result >= 0 && mode == OUTPUT ) {
+        memset( aggregate->deviceBuffer, 0, aggregate->deviceChannels * stream_.bufferSize * formatBytes( aggregate->deviceConvert.outFormat ) );
+        result = snd_pcm_writei( aggregate->handle, aggregate->deviceBuffer, stream_.bufferSize );
+      }
+      if ( result >= 0 )
+        result = snd_pcm_start( aggregate->handle );
+      if ( result < 0 ) {
+        errorStream_ << "RtApiAlsa::startStream: error starting aggregate device, " << snd_strerror( result ) << ".";
+        errorText_ = errorStream_.str();
+        return result;
+      }
+    }
+  }
+
+  return 0;
+}
+
+void RtApiAlsa :: stopAggregateDevices()
+{
+  for ( int mode=0; mode<2; mode++ )
+    for ( unsigned int i=0; i<aggregate_[mode].size(); i++ )
+      snd_pcm_drop( aggregate_[mode][i]->handle );
+}
+
+void RtApiAlsa :: restartAggregateDevice( AggregateDevice *aggregate, StreamMode mode )
+{
+  // Recover from an xrun.  The FIFO keeps its content so the drift
+  // controller is not disturbed.
+  AlsaHandle *apiInfo = (AlsaHandle *) stream_.apiHandle;
+  apiInfo->xrun[mode] = true;
+  snd_pcm_drop( aggregate->handle );
+  if ( snd_pcm_prepare( aggregate->handle ) < 0 ) return;
+  if ( mode == OUTPUT ) {
+    memset( aggregate->deviceBuffer, 0, aggregate->deviceChannels * stream_.bufferSize * formatBytes( aggregate->deviceConvert.outFormat ) );
+    snd_pcm_writei( aggregate->handle, aggregate->deviceBuffer, stream_.bufferSize );
+  }
+  snd_pcm_start( aggregate->handle );
+}
+
+int RtApiAlsa :: writeOutputSilence()
+{
+  // Fill the output with silence: the whole hardware buffer, or in
+  // timer scheduling mode the amount normally kept queued.  Filling
+  // only to the start threshold (one buffer) would leave the first
+  // callback of a duplex stream no time to write before the output
+  // runs dry.  The first write reaches the start threshold, so it
+  // starts the output device and a linked input device.  Returns the
+  // number of frames written.
+  AlsaHandle *apiInfo = (AlsaHandle *) stream_.apiHandle;
+  snd_pcm_uframes_t total = apiInfo->hwBufferFrames[0];
+  if ( apiInfo->timerFd >= 0 && stream_.bufferSize + apiInfo->wakeAhead < total )
+    total = stream_.bufferSize + apiInfo->wakeAhead;
+
+  char *buffer = &apiInfo->silence[0];
+  int channels = stream_.nDeviceChannels[0];
+  void *bufs[channels];
+  size_t offset = stream_.bufferSize * formatBytes( stream_.deviceFormat[0] );
+  for ( int i=0; i<channels; i++ )
+    bufs[i] = (void *) (buffer + (i * offset));
+
+  snd_pcm_uframes_t written = 0;
+  while ( written < total ) {
+    snd_pcm_uframes_t frames = total - written;
+    if ( frames > stream_.bufferSize ) frames = stream_.bufferSize;
+    int result;
+    if ( stream_.deviceInterleaved[0] )
+      result = snd_pcm_writei( apiInfo->handles[0], buffer, frames );
+    else
+      result = snd_pcm_writen( apiInfo->handles[0], bufs, frames );
+    if ( result < 0 ) return result;
+    written += result;
+  }
+
+  return (int) written;
+}
+
+void RtApiAlsa :: updateDuplexLatency()
+{
+  // The callback is passed the input read during the previous
+  // callback, so the duplex latency is one buffer plus the input and
+  // output delays at the same instant.  The input delay is read first:
+  // a frame elapsing between the two reads can then only lower the
+  // sum, so the largest sum since the start is exact.  Called with the
+  // stream mutex held, after the output was written.
+
+  AlsaHandle *apiInfo = (AlsaHandle *) stream_.apiHandle;
+  snd_pcm_t **handle = (snd_pcm_t **) apiInfo->handles;
+  snd_pcm_sframes_t inputDelay, outputDelay;
+  if ( snd_pcm_delay( handle[1], &inputDelay ) < 0 ) return;
+  if ( snd_pcm_delay( handle[0], &outputDelay ) < 0 ) return;
+  if ( outputDelay > 0 ) stream_.latency[0] = outputDelay;
+
+  long roundTrip = inputDelay + outputDelay + stream_.bufferSize;
+  if ( roundTrip <= apiInfo->roundTrip ) return;
+  apiInfo->roundTrip = roundTrip;
+
+  if ( apiInfo->align ) {
+    // Delay the input so that the latency is a whole number of buffers.
+    unsigned long alignFrames = ( stream_.bufferSize - roundTrip % stream_.bufferSize ) % stream_.bufferSize;
+    if ( alignFrames != apiInfo->alignFrames ) {
+      apiInfo->alignFrames = alignFrames;
+      memset( &apiInfo->alignBuffer[0], 0, apiInfo->alignBuffer.size() );
+    }
+  }
+  stream_.duplexLatency = roundTrip + apiInfo->alignFrames;
+}
+
+void RtApiAlsa :: alignInput()
+{
+  // Delay the user input buffer by alignFrames, carrying its last
+  // frames over to the next buffer.  A non-interleaved buffer is
+  // shifted one channel at a time.
+
+  AlsaHandle *apiInfo = (AlsaHandle *) stream_.apiHandle;
+  size_t frames = stream_.bufferSize;
+  size_t shift = apiInfo->alignFrames;
+  size_t channels = stream_.nUserChannels[1];
+  size_t blocks = stream_.userInterleaved ? 1 : channels;
+  size_t frameBytes = formatBytes( stream_.userFormat ) * ( stream_.userInterleaved ? channels : 1 );
+  char *carry = &apiInfo->alignBuffer[0];
+  char *temp = carry + apiInfo->alignBuffer.size() / 2;
+
+  for ( size_t i=0; i<blocks; i++ ) {
+    char *data = stream_.userBuffer[1] + i * frames * frameBytes;
+    char *saved = carry + i * shift * frameBytes;
+    memcpy( temp, data + ( frames - shift ) * frameBytes, shift * frameBytes );
+    memmove( data + shift * frameBytes, data, ( frames - shift ) * frameBytes );
+    memcpy( data, saved, shift * frameBytes );
+    memcpy( saved, temp, shift * frameBytes );
+  }
+}
+
+void RtApiAlsa :: recoverXruns()
+{
+  // Look for xruns on the main devices.  With the stop threshold at
+  // the boundary a device keeps running through an xrun, which then
+  // shows as more than a whole hardware buffer being available.  A
+  // device that stopped anyway is in the XRUN state.  The recovery
+  // restarts all main devices together, so the input and output of a
+  // duplex stream stay aligned, and advances the stream time by the
+  // frames lost.  Called with the stream mutex held.
+  //
+  // The input a callback gets was read after the previous callback, so
+  // input lost here is only reported (with the stream time advanced)
+  // to the callback that gets the first buffer read after the restart.
+  // Output lost is reported at once, as the next output plays after
+  // the gap.
+
+  AlsaHandle *apiInfo = (AlsaHandle *) stream_.apiHandle;
+  snd_pcm_t **handle = (snd_pcm_t **) apiInfo->handles;
+  snd_pcm_uframes_t lost[2] = { 0, 0 };
+  bool xrun = false;
+  for ( int i=0; i<2; i++ ) {
+    if ( handle[i] == 0 ) continue;
+    snd_pcm_state_t state = snd_pcm_state( handle[i] );
+    if ( state == SND_PCM_STATE_XRUN ) {
+      // Count the time since the device stopped.  A capture device
+      // stops with its buffer full, and that data is dropped as well.
+      snd_pcm_status_t *status;
+      snd_pcm_status_alloca( &status );
+      if ( snd_pcm_status( handle[i], status ) == 0 ) {
+        snd_htimestamp_t now, then;
+        snd_pcm_status_get_htstamp( status, &now );
+        snd_pcm_status_get_trigger_htstamp( status, &then );
+        double seconds = ( now.tv_sec - then.tv_sec ) + ( now.tv_nsec - then.tv_nsec ) * 1e-9;
+        if ( seconds > 0.0 ) lost[i] = (snd_pcm_uframes_t) ( seconds * stream_.sampleRate + 0.5 );
+      }
+      if ( i == 1 ) lost[i] += apiInfo->hwBufferFrames[1];
+      if ( i == 0 ) apiInfo->xrun[0] = true;
+      else apiInfo->inputOverflow = true;
+      xrun = true;
+    }
+    else if ( state == SND_PCM_STATE_RUNNING ) {
+      snd_pcm_sframes_t avail = snd_pcm_avail_update( handle[i] );
+      if ( avail > (snd_pcm_sframes_t) apiInfo->hwBufferFrames[i] ) {
+        if ( i == 0 ) apiInfo->xrun[0] = true;
+        else apiInfo->inputOverflow = true;
+        xrun = true;
+      }
+      // Output beyond the buffer was played as silence.  All captured
+      // input not read yet is lost by the restart.
+      if ( i == 0 && avail > (snd_pcm_sframes_t) apiInfo->hwBufferFrames[0] )
+        lost[0] = avail - apiInfo->hwBufferFrames[0];
+      else if ( i == 1 && avail > 0 )
+        lost[1] = avail;
+    }
+  }
+  if ( !xrun ) return;
+
+  // Drop and prepare the devices, link them again and restart them.
+  // The output is filled with silence as in startStream().
+  int result = 0;
+  int queued = 0;
+  apiInfo->roundTrip = 0;
+  for ( int i=0; i<2; i++ )
+    if ( handle[i] ) snd_pcm_drop( handle[i] );
+  if ( stream_.mode == DUPLEX ) snd_pcm_unlink( handle[1] );
+  for ( int i=0; i<2 && result >= 0; i++ )
+    if ( handle[i] ) result = snd_pcm_prepare( handle[i] );
+  if ( result >= 0 && stream_.mode == DUPLEX )
+    apiInfo->synchronized = ( snd_pcm_link( handle[0], handle[1] ) == 0 );
+  if ( result >= 0 && handle[0] )
+    result = queued = writeOutputSilence();
+  if ( result >= 0 && handle[1] && !( handle[0] && apiInfo->synchronized ) )
+    result = snd_pcm_start( handle[1] );
+  if ( result < 0 ) {
+    errorStream_ << "RtApiAlsa::callbackEvent: error restarting pcm devices after xrun, " << snd_strerror( result ) << ".";
+    errorText_ = errorStream_.str();
+    error( RtError::WARNING );
+  }
+
+  // The input defines the stream time.  An output-only stream also
+  // skips the silence just queued.  Input losses add up until the
+  // first buffer after them has been read.
+  if ( handle[1] ) {
+    apiInfo->droppedInput += lost[1];
+    apiInfo->inputDrop = 1;
+    return;
+  }
+  stream_.droppedFrames = lost[0] + ( queued > 0 ? queued : 0 );
+  stream_.streamTime += stream_.droppedFrames * 1.0 / stream_.sampleRate;
+}
+
+void RtApiAlsa :: readAggregateDevices()
+{
+  // Read whatever the additional input devices have captured since the
+  // last buffer, then deliver one buffer from each FIFO.
+  unsigned int bufferSize = stream_.bufferSize;
+  for ( unsigned int i=0; i<aggregate_[1].size(); i++ ) {
+    AggregateDevice *aggregate = aggregate_[1][i];
+    snd_pcm_sframes_t avail = 0;
+    for ( unsigned int n=0; n<aggregate->periods; n++ ) {
+      avail = snd_pcm_avail_update( aggregate->handle );
+      if ( avail < 0 ) {
+        restartAggregateDevice( aggregate, INPUT );
+        avail = 0;
+        break;
+      }
+      if ( avail < (snd_pcm_sframes_t) bufferSize ) break;
+      if ( snd_pcm_readi( aggregate->handle, aggregate->deviceBuffer, bufferSize ) < 0 ) {
+        restartAggregateDevice( aggregate, INPUT );
+        avail = 0;
+        break;
+      }
+      convertBuffer( (char *) &aggregate->block[0], aggregate->deviceBuffer, aggregate->deviceConvert );
+      aggregate->resampleToFifo( &aggregate->block[0], bufferSize );
+      avail -= bufferSize;
+    }
+
+    // An empty FIFO (the device stalled) delivers silence.
+    float *frame = &aggregate->block[0];
+    for ( unsigned int f=0; f<bufferSize; f++, frame += aggregate->channels ) {
+      if ( aggregate->popFrame( frame ) == false )
+        for ( unsigned int j=0; j<aggregate->channels; j++ ) frame[j] = 0.0f;
+    }
+    convertBuffer( stream_.userBuffer[1], (char *) &aggregate->block[0], aggregate->userConvert );
+    aggregate->updateRatio( bufferSize, avail );
+  }
+}
+
+void RtApiAlsa :: writeAggregateDevices()
+{
+  // Queue one buffer for each additional output device, then top up
+  // any device holding one buffer or less.  The devices run on their
+  // own clocks, so this may take zero, one or two transfers.  Keeping
+  // the device queue short leaves the slack in the FIFO, where the
+  // resampler can use it.
+  unsigned int bufferSize = stream_.bufferSize;
+  for ( unsigned int i=0; i<aggregate_[0].size(); i++ ) {
+    AggregateDevice *aggregate = aggregate_[0][i];
+    convertBuffer( (char *) &aggregate->block[0], stream_.userBuffer[0], aggregate->userConvert );
+    for ( unsigned int f=0; f<bufferSize; f++ )
+      aggregate->pushFrame( &aggregate->block[ f * aggregate->channels ] );
+
+    unsigned long queued = 0;
+    for ( unsigned int n=0; n<aggregate->periods; n++ ) {
+      snd_pcm_sframes_t avail = snd_pcm_avail_update( aggregate->handle );
+      if ( avail < 0 ) {
+        restartAggregateDevice( aggregate, OUTPUT );
+        queued = bufferSize;
+        break;
+      }
+      queued = 0;
+      if ( (unsigned long) avail < aggregate->hwBufferFrames )
+        queued = aggregate->hwBufferFrames - avail;
+      if ( queued > bufferSize ) break;
+      aggregate->resampleFromFifo( &aggregate->block[0], bufferSize );
+      convertBuffer( aggregate->deviceBuffer, (char *) &aggregate->block[0], aggregate->deviceConvert );
+      if ( snd_pcm_writei( aggregate->handle, aggregate->deviceBuffer, bufferSize ) < 0 ) {
+        restartAggregateDevice( aggregate, OUTPUT );
+        queued = bufferSize;
+        break;
+      }
+      queued += bufferSize;
+    }
+    aggregate->updateRatio( bufferSize, queued );
+  }
+}
+
+long RtApiAlsa :: framesUntilReady( bool *waiting )
 {
+  // Return the number of frames until every running pcm device can
+  // transfer a whole buffer.  Devices that are not running yet (or
+  // are in an error state) are treated as ready: the subsequent read
+  // or write starts them or reports the error.  If waiting is given,
+  // waiting[i] tells whether direction i is still short of a buffer.
+
   AlsaHandle *apiInfo = (AlsaHandle *) stream_.apiHandle;
+  snd_pcm_t **handle = (snd_pcm_t **) apiInfo->handles;
+  snd_pcm_uframes_t bufferSize = stream_.bufferSize;
+
+  bool notReady[2] = { false, false };
+  if ( waiting == 0 ) waiting = notReady;
+  waiting[0] = false;
+  waiting[1] = false;
+
+  snd_pcm_uframes_t waitFrames = 0;
+  for ( int i=0; i<2; i++ ) {
+    if ( handle[i] == 0 ) continue;
+    if ( snd_pcm_state( handle[i] ) != SND_PCM_STATE_RUNNING ) continue;
+    snd_pcm_sframes_t avail = snd_pcm_avail_update( handle[i] );
+    if ( avail < 0 ) return 0;
+
+    snd_pcm_uframes_t needed = 0;
+    if ( (snd_pcm_uframes_t) avail < bufferSize )
+      needed = bufferSize - avail;
+    if ( i == 0 && apiInfo->timerFd >= 0 ) {
+      // Timer scheduling only tops up the output once the queued
+      // amount drops to one buffer plus the wake-ahead margin.
+      snd_pcm_uframes_t queued = 0;
+      if ( (snd_pcm_uframes_t) avail < apiInfo->hwBufferFrames[0] )
+        queued = apiInfo->hwBufferFrames[0] - avail;
+      snd_pcm_uframes_t target = bufferSize + apiInfo->wakeAhead;
+      if ( queued > target && queued - target > needed )
+        needed = queued - target;
+    }
+    waiting[i] = ( needed > 0 );
+    if ( needed > waitFrames ) waitFrames = needed;
+  }
+
+  return (long) waitFrames;
+}
+
+bool RtApiAlsa :: waitForDevices()
+{
+  // Sleep while the stream is stopped, and then until the devices are
+  // ready (see framesUntilReady()) or until a control event (stop,
+  // abort or close) arrives.  Returns false if the callback should not
+  // be invoked.
+
+  AlsaHandle *apiInfo = (AlsaHandle *) stream_.apiHandle;
+  snd_pcm_t **handle = (snd_pcm_t **) apiInfo->handles;
   if ( stream_.state == STREAM_STOPPED ) {
     MUTEX_LOCK( &stream_.mutex );
     while ( !apiInfo->runnable )
@@ -6184,17 +7494,101 @@ void RtApiAlsa :: callbackEvent()
 
     if ( stream_.state != STREAM_RUNNING ) {
       MUTEX_UNLOCK( &stream_.mutex );
-      return;
+      return false;
     }
     MUTEX_UNLOCK( &stream_.mutex );
   }
 
+  while ( stream_.state == STREAM_RUNNING ) {
+
+    bool waiting[2];
+    long waitFrames = framesUntilReady( waiting );
+    if ( waitFrames == 0 ) return true;
+
+    if ( apiInfo->timerFd >= 0 ) {
+      struct itimerspec timeout;
+      long long nsec = (long long) waitFrames * 1000000000LL / stream_.sampleRate;
+      if ( nsec < 50000 ) nsec = 50000;
+      timeout.it_interval.tv_sec = 0;
+      timeout.it_interval.tv_nsec = 0;
+      timeout.it_value.tv_sec = nsec / 1000000000LL;
+      timeout.it_value.tv_nsec = nsec % 1000000000LL;
+      timerfd_settime( apiInfo->timerFd, 0, &timeout, NULL );
+    }
+
+    // Poll only the directions that are not ready yet.
+    std::vector<struct pollfd> &fds = apiInfo->waitFds;
+    unsigned int offset[2];
+    fds.assign( 1, apiInfo->pollFds[0] );
+    appendAlsaWaitDescriptors( apiInfo, waiting, fds, offset );
+
+    int result = poll( &fds[0], fds.size(), -1 );
+    if ( result < 0 ) {
+      if ( errno == EINTR ) continue;
+      errorStream_ << "RtApiAlsa::waitForDevices: poll error, " << strerror( errno ) << ".";
+      errorText_ = errorStream_.str();
+      error( RtError::WARNING );
+      return false;
+    }
+
+    uint64_t value;
+    if ( fds[0].revents ) {
+      if ( read( apiInfo->controlFd, &value, sizeof( value ) ) < 0 ) {}
+      return false;
+    }
+    if ( apiInfo->timerFd >= 0 ) {
+      if ( read( apiInfo->timerFd, &value, sizeof( value ) ) < 0 ) {}
+      continue;
+    }
+
+    for ( int i=0; i<2; i++ ) {
+      if ( !waiting[i] || apiInfo->pcmFdCount[i] == 0 ) continue;
+      unsigned short revents = 0;
+      snd_pcm_poll_descriptors_revents( handle[i], &fds[ offset[i] ], apiInfo->pcmFdCount[i], &revents );
+      if ( revents & ( POLLERR | POLLNVAL ) ) return true;
+    }
+  }
+
+  return false;
+}
+
+void RtApiAlsa :: callbackEvent()
+{
+  // Run the callback and transfer one buffer.  The caller makes sure
+  // the devices are ready (see waitForDevices()).
+
+  AlsaHandle *apiInfo = (AlsaHandle *) stream_.apiHandle;
   if ( stream_.state == STREAM_CLOSED ) {
     errorText_ = "RtApiAlsa::callbackEvent(): the stream is closed ... this shouldn't happen!";
     error( RtError::WARNING );
     return;
   }
 
+  if ( stream_.state != STREAM_RUNNING ) return;
+
+  if ( stream_.lockStackBytes && !stream_.stackLocked ) lockCallbackStack();
+
+  // The whole buffer is measured for SCHED_DEADLINE: recovery, the
+  // callback, the conversions and the transfers all use its runtime.
+  double bufferStart = 0.0;
+  if ( stream_.deadline ) bufferStart = threadCpuSeconds();
+
+  // Recover from xruns before the callback, so that it can be told how
+  // many frames were lost.
+  MUTEX_LOCK( &stream_.mutex );
+  stream_.droppedFrames = 0;
+  if ( apiInfo->inputDrop == 2 ) {
+    // The input of this callback is the first read after a recovery.
+    stream_.droppedFrames = apiInfo->droppedInput;
+    stream_.streamTime += apiInfo->droppedInput * 1.0 / stream_.sampleRate;
+    apiInfo->xrun[1] = apiInfo->inputOverflow;
+    apiInfo->inputOverflow = false;
+    apiInfo->droppedInput = 0;
+    apiInfo->inputDrop = 0;
+  }
+  if ( stream_.state == STREAM_RUNNING ) recoverXruns();
+  MUTEX_UNLOCK( &stream_.mutex );
+
   int doStopStream = 0;
   RtAudioCallback callback = (RtAudioCallback) stream_.callbackInfo.callback;
   double streamTime = getStreamTime();
@@ -6254,17 +7648,12 @@ void RtApiAlsa :: callbackEvent()
     }
 
     if ( result < (int) stream_.bufferSize ) {
-      // Either an error or overrun occured.
+      // Either an error or overrun occured.  An overrun is recovered
+      // before the next callback (see recoverXruns()).
       if ( result == -EPIPE ) {
         snd_pcm_state_t state = snd_pcm_state( handle[1] );
-        if ( state == SND_PCM_STATE_XRUN ) {
-          apiInfo->xrun[1] = true;
-          result = snd_pcm_prepare( handle[1] );
-          if ( result < 0 ) {
-            errorStream_ << "RtApiAlsa::callbackEvent: error preparing device after overrun, " << snd_strerror( result ) << ".";
-            errorText_ = errorStream_.str();
-          }
-        }
+        if ( state == SND_PCM_STATE_XRUN )
+          goto tryOutput;
         else {
           errorStream_ << "RtApiAlsa::callbackEvent: error, current state is " << snd_pcm_state_name( state ) << ", " << snd_strerror( result ) << ".";
           errorText_ = errorStream_.str();
@@ -6278,6 +7667,10 @@ void RtApiAlsa :: callbackEvent()
       goto tryOutput;
     }
 
+    // The next callback gets this buffer, so it reports a preceding
+    // recovery (see recoverXruns()).
+    if ( apiInfo->inputDrop == 1 ) apiInfo->inputDrop = 2;
+
     // Do byte swapping if necessary.
     if ( stream_.doByteSwap[1] )
       byteSwapBuffer( buffer, stream_.bufferSize * channels, format );
@@ -6293,8 +7686,17 @@ void RtApiAlsa :: callbackEvent()
 
  tryOutput:
 
+  // Fill in the channels of any additional input devices.
+  if ( aggregate_[1].size() ) readAggregateDevices();
+
+  // Line the input up with the output (RTAUDIO_ALIGN_DUPLEX).
+  if ( apiInfo->alignFrames ) alignInput();
+
   if ( stream_.mode == OUTPUT || stream_.mode == DUPLEX ) {
 
+    // Pass the channels of any additional output devices on to them.
+    if ( aggregate_[0].size() ) writeAggregateDevices();
+
     // Setup parameters and do buffer conversion if necessary.
     if ( stream_.doConvertBuffer[0] ) {
       buffer = stream_.deviceBuffer;
@@ -6324,17 +7726,12 @@ void RtApiAlsa :: callbackEvent()
     }
 
     if ( result < (int) stream_.bufferSize ) {
-      // Either an error or underrun occured.
+      // Either an error or underrun occured.  An underrun is recovered
+      // before the next callback (see recoverXruns()).
       if ( result == -EPIPE ) {
         snd_pcm_state_t state = snd_pcm_state( handle[0] );
-        if ( state == SND_PCM_STATE_XRUN ) {
-          apiInfo->xrun[0] = true;
-          result = snd_pcm_prepare( handle[0] );
-          if ( result < 0 ) {
-            errorStream_ << "RtApiAlsa::callbackEvent: error preparing device after underrun, " << snd_strerror( result ) << ".";
-            errorText_ = errorStream_.str();
-          }
-        }
+        if ( state == SND_PCM_STATE_XRUN )
+          goto unlock;
         else {
           errorStream_ << "RtApiAlsa::callbackEvent: error, current state is " << snd_pcm_state_name( state ) << ", " << snd_strerror( result ) << ".";
           errorText_ = errorStream_.str();
@@ -6349,15 +7746,25 @@ void RtApiAlsa :: callbackEvent()
     }
 
     // Check stream latency
-    result = snd_pcm_delay( handle[0], &frames );
-    if ( result == 0 && frames > 0 ) stream_.latency[0] = frames;
+    if ( stream_.mode == DUPLEX )
+      updateDuplexLatency();
+    else {
+      result = snd_pcm_delay( handle[0], &frames );
+      if ( result == 0 && frames > 0 ) stream_.latency[0] = frames;
+    }
   }
 
  unlock:
   MUTEX_UNLOCK( &stream_.mutex );
 
+  if ( stream_.deadline ) updateDeadlineScheduling( threadCpuSeconds() - bufferStart );
   RtApi::tickStreamTime();
-  if ( doStopStream == 1 ) this->stopStream();
+  if ( doStopStream == 1 ) {
+    // The shared thread runs callbacks with its mutex held; it stops
+    // the stream once the mutex is released.
+    if ( apiInfo->sharedThread ) apiInfo->stopRequested = true;
+    else this->stopStream();
+  }
 }
 
 extern "C" void *alsaCallbackHandler( void *ptr )
@@ -6366,14 +7773,78 @@ extern "C" void *alsaCallbackHandler( void *ptr )
   RtApiAlsa *object = (RtApiAlsa *) info->object;
   bool *isRunning = &info->isRunning;
 
+  // The thread is shut down by clearing isRunning and waking it
+  // through the control eventfd (see closeStream()).
   while ( *isRunning == true ) {
-    pthread_testcancel();
-    object->callbackEvent();
+    if ( object->waitForDevices() )
+      object->callbackEvent();
   }
 
   pthread_exit( NULL );
 }
 
+extern "C" void *alsaSharedCallbackHandler( void * )
+{
+  std::vector<struct pollfd> pollFds;
+  uint64_t value;
+  bool waiting[2];
+  unsigned int offset[2];
+
+  while ( true ) {
+    MUTEX_LOCK( &alsaSharedThread.mutex );
+    if ( alsaSharedThread.streams.empty() ) {
+      alsaSharedThread.running = false;
+      MUTEX_UNLOCK( &alsaSharedThread.mutex );
+      break;
+    }
+
+    // Service every running stream whose devices are ready and collect
+    // the descriptors the others are waiting on.  Stopped streams are
+    // skipped; starting one wakes us through the control eventfd.
+    bool serviced = false;
+    pollFds.resize( 1 );
+    pollFds[0].fd = alsaSharedThread.controlFd;
+    pollFds[0].events = POLLIN;
+    pollFds[0].revents = 0;
+    for ( unsigned int i=0; i<alsaSharedThread.streams.size(); i++ ) {
+      RtApiAlsa *object = alsaSharedThread.streams[i];
+      AlsaHandle *apiInfo = alsaSharedThread.handles[i];
+      if ( !object->isStreamRunning() ) continue;
+      if ( object->framesUntilReady( waiting ) == 0 ) {
+        object->callbackEvent();
+        serviced = true;
+        if ( apiInfo->stopRequested ) {
+          apiInfo->stopRequested = false;
+          alsaSharedThread.stopping.push_back( object );
+        }
+      }
+      else
+        appendAlsaWaitDescriptors( apiInfo, waiting, pollFds, offset );
+    }
+    MUTEX_UNLOCK( &alsaSharedThread.mutex );
+
+    // Stopping drains the output, so it is done without the mutex.
+    // Only this thread changes the stopping list.
+    if ( !alsaSharedThread.stopping.empty() ) {
+      for ( unsigned int i=0; i<alsaSharedThread.stopping.size(); i++ )
+        alsaSharedThread.stopping[i]->stopStream();
+      MUTEX_LOCK( &alsaSharedThread.mutex );
+      alsaSharedThread.stopping.clear();
+      pthread_cond_broadcast( &alsaSharedThread.stopped );
+      MUTEX_UNLOCK( &alsaSharedThread.mutex );
+    }
+    if ( serviced ) continue;
+
+    // An error on a pcm descriptor also ends the wait; the stream is
+    // then treated as ready and its next transfer recovers from it.
+    if ( poll( &pollFds[0], pollFds.size(), -1 ) < 0 ) continue;
+    if ( pollFds[0].revents )
+      if ( read( alsaSharedThread.controlFd, &value, sizeof( value ) ) < 0 ) {}
+  }
+
+  return NULL;
+}
+
 //******************** End of __LINUX_ALSA__ *********************//
 #endif
 
@@ -6869,7 +8340,7 @@ bool RtApiOss :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigned
   // Allocate necessary internal buffers.
   unsigned long bufferBytes;
   bufferBytes = stream_.nUserChannels[mode] * *bufferSize * formatBytes( stream_.userFormat );
-  stream_.userBuffer[mode] = (char *) calloc( bufferBytes, 1 );
+  stream_.userBuffer[mode] = allocateBuffer( bufferBytes );
   if ( stream_.userBuffer[mode] == NULL ) {
     errorText_ = "RtApiOss::probeDeviceOpen: error allocating user buffer memory.";
     goto error;
@@ -6888,8 +8359,8 @@ bool RtApiOss :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigned
 
     if ( makeBuffer ) {
       bufferBytes *= *bufferSize;
-      if ( stream_.deviceBuffer ) free( stream_.deviceBuffer );
-      stream_.deviceBuffer = (char *) calloc( bufferBytes, 1 );
+      if ( stream_.deviceBuffer ) freeBuffer( stream_.deviceBuffer );
+      stream_.deviceBuffer = allocateBuffer( bufferBytes );
       if ( stream_.deviceBuffer == NULL ) {
         errorText_ = "RtApiOss::probeDeviceOpen: error allocating device buffer memory.";
         goto error;
@@ -6915,29 +8386,10 @@ bool RtApiOss :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigned
     // Setup callback thread.
     stream_.callbackInfo.object = (void *) this;
 
-    // Set the thread attributes for joinable and realtime scheduling
-    // priority.  The higher priority will only take affect if the
-    // program is run as root or suid.
+    // Set the thread attributes for joinable.
     pthread_attr_t attr;
     pthread_attr_init( &attr );
     pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_JOINABLE );
-#ifdef SCHED_RR // Undefined with some OSes (eg: NetBSD 1.6.x with GNU Pthread)
-    if ( options && options->flags & RTAUDIO_SCHEDULE_REALTIME ) {
-      struct sched_param param;
-      int priority = options->priority;
-      int min = sched_get_priority_min( SCHED_RR );
-      int max = sched_get_priority_max( SCHED_RR );
-      if ( priority < min ) priority = min;
-      else if ( priority > max ) priority = max;
-      param.sched_priority = priority;
-      pthread_attr_setschedparam( &attr, &param );
-      pthread_attr_setschedpolicy( &attr, SCHED_RR );
-    }
-    else
-      pthread_attr_setschedpolicy( &attr, SCHED_OTHER );
-#else
-    pthread_attr_setschedpolicy( &attr, SCHED_OTHER );
-#endif
 
     stream_.callbackInfo.isRunning = true;
     result = pthread_create( &stream_.callbackInfo.thread, &attr, ossCallbackHandler, &stream_.callbackInfo );
@@ -6947,6 +8399,9 @@ bool RtApiOss :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigned
       errorText_ = "RtApiOss::error creating callback thread!";
       goto error;
     }
+
+    // Set the realtime scheduling priority and CPU affinity (optional).
+    setCallbackThreadAttributes( stream_.callbackInfo.thread, options );
   }
 
   return SUCCESS;
@@ -6962,13 +8417,13 @@ bool RtApiOss :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigned
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -7009,13 +8464,13 @@ void RtApiOss :: closeStream()
 
   for ( int i=0; i<2; i++ ) {
     if ( stream_.userBuffer[i] ) {
-      free( stream_.userBuffer[i] );
+      freeBuffer( stream_.userBuffer[i] );
       stream_.userBuffer[i] = 0;
     }
   }
 
   if ( stream_.deviceBuffer ) {
-    free( stream_.deviceBuffer );
+    freeBuffer( stream_.deviceBuffer );
     stream_.deviceBuffer = 0;
   }
 
@@ -7182,6 +8637,13 @@ void RtApiOss :: callbackEvent()
     return;
   }
 
+  if ( stream_.lockStackBytes && !stream_.stackLocked ) lockCallbackStack();
+
+  // The whole buffer is measured for SCHED_DEADLINE: the callback, the
+  // conversions and the transfers all use its runtime.
+  double bufferStart = 0.0;
+  if ( stream_.deadline ) bufferStart = threadCpuSeconds();
+
   // Invoke user callback to get fresh output data.
   int doStopStream = 0;
   RtAudioCallback callback = (RtAudioCallback) stream_.callbackInfo.callback;
@@ -7197,6 +8659,7 @@ void RtApiOss :: callbackEvent()
   }
   doStopStream = callback( stream_.userBuffer[0], stream_.userBuffer[1],
                            stream_.bufferSize, streamTime, status, stream_.callbackInfo.userData );
+
   if ( doStopStream == 2 ) {
     this->abortStream();
     return;
@@ -7291,6 +8754,7 @@ void RtApiOss :: callbackEvent()
  unlock:
   MUTEX_UNLOCK( &stream_.mutex );
 
+  if ( stream_.deadline ) updateDeadlineScheduling( threadCpuSeconds() - bufferStart );
   RtApi::tickStreamTime();
   if ( doStopStream == 1 ) this->stopStream();
 }
@@ -7348,6 +8812,17 @@ void RtApi :: clearStreamInfo()
   stream_.userFormat = 0;
   stream_.userInterleaved = true;
   stream_.streamTime = 0.0;
+  stream_.droppedFrames = 0;
+  stream_.duplexLatency = 0;
+  stream_.routing[0].clear();
+  stream_.routing[1].clear();
+  stream_.lockStackBytes = 0;
+  stream_.stackLocked = false;
+  stream_.threadInfo = RtAudio::ThreadInfo();
+  stream_.deadline = false;
+  stream_.deadlineBuffers = 0;
+  stream_.deadlineCost = 0.0;
+  stream_.deadlineRuntime = 0.0;
   stream_.apiHandle = 0;
   stream_.deviceBuffer = 0;
   stream_.callbackInfo.callback = 0;
@@ -7371,6 +8846,18 @@ void RtApi :: clearStreamInfo()
     stream_.convertInfo[i].outFormat = 0;
     stream_.convertInfo[i].inOffset.clear();
     stream_.convertInfo[i].outOffset.clear();
+    stream_.convertInfo[i].firstChannel = 0;
+    stream_.convertInfo[i].inChannels = 0;
+    stream_.convertInfo[i].outChannels = 0;
+    stream_.convertInfo[i].gains.clear();
+    stream_.convertInfo[i].mix.clear();
+    stream_.convertInfo[i].dither = false;
+    stream_.convertInfo[i].noiseShaping = false;
+    stream_.convertInfo[i].ditherCounter = 0;
+    stream_.convertInfo[i].ditherError.clear();
+    stream_.convertInfo[i].inSamples = 0;
+    stream_.convertInfo[i].outSamples = 0;
+    stream_.convertInfo[i].unpacked.clear();
   }
 }
 
@@ -7385,6 +8872,8 @@ unsigned int RtApi :: formatBytes( RtAudioFormat format )
     return 8;
   else if ( format == RTAUDIO_SINT8 )
     return 1;
+  else if ( format == RTAUDIO_SINT24_PACKED )
+    return 3;
 
   errorText_ = "RtApi::formatBytes: undefined format.";
   error( RtError::WARNING );
@@ -7392,6 +8881,341 @@ unsigned int RtApi :: formatBytes( RtAudioFormat format )
   return 0;
 }
 
+#if !defined(__WINDOWS_ASIO__) && !defined(__WINDOWS_DS__)
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <map>
+
+// Freed stream buffers up to this many bytes are kept for reuse.
+#define RTAUDIO_POOL_CACHE_BYTES ( 64 << 20 )
+// Buffers at least this large are aligned for transparent huge pages.
+#define RTAUDIO_HUGE_PAGE_BYTES ( 2 << 20 )
+
+// A process-wide pool of stream buffers.  Blocks are a power-of-two
+// number of pages, page aligned (huge page aligned when large enough),
+// and locked into memory when the RLIMIT_MEMLOCK limit allows it.  A
+// freed block is kept and handed to the next stream asking for the same
+// size class, so that reopening a stream does not fault in new pages.
+// The pool is only used from open and close, never from the callback.
+class RtBufferPool
+{
+ public:
+  RtBufferPool() : cachedBytes_( 0 ) { pthread_mutex_init( &mutex_, NULL ); }
+
+  void *allocate( size_t bytes ) {
+    size_t page = (size_t) sysconf( _SC_PAGESIZE );
+    size_t size = page;
+    while ( size < bytes ) size <<= 1;
+
+    void *buffer = 0;
+    pthread_mutex_lock( &mutex_ );
+    std::multimap<size_t, void *>::iterator it = cached_.find( size );
+    if ( it != cached_.end() ) {
+      buffer = it->second;
+      cached_.erase( it );
+      cachedBytes_ -= size;
+    }
+    pthread_mutex_unlock( &mutex_ );
+
+    if ( buffer == 0 ) {
+      size_t alignment = ( size >= RTAUDIO_HUGE_PAGE_BYTES ) ? RTAUDIO_HUGE_PAGE_BYTES : page;
+      if ( posix_memalign( &buffer, alignment, size ) ) return 0;
+#if defined(MADV_HUGEPAGE)
+      if ( size >= RTAUDIO_HUGE_PAGE_BYTES ) madvise( buffer, size, MADV_HUGEPAGE );
+#endif
+      mlock( buffer, size ); // best effort
+    }
+
+    // Zeroing also faults in any pages that are not locked.
+    memset( buffer, 0, size );
+
+    pthread_mutex_lock( &mutex_ );
+    used_[buffer] = size;
+    pthread_mutex_unlock( &mutex_ );
+    return buffer;
+  }
+
+  void release( void *buffer ) {
+    if ( buffer == 0 ) return;
+
+    size_t size = 0;
+    pthread_mutex_lock( &mutex_ );
+    std::map<void *, size_t>::iterator it = used_.find( buffer );
+    if ( it != used_.end() ) {
+      size = it->second;
+      used_.erase( it );
+      if ( cachedBytes_ + size <= RTAUDIO_POOL_CACHE_BYTES ) {
+        cached_.insert( std::make_pair( size, buffer ) );
+        cachedBytes_ += size;
+        buffer = 0;
+      }
+    }
+    pthread_mutex_unlock( &mutex_ );
+
+    if ( buffer && size ) {
+      munlock( buffer, size );
+      free( buffer );
+    }
+  }
+
+ private:
+  pthread_mutex_t mutex_;
+  std::map<void *, size_t> used_;
+  std::multimap<size_t, void *> cached_;
+  size_t cachedBytes_;
+};
+
+// The pool is never destroyed, so streams closed during static
+// destruction can still return their buffers.
+static RtBufferPool &bufferPool( void )
+{
+  static RtBufferPool *pool = new RtBufferPool;
+  return *pool;
+}
+
+#endif
+
+char *RtApi :: allocateBuffer( size_t bytes )
+{
+  // Pooled buffers are page aligned, so the channels of a
+  // non-interleaved buffer are 64-byte aligned whenever the size of one
+  // channel is a multiple of 64 bytes.
+#if defined(__WINDOWS_ASIO__) || defined(__WINDOWS_DS__)
+  void *buffer = _aligned_malloc( bytes, 64 );
+  if ( buffer == NULL ) return 0;
+  memset( buffer, 0, bytes );
+  return (char *) buffer;
+#else
+  return (char *) bufferPool().allocate( bytes );
+#endif
+}
+
+void RtApi :: freeBuffer( char *buffer )
+{
+#if defined(__WINDOWS_ASIO__) || defined(__WINDOWS_DS__)
+  _aligned_free( buffer );
+#else
+  bufferPool().release( buffer );
+#endif
+}
+
+bool RtApi :: lockMemoryRegion( void *address, unsigned long bytes )
+{
+  if ( address == 0 || bytes == 0 ) return true;
+
+#if defined(__WINDOWS_ASIO__) || defined(__WINDOWS_DS__)
+  bool locked = ( VirtualLock( address, bytes ) != 0 );
+  SYSTEM_INFO system;
+  GetSystemInfo( &system );
+  unsigned long page = system.dwPageSize;
+#else
+  bool locked = ( mlock( address, bytes ) == 0 );
+  unsigned long page = (unsigned long) sysconf( _SC_PAGESIZE );
+#endif
+
+  // Touch every page, so that it is mapped even if it could not be
+  // locked.  The values are written back unchanged.
+  volatile char *data = (volatile char *) address;
+  for ( unsigned long i=0; i<bytes; i+=page ) data[i] = data[i];
+  data[bytes-1] = data[bytes-1];
+
+  return locked;
+}
+
+void RtApi :: lockStreamMemory( RtAudio::StreamOptions *options )
+{
+  bool locked = true;
+  unsigned long deviceBytes = 0;
+  for ( int i=0; i<2; i++ ) {
+    if ( stream_.userBuffer[i] )
+      locked &= lockMemoryRegion( stream_.userBuffer[i], stream_.nUserChannels[i] * stream_.bufferSize * formatBytes( stream_.userFormat ) );
+    if ( stream_.doConvertBuffer[i] ) {
+      unsigned long bytes = stream_.nDeviceChannels[i] * stream_.bufferSize * formatBytes( stream_.deviceFormat[i] );
+      if ( bytes > deviceBytes ) deviceBytes = bytes;
+    }
+  }
+  if ( stream_.deviceBuffer )
+    locked &= lockMemoryRegion( stream_.deviceBuffer, deviceBytes );
+
+  for ( unsigned int i=0; i<options->lockRegions.size(); i++ )
+    locked &= lockMemoryRegion( options->lockRegions[i].address, options->lockRegions[i].bytes );
+
+  if ( !locked ) {
+    errorText_ = "RtApi::lockStreamMemory: some memory could not be locked (memory lock limit too low?), pages were only touched.";
+    error( RtError::WARNING );
+  }
+}
+
+void RtApi :: lockCallbackStack( void )
+{
+  // The callback runs in frames below this one, so lock the stack
+  // there.  Failures are ignored here, as no warning can be printed
+  // from the callback thread.  The block is fresh stack, so it is
+  // cleared first: that maps its pages with writes, and the reads of
+  // lockMemoryRegion() then see initialized memory.
+  stream_.stackLocked = true;
+  void *stack = alloca( stream_.lockStackBytes );
+  memset( stack, 0, stream_.lockStackBytes );
+  lockMemoryRegion( stack, stream_.lockStackBytes );
+}
+
+#if defined(__linux__) && ( defined(__LINUX_ALSA__) || defined(__LINUX_OSS__) )
+#include <sys/syscall.h>
+#include <stdint.h>
+
+#if defined(SYS_sched_setattr)
+#define RTAUDIO_HAVE_SCHED_DEADLINE
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+// Buffers measured before the SCHED_DEADLINE runtime is refined.
+#define RTAUDIO_DEADLINE_MEASURE_BUFFERS 64
+
+// The kernel's struct sched_attr, which older C libraries do not declare.
+struct RtSchedAttr {
+  uint32_t size;
+  uint32_t policy;
+  uint64_t flags;
+  int32_t nice;
+  uint32_t priority;
+  uint64_t runtime;
+  uint64_t deadline;
+  uint64_t period;
+};
+
+// Switch the calling thread to SCHED_DEADLINE.
+static bool setDeadlineScheduling( uint64_t runtime, uint64_t period )
+{
+  struct RtSchedAttr attr;
+  memset( &attr, 0, sizeof( attr ) );
+  attr.size = sizeof( attr );
+  attr.policy = SCHED_DEADLINE;
+  attr.runtime = runtime;
+  attr.deadline = period;
+  attr.period = period;
+  return syscall( SYS_sched_setattr, 0, &attr, 0 ) == 0;
+}
+#endif
+#endif
+
+// The scheduling is set on the running thread rather than through its
+// creation attributes, so that a refused realtime policy does not make
+// pthread_create() fail.  The higher priority will only take effect if
+// the program is run as root or suid.  Note, under Linux processes with
+// CAP_SYS_NICE privilege, a user can change scheduling policy and
+// priority (thus need not be root).  See POSIX "capabilities".
+void RtApi :: setCallbackThreadAttributes( ThreadHandle thread, RtAudio::StreamOptions *options )
+{
+  stream_.threadInfo = RtAudio::ThreadInfo();
+
+#if defined(__LINUX_ALSA__) || defined(__LINUX_OSS__)
+  bool granted = true;
+
+#ifdef SCHED_RR // Undefined with some OSes (eg: NetBSD 1.6.x with GNU Pthread)
+  if ( options && options->flags & RTAUDIO_SCHEDULE_REALTIME ) {
+    // SCHED_DEADLINE is entered by the callback thread itself once it
+    // has measured a callback (see updateDeadlineScheduling()), and
+    // SCHED_RR is used until then.
+#if defined(RTAUDIO_HAVE_SCHED_DEADLINE)
+    stream_.deadline = ( options->schedulingPolicy == RtAudio::SCHEDULE_DEADLINE );
+#endif
+    int policy = ( options->schedulingPolicy == RtAudio::SCHEDULE_FIFO ) ? SCHED_FIFO : SCHED_RR;
+    struct sched_param param;
+    int priority = options->priority;
+    int min = sched_get_priority_min( policy );
+    int max = sched_get_priority_max( policy );
+    if ( priority < min ) priority = min;
+    else if ( priority > max ) priority = max;
+    param.sched_priority = priority;
+    if ( pthread_setschedparam( thread, policy, &param ) ) granted = false;
+  }
+#endif
+
+#if defined(__linux__)
+  if ( options && options->cpus.size() ) {
+    cpu_set_t cpus;
+    CPU_ZERO( &cpus );
+    for ( unsigned int i=0; i<options->cpus.size(); i++ )
+      if ( options->cpus[i] < CPU_SETSIZE ) CPU_SET( options->cpus[i], &cpus );
+    if ( pthread_setaffinity_np( thread, sizeof( cpus ), &cpus ) ) granted = false;
+  }
+#endif
+
+  // Report what the thread actually got.
+  int policy;
+  struct sched_param param;
+  if ( pthread_getschedparam( thread, &policy, &param ) == 0 ) {
+    stream_.threadInfo.isValid = true;
+#ifdef SCHED_RR
+    if ( policy == SCHED_RR ) stream_.threadInfo.policy = RtAudio::SCHEDULE_RR;
+    else if ( policy == SCHED_FIFO ) stream_.threadInfo.policy = RtAudio::SCHEDULE_FIFO;
+#endif
+    if ( stream_.threadInfo.policy != RtAudio::SCHEDULE_OTHER )
+      stream_.threadInfo.priority = param.sched_priority;
+  }
+
+#if defined(__linux__)
+  cpu_set_t cpus;
+  if ( pthread_getaffinity_np( thread, sizeof( cpus ), &cpus ) == 0 ) {
+    for ( unsigned int i=0; i<CPU_SETSIZE; i++ )
+      if ( CPU_ISSET( i, &cpus ) ) stream_.threadInfo.cpus.push_back( i );
+  }
+#endif
+
+  if ( !granted ) {
+    errorText_ = "RtApi::setCallbackThreadAttributes: the requested scheduling policy, priority or CPU affinity could not be set (see RtAudio::getStreamThreadInfo()).";
+    error( RtError::WARNING );
+  }
+#endif
+}
+
+void RtApi :: updateDeadlineScheduling( double cost )
+{
+#if defined(RTAUDIO_HAVE_SCHED_DEADLINE)
+  double period = (double) stream_.bufferSize / stream_.sampleRate;
+  if ( cost > stream_.deadlineCost ) stream_.deadlineCost = cost;
+  // Only the first buffers are counted, so the count cannot wrap.
+  if ( stream_.deadlineBuffers <= RTAUDIO_DEADLINE_MEASURE_BUFFERS ) stream_.deadlineBuffers++;
+
+  // Enter SCHED_DEADLINE after the first buffer, refine the runtime
+  // once enough buffers have been measured, and raise it whenever a
+  // buffer comes close to using all of it.
+  double runtime;
+  if ( stream_.deadlineBuffers == 1 )
+    runtime = ( 2.0 * cost > 0.5 * period ) ? 2.0 * cost : 0.5 * period;
+  else if ( stream_.deadlineBuffers == RTAUDIO_DEADLINE_MEASURE_BUFFERS )
+    runtime = 2.0 * stream_.deadlineCost;
+  else if ( cost > 0.8 * stream_.deadlineRuntime )
+    runtime = 2.0 * cost;
+  else
+    return;
+
+  if ( runtime < 0.1 * period ) runtime = 0.1 * period;
+  if ( runtime > 0.9 * period ) runtime = 0.9 * period;
+  if ( runtime == stream_.deadlineRuntime ) return;
+
+  uint64_t runtimeNs = (uint64_t) ( runtime * 1e9 );
+  uint64_t periodNs = (uint64_t) ( period * 1e9 );
+  if ( !setDeadlineScheduling( runtimeNs, periodNs ) ) {
+    // Refused: keep the SCHED_RR set when the thread was created.
+    stream_.deadline = false;
+    return;
+  }
+
+  stream_.deadlineRuntime = runtime;
+  MUTEX_LOCK( &stream_.mutex );
+  stream_.threadInfo.policy = RtAudio::SCHEDULE_DEADLINE;
+  stream_.threadInfo.priority = 0;
+  stream_.threadInfo.runtime = runtimeNs;
+  stream_.threadInfo.period = periodNs;
+  MUTEX_UNLOCK( &stream_.mutex );
+#endif
+}
+
 void RtApi :: setConvertInfo( StreamMode mode, unsigned int firstChannel )
 {
   if ( mode == INPUT ) { // convert device to user buffer
@@ -7412,18 +9236,45 @@ void RtApi :: setConvertInfo( StreamMode mode, unsigned int firstChannel )
   else
     stream_.convertInfo[mode].channels = stream_.convertInfo[mode].outJump;
 
+  // Packed 24-bit samples are converted through a scratch buffer in
+  // the RTAUDIO_SINT24 layout, which holds every sample of the packed
+  // side(s).
+  stream_.convertInfo[mode].inSamples = stream_.convertInfo[mode].inJump * stream_.bufferSize;
+  stream_.convertInfo[mode].outSamples = stream_.convertInfo[mode].outJump * stream_.bufferSize;
+  unsigned int unpackedSamples = 0;
+  if ( stream_.convertInfo[mode].inFormat == RTAUDIO_SINT24_PACKED )
+    unpackedSamples += stream_.convertInfo[mode].inSamples;
+  if ( stream_.convertInfo[mode].outFormat == RTAUDIO_SINT24_PACKED )
+    unpackedSamples += stream_.convertInfo[mode].outSamples;
+  stream_.convertInfo[mode].unpacked.assign( unpackedSamples, 0 );
+
+  // A routing matrix involves every channel on both sides, so the
+  // offsets are set up for the larger side.
+  int offsets = stream_.convertInfo[mode].channels;
+  stream_.convertInfo[mode].firstChannel = firstChannel;
+  stream_.convertInfo[mode].gains = stream_.routing[mode];
+  if ( stream_.routing[mode].size() ) {
+    int userChannels = stream_.nUserChannels[mode];
+    int deviceChannels = stream_.routing[mode].size() / userChannels;
+    stream_.convertInfo[mode].inChannels = ( mode == INPUT ) ? deviceChannels : userChannels;
+    stream_.convertInfo[mode].outChannels = ( mode == INPUT ) ? userChannels : deviceChannels;
+    stream_.convertInfo[mode].mix.assign( stream_.bufferSize, 0.0 );
+    offsets = stream_.convertInfo[mode].inJump;
+    if ( stream_.convertInfo[mode].outJump > offsets ) offsets = stream_.convertInfo[mode].outJump;
+  }
+
   // Set up the interleave/deinterleave offsets.
   if ( stream_.deviceInterleaved[mode] != stream_.userInterleaved ) {
     if ( ( mode == OUTPUT && stream_.deviceInterleaved[mode] ) ||
          ( mode == INPUT && stream_.userInterleaved ) ) {
-      for ( int k=0; k<stream_.convertInfo[mode].channels; k++ ) {
+      for ( int k=0; k<offsets; k++ ) {
         stream_.convertInfo[mode].inOffset.push_back( k * stream_.bufferSize );
         stream_.convertInfo[mode].outOffset.push_back( k );
         stream_.convertInfo[mode].inJump = 1;
       }
     }
     else {
-      for ( int k=0; k<stream_.convertInfo[mode].channels; k++ ) {
+      for ( int k=0; k<offsets; k++ ) {
         stream_.convertInfo[mode].inOffset.push_back( k );
         stream_.convertInfo[mode].outOffset.push_back( k * stream_.bufferSize );
         stream_.convertInfo[mode].outJump = 1;
@@ -7432,13 +9283,13 @@ void RtApi :: setConvertInfo( StreamMode mode, unsigned int firstChannel )
   }
   else { // no (de)interleaving
     if ( stream_.userInterleaved ) {
-      for ( int k=0; k<stream_.convertInfo[mode].channels; k++ ) {
+      for ( int k=0; k<offsets; k++ ) {
         stream_.convertInfo[mode].inOffset.push_back( k );
         stream_.convertInfo[mode].outOffset.push_back( k );
       }
     }
     else {
-      for ( int k=0; k<stream_.convertInfo[mode].channels; k++ ) {
+      for ( int k=0; k<offsets; k++ ) {
         stream_.convertInfo[mode].inOffset.push_back( k * stream_.bufferSize );
         stream_.convertInfo[mode].outOffset.push_back( k * stream_.bufferSize );
         stream_.convertInfo[mode].inJump = 1;
@@ -7451,38 +9302,544 @@ void RtApi :: setConvertInfo( StreamMode mode, unsigned int firstChannel )
   if ( firstChannel > 0 ) {
     if ( stream_.deviceInterleaved[mode] ) {
       if ( mode == OUTPUT ) {
-        for ( int k=0; k<stream_.convertInfo[mode].channels; k++ )
+        for ( int k=0; k<offsets; k++ )
           stream_.convertInfo[mode].outOffset[k] += firstChannel;
       }
       else {
-        for ( int k=0; k<stream_.convertInfo[mode].channels; k++ )
+        for ( int k=0; k<offsets; k++ )
           stream_.convertInfo[mode].inOffset[k] += firstChannel;
       }
     }
     else {
       if ( mode == OUTPUT ) {
-        for ( int k=0; k<stream_.convertInfo[mode].channels; k++ )
+        for ( int k=0; k<offsets; k++ )
           stream_.convertInfo[mode].outOffset[k] += ( firstChannel * stream_.bufferSize );
       }
       else {
-        for ( int k=0; k<stream_.convertInfo[mode].channels; k++ )
+        for ( int k=0; k<offsets; k++ )
           stream_.convertInfo[mode].inOffset[k] += ( firstChannel  * stream_.bufferSize );
       }
     }
   }
 }
 
+bool RtApi :: setRouting( StreamMode mode, const std::vector<double> &gains )
+{
+  // The device was opened for the channels given in the stream
+  // parameters.  The user buffer carries the channels of the routing
+  // matrix instead, and the conversion always runs.  It keeps the
+  // channel offset used by the API, if any.
+  unsigned int firstChannel = 0;
+  if ( stream_.doConvertBuffer[mode] ) firstChannel = stream_.convertInfo[mode].firstChannel;
+  unsigned int userChannels = gains.size() / stream_.nUserChannels[mode];
+
+  stream_.nUserChannels[mode] = userChannels;
+  if ( stream_.userBuffer[mode] ) freeBuffer( stream_.userBuffer[mode] );
+  stream_.userBuffer[mode] = allocateBuffer( userChannels * stream_.bufferSize * formatBytes( stream_.userFormat ) );
+  if ( stream_.userBuffer[mode] == NULL ) {
+    errorText_ = "RtApi::openStream: error allocating user buffer memory.";
+    return FAILURE;
+  }
+
+  // The device buffer is shared by both directions of a duplex stream.
+  stream_.doConvertBuffer[mode] = true;
+  unsigned long bufferBytes = 0;
+  for ( int i=0; i<2; i++ ) {
+    if ( !stream_.doConvertBuffer[i] ) continue;
+    unsigned long bytes = stream_.nDeviceChannels[i] * stream_.bufferSize * formatBytes( stream_.deviceFormat[i] );
+    if ( bytes > bufferBytes ) bufferBytes = bytes;
+  }
+  if ( stream_.deviceBuffer ) freeBuffer( stream_.deviceBuffer );
+  stream_.deviceBuffer = allocateBuffer( bufferBytes );
+  if ( stream_.deviceBuffer == NULL ) {
+    errorText_ = "RtApi::openStream: error allocating device buffer memory.";
+    return FAILURE;
+  }
+
+  stream_.routing[mode] = gains;
+  stream_.convertInfo[mode].inOffset.clear();
+  stream_.convertInfo[mode].outOffset.clear();
+  setConvertInfo( mode, firstChannel );
+  return SUCCESS;
+}
+
+void RtApi :: setDither( bool noiseShaping )
+{
+  // Only float to integer conversions of the output are dithered.
+  // 32-bit integers hold more than the precision of a float.
+  ConvertInfo &info = stream_.convertInfo[0];
+  if ( !stream_.doConvertBuffer[0] ) return;
+  if ( info.inFormat != RTAUDIO_FLOAT32 && info.inFormat != RTAUDIO_FLOAT64 ) return;
+  if ( info.outFormat != RTAUDIO_SINT8 && info.outFormat != RTAUDIO_SINT16 &&
+       info.outFormat != RTAUDIO_SINT24 && info.outFormat != RTAUDIO_SINT24_PACKED ) return;
+
+  info.dither = true;
+  info.noiseShaping = noiseShaping;
+  info.ditherCounter = 0;
+  info.ditherError.assign( info.gains.size() ? info.outChannels : info.channels, 0.0 );
+}
+
+// The dither noise is TPDF, the difference of two uniform values,
+// with a peak of one LSB.  Both values are taken from a hash of a
+// sample counter, so the noise of a channel has no serial dependency
+// and the plain dither loop vectorizes.  Noise shaping subtracts the
+// error of each sample from the next one (first order, highpass), so
+// that loop runs serially over the frames of a channel.
+static inline double ditherNoise( unsigned int n )
+{
+  n *= 0x9e3779b1U;
+  n ^= n >> 15;
+  n *= 0x85ebca77U;
+  n ^= n >> 13;
+  return ( (double) ( n & 0xffff ) - (double) ( n >> 16 ) ) * ( 1.0 / 65536.0 );
+}
+
+// Samples are scaled as in convertBuffer(), x * scale - 0.5, and
+// rounded to the nearest integer in [low, high].  Adding 0.5 for the
+// rounding cancels the offset, and floor() is a truncation after
+// moving the range above zero.
+struct DitherArgs {
+  double scale;
+  double low, high;
+  bool shape;
+};
+
+static DitherArgs ditherArgs( RtAudioFormat format, bool shape )
+{
+  DitherArgs args;
+  int bits = ( format == RTAUDIO_SINT8 ) ? 8 : ( ( format == RTAUDIO_SINT16 ) ? 16 : 24 );
+  args.high = (double) ( ( 1 << ( bits - 1 ) ) - 1 );
+  args.low = -args.high - 1.0;
+  args.scale = args.high + 0.5;
+  args.shape = shape;
+  return args;
+}
+
+template <class OutType, class InType>
+static void ditherChannel( OutType *out, int outJump, const InType *in, int inJump,
+                           unsigned int nFrames, const DitherArgs &args,
+                           unsigned int seed, double &error )
+{
+  int low = (int) args.low;
+  if ( !args.shape ) {
+    for ( unsigned int i=0; i<nFrames; i++ ) {
+      double y = in[i*inJump] * args.scale + ditherNoise( seed + i );
+      y = ( y < args.low ) ? args.low : ( ( y > args.high ) ? args.high : y );
+      out[i*outJump] = (OutType) ( (int) ( y - args.low ) + low );
+    }
+    return;
+  }
+
+  // The error is bounded so that clipping cannot make the loop unstable.
+  double e = error;
+  for ( unsigned int i=0; i<nFrames; i++ ) {
+    double t = in[i*inJump] * args.scale - e;
+    double y = t + ditherNoise( seed + i );
+    y = ( y < args.low ) ? args.low : ( ( y > args.high ) ? args.high : y );
+    int q = (int) ( y - args.low ) + low;
+    out[i*outJump] = (OutType) q;
+    e = q - t + 0.5;
+    e = ( e < -1.5 ) ? -1.5 : ( ( e > 1.5 ) ? 1.5 : e );
+  }
+  error = e;
+}
+
+template <class OutType, class InType>
+static void ditherChannels( OutType *out, InType *in, const int *outOffset, const int *inOffset,
+                            int channels, int outJump, int inJump, unsigned int nFrames,
+                            const DitherArgs &args, unsigned int seed, double *error )
+{
+  for ( int j=0; j<channels; j++ )
+    ditherChannel( out + outOffset[j], outJump, in + inOffset[j], inJump, nFrames,
+                   args, seed + j * nFrames, error[j] );
+}
+
+// Copies or converts one channel at a time.  When a side is
+// non-interleaved, the inner loop runs over contiguous samples and can
+// be vectorized by the compiler.
+template <class OutType, class InType>
+static void convertChannels( OutType *out, InType *in, const int *outOffset, const int *inOffset,
+                             int channels, int outJump, int inJump, unsigned int nFrames )
+{
+  for ( int j=0; j<channels; j++ ) {
+    OutType *o = out + outOffset[j];
+    InType *p = in + inOffset[j];
+    if ( outJump == 1 && inJump == 1 ) {
+      for ( unsigned int i=0; i<nFrames; i++ )
+        o[i] = (OutType) p[i];
+    }
+    else {
+      for ( unsigned int i=0; i<nFrames; i++ )
+        o[i*outJump] = (OutType) p[i*inJump];
+    }
+  }
+}
+
+template <class InType>
+static void ditherTo( char *outBuffer, RtAudioFormat outFormat, InType *in, const int *outOffset,
+                      const int *inOffset, int channels, int outJump, int inJump, unsigned int nFrames,
+                      const DitherArgs &args, unsigned int seed, double *error )
+{
+  if ( outFormat == RTAUDIO_SINT8 )
+    ditherChannels( (signed char *) outBuffer, in, outOffset, inOffset, channels, outJump, inJump,
+                    nFrames, args, seed, error );
+  else if ( outFormat == RTAUDIO_SINT16 )
+    ditherChannels( (signed short *) outBuffer, in, outOffset, inOffset, channels, outJump, inJump,
+                    nFrames, args, seed, error );
+  else
+    ditherChannels( (signed int *) outBuffer, in, outOffset, inOffset, channels, outJump, inJump,
+                    nFrames, args, seed, error );
+}
+
+bool RtApi :: convertBufferFast( char *outBuffer, char *inBuffer, ConvertInfo &info )
+{
+  unsigned int nFrames = stream_.bufferSize;
+  const int *outOffset = &info.outOffset[0];
+  const int *inOffset = &info.inOffset[0];
+
+  if ( info.inFormat == info.outFormat ) {
+    unsigned int bytes = formatBytes( info.inFormat );
+
+    // Identical layouts without gaps are copied in one go.
+    bool contiguous = ( info.inJump == info.outJump && info.inOffset == info.outOffset );
+    for ( int j=0; contiguous && j<info.channels; j++ ) {
+      if ( info.inJump == 1 ) contiguous = ( inOffset[j] == j * (int) nFrames );
+      else contiguous = ( info.inJump == info.channels && inOffset[j] == j );
+    }
+    if ( contiguous ) {
+      memcpy( outBuffer, inBuffer, info.channels * nFrames * bytes );
+      return true;
+    }
+
+    // Non-interleaved channels are copied one channel at a time.
+    if ( info.inJump == 1 && info.outJump == 1 ) {
+      for ( int j=0; j<info.channels; j++ )
+        memcpy( outBuffer + outOffset[j] * bytes, inBuffer + inOffset[j] * bytes, nFrames * bytes );
+      return true;
+    }
+
+    if ( bytes == 1 )
+      convertChannels( (signed char *) outBuffer, (signed char *) inBuffer, outOffset, inOffset,
+                       info.channels, info.outJump, info.inJump, nFrames );
+    else if ( bytes == 2 )
+      convertChannels( (Int16 *) outBuffer, (Int16 *) inBuffer, outOffset, inOffset,
+                       info.channels, info.outJump, info.inJump, nFrames );
+    else if ( bytes == 4 )
+      convertChannels( (Int32 *) outBuffer, (Int32 *) inBuffer, outOffset, inOffset,
+                       info.channels, info.outJump, info.inJump, nFrames );
+    else if ( bytes == 8 )
+      convertChannels( (Float64 *) outBuffer, (Float64 *) inBuffer, outOffset, inOffset,
+                       info.channels, info.outJump, info.inJump, nFrames );
+    else
+      return false;
+    return true;
+  }
+
+  if ( info.dither ) {
+    DitherArgs args = ditherArgs( info.outFormat, info.noiseShaping );
+    unsigned int seed = info.ditherCounter;
+    info.ditherCounter += info.channels * nFrames;
+    if ( info.inFormat == RTAUDIO_FLOAT32 )
+      ditherTo( outBuffer, info.outFormat, (Float32 *) inBuffer, outOffset, inOffset, info.channels,
+                info.outJump, info.inJump, nFrames, args, seed, &info.ditherError[0] );
+    else
+      ditherTo( outBuffer, info.outFormat, (Float64 *) inBuffer, outOffset, inOffset, info.channels,
+                info.outJump, info.inJump, nFrames, args, seed, &info.ditherError[0] );
+    return true;
+  }
+
+  if ( info.outFormat == RTAUDIO_FLOAT64 && info.inFormat == RTAUDIO_FLOAT32 ) {
+    convertChannels( (Float64 *) outBuffer, (Float32 *) inBuffer, outOffset, inOffset,
+                     info.channels, info.outJump, info.inJump, nFrames );
+    return true;
+  }
+
+  if ( info.outFormat == RTAUDIO_FLOAT32 && info.inFormat == RTAUDIO_FLOAT64 ) {
+    convertChannels( (Float32 *) outBuffer, (Float64 *) inBuffer, outOffset, inOffset,
+                     info.channels, info.outJump, info.inJump, nFrames );
+    return true;
+  }
+
+  return false;
+}
+
+// Arguments of the routing pass.  Integer samples are scaled as in
+// convertBuffer(): x reads as ( x + 0.5 ) / scale, and y is written as
+// y * scale - 0.5.  A scale of zero marks a floating-point format.
+struct RouteArgs {
+  const int *outOffset, *inOffset;
+  int outChannels, inChannels;
+  int outJump, inJump;
+  const double *gains;
+  double *mix;
+  unsigned int nFrames;
+  double inScale, outScale;
+  bool in24;
+  const DitherArgs *dither;  // NULL unless the output is dithered
+  unsigned int ditherSeed;
+  double *ditherError;
+};
+
+static double routeScale( RtAudioFormat format )
+{
+  if ( format == RTAUDIO_SINT8 ) return 127.5;
+  if ( format == RTAUDIO_SINT16 ) return 32767.5;
+  if ( format == RTAUDIO_SINT24 ) return 8388607.5;
+  if ( format == RTAUDIO_SINT32 ) return 2147483647.5;
+  return 0.0;
+}
+
+// 24-bit samples occupy the lower three bytes and are sign extended.
+template <class InType>
+static inline double routeLoad( InType x, bool ) { return (double) x; }
+
+static inline double routeLoad( signed int x, bool in24 )
+{
+  if ( in24 ) return (double) ( (signed int) ( (unsigned int) x << 8 ) >> 8 );
+  return (double) x;
+}
+
+template <class OutType>
+static inline OutType routeStore( double y, double scale )
+{
+  if ( scale == 0.0 ) return (OutType) y;
+  if ( y > 1.0 ) y = 1.0;
+  else if ( y < -1.0 ) y = -1.0;
+  return (OutType) ( y * scale - 0.5 );
+}
+
+// Computes each output channel as the weighted sum of the input
+// channels with a non-zero gain.  A channel fed by a single input (a
+// channel map or fan-out) is converted straight into the output, so it
+// costs the same as a plain conversion.  A mix is summed in a scratch
+// channel first.  The inner loops run over frames and vectorize when
+// both sides are non-interleaved.
+template <class OutType, class InType>
+static void routeChannels( OutType *out, InType *in, const RouteArgs &args )
+{
+  double inBias = ( args.inScale > 0.0 ) ? 0.5 : 0.0;
+  double inGain = ( args.inScale > 0.0 ) ? 1.0 / args.inScale : 1.0;
+  int outJump = args.outJump, inJump = args.inJump;
+
+  for ( int j=0; j<args.outChannels; j++ ) {
+    OutType *o = out + args.outOffset[j];
+    const double *row = args.gains + j * args.inChannels;
+    int terms = 0, source = 0;
+    for ( int k=0; k<args.inChannels; k++ ) {
+      if ( row[k] != 0.0 ) {
+        terms++;
+        source = k;
+      }
+    }
+
+    if ( terms == 0 ) {
+      for ( unsigned int i=0; i<args.nFrames; i++ )
+        o[i*outJump] = 0;
+      continue;
+    }
+
+    if ( terms == 1 && !args.dither ) {
+      InType *p = in + args.inOffset[source];
+      double g = row[source] * inGain;
+      for ( unsigned int i=0; i<args.nFrames; i++ )
+        o[i*outJump] = routeStore<OutType>( ( routeLoad( p[i*inJump], args.in24 ) + inBias ) * g, args.outScale );
+      continue;
+    }
+
+    double *m = args.mix;
+    bool first = true;
+    for ( int k=0; k<args.inChannels; k++ ) {
+      if ( row[k] == 0.0 ) continue;
+      InType *p = in + args.inOffset[k];
+      double g = row[k] * inGain;
+      if ( first ) {
+        for ( unsigned int i=0; i<args.nFrames; i++ )
+          m[i] = ( routeLoad( p[i*inJump], args.in24 ) + inBias ) * g;
+        first = false;
+      }
+      else {
+        for ( unsigned int i=0; i<args.nFrames; i++ )
+          m[i] += ( routeLoad( p[i*inJump], args.in24 ) + inBias ) * g;
+      }
+    }
+    if ( args.dither )
+      ditherChannel( o, outJump, m, 1, args.nFrames, *args.dither,
+                     args.ditherSeed + j * args.nFrames, args.ditherError[j] );
+    else {
+      for ( unsigned int i=0; i<args.nFrames; i++ )
+        o[i*outJump] = routeStore<OutType>( m[i], args.outScale );
+    }
+  }
+}
+
+template <class InType>
+static void routeFrom( char *outBuffer, RtAudioFormat outFormat, InType *in, const RouteArgs &args )
+{
+  if ( outFormat == RTAUDIO_SINT8 )
+    routeChannels( (signed char *) outBuffer, in, args );
+  else if ( outFormat == RTAUDIO_SINT16 )
+    routeChannels( (signed short *) outBuffer, in, args );
+  else if ( outFormat == RTAUDIO_SINT24 || outFormat == RTAUDIO_SINT32 )
+    routeChannels( (signed int *) outBuffer, in, args );
+  else if ( outFormat == RTAUDIO_FLOAT32 )
+    routeChannels( (float *) outBuffer, in, args );
+  else if ( outFormat == RTAUDIO_FLOAT64 )
+    routeChannels( (double *) outBuffer, in, args );
+}
+
+void RtApi :: routeBuffer( char *outBuffer, char *inBuffer, ConvertInfo &info )
+{
+  RouteArgs args;
+  args.outOffset = &info.outOffset[0];
+  args.inOffset = &info.inOffset[0];
+  args.outChannels = info.outChannels;
+  args.inChannels = info.inChannels;
+  args.outJump = info.outJump;
+  args.inJump = info.inJump;
+  args.gains = &info.gains[0];
+  args.mix = &info.mix[0];
+  args.nFrames = stream_.bufferSize;
+  args.inScale = routeScale( info.inFormat );
+  args.outScale = routeScale( info.outFormat );
+  args.in24 = ( info.inFormat == RTAUDIO_SINT24 );
+  DitherArgs dither;
+  args.dither = NULL;
+  if ( info.dither ) {
+    dither = ditherArgs( info.outFormat, info.noiseShaping );
+    args.dither = &dither;
+    args.ditherSeed = info.ditherCounter;
+    args.ditherError = &info.ditherError[0];
+    info.ditherCounter += info.outChannels * stream_.bufferSize;
+  }
+
+  if ( info.inFormat == RTAUDIO_SINT8 )
+    routeFrom( outBuffer, info.outFormat, (signed char *) inBuffer, args );
+  else if ( info.inFormat == RTAUDIO_SINT16 )
+    routeFrom( outBuffer, info.outFormat, (Int16 *) inBuffer, args );
+  else if ( info.inFormat == RTAUDIO_SINT24 || info.inFormat == RTAUDIO_SINT32 )
+    routeFrom( outBuffer, info.outFormat, (Int32 *) inBuffer, args );
+  else if ( info.inFormat == RTAUDIO_FLOAT32 )
+    routeFrom( outBuffer, info.outFormat, (Float32 *) inBuffer, args );
+  else if ( info.inFormat == RTAUDIO_FLOAT64 )
+    routeFrom( outBuffer, info.outFormat, (Float64 *) inBuffer, args );
+}
+
+static bool hostIsBigEndian( void )
+{
+  unsigned short value = 1;
+  return *( (unsigned char *) &value ) == 0;
+}
+
+// Packed 24-bit samples are in host byte order, like the other
+// formats.  On little-endian hosts, four samples are moved as three
+// 32-bit words with shifts and masks instead of twelve single bytes.
+// The remaining samples, and all samples on big-endian hosts, are
+// moved byte by byte.
+static void unpack24( signed int *out, const unsigned char *in, unsigned int samples )
+{
+  unsigned int i = 0;
+  if ( hostIsBigEndian() ) {
+    for ( ; i<samples; i++ )
+      out[i] = (signed int) ( (unsigned int) in[3*i] << 24 | (unsigned int) in[3*i+1] << 16 |
+                              (unsigned int) in[3*i+2] << 8 ) >> 8;
+    return;
+  }
+
+  for ( ; i+4<=samples; i+=4 ) {
+    unsigned int w[3];
+    memcpy( w, in + 3*i, 12 );
+    out[i] = (signed int) ( w[0] << 8 ) >> 8;
+    out[i+1] = (signed int) ( ( w[0] >> 16 ) | ( w[1] << 16 ) ) >> 8;
+    out[i+2] = (signed int) ( ( w[1] >> 8 ) | ( w[2] << 24 ) ) >> 8;
+    out[i+3] = (signed int) w[2] >> 8;
+  }
+  for ( ; i<samples; i++ )
+    out[i] = (signed int) ( (unsigned int) in[3*i+2] << 24 | (unsigned int) in[3*i+1] << 16 |
+                            (unsigned int) in[3*i] << 8 ) >> 8;
+}
+
+static void pack24( unsigned char *out, const signed int *in, unsigned int samples )
+{
+  unsigned int i = 0;
+  if ( hostIsBigEndian() ) {
+    for ( ; i<samples; i++ ) {
+      out[3*i] = (unsigned char) ( in[i] >> 16 );
+      out[3*i+1] = (unsigned char) ( in[i] >> 8 );
+      out[3*i+2] = (unsigned char) in[i];
+    }
+    return;
+  }
+
+  for ( ; i+4<=samples; i+=4 ) {
+    unsigned int s0 = in[i], s1 = in[i+1], s2 = in[i+2], s3 = in[i+3];
+    unsigned int w[3];
+    w[0] = ( s0 & 0x00ffffff ) | ( s1 << 24 );
+    w[1] = ( ( s1 >> 8 ) & 0x0000ffff ) | ( s2 << 16 );
+    w[2] = ( ( s2 >> 16 ) & 0x000000ff ) | ( s3 << 8 );
+    memcpy( out + 3*i, w, 12 );
+  }
+  for ( ; i<samples; i++ ) {
+    out[3*i] = (unsigned char) in[i];
+    out[3*i+1] = (unsigned char) ( in[i] >> 8 );
+    out[3*i+2] = (unsigned char) ( in[i] >> 16 );
+  }
+}
+
+void RtApi :: convertPacked( char *outBuffer, char *inBuffer, ConvertInfo &info )
+{
+  // The packed side is unpacked into, or packed from, info.unpacked,
+  // and the conversion itself (including routing and dither) runs on
+  // the RTAUDIO_SINT24 layout.  Channels the conversion does not write
+  // stay zero in the scratch buffer.
+  RtAudioFormat inFormat = info.inFormat, outFormat = info.outFormat;
+  signed int *scratch = &info.unpacked[0];
+  char *in = inBuffer, *out = outBuffer;
+
+  if ( inFormat == RTAUDIO_SINT24_PACKED ) {
+    unpack24( scratch, (unsigned char *) inBuffer, info.inSamples );
+    in = (char *) scratch;
+    scratch += info.inSamples;
+    info.inFormat = RTAUDIO_SINT24;
+  }
+  if ( outFormat == RTAUDIO_SINT24_PACKED ) {
+    out = (char *) scratch;
+    info.outFormat = RTAUDIO_SINT24;
+  }
+
+  convertBuffer( out, in, info );
+  info.inFormat = inFormat;
+  info.outFormat = outFormat;
+
+  if ( outFormat == RTAUDIO_SINT24_PACKED )
+    pack24( (unsigned char *) outBuffer, scratch, info.outSamples );
+}
+
 void RtApi :: convertBuffer( char *outBuffer, char *inBuffer, ConvertInfo &info )
 {
   // This function does format conversion, input/output channel compensation, and
   // data interleaving/deinterleaving.  24-bit integers are assumed to occupy
-  // the lower three bytes of a 32-bit integer.
+  // the lower three bytes of a 32-bit integer; the upper byte is ignored
+  // and bit 23 is the sign.
 
   // Clear our device buffer when in/out duplex device channels are different
   if ( outBuffer == stream_.deviceBuffer && stream_.mode == DUPLEX &&
        ( stream_.nDeviceChannels[0] < stream_.nDeviceChannels[1] ) )
     memset( outBuffer, 0, stream_.bufferSize * info.outJump * formatBytes( info.outFormat ) );
 
+  if ( info.inFormat == RTAUDIO_SINT24_PACKED || info.outFormat == RTAUDIO_SINT24_PACKED ) {
+    convertPacked( outBuffer, inBuffer, info );
+    return;
+  }
+
+  // Routing matrices have their own pass (see setRouting()).
+  if ( info.gains.size() ) {
+    routeBuffer( outBuffer, inBuffer, info );
+    return;
+  }
+
+  // Copies and float conversions have a channel-at-a-time fast path.
+  if ( info.channels > 0 && convertBufferFast( outBuffer, inBuffer, info ) ) return;
+
   int j;
   if (info.outFormat == RTAUDIO_FLOAT64) {
     Float64 scale;
@@ -7519,7 +9876,7 @@ void RtApi :: convertBuffer( char *outBuffer, char *inBuffer, ConvertInfo &info
       scale = 1.0 / 8388607.5;
       for (unsigned int i=0; i<stream_.bufferSize; i++) {
         for (j=0; j<info.channels; j++) {
-          out[info.outOffset[j]] = (Float64) (in[info.inOffset[j]] & 0x00ffffff);
+          out[info.outOffset[j]] = (Float64) ( (Int32) ( (unsigned int) in[info.inOffset[j]] << 8 ) >> 8 );
           out[info.outOffset[j]] += 0.5;
           out[info.outOffset[j]] *= scale;
         }
@@ -7597,7 +9954,7 @@ void RtApi :: convertBuffer( char *outBuffer, char *inBuffer, ConvertInfo &info
       scale = (Float32) ( 1.0 / 8388607.5 );
       for (unsigned int i=0; i<stream_.bufferSize; i++) {
         for (j=0; j<info.channels; j++) {
-          out[info.outOffset[j]] = (Float32) (in[info.inOffset[j]] & 0x00ffffff);
+          out[info.outOffset[j]] = (Float32) ( (Int32) ( (unsigned int) in[info.inOffset[j]] << 8 ) >> 8 );
           out[info.outOffset[j]] += 0.5;
           out[info.outOffset[j]] *= scale;
         }
@@ -7926,6 +10283,17 @@ void RtApi :: byteSwapBuffer( char *buffer, unsigned int samples, RtAudioFormat
       ptr += 2;
     }
   }
+  else if ( format == RTAUDIO_SINT24_PACKED ) {
+    for ( unsigned int i=0; i<samples; i++ ) {
+      // Swap 1st and 3rd bytes.
+      val = *(ptr);
+      *(ptr) = *(ptr+2);
+      *(ptr+2) = val;
+
+      // Increment 3 bytes.
+      ptr += 3;
+    }
+  }
   else if ( format == RTAUDIO_SINT24 ||
             format == RTAUDIO_SINT32 ||
             format == RTAUDIO_FLOAT32 ) {
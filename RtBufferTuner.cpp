@@ -0,0 +1,305 @@
+/************************************************************************/
+/*! \class RtBufferTuner
+    \brief Adaptive buffer size tuning for RtAudio streams.
+
+    See RtBufferTuner.h for an overview.
+*/
+/************************************************************************/
+
+#include "RtBufferTuner.h"
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+
+// Buffer size requested for the first step; the API rounds it up to
+// the smallest size the device supports.
+const unsigned int RTBUFFERTUNER_MIN_FRAMES = 16;
+
+// Interval between two checks of the statistics.
+const unsigned int RTBUFFERTUNER_INTERVAL_MICROSECONDS = 250000;
+
+// Checks ignored after the stream is (re)started, while it settles.
+const int RTBUFFERTUNER_SETTLE_CHECKS = 2;
+
+// Callback load above which the latency is raised.
+const double RTBUFFERTUNER_GROW_LOAD = 0.8;
+
+// Callback load below which the latency may be lowered.
+const double RTBUFFERTUNER_SHRINK_LOAD = 0.4;
+
+// Time without xruns before the latency is lowered.
+const double RTBUFFERTUNER_STABLE_SECONDS = 10.0;
+
+// Initial and longest hold-off of a step which failed.
+const double RTBUFFERTUNER_HOLD_SECONDS = 10.0;
+const double RTBUFFERTUNER_MAX_HOLD_SECONDS = 600.0;
+
+// Bounds the number of steps, so that frame counts cannot overflow.
+const unsigned int RTBUFFERTUNER_MAX_STEPS = 24;
+
+static double monotonicSeconds( void )
+{
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+RtBufferTuner :: RtBufferTuner( RtAudio &audio )
+  : audio_( audio ), hasOutput_( false ), hasInput_( false ), format_( 0 ), sampleRate_( 0 ),
+    callback_( 0 ), userData_( 0 ), variableBuffers_( false ), baseFrames_( 0 ), step_( 0 ),
+    maxStep_( 0 ), streamTimeOffset_( 0.0 ), open_( false ), stop_( false ), bufferFrames_( 0 ),
+    numberOfBuffers_( 0 ), retunes_( 0 ), load_( 0.0 ), xruns_( 0 ), frames_( 0 ),
+    busyNanoseconds_( 0 )
+{
+  pthread_mutex_init( &mutex_, NULL );
+}
+
+RtBufferTuner :: ~RtBufferTuner( void )
+{
+  closeStream();
+  pthread_mutex_destroy( &mutex_ );
+}
+
+void RtBufferTuner :: openStream( RtAudio::StreamParameters *outputParameters,
+                                  RtAudio::StreamParameters *inputParameters,
+                                  RtAudioFormat format, unsigned int sampleRate,
+                                  RtAudioCallback callback, void *userData,
+                                  RtAudio::StreamOptions *options,
+                                  unsigned int maxLatencyFrames )
+{
+  if ( open_ || audio_.isStreamOpen() )
+    throw RtError( "RtBufferTuner::openStream: a stream is already open.", RtError::INVALID_USE );
+
+  hasOutput_ = ( outputParameters != NULL );
+  if ( hasOutput_ ) outputParameters_ = *outputParameters;
+  hasInput_ = ( inputParameters != NULL );
+  if ( hasInput_ ) inputParameters_ = *inputParameters;
+  format_ = format;
+  sampleRate_ = sampleRate;
+  callback_ = callback;
+  userData_ = userData;
+  options_ = options ? *options : RtAudio::StreamOptions();
+
+  RtAudio::Api api = audio_.getCurrentApi();
+  variableBuffers_ = ( api == RtAudio::LINUX_ALSA || api == RtAudio::LINUX_OSS ||
+                       api == RtAudio::WINDOWS_DS );
+
+  streamTimeOffset_ = 0.0;
+  xruns_ = 0;
+  frames_ = 0;
+  busyNanoseconds_ = 0;
+  load_ = 0.0;
+  retunes_ = 0;
+
+  // Start at the smallest buffer size, then find the last step below
+  // the latency ceiling.
+  baseFrames_ = RTBUFFERTUNER_MIN_FRAMES;
+  step_ = 0;
+  openStep( 0 );
+  baseFrames_ = bufferFrames_;
+  maxStep_ = 0;
+  // The JACK server fixes the buffer size, so there is nothing to tune.
+  while ( api != RtAudio::UNIX_JACK && maxStep_ < RTBUFFERTUNER_MAX_STEPS &&
+          stepFrames( maxStep_ + 1 ) * std::max( stepBuffers( maxStep_ + 1 ), 2u ) <= maxLatencyFrames )
+    maxStep_++;
+  holdUntil_.assign( maxStep_ + 1, 0.0 );
+  holdSeconds_.assign( maxStep_ + 1, RTBUFFERTUNER_HOLD_SECONDS );
+
+  stop_ = false;
+  open_ = true;
+  if ( pthread_create( &thread_, NULL, monitorThread, this ) ) {
+    open_ = false;
+    audio_.closeStream();
+    throw RtError( "RtBufferTuner::openStream: error creating monitor thread.", RtError::THREAD_ERROR );
+  }
+}
+
+void RtBufferTuner :: startStream( void )
+{
+  pthread_mutex_lock( &mutex_ );
+  try {
+    audio_.startStream();
+  }
+  catch ( RtError & ) {
+    pthread_mutex_unlock( &mutex_ );
+    throw;
+  }
+  pthread_mutex_unlock( &mutex_ );
+}
+
+void RtBufferTuner :: stopStream( void )
+{
+  pthread_mutex_lock( &mutex_ );
+  try {
+    audio_.stopStream();
+  }
+  catch ( RtError & ) {
+    pthread_mutex_unlock( &mutex_ );
+    throw;
+  }
+  pthread_mutex_unlock( &mutex_ );
+}
+
+void RtBufferTuner :: closeStream( void )
+{
+  if ( !open_ ) return;
+
+  stop_ = true;
+  pthread_join( thread_, NULL );
+  if ( audio_.isStreamOpen() ) audio_.closeStream();
+  open_ = false;
+}
+
+unsigned int RtBufferTuner :: stepFrames( unsigned int step ) const
+{
+  return baseFrames_ << ( variableBuffers_ ? step / 2 : step );
+}
+
+unsigned int RtBufferTuner :: stepBuffers( unsigned int step ) const
+{
+  // Zero lets the other APIs choose, they ignore it anyway.
+  return variableBuffers_ ? 2 + step % 2 : 0;
+}
+
+void RtBufferTuner :: openStep( unsigned int step )
+{
+  unsigned int frames = stepFrames( step );
+  options_.numberOfBuffers = stepBuffers( step );
+  audio_.openStream( hasOutput_ ? &outputParameters_ : NULL, hasInput_ ? &inputParameters_ : NULL,
+                     format_, sampleRate_, &frames, &tunerCallback, (void *) this, &options_ );
+  bufferFrames_ = frames;
+  numberOfBuffers_ = options_.numberOfBuffers;
+}
+
+bool RtBufferTuner :: retune( unsigned int step )
+{
+  // The stream is stopped while it is reopened, so the callback does
+  // not run and streamTimeOffset_ can be changed.
+  streamTimeOffset_ += audio_.getStreamTime();
+  audio_.abortStream();
+  audio_.closeStream();
+
+  unsigned int frames = bufferFrames_;
+  unsigned int buffers = numberOfBuffers_;
+  try {
+    openStep( step );
+
+    // The API did not change anything: stay at the current step.  No
+    // higher step will help either, and a lower one is held off.
+    if ( bufferFrames_ == frames && numberOfBuffers_ == buffers ) {
+      if ( step > step_ ) maxStep_ = step_;
+      else holdUntil_[step] = monotonicSeconds() + RTBUFFERTUNER_MAX_HOLD_SECONDS;
+      step = step_;
+    }
+  }
+  catch ( RtError &e ) {
+    e.printMessage();
+    holdUntil_[step] = monotonicSeconds() + RTBUFFERTUNER_MAX_HOLD_SECONDS;
+    try {
+      openStep( step_ );
+    }
+    catch ( RtError &e ) {
+      e.printMessage();
+      return false;
+    }
+    step = step_;
+  }
+
+  step_ = step;
+  try {
+    audio_.startStream();
+  }
+  catch ( RtError &e ) {
+    e.printMessage();
+    return false;
+  }
+  return true;
+}
+
+int RtBufferTuner :: tunerCallback( void *outputBuffer, void *inputBuffer, unsigned int nFrames,
+                                    double streamTime, RtAudioStreamStatus status, void *userData )
+{
+  RtBufferTuner *tuner = (RtBufferTuner *) userData;
+  double start = monotonicSeconds();
+  int result = tuner->callback_( outputBuffer, inputBuffer, nFrames, tuner->streamTimeOffset_ + streamTime,
+                                 status, tuner->userData_ );
+  double busy = monotonicSeconds() - start;
+
+  if ( status & ( RTAUDIO_OUTPUT_UNDERFLOW | RTAUDIO_INPUT_OVERFLOW ) )
+    tuner->xruns_.fetch_add( 1, std::memory_order_relaxed );
+  tuner->busyNanoseconds_.fetch_add( (unsigned long long) ( busy * 1e9 ), std::memory_order_relaxed );
+  tuner->frames_.fetch_add( nFrames, std::memory_order_relaxed );
+  return result;
+}
+
+void *RtBufferTuner :: monitorThread( void *ptr )
+{
+  ( (RtBufferTuner *) ptr )->monitor();
+  return NULL;
+}
+
+void RtBufferTuner :: monitor( void )
+{
+  unsigned long long lastXruns = xruns_.load();
+  unsigned long long lastFrames = frames_.load();
+  unsigned long long lastBusy = busyNanoseconds_.load();
+  int settle = RTBUFFERTUNER_SETTLE_CHECKS;
+  double stableSince = monotonicSeconds();
+
+  while ( !stop_ ) {
+    usleep( RTBUFFERTUNER_INTERVAL_MICROSECONDS );
+
+    pthread_mutex_lock( &mutex_ );
+    unsigned long long xruns = xruns_.load();
+    unsigned long long frames = frames_.load();
+    unsigned long long busy = busyNanoseconds_.load();
+    unsigned long long newXruns = xruns - lastXruns;
+    double seconds = (double) ( frames - lastFrames ) / sampleRate_;
+    double load = ( seconds > 0.0 ) ? ( busy - lastBusy ) * 1e-9 / seconds : 0.0;
+    lastXruns = xruns;
+    lastFrames = frames;
+    lastBusy = busy;
+
+    double now = monotonicSeconds();
+    if ( stop_ || !audio_.isStreamRunning() ) {
+      settle = RTBUFFERTUNER_SETTLE_CHECKS;
+      stableSince = now;
+      pthread_mutex_unlock( &mutex_ );
+      continue;
+    }
+
+    load_ = load;
+    if ( settle > 0 ) {
+      settle--;
+      pthread_mutex_unlock( &mutex_ );
+      continue;
+    }
+
+    // Raise the latency after an xrun or a heavy callback, and hold
+    // off the failed step.  Lower it after a quiet period, unless the
+    // lower step failed recently.
+    unsigned int target = step_;
+    if ( newXruns > 0 || load > RTBUFFERTUNER_GROW_LOAD ) {
+      stableSince = now;
+      if ( step_ < maxStep_ ) {
+        holdUntil_[step_] = now + holdSeconds_[step_];
+        holdSeconds_[step_] = std::min( 2.0 * holdSeconds_[step_], RTBUFFERTUNER_MAX_HOLD_SECONDS );
+        target = step_ + 1;
+      }
+    }
+    else if ( step_ > 0 && now - stableSince >= RTBUFFERTUNER_STABLE_SECONDS &&
+              load < RTBUFFERTUNER_SHRINK_LOAD && now >= holdUntil_[step_ - 1] )
+      target = step_ - 1;
+
+    if ( target != step_ ) {
+      if ( !retune( target ) ) {
+        pthread_mutex_unlock( &mutex_ );
+        break;
+      }
+      retunes_++;
+      settle = RTBUFFERTUNER_SETTLE_CHECKS;
+      stableSince = monotonicSeconds();
+    }
+    pthread_mutex_unlock( &mutex_ );
+  }
+}
@@ -0,0 +1,145 @@
+/************************************************************************/
+/*! \class RtBufferTuner
+    \brief Adaptive buffer size tuning for RtAudio streams.
+
+    RtBufferTuner opens the stream of an RtAudio instance with the
+    smallest buffer size the device accepts and then looks for the
+    lowest latency that runs without xruns.  It passes the user
+    callback through a wrapper which counts the callbacks reporting
+    RTAUDIO_OUTPUT_UNDERFLOW or RTAUDIO_INPUT_OVERFLOW and measures the
+    time spent in the callback.  A monitor thread checks these
+    statistics four times per second:
+
+    - After an xrun, or if the callback uses more than 80% of the
+      buffer period, the latency is raised one step.
+    - After 10 seconds without xruns and with the callback using less
+      than 40% of the period, the latency is lowered one step, unless
+      the lower step failed recently.  A step that fails is held off
+      for 10 seconds, doubling with every failure up to 10 minutes.
+
+    The steps double the buffer size.  With the APIs that honour
+    StreamOptions::numberOfBuffers (ALSA, OSS and DirectSound), each
+    buffer size is tried with two and then three buffers.  The
+    latency never exceeds the ceiling given to openStream().
+
+    A step is taken by stopping, closing, reopening and restarting the
+    stream, which causes a short gap in the audio.  The callback must
+    therefore accept any \c nFrames value.  The stream time passed to
+    the callback continues across reopens.  While the tuner is in use,
+    the primary stream of the RtAudio instance must only be controlled
+    through the tuner.  JACK streams, whose buffer size is set by the
+    server, are left alone.  If the API keeps the buffer size when
+    the latency is raised, it is not raised past that step again.
+*/
+/************************************************************************/
+
+/*!
+  \file RtBufferTuner.h
+ */
+
+#ifndef __RTBUFFERTUNER_H
+#define __RTBUFFERTUNER_H
+
+#include "RtAudio.h"
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+class RtBufferTuner
+{
+ public:
+
+  //! The constructor.  The tuner controls the primary stream of \c audio.
+  RtBufferTuner( RtAudio &audio );
+
+  //! The destructor closes an open stream.
+  ~RtBufferTuner( void );
+
+  //! Opens the stream with the smallest buffer size and starts the monitor thread.
+  /*!
+    The parameters are the same as for RtAudio::openStream(), except
+    that the buffer size is chosen by the tuner.  \c maxLatencyFrames
+    is the ceiling for the buffer size times the number of buffers.
+    RtErrors thrown by RtAudio::openStream() are passed on.  An
+    RtError is also thrown if a stream is already open (type =
+    RtError::INVALID_USE) or if the monitor thread cannot be started
+    (type = RtError::THREAD_ERROR).
+  */
+  void openStream( RtAudio::StreamParameters *outputParameters,
+                   RtAudio::StreamParameters *inputParameters,
+                   RtAudioFormat format, unsigned int sampleRate,
+                   RtAudioCallback callback, void *userData = NULL,
+                   RtAudio::StreamOptions *options = NULL,
+                   unsigned int maxLatencyFrames = 8192 );
+
+  //! Starts the stream and the tuning.
+  void startStream( void );
+
+  //! Stops the stream.  The tuning pauses while the stream is stopped.
+  void stopStream( void );
+
+  //! Stops the monitor thread and closes the stream.
+  void closeStream( void );
+
+  //! Returns true while a stream is open.
+  bool isStreamOpen( void ) const { return open_; };
+
+  //! Returns the current buffer size in frames.
+  unsigned int getBufferFrames( void ) const { return bufferFrames_.load(); };
+
+  //! Returns the current number of buffers.
+  unsigned int getNumberOfBuffers( void ) const { return numberOfBuffers_.load(); };
+
+  //! Returns the number of callbacks which reported an xrun.
+  unsigned long long getXrunCount( void ) const { return xruns_.load(); };
+
+  //! Returns the fraction of the buffer period spent in the callback during the last check.
+  double getLoad( void ) const { return load_.load(); };
+
+  //! Returns the number of times the stream was reopened with a new buffer size.
+  unsigned int getRetuneCount( void ) const { return retunes_.load(); };
+
+ protected:
+
+  static int tunerCallback( void *outputBuffer, void *inputBuffer, unsigned int nFrames,
+                            double streamTime, RtAudioStreamStatus status, void *userData );
+  static void *monitorThread( void *ptr );
+  void monitor( void );
+  void openStep( unsigned int step );
+  bool retune( unsigned int step );
+  unsigned int stepFrames( unsigned int step ) const;
+  unsigned int stepBuffers( unsigned int step ) const;
+
+  RtAudio &audio_;
+  RtAudio::StreamParameters outputParameters_;
+  RtAudio::StreamParameters inputParameters_;
+  bool hasOutput_;
+  bool hasInput_;
+  RtAudioFormat format_;
+  unsigned int sampleRate_;
+  RtAudioCallback callback_;
+  void *userData_;
+  RtAudio::StreamOptions options_;
+  bool variableBuffers_;
+
+  unsigned int baseFrames_;
+  unsigned int step_;
+  unsigned int maxStep_;
+  std::vector<double> holdUntil_;
+  std::vector<double> holdSeconds_;
+  double streamTimeOffset_;
+
+  pthread_t thread_;
+  pthread_mutex_t mutex_;
+  std::atomic<bool> open_;
+  std::atomic<bool> stop_;
+  std::atomic<unsigned int> bufferFrames_;
+  std::atomic<unsigned int> numberOfBuffers_;
+  std::atomic<unsigned int> retunes_;
+  std::atomic<double> load_;
+  std::atomic<unsigned long long> xruns_;
+  std::atomic<unsigned long long> frames_;
+  std::atomic<unsigned long long> busyNanoseconds_;
+};
+
+#endif
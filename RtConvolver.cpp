@@ -0,0 +1,379 @@
+/************************************************************************/
+/*! \class RtConvolver
+    \brief Zero-latency partitioned convolution for long impulse responses.
+
+    See RtConvolver.h for an overview.
+*/
+/************************************************************************/
+
+#include "RtConvolver.h"
+#include "RtUtilities.h"
+#include <sched.h>
+#include <algorithm>
+#include <cstring>
+
+// Sum += X * H over n bins, with the spectra split into real and
+// imaginary arrays.  The loop has no dependency between bins, so the
+// compiler vectorizes it.
+static void multiplyAccumulate( float *sumRe, float *sumIm, const float *xRe, const float *xIm,
+                                const float *hRe, const float *hIm, unsigned int n )
+{
+  for ( unsigned int k=0; k<n; k++ ) {
+    sumRe[k] += xRe[k] * hRe[k] - xIm[k] * hIm[k];
+    sumIm[k] += xRe[k] * hIm[k] + xIm[k] * hRe[k];
+  }
+}
+
+static bool isPowerOfTwo( unsigned int value )
+{
+  return value > 0 && ( value & ( value - 1 ) ) == 0;
+}
+
+RtConvolver::Level :: Level( unsigned int nChannels, unsigned int partitionSize,
+                             unsigned int nPartitions, bool tail )
+  : channels( nChannels ), size( partitionSize ), partitions( nPartitions ),
+    bins( partitionSize + 1 ), slot( 0 ), threaded( false ), running( false ), posted( 0 ), done( 0 )
+{
+  fft.setSize( 2 * size );
+  unsigned int spectra = channels * partitions * bins;
+  filterRe.assign( spectra, 0.0 );
+  filterIm.assign( spectra, 0.0 );
+  delayRe.assign( spectra, 0.0 );
+  delayIm.assign( spectra, 0.0 );
+  sumRe.assign( bins, 0.0 );
+  sumIm.assign( bins, 0.0 );
+  time.assign( 2 * size, 0.0 );
+  if ( tail ) {
+    window.assign( channels * 2 * size, 0.0 );
+    input.assign( 2 * channels * size, 0.0 );
+    output.assign( 2 * channels * size, 0.0 );
+  }
+  pthread_mutex_init( &mutex, NULL );
+  pthread_cond_init( &wakeup, NULL );
+}
+
+RtConvolver::Level :: ~Level( void )
+{
+  if ( threaded ) {
+    pthread_mutex_lock( &mutex );
+    running = false;
+    pthread_cond_signal( &wakeup );
+    pthread_mutex_unlock( &mutex );
+    pthread_join( thread, NULL );
+  }
+  pthread_cond_destroy( &wakeup );
+  pthread_mutex_destroy( &mutex );
+}
+
+void RtConvolver::Level :: step( const float *windows, unsigned int windowStride,
+                                 float *out, unsigned int outStride )
+{
+  // Uniformly partitioned overlap-save.  The newest spectrum goes into
+  // the delay line slot, and partition p is applied to the spectrum p
+  // steps old.
+  slot = ( slot == 0 ) ? partitions - 1 : slot - 1;
+  for ( unsigned int c=0; c<channels; c++ ) {
+    unsigned int base = c * partitions * bins;
+    fft.forward( windows + c * windowStride, &delayRe[base + slot * bins], &delayIm[base + slot * bins] );
+
+    std::fill( sumRe.begin(), sumRe.end(), 0.0f );
+    std::fill( sumIm.begin(), sumIm.end(), 0.0f );
+    for ( unsigned int p=0; p<partitions; p++ ) {
+      unsigned int x = base + ( ( slot + p ) % partitions ) * bins;
+      unsigned int h = base + p * bins;
+      multiplyAccumulate( &sumRe[0], &sumIm[0], &delayRe[x], &delayIm[x],
+                          &filterRe[h], &filterIm[h], bins );
+    }
+
+    // The second half of the circular convolution is the linear one.
+    fft.inverse( &sumRe[0], &sumIm[0], &time[0] );
+    memcpy( out + c * outStride, &time[size], size * sizeof( float ) );
+  }
+}
+
+RtConvolver :: RtConvolver( unsigned int channels, unsigned int blockSize,
+                            unsigned int growth, int priority )
+  : RtGraphNode( channels, channels ), blockSize_( blockSize ), growth_( growth ),
+    priority_( priority ), length_( 0 ), headLength_( 0 ), position_( 0 ), late_( 0 )
+{
+  if ( channels == 0 )
+    throw RtError( "RtConvolver: the convolver must have at least one channel.", RtError::INVALID_PARAMETER );
+  if ( !isPowerOfTwo( blockSize ) || blockSize < 16 )
+    throw RtError( "RtConvolver: the block size must be a power of two of at least 16.", RtError::INVALID_PARAMETER );
+  if ( growth != 0 && ( !isPowerOfTwo( growth ) || growth < 2 ) )
+    throw RtError( "RtConvolver: the growth must be zero or a power of two of at least 2.", RtError::INVALID_PARAMETER );
+
+  history_.assign( channels * 2 * blockSize, 0.0 );
+  scratch_.assign( channels * 2 * blockSize, 0.0 );
+  inputs_.resize( channels );
+  outputs_.resize( channels );
+  for ( unsigned int c=0; c<channels; c++ ) {
+    inputs_[c] = &scratch_[c * blockSize];
+    outputs_[c] = &scratch_[( channels + c ) * blockSize];
+  }
+}
+
+RtConvolver :: ~RtConvolver( void )
+{
+  unload();
+}
+
+void RtConvolver :: unload( void )
+{
+  for ( unsigned int i=0; i<levels_.size(); i++ ) delete levels_[i];
+  levels_.clear();
+  head_.clear();
+  levelOutput_.clear();
+  length_ = 0;
+  headLength_ = 0;
+}
+
+void RtConvolver :: load( const std::vector< std::vector<float> > &impulses )
+{
+  if ( impulses.empty() )
+    throw RtError( "RtConvolver::load: no impulse response given.", RtError::INVALID_PARAMETER );
+
+  unload();
+  unsigned int nChannels = outputChannels_;
+  unsigned int B = blockSize_;
+  unsigned long length = 0;
+  for ( unsigned int i=0; i<impulses.size(); i++ )
+    length = std::max( length, (unsigned long) impulses[i].size() );
+
+  headLength_ = (unsigned int) std::min( length, (unsigned long) B );
+  head_.assign( nChannels * B, 0.0 );
+  for ( unsigned int c=0; c<nChannels; c++ ) {
+    const std::vector<float> &impulse = impulses[c % impulses.size()];
+    unsigned int count = (unsigned int) std::min( impulse.size(), (size_t) B );
+    std::copy( impulse.begin(), impulse.begin() + count, head_.begin() + c * B );
+  }
+
+  // Level 0 starts after the head.  Tail level l has partitions of
+  // B * growth^l taps and starts at twice its partition size, which
+  // leaves its thread one partition period to compute each step.
+  unsigned long start = B;
+  unsigned long size = B;
+  while ( start < length ) {
+    unsigned long nextSize = size * growth_;
+    unsigned long end = ( growth_ == 0 ) ? length : std::min( length, 2 * nextSize );
+    unsigned int nPartitions = (unsigned int) ( ( end - start + size - 1 ) / size );
+    Level *level = new Level( nChannels, (unsigned int) size, nPartitions, !levels_.empty() );
+    levels_.push_back( level );
+
+    // Each partition is transformed zero-padded to twice its size, and
+    // scaled for the unnormalized inverse transform.
+    float scale = 1.0f / size;
+    for ( unsigned int c=0; c<nChannels; c++ ) {
+      const std::vector<float> &impulse = impulses[c % impulses.size()];
+      for ( unsigned int p=0; p<nPartitions; p++ ) {
+        unsigned long first = start + (unsigned long) p * size;
+        unsigned long last = std::min( first + size, (unsigned long) impulse.size() );
+        std::fill( level->time.begin(), level->time.end(), 0.0f );
+        for ( unsigned long i=first; i<last; i++ ) level->time[i - first] = impulse[i] * scale;
+        unsigned int offset = ( c * nPartitions + p ) * level->bins;
+        level->fft.forward( &level->time[0], &level->filterRe[offset], &level->filterIm[offset] );
+      }
+    }
+
+    start = end;
+    size = nextSize;
+  }
+
+  length_ = length;
+  if ( !levels_.empty() ) levelOutput_.assign( nChannels * B, 0.0 );
+  reset();
+
+  bool warned = false;
+  for ( unsigned int i=1; i<levels_.size(); i++ ) {
+    Level *level = levels_[i];
+    level->running = true;
+    int priority = priority_ > 0 ? std::max( priority_ - (int) i + 1, 1 ) : 0;
+    if ( createRealtimeThread( &level->thread, levelThread, level, priority,
+                               "RtConvolver: realtime scheduling was not granted, tail threads use the default policy.",
+                               warned ) ) {
+      level->running = false;
+      unload();
+      throw RtError( "RtConvolver::load: error creating tail thread.", RtError::THREAD_ERROR );
+    }
+    level->threaded = true;
+  }
+}
+
+void RtConvolver :: reset( void )
+{
+  for ( unsigned int i=0; i<levels_.size(); i++ ) {
+    Level *level = levels_[i];
+    while ( level->done.load( std::memory_order_acquire ) != level->posted.load() )
+      sched_yield();
+    std::fill( level->delayRe.begin(), level->delayRe.end(), 0.0f );
+    std::fill( level->delayIm.begin(), level->delayIm.end(), 0.0f );
+    std::fill( level->window.begin(), level->window.end(), 0.0f );
+    std::fill( level->input.begin(), level->input.end(), 0.0f );
+    std::fill( level->output.begin(), level->output.end(), 0.0f );
+    level->slot = 0;
+  }
+  std::fill( history_.begin(), history_.end(), 0.0f );
+  std::fill( levelOutput_.begin(), levelOutput_.end(), 0.0f );
+  position_ = 0;
+}
+
+void *RtConvolver :: levelThread( void *ptr )
+{
+  Level *level = (Level *) ptr;
+  unsigned int size = level->size;
+
+  while ( true ) {
+    pthread_mutex_lock( &level->mutex );
+    while ( level->running && level->posted.load( std::memory_order_acquire ) == level->done.load() )
+      pthread_cond_wait( &level->wakeup, &level->mutex );
+    bool running = level->running;
+    pthread_mutex_unlock( &level->mutex );
+    if ( !running ) break;
+
+    // Slide the window by one partition and append the new input.
+    unsigned long job = level->done.load( std::memory_order_relaxed );
+    const float *input = &level->input[( job & 1 ) * level->channels * size];
+    for ( unsigned int c=0; c<level->channels; c++ ) {
+      float *window = &level->window[c * 2 * size];
+      memcpy( window, window + size, size * sizeof( float ) );
+      memcpy( window + size, input + c * size, size * sizeof( float ) );
+    }
+    level->step( &level->window[0], 2 * size, &level->output[( job & 1 ) * level->channels * size], size );
+    level->done.store( job + 1, std::memory_order_release );
+  }
+
+  return 0;
+}
+
+void RtConvolver :: convolve( float **input, float **output, unsigned int offset, unsigned int nFrames )
+{
+  unsigned int B = blockSize_;
+  unsigned int start = (unsigned int) ( position_ & ( B - 1 ) );
+  unsigned int nChannels = outputChannels_;
+
+  // Store all input first, since the output may overwrite it.
+  for ( unsigned int c=0; c<nChannels; c++ )
+    memcpy( &history_[c * 2 * B + B + start], input[c] + offset, nFrames * sizeof( float ) );
+
+  for ( unsigned int c=0; c<nChannels; c++ ) {
+    float *out = output[c] + offset;
+    const float *x = &history_[c * 2 * B + B + start];
+    if ( levelOutput_.empty() )
+      memset( out, 0, nFrames * sizeof( float ) );
+    else
+      memcpy( out, &levelOutput_[c * B + start], nFrames * sizeof( float ) );
+
+    // Direct head, one tap at a time so that the inner loop runs over
+    // frames and vectorizes.  x[-j] reaches back into the previous block.
+    const float *h = &head_[c * B];
+    for ( unsigned int j=0; j<headLength_; j++ ) {
+      float tap = h[j];
+      const float *xj = x - j;
+      for ( unsigned int i=0; i<nFrames; i++ ) out[i] += tap * xj[i];
+    }
+
+    // Tail levels: the result of the job before the last one.
+    for ( unsigned int l=1; l<levels_.size(); l++ ) {
+      Level *level = levels_[l];
+      unsigned int size = level->size;
+      unsigned long read = level->posted.load( std::memory_order_relaxed ) & 1;
+      const float *tail = &level->output[( read * nChannels + c ) * size + ( position_ & ( size - 1 ) )];
+      for ( unsigned int i=0; i<nFrames; i++ ) out[i] += tail[i];
+    }
+  }
+
+  position_ += nFrames;
+  if ( ( position_ & ( B - 1 ) ) == 0 ) endBlock();
+}
+
+void RtConvolver :: endBlock( void )
+{
+  unsigned int B = blockSize_;
+  unsigned int nChannels = outputChannels_;
+
+  if ( !levels_.empty() )
+    levels_[0]->step( &history_[0], 2 * B, &levelOutput_[0], B );
+
+  for ( unsigned int l=1; l<levels_.size(); l++ ) {
+    Level *level = levels_[l];
+    unsigned int size = level->size;
+    unsigned long posted = level->posted.load( std::memory_order_relaxed );
+    unsigned int offset = (unsigned int) ( ( position_ - B ) & ( size - 1 ) );
+    float *input = &level->input[( posted & 1 ) * nChannels * size];
+    for ( unsigned int c=0; c<nChannels; c++ )
+      memcpy( input + c * size + offset, &history_[c * 2 * B + B], B * sizeof( float ) );
+    if ( ( position_ & ( size - 1 ) ) != 0 ) continue;
+
+    // A partition is complete.  The previous job must be done before
+    // its output is read during the next partition period.
+    if ( level->done.load( std::memory_order_acquire ) != posted ) {
+      late_.fetch_add( 1, std::memory_order_relaxed );
+      while ( level->done.load( std::memory_order_acquire ) != posted )
+        sched_yield();
+    }
+    pthread_mutex_lock( &level->mutex );
+    level->posted.store( posted + 1, std::memory_order_release );
+    pthread_cond_signal( &level->wakeup );
+    pthread_mutex_unlock( &level->mutex );
+  }
+
+  for ( unsigned int c=0; c<nChannels; c++ )
+    memcpy( &history_[c * 2 * B], &history_[c * 2 * B + B], B * sizeof( float ) );
+}
+
+void RtConvolver :: process( float **input, float **output, unsigned int nFrames )
+{
+  if ( length_ == 0 ) {
+    for ( unsigned int c=0; c<outputChannels_; c++ )
+      memset( output[c], 0, nFrames * sizeof( float ) );
+    return;
+  }
+
+  // Blocks are processed up to the next block boundary at a time.
+  unsigned int offset = 0;
+  while ( offset < nFrames ) {
+    unsigned int count = blockSize_ - (unsigned int) ( position_ & ( blockSize_ - 1 ) );
+    count = std::min( count, nFrames - offset );
+    convolve( input, output, offset, count );
+    offset += count;
+  }
+}
+
+void RtConvolver :: mix( void *outputBuffer, const void *inputBuffer, unsigned int nFrames,
+                         RtAudioFormat format, float gain )
+{
+  if ( length_ == 0 ) return;
+
+  unsigned int nChannels = outputChannels_;
+  unsigned int offset = 0;
+  while ( offset < nFrames ) {
+    unsigned int count = blockSize_ - (unsigned int) ( position_ & ( blockSize_ - 1 ) );
+    count = std::min( count, nFrames - offset );
+    unsigned int i, c;
+
+    if ( format == RTAUDIO_FLOAT32 ) {
+      const float *in = (const float *) inputBuffer + offset * nChannels;
+      for ( i=0; i<count; i++ )
+        for ( c=0; c<nChannels; c++ ) inputs_[c][i] = *in++;
+    }
+    else {
+      const double *in = (const double *) inputBuffer + offset * nChannels;
+      for ( i=0; i<count; i++ )
+        for ( c=0; c<nChannels; c++ ) inputs_[c][i] = (float) *in++;
+    }
+
+    convolve( &inputs_[0], &outputs_[0], 0, count );
+
+    if ( format == RTAUDIO_FLOAT32 ) {
+      float *out = (float *) outputBuffer + offset * nChannels;
+      for ( i=0; i<count; i++ )
+        for ( c=0; c<nChannels; c++ ) *out++ += gain * outputs_[c][i];
+    }
+    else {
+      double *out = (double *) outputBuffer + offset * nChannels;
+      for ( i=0; i<count; i++ )
+        for ( c=0; c<nChannels; c++ ) *out++ += gain * outputs_[c][i];
+    }
+    offset += count;
+  }
+}
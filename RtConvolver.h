@@ -0,0 +1,181 @@
+/************************************************************************/
+/*! \class RtConvolver
+    \brief Zero-latency partitioned convolution for long impulse responses.
+
+    RtConvolver convolves every channel of a stream with an impulse
+    response, e.g. to add the reverb of a room to the input of a
+    duplex stream.  The impulse response is split into partitions
+    which grow with their distance from the start:
+
+    - The first block of taps is a direct FIR filter, so the output
+      has no latency.
+    - The taps up to twice the first tail partition size are uniform
+      partitions of one block, computed by FFT in the calling thread
+      once per block.
+    - The remaining taps form the tail.  Each tail level has
+      partitions \c growth times larger than the previous level and is
+      computed by FFT on its own background thread.  A level has one
+      partition period of time for its work, so the expensive
+      transforms of the long tail never run in the audio callback.
+
+    Each partitioned level keeps the spectra of its past input in a
+    frequency-domain delay line, so every partition costs one complex
+    multiply-accumulate over the spectrum per step.  The spectra are
+    stored as separate real and imaginary arrays, which lets the
+    compiler vectorize that loop.  With \c growth set to zero the
+    convolution is uniformly partitioned and runs entirely in the
+    calling thread.
+
+    If a tail thread has not finished when its result is due, the
+    calling thread waits for it and getLateCount() is incremented.
+    The convolver is an RtGraphNode, so it can be used in an RtGraph,
+    or it can mix() directly into an RtAudio buffer.
+*/
+/************************************************************************/
+
+/*!
+  \file RtConvolver.h
+ */
+
+#ifndef __RTCONVOLVER_H
+#define __RTCONVOLVER_H
+
+#include "RtGraph.h"
+#include "RtFft.h"
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+class RtConvolver : public RtGraphNode
+{
+ public:
+
+  //! The constructor.
+  /*!
+    \c blockSize is the length of the direct head and of the first
+    partitions, and must be a power of two of at least 16.  It does
+    not need to match the buffer size of the stream.  \c growth is
+    the ratio between the partition sizes of consecutive tail levels
+    (a power of two), or zero for uniform partitioning.  When \c
+    priority is greater than zero, the tail threads request SCHED_FIFO
+    scheduling, at \c priority for the first level and one less for
+    each further level.  An RtError (type =
+    RtError::INVALID_PARAMETER) is thrown for invalid sizes.
+  */
+  RtConvolver( unsigned int channels, unsigned int blockSize = 256,
+               unsigned int growth = 8, int priority = 0 );
+
+  //! The destructor stops the tail threads.
+  ~RtConvolver( void );
+
+  //! Sets the impulse responses and clears the convolution state.
+  /*!
+    Impulse response \e k % impulses.size() is used for channel \e k,
+    so a single response applies to all channels.  The partitions are
+    laid out for the longest response and the tail threads are
+    (re)started.  Must not be called while another thread is inside
+    process() or mix().  An RtError is thrown if \c impulses is empty
+    (type = RtError::INVALID_PARAMETER) or if a tail thread cannot be
+    created (type = RtError::THREAD_ERROR).
+  */
+  void load( const std::vector< std::vector<float> > &impulses );
+
+  //! Clears the convolution state (the input history) without changing the impulse responses.
+  /*!
+    Must not be called while another thread is inside process() or
+    mix().
+  */
+  void reset( void );
+
+  //! Convolves \c nFrames of non-interleaved \c input into \c output (RtGraphNode interface).
+  /*!
+    \c input and \c output may be the same buffers.  Without impulse
+    responses the output is silent.
+  */
+  void process( float **input, float **output, unsigned int nFrames );
+
+  //! Convolves \c nFrames of interleaved input and adds the result to an interleaved buffer.
+  /*!
+    \c format must be RTAUDIO_FLOAT32 or RTAUDIO_FLOAT64.  Both
+    buffers hold getOutputChannels() channels, and the convolved
+    input is scaled by \c gain and added to \c outputBuffer, so a dry
+    signal already in the buffer is kept.  The buffers may be the
+    same.
+  */
+  void mix( void *outputBuffer, const void *inputBuffer, unsigned int nFrames,
+            RtAudioFormat format, float gain = 1.0 );
+
+  //! Returns the length of the longest impulse response in frames.
+  unsigned long getLength( void ) const { return length_; };
+
+  //! Returns the number of partitioned levels, including the one computed in the calling thread.
+  unsigned int getLevelCount( void ) const { return (unsigned int) levels_.size(); };
+
+  //! Returns the number of times the calling thread had to wait for a tail thread.
+  unsigned long long getLateCount( void ) const { return late_.load(); };
+
+ protected:
+
+  // One level of uniform partitions of \c size taps.  Level 0 runs in
+  // the calling thread; the others run on their own thread.  The
+  // spectra are laid out [channel][partition][bin].
+  struct Level {
+    unsigned int channels;
+    unsigned int size;
+    unsigned int partitions;
+    unsigned int bins;
+    unsigned int slot;
+    RtFft fft;
+    std::vector<float> filterRe;
+    std::vector<float> filterIm;
+    std::vector<float> delayRe;
+    std::vector<float> delayIm;
+    std::vector<float> sumRe;
+    std::vector<float> sumIm;
+    std::vector<float> time;
+
+    // Tail levels only: input window [channel][2 * size], and double
+    // buffered input and output [2][channel][size].  Job \e j reads
+    // input \e j & 1 and writes output \e j & 1.
+    std::vector<float> window;
+    std::vector<float> input;
+    std::vector<float> output;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;
+    bool threaded;
+    bool running;
+    std::atomic<unsigned long> posted;
+    std::atomic<unsigned long> done;
+
+    Level( unsigned int nChannels, unsigned int partitionSize, unsigned int nPartitions, bool tail );
+    ~Level( void );
+    void step( const float *windows, unsigned int windowStride, float *out, unsigned int outStride );
+  };
+
+  static void *levelThread( void *ptr );
+  void unload( void );
+  void convolve( float **input, float **output, unsigned int offset, unsigned int nFrames );
+  void endBlock( void );
+
+  unsigned int blockSize_;
+  unsigned int growth_;
+  int priority_;
+  unsigned long length_;
+  unsigned int headLength_;
+  unsigned long long position_;
+
+  // Direct head taps [channel][blockSize] and the input history
+  // [channel][2 * blockSize], whose second half is the current block.
+  // levelOutput_ holds the level 0 output for the current block.
+  std::vector<float> head_;
+  std::vector<float> history_;
+  std::vector<float> levelOutput_;
+  std::vector<Level *> levels_;
+  std::vector<float> scratch_;
+  std::vector<float *> inputs_;
+  std::vector<float *> outputs_;
+  std::atomic<unsigned long long> late_;
+};
+
+#endif
@@ -0,0 +1,126 @@
+/************************************************************************/
+/*! \class RtFft
+    \brief Real FFT with split real and imaginary spectra.
+
+    See RtFft.h for an overview.
+*/
+/************************************************************************/
+
+#include "RtFft.h"
+#include "RtError.h"
+#include <math.h>
+
+RtFft :: RtFft( unsigned int size )
+  : n_( 0 )
+{
+  setSize( size );
+}
+
+void RtFft :: setSize( unsigned int size )
+{
+  if ( size != 0 && ( size < 4 || ( size & ( size - 1 ) ) != 0 ) )
+    throw RtError( "RtFft::setSize: the size must be a power of two of at least 4.", RtError::INVALID_PARAMETER );
+
+  n_ = size / 2;
+  unsigned int bits = 0;
+  while ( ( 1u << bits ) < n_ ) bits++;
+  reverse_.resize( n_ );
+  for ( unsigned int i=0; i<n_; i++ ) {
+    unsigned int r = 0;
+    for ( unsigned int b=0; b<bits; b++ )
+      if ( i & ( 1u << b ) ) r |= 1u << ( bits - 1 - b );
+    reverse_[i] = r;
+  }
+
+  // The twiddles of the stage with butterflies of half length h are
+  // stored contiguously at offset h - 1.
+  twiddleRe_.resize( n_ );
+  twiddleIm_.resize( n_ );
+  for ( unsigned int half=1; half<n_; half*=2 ) {
+    for ( unsigned int j=0; j<half; j++ ) {
+      double angle = -M_PI * j / half;
+      twiddleRe_[half - 1 + j] = (float) cos( angle );
+      twiddleIm_[half - 1 + j] = (float) sin( angle );
+    }
+  }
+
+  // Twiddles splitting the n-point result into the 2n-point real spectrum.
+  realRe_.resize( n_ + 1 );
+  realIm_.resize( n_ + 1 );
+  for ( unsigned int k=0; k<=n_; k++ ) {
+    double angle = -M_PI * k / n_;
+    realRe_[k] = (float) cos( angle );
+    realIm_[k] = (float) sin( angle );
+  }
+
+  re_.assign( n_, 0.0 );
+  im_.assign( n_, 0.0 );
+}
+
+void RtFft :: transform( void )
+{
+  // Iterative radix-2 decimation in time.  The input is in bit-reversed
+  // order; the inner loop runs over contiguous butterflies and twiddles.
+  for ( unsigned int half=1; half<n_; half*=2 ) {
+    const float *wRe = &twiddleRe_[half - 1];
+    const float *wIm = &twiddleIm_[half - 1];
+    for ( unsigned int base=0; base<n_; base+=2*half ) {
+      float *aRe = &re_[base], *aIm = &im_[base];
+      float *bRe = aRe + half, *bIm = aIm + half;
+      for ( unsigned int j=0; j<half; j++ ) {
+        float tRe = bRe[j] * wRe[j] - bIm[j] * wIm[j];
+        float tIm = bRe[j] * wIm[j] + bIm[j] * wRe[j];
+        bRe[j] = aRe[j] - tRe;
+        bIm[j] = aIm[j] - tIm;
+        aRe[j] += tRe;
+        aIm[j] += tIm;
+      }
+    }
+  }
+}
+
+void RtFft :: forward( const float *x, float *re, float *im )
+{
+  // The even samples are the real and the odd samples the imaginary
+  // part of an n-point signal.
+  for ( unsigned int m=0; m<n_; m++ ) {
+    re_[reverse_[m]] = x[2*m];
+    im_[reverse_[m]] = x[2*m+1];
+  }
+  transform();
+
+  re[0] = re_[0] + im_[0];
+  im[0] = 0.0;
+  re[n_] = re_[0] - im_[0];
+  im[n_] = 0.0;
+  for ( unsigned int k=1; k<n_; k++ ) {
+    float evenRe = 0.5f * ( re_[k] + re_[n_-k] );
+    float evenIm = 0.5f * ( im_[k] - im_[n_-k] );
+    float oddRe = 0.5f * ( im_[k] + im_[n_-k] );
+    float oddIm = -0.5f * ( re_[k] - re_[n_-k] );
+    re[k] = evenRe + realRe_[k] * oddRe - realIm_[k] * oddIm;
+    im[k] = evenIm + realRe_[k] * oddIm + realIm_[k] * oddRe;
+  }
+}
+
+void RtFft :: inverse( const float *re, const float *im, float *x )
+{
+  // Rebuild the n-point spectrum and transform its conjugate, which
+  // yields n times the conjugated signal.
+  for ( unsigned int k=0; k<n_; k++ ) {
+    float evenRe = 0.5f * ( re[k] + re[n_-k] );
+    float evenIm = 0.5f * ( im[k] - im[n_-k] );
+    float diffRe = 0.5f * ( re[k] - re[n_-k] );
+    float diffIm = 0.5f * ( im[k] + im[n_-k] );
+    float oddRe = diffRe * realRe_[k] + diffIm * realIm_[k];
+    float oddIm = diffIm * realRe_[k] - diffRe * realIm_[k];
+    re_[reverse_[k]] = evenRe - oddIm;
+    im_[reverse_[k]] = -( evenIm + oddRe );
+  }
+  transform();
+
+  for ( unsigned int m=0; m<n_; m++ ) {
+    x[2*m] = re_[m];
+    x[2*m+1] = -im_[m];
+  }
+}
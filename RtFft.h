@@ -0,0 +1,74 @@
+/************************************************************************/
+/*! \class RtFft
+    \brief Real FFT with split real and imaginary spectra.
+
+    RtFft transforms a block of real samples into its spectrum of
+    size / 2 + 1 bins, and back.  The spectrum is stored as separate
+    arrays of real and imaginary parts, so that loops over the bins
+    (e.g. complex multiplies or magnitudes) vectorize.  A real block
+    of \e n samples is computed as a complex radix-2 FFT of \e n / 2
+    points, whose butterflies and twiddles are stored contiguously per
+    stage.
+
+    An RtFft holds its own work buffers, so each thread needs its own
+    instance.  The transforms do not allocate memory.
+*/
+/************************************************************************/
+
+/*!
+  \file RtFft.h
+ */
+
+#ifndef __RTFFT_H
+#define __RTFFT_H
+
+#include <vector>
+
+class RtFft
+{
+ public:
+
+  //! The constructor.  See setSize().
+  RtFft( unsigned int size = 0 );
+
+  //! Sets the number of real samples per block.
+  /*!
+    \c size must be a power of two of at least 4, or zero.  An
+    RtError (type = RtError::INVALID_PARAMETER) is thrown otherwise.
+  */
+  void setSize( unsigned int size );
+
+  //! Returns the number of real samples per block.
+  unsigned int getSize( void ) const { return 2 * n_; };
+
+  //! Returns the number of spectrum bins, getSize() / 2 + 1.
+  unsigned int getBins( void ) const { return n_ + 1; };
+
+  //! Transforms getSize() samples of \c x into getBins() bins of \c re and \c im.
+  /*!
+    The transform is not normalized.
+  */
+  void forward( const float *x, float *re, float *im );
+
+  //! Transforms getBins() bins of \c re and \c im into getSize() samples of \c x.
+  /*!
+    The result is scaled by getSize() / 2, i.e. forward() followed by
+    inverse() multiplies the signal by getSize() / 2.
+  */
+  void inverse( const float *re, const float *im, float *x );
+
+ protected:
+
+  void transform( void );
+
+  unsigned int n_;
+  std::vector<unsigned int> reverse_;
+  std::vector<float> twiddleRe_;
+  std::vector<float> twiddleIm_;
+  std::vector<float> realRe_;
+  std::vector<float> realIm_;
+  std::vector<float> re_;
+  std::vector<float> im_;
+};
+
+#endif
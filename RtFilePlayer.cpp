@@ -0,0 +1,522 @@
+/************************************************************************/
+/*! \class RtFilePlayer
+    \brief Disk streaming playback with read-ahead.
+
+    See RtFilePlayer.h for an overview.
+*/
+/************************************************************************/
+
+#include "RtFilePlayer.h"
+#include "RtUtilities.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+
+// Number of frames read and decoded at a time by the prefetch thread.
+const unsigned int RTFILEPLAYER_CHUNK_FRAMES = 8192;
+
+// How long the prefetch thread sleeps when every cache is full.
+const unsigned int RTFILEPLAYER_SLEEP_MICROSECONDS = 5000;
+
+// All players share a single prefetch thread.  It visits the players
+// round-robin, decoding one chunk per player and pass, and exits when
+// the last player is closed.
+struct RtFilePlayerThread {
+  pthread_mutex_t mutex;
+  std::vector<RtFilePlayer *> players;
+  bool running;
+
+  RtFilePlayerThread()
+    :running(false) { pthread_mutex_init( &mutex, NULL ); }
+};
+
+static RtFilePlayerThread prefetchThread;
+
+static void *prefetchHandler( void * )
+{
+  while ( true ) {
+    pthread_mutex_lock( &prefetchThread.mutex );
+    if ( prefetchThread.players.empty() ) {
+      prefetchThread.running = false;
+      pthread_mutex_unlock( &prefetchThread.mutex );
+      break;
+    }
+    bool busy = false;
+    for ( unsigned int i=0; i<prefetchThread.players.size(); i++ )
+      busy |= prefetchThread.players[i]->prefetch();
+    pthread_mutex_unlock( &prefetchThread.mutex );
+
+    if ( !busy ) usleep( RTFILEPLAYER_SLEEP_MICROSECONDS );
+  }
+
+  return 0;
+}
+
+static unsigned long long getLittle( const unsigned char *p, int bytes )
+{
+  unsigned long long value = 0;
+  for ( int i=bytes-1; i>=0; i-- ) value = ( value << 8 ) | p[i];
+  return value;
+}
+
+static unsigned long long getBig( const unsigned char *p, int bytes )
+{
+  unsigned long long value = 0;
+  for ( int i=0; i<bytes; i++ ) value = ( value << 8 ) | p[i];
+  return value;
+}
+
+static bool readAt( int fd, void *buffer, size_t bytes, unsigned long long offset )
+{
+  return pread( fd, buffer, bytes, (off_t) offset ) == (ssize_t) bytes;
+}
+
+RtFilePlayer :: RtFilePlayer( unsigned int channels )
+  : RtGraphNode( 0, channels ), fd_( -1 ), open_( false ), fileChannels_( 0 ), sampleRate_( 0 ),
+    sampleType_( SAMPLE_INT16 ), sampleBytes_( 0 ), bigEndian_( false ), dataOffset_( 0 ),
+    totalFrames_( 0 ), cacheMask_( 0 ), aheadFrames_( 0 ), historyFrames_( 0 ), position_( 0 ),
+    start_( 0 ), end_( 0 ), seekRequest_( 0 ), seekGeneration_( 0 ), servedGeneration_( 0 ),
+    underrunFrames_( 0 )
+{
+}
+
+RtFilePlayer :: ~RtFilePlayer( void )
+{
+  close();
+}
+
+void RtFilePlayer :: open( const std::string &filename, double aheadSeconds, double historySeconds )
+{
+  if ( open_ )
+    throw RtError( "RtFilePlayer::open: a file is already open.", RtError::INVALID_USE );
+
+  fd_ = ::open( filename.c_str(), O_RDONLY );
+  if ( fd_ < 0 ) {
+    std::string message = "RtFilePlayer::open: error opening file " + filename + " (" + strerror( errno ) + ").";
+    throw RtError( message, RtError::SYSTEM_ERROR );
+  }
+
+  if ( !readHeader() ) {
+    ::close( fd_ );
+    fd_ = -1;
+    throw RtError( "RtFilePlayer::open: " + filename + " is not a supported WAV or CAF file.", RtError::INVALID_PARAMETER );
+  }
+
+  start( filename, aheadSeconds, historySeconds );
+}
+
+void RtFilePlayer :: openRaw( const std::string &filename, unsigned int channels, unsigned int sampleRate,
+                              RtAudioFormat format, double aheadSeconds, double historySeconds )
+{
+  if ( open_ )
+    throw RtError( "RtFilePlayer::openRaw: a file is already open.", RtError::INVALID_USE );
+
+  if ( format == RTAUDIO_SINT8 ) setSampleType( 8, 1, false );
+  else if ( format == RTAUDIO_SINT16 ) setSampleType( 16, 2, false );
+  else if ( format == RTAUDIO_SINT24 ) setSampleType( 24, 4, false );
+  else if ( format == RTAUDIO_SINT24_PACKED ) setSampleType( 24, 3, false );
+  else if ( format == RTAUDIO_SINT32 ) setSampleType( 32, 4, false );
+  else if ( format == RTAUDIO_FLOAT32 ) setSampleType( 32, 4, true );
+  else if ( format == RTAUDIO_FLOAT64 ) setSampleType( 64, 8, true );
+  else
+    throw RtError( "RtFilePlayer::openRaw: unsupported sample format.", RtError::INVALID_PARAMETER );
+  if ( channels == 0 || sampleRate == 0 )
+    throw RtError( "RtFilePlayer::openRaw: invalid channel count or sample rate.", RtError::INVALID_PARAMETER );
+
+  fd_ = ::open( filename.c_str(), O_RDONLY );
+  struct stat info;
+  if ( fd_ < 0 || fstat( fd_, &info ) ) {
+    std::string message = "RtFilePlayer::openRaw: error opening file " + filename + " (" + strerror( errno ) + ").";
+    if ( fd_ >= 0 ) ::close( fd_ );
+    fd_ = -1;
+    throw RtError( message, RtError::SYSTEM_ERROR );
+  }
+
+  fileChannels_ = channels;
+  sampleRate_ = sampleRate;
+  bigEndian_ = hostIsBigEndian();
+  dataOffset_ = 0;
+  totalFrames_ = (unsigned long long) info.st_size / ( channels * sampleBytes_ );
+  start( filename, aheadSeconds, historySeconds );
+}
+
+void RtFilePlayer :: start( const std::string &filename, double aheadSeconds, double historySeconds )
+{
+  aheadFrames_ = (unsigned long long) ( std::max( aheadSeconds, 0.0 ) * sampleRate_ ) + RTFILEPLAYER_CHUNK_FRAMES;
+  historyFrames_ = (unsigned long long) ( std::max( historySeconds, 0.0 ) * sampleRate_ );
+  unsigned long long size = 1;
+  while ( size < aheadFrames_ + historyFrames_ + RTFILEPLAYER_CHUNK_FRAMES ) size <<= 1;
+  cacheMask_ = size - 1;
+
+  try {
+    cache_.assign( fileChannels_, std::vector<float>( size, 0.0f ) );
+    chunk_.resize( RTFILEPLAYER_CHUNK_FRAMES * fileChannels_ * sampleBytes_ );
+  }
+  catch ( std::bad_alloc & ) {
+    ::close( fd_ );
+    fd_ = -1;
+    throw RtError( "RtFilePlayer::open: error allocating cache memory for " + filename + ".", RtError::MEMORY_ERROR );
+  }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise( fd_, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+
+  position_ = 0;
+  start_ = 0;
+  end_ = 0;
+  seekRequest_ = 0;
+  seekGeneration_ = 0;
+  servedGeneration_ = 0;
+  underrunFrames_ = 0;
+  open_ = true;
+
+  pthread_mutex_lock( &prefetchThread.mutex );
+  prefetchThread.players.push_back( this );
+  if ( !prefetchThread.running ) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+    prefetchThread.running = ( pthread_create( &thread, &attr, prefetchHandler, NULL ) == 0 );
+    pthread_attr_destroy( &attr );
+    if ( !prefetchThread.running ) {
+      prefetchThread.players.pop_back();
+      pthread_mutex_unlock( &prefetchThread.mutex );
+      close();
+      throw RtError( "RtFilePlayer::open: error creating prefetch thread.", RtError::THREAD_ERROR );
+    }
+  }
+  pthread_mutex_unlock( &prefetchThread.mutex );
+}
+
+void RtFilePlayer :: close( void )
+{
+  // Once the player is out of the list, the prefetch thread no longer
+  // touches it (it holds the mutex while it visits the players).
+  pthread_mutex_lock( &prefetchThread.mutex );
+  std::vector<RtFilePlayer *>::iterator it;
+  it = std::find( prefetchThread.players.begin(), prefetchThread.players.end(), this );
+  if ( it != prefetchThread.players.end() ) prefetchThread.players.erase( it );
+  pthread_mutex_unlock( &prefetchThread.mutex );
+
+  open_ = false;
+  if ( fd_ >= 0 ) ::close( fd_ );
+  fd_ = -1;
+  cache_.clear();
+}
+
+void RtFilePlayer :: seek( unsigned long long frame )
+{
+  // The request is picked up by the next process() or render() call,
+  // so that position_ only ever has one writer.  Zero means no request.
+  seekRequest_.store( std::min( frame, totalFrames_.load() ) + 1, std::memory_order_release );
+}
+
+unsigned long long RtFilePlayer :: getBufferedFrames( void ) const
+{
+  if ( servedGeneration_.load( std::memory_order_acquire ) != seekGeneration_.load() ) return 0;
+  unsigned long long position = position_.load();
+  unsigned long long end = end_.load( std::memory_order_acquire );
+  return ( end > position ) ? end - position : 0;
+}
+
+unsigned int RtFilePlayer :: beginRead( unsigned int nFrames, unsigned long long &first )
+{
+  first = position_.load( std::memory_order_relaxed );
+  if ( !open_ ) return 0;
+
+  unsigned long generation = seekGeneration_.load( std::memory_order_relaxed );
+  bool valid = ( servedGeneration_.load( std::memory_order_acquire ) == generation );
+  unsigned long long position = first;
+
+  unsigned long long request = seekRequest_.exchange( 0, std::memory_order_acquire );
+  if ( request ) {
+    unsigned long long target = request - 1;
+    // Frames in the history behind the current position have not been
+    // overwritten yet, nor have frames up to end_.
+    unsigned long long low = ( position > historyFrames_ ) ? position - historyFrames_ : 0;
+    low = std::max( low, start_.load( std::memory_order_relaxed ) );
+    valid = valid && target >= low && target <= end_.load( std::memory_order_acquire );
+    first = position = target;
+    position_.store( position, std::memory_order_release );
+    if ( !valid ) {
+      // Cache miss: have the prefetch thread restart at the new position.
+      seekGeneration_.store( generation + 1, std::memory_order_release );
+      return 0;
+    }
+  }
+  if ( !valid ) return 0;
+
+  unsigned long long end = end_.load( std::memory_order_acquire );
+  return (unsigned int) std::min( (unsigned long long) nFrames, ( end > position ) ? end - position : 0 );
+}
+
+void RtFilePlayer :: process( float ** /*input*/, float **output, unsigned int nFrames )
+{
+  unsigned long long first = 0;
+  unsigned int count = beginRead( nFrames, first );
+
+  if ( count > 0 ) {
+    // At most two contiguous pieces of the cache ring.
+    unsigned long long slot = first & cacheMask_;
+    unsigned int piece = (unsigned int) std::min( (unsigned long long) count, cacheMask_ + 1 - slot );
+    for ( unsigned int k=0; k<outputChannels_; k++ ) {
+      const float *cache = &cache_[k % fileChannels_][0];
+      memcpy( output[k], cache + slot, piece * sizeof( float ) );
+      memcpy( output[k] + piece, cache, ( count - piece ) * sizeof( float ) );
+    }
+  }
+  for ( unsigned int k=0; k<outputChannels_; k++ )
+    memset( output[k] + count, 0, ( nFrames - count ) * sizeof( float ) );
+
+  if ( !open_ ) return;
+  position_.store( first + count, std::memory_order_release );
+  if ( count < nFrames && first + count < totalFrames_ )
+    underrunFrames_.fetch_add( nFrames - count, std::memory_order_relaxed );
+}
+
+void RtFilePlayer :: render( void *outputBuffer, unsigned int nFrames, RtAudioFormat format )
+{
+  unsigned long long first = 0;
+  unsigned int count = beginRead( nFrames, first );
+  unsigned int i, k, nChannels = outputChannels_;
+
+  if ( format == RTAUDIO_FLOAT32 ) {
+    float *out = (float *) outputBuffer;
+    for ( i=0; i<count; i++ ) {
+      unsigned long long slot = ( first + i ) & cacheMask_;
+      for ( k=0; k<nChannels; k++ ) *out++ = cache_[k % fileChannels_][slot];
+    }
+    memset( out, 0, ( nFrames - count ) * nChannels * sizeof( float ) );
+  }
+  else {
+    double *out = (double *) outputBuffer;
+    for ( i=0; i<count; i++ ) {
+      unsigned long long slot = ( first + i ) & cacheMask_;
+      for ( k=0; k<nChannels; k++ ) *out++ = cache_[k % fileChannels_][slot];
+    }
+    memset( out, 0, ( nFrames - count ) * nChannels * sizeof( double ) );
+  }
+
+  if ( !open_ ) return;
+  position_.store( first + count, std::memory_order_release );
+  if ( count < nFrames && first + count < totalFrames_ )
+    underrunFrames_.fetch_add( nFrames - count, std::memory_order_relaxed );
+}
+
+bool RtFilePlayer :: prefetch( void )
+{
+  unsigned long generation = seekGeneration_.load( std::memory_order_acquire );
+  if ( generation != servedGeneration_.load( std::memory_order_relaxed ) ) {
+    // Restart the cache at the seek target.  position_ does not move
+    // while the cache is invalid.
+    unsigned long long target = position_.load( std::memory_order_acquire );
+    start_.store( target, std::memory_order_relaxed );
+    end_.store( target, std::memory_order_relaxed );
+    servedGeneration_.store( generation, std::memory_order_release );
+    return true;
+  }
+
+  // Only frames behind the history may be overwritten.
+  unsigned long long position = position_.load( std::memory_order_acquire );
+  unsigned long long end = end_.load( std::memory_order_relaxed );
+  unsigned long long keep = ( position > historyFrames_ ) ? position - historyFrames_ : 0;
+  unsigned long long limit = std::min( position + aheadFrames_, keep + cacheMask_ + 1 );
+  limit = std::min( limit, totalFrames_.load() );
+  if ( end >= limit ) return false;
+
+  unsigned int frameBytes = fileChannels_ * sampleBytes_;
+  unsigned int nFrames = (unsigned int) std::min( limit - end, (unsigned long long) RTFILEPLAYER_CHUNK_FRAMES );
+  ssize_t result = pread( fd_, &chunk_[0], nFrames * frameBytes, (off_t) ( dataOffset_ + end * frameBytes ) );
+  if ( result < (ssize_t) frameBytes ) {
+    // Read error, or the file is shorter than its header claims.
+    // Nothing more can be played from here on.
+    if ( result >= 0 ) totalFrames_ = end;
+    return false;
+  }
+  nFrames = (unsigned int) ( result / frameBytes );
+
+  // The chunk overwrites the oldest frames of the ring; move start_
+  // past them first, so that a backward seek no longer lands there.
+  unsigned long long size = cacheMask_ + 1;
+  if ( end + nFrames > start_.load( std::memory_order_relaxed ) + size )
+    start_.store( end + nFrames - size );
+  decode( &chunk_[0], end, nFrames );
+
+  // Drop the chunk if a seek has invalidated the cache meanwhile.
+  if ( seekGeneration_.load( std::memory_order_acquire ) == generation )
+    end_.store( end + nFrames, std::memory_order_release );
+  return true;
+}
+
+void RtFilePlayer :: decode( const unsigned char *data, unsigned long long first, unsigned int nFrames )
+{
+  const float scale8 = 1.0f / 128.0f;
+  const float scale16 = 1.0f / 32768.0f;
+  const float scale24 = 1.0f / 8388608.0f;
+  const double scale32 = 1.0 / 2147483648.0;
+  unsigned long long ( *get )( const unsigned char *, int ) = bigEndian_ ? getBig : getLittle;
+
+  for ( unsigned int i=0; i<nFrames; i++ ) {
+    unsigned long long slot = ( first + i ) & cacheMask_;
+    for ( unsigned int k=0; k<fileChannels_; k++, data += sampleBytes_ ) {
+      float sample;
+      switch ( sampleType_ ) {
+      case SAMPLE_INT8:
+        sample = (signed char) data[0] * scale8;
+        break;
+      case SAMPLE_UINT8:
+        sample = ( (int) data[0] - 128 ) * scale8;
+        break;
+      case SAMPLE_INT16:
+        sample = (short) get( data, 2 ) * scale16;
+        break;
+      case SAMPLE_INT24:
+        sample = ( (int) ( get( data, 3 ) << 8 ) >> 8 ) * scale24;
+        break;
+      case SAMPLE_INT24_LOW:
+        sample = ( (int) ( get( data, 4 ) << 8 ) >> 8 ) * scale24;
+        break;
+      case SAMPLE_INT32:
+        sample = (float) ( (int) get( data, 4 ) * scale32 );
+        break;
+      case SAMPLE_FLOAT32: {
+        unsigned int bits = (unsigned int) get( data, 4 );
+        memcpy( &sample, &bits, 4 );
+        break;
+      }
+      default: {
+        unsigned long long bits = get( data, 8 );
+        double value;
+        memcpy( &value, &bits, 8 );
+        sample = (float) value;
+      }
+      }
+      cache_[k][slot] = sample;
+    }
+  }
+}
+
+bool RtFilePlayer :: setSampleType( unsigned int bits, unsigned int bytes, bool isFloat )
+{
+  sampleBytes_ = bytes;
+  if ( isFloat ) {
+    if ( bits == 32 && bytes == 4 ) sampleType_ = SAMPLE_FLOAT32;
+    else if ( bits == 64 && bytes == 8 ) sampleType_ = SAMPLE_FLOAT64;
+    else return false;
+  }
+  else if ( bits == 8 && bytes == 1 ) sampleType_ = SAMPLE_INT8;
+  else if ( bits == 16 && bytes == 2 ) sampleType_ = SAMPLE_INT16;
+  else if ( bits == 24 && bytes == 3 ) sampleType_ = SAMPLE_INT24;
+  else if ( bits == 24 && bytes == 4 ) sampleType_ = SAMPLE_INT24_LOW;
+  else if ( bits == 32 && bytes == 4 ) sampleType_ = SAMPLE_INT32;
+  else return false;
+  return true;
+}
+
+bool RtFilePlayer :: readHeader( void )
+{
+  struct stat info;
+  unsigned char magic[4];
+  if ( fstat( fd_, &info ) || !readAt( fd_, magic, 4, 0 ) ) return false;
+
+  if ( !memcmp( magic, "RIFF", 4 ) || !memcmp( magic, "RF64", 4 ) )
+    return readWav( (unsigned long long) info.st_size );
+  if ( !memcmp( magic, "caff", 4 ) )
+    return readCaf( (unsigned long long) info.st_size );
+  return false;
+}
+
+bool RtFilePlayer :: readWav( unsigned long long fileSize )
+{
+  unsigned char header[40];
+  if ( !readAt( fd_, header, 12, 0 ) || memcmp( header + 8, "WAVE", 4 ) ) return false;
+
+  bool haveFormat = false;
+  unsigned long long dataSize64 = 0;
+  unsigned long long offset = 12;
+  while ( offset + 8 <= fileSize ) {
+    if ( !readAt( fd_, header, 8, offset ) ) return false;
+    unsigned long long size = getLittle( header + 4, 4 );
+
+    if ( !memcmp( header, "ds64", 4 ) ) {
+      if ( size < 16 || !readAt( fd_, header, 16, offset + 8 ) ) return false;
+      dataSize64 = getLittle( header + 8, 8 );
+    }
+    else if ( !memcmp( header, "fmt ", 4 ) ) {
+      if ( size < 16 || !readAt( fd_, header, std::min( size, 40ULL ), offset + 8 ) ) return false;
+      unsigned int tag = (unsigned int) getLittle( header, 2 );
+      fileChannels_ = (unsigned int) getLittle( header + 2, 2 );
+      sampleRate_ = (unsigned int) getLittle( header + 4, 4 );
+      unsigned int blockAlign = (unsigned int) getLittle( header + 12, 2 );
+      unsigned int bits = (unsigned int) getLittle( header + 14, 2 );
+      if ( tag == 0xFFFE && size >= 40 ) tag = (unsigned int) getLittle( header + 24, 2 );
+      if ( fileChannels_ == 0 || sampleRate_ == 0 || ( tag != 1 && tag != 3 ) ) return false;
+      // Containers are whole bytes; valid bits may be fewer.
+      if ( !setSampleType( ( tag == 3 ) ? bits : ( bits + 7 ) / 8 * 8, blockAlign / fileChannels_, tag == 3 ) )
+        return false;
+      if ( sampleType_ == SAMPLE_INT8 ) sampleType_ = SAMPLE_UINT8;
+      haveFormat = true;
+    }
+    else if ( !memcmp( header, "data", 4 ) ) {
+      if ( !haveFormat ) return false;
+      dataOffset_ = offset + 8;
+      if ( size == 0xFFFFFFFFULL && dataSize64 ) size = dataSize64;
+      // A file whose header was never completed (e.g. an interrupted
+      // recording) plays to the end.
+      if ( size == 0 || dataOffset_ + size > fileSize ) size = fileSize - dataOffset_;
+      totalFrames_ = size / ( fileChannels_ * sampleBytes_ );
+      bigEndian_ = false;
+      return true;
+    }
+    offset += 8 + size + ( size & 1 );
+  }
+
+  return false;
+}
+
+bool RtFilePlayer :: readCaf( unsigned long long fileSize )
+{
+  unsigned char header[32];
+  bool haveFormat = false;
+  unsigned long long offset = 8;
+  while ( offset + 12 <= fileSize ) {
+    if ( !readAt( fd_, header, 12, offset ) ) return false;
+    long long size = (long long) getBig( header + 4, 8 );
+
+    if ( !memcmp( header, "desc", 4 ) ) {
+      if ( size < 32 || !readAt( fd_, header, 32, offset + 12 ) ) return false;
+      union { double value; unsigned long long bits; } rate;
+      rate.bits = getBig( header, 8 );
+      unsigned int flags = (unsigned int) getBig( header + 12, 4 );
+      unsigned int bytesPerPacket = (unsigned int) getBig( header + 16, 4 );
+      unsigned int framesPerPacket = (unsigned int) getBig( header + 20, 4 );
+      fileChannels_ = (unsigned int) getBig( header + 24, 4 );
+      unsigned int bits = (unsigned int) getBig( header + 28, 4 );
+      sampleRate_ = (unsigned int) ( rate.value + 0.5 );
+      if ( memcmp( header + 8, "lpcm", 4 ) || framesPerPacket != 1 || fileChannels_ == 0 || sampleRate_ == 0 )
+        return false;
+      if ( !setSampleType( bits, bytesPerPacket / fileChannels_, flags & 1 ) ) return false;
+      bigEndian_ = !( flags & 2 );
+      haveFormat = true;
+    }
+    else if ( !memcmp( header, "data", 4 ) ) {
+      if ( !haveFormat ) return false;
+      // The data chunk starts with a 4-byte edit count.  A size of -1
+      // means the data runs to the end of the file.
+      dataOffset_ = offset + 16;
+      unsigned long long bytes = fileSize - dataOffset_;
+      if ( size >= 4 && dataOffset_ + size - 4 <= fileSize ) bytes = size - 4;
+      totalFrames_ = bytes / ( fileChannels_ * sampleBytes_ );
+      return true;
+    }
+    if ( size < 0 ) return false;
+    offset += 12 + size;
+  }
+
+  return false;
+}
@@ -0,0 +1,176 @@
+/************************************************************************/
+/*! \class RtFilePlayer
+    \brief Disk streaming playback with read-ahead.
+
+    RtFilePlayer plays WAV (including WAVE_FORMAT_EXTENSIBLE and
+    RF64), CAF and raw files without doing any file I/O in the audio
+    callback.  A prefetch thread, shared by all players, reads and
+    decodes each file into a per-player float cache, keeping a number
+    of seconds decoded ahead of the play position.  The callback only
+    copies from the cache, so hundreds of tracks can stream at once.
+
+    The cache also keeps some of the most recently played audio.  A
+    seek() into the decoded range ahead or into this history is
+    served immediately from the cache.  Any other seek restarts the
+    read-ahead at the new position, and the player outputs silence
+    until data arrives.
+
+    The player always produces the number of channels given to the
+    constructor.  File channel \e k % fileChannels feeds output
+    channel \e k, so a mono file plays on all channels.  No sample
+    rate conversion is done.  The player is an RtGraphNode, so it can
+    be mixed by an RtGraph, or it can render() directly into an
+    RtAudio buffer.
+*/
+/************************************************************************/
+
+/*!
+  \file RtFilePlayer.h
+ */
+
+#ifndef __RTFILEPLAYER_H
+#define __RTFILEPLAYER_H
+
+#include "RtGraph.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+class RtFilePlayer : public RtGraphNode
+{
+ public:
+
+  //! The constructor.
+  RtFilePlayer( unsigned int channels );
+
+  //! The destructor closes an open file.
+  ~RtFilePlayer( void );
+
+  //! Opens a WAV or CAF file (recognized by its header) for playback.
+  /*!
+    \c aheadSeconds is the amount of audio kept decoded ahead of the
+    play position, \c historySeconds the amount of played audio kept
+    for backward seeks.  Playback starts at the beginning of the
+    file.  An RtError is thrown if a file is already open (type =
+    RtError::INVALID_USE), if the file cannot be read (type =
+    RtError::SYSTEM_ERROR), or if its format is not supported (type =
+    RtError::INVALID_PARAMETER).
+  */
+  void open( const std::string &filename, double aheadSeconds = 2.0, double historySeconds = 1.0 );
+
+  //! Opens a headerless file of interleaved samples in host byte order.
+  /*!
+    \c format is one of the RtAudioFormat types.  Otherwise the same
+    as open().
+  */
+  void openRaw( const std::string &filename, unsigned int channels, unsigned int sampleRate,
+                RtAudioFormat format, double aheadSeconds = 2.0, double historySeconds = 1.0 );
+
+  //! Stops the prefetching and closes the file.
+  /*!
+    Must not be called while another thread is inside process() or
+    render().
+  */
+  void close( void );
+
+  //! Returns true while a file is open.
+  bool isOpen( void ) const { return open_; };
+
+  //! Requests playback to continue from \c frame.  Safe to call while playing.
+  void seek( unsigned long long frame );
+
+  //! Renders \c nFrames into non-interleaved \c output buffers (RtGraphNode interface).
+  void process( float **input, float **output, unsigned int nFrames );
+
+  //! Renders \c nFrames of interleaved samples into an RtAudio buffer.
+  /*!
+    \c format must be RTAUDIO_FLOAT32 or RTAUDIO_FLOAT64, and \c
+    outputBuffer must hold getOutputChannels() channels.  Frames
+    which are not available (end of file, or data not read yet) are
+    silent.
+  */
+  void render( void *outputBuffer, unsigned int nFrames, RtAudioFormat format );
+
+  //! Returns the play position in frames.
+  unsigned long long getPosition( void ) const { return position_.load(); };
+
+  //! Returns the length of the file in frames.
+  unsigned long long getLength( void ) const { return totalFrames_; };
+
+  //! Returns the sample rate of the file.
+  unsigned int getSampleRate( void ) const { return sampleRate_; };
+
+  //! Returns the number of channels in the file.
+  unsigned int getFileChannels( void ) const { return fileChannels_; };
+
+  //! Returns true once the play position has reached the end of the file.
+  bool isFinished( void ) const { return open_ && position_.load() >= totalFrames_; };
+
+  //! Returns the number of frames decoded ahead of the play position.
+  unsigned long long getBufferedFrames( void ) const;
+
+  //! Returns the number of frames output as silence because data had not been read in time.
+  unsigned long long getUnderrunFrames( void ) const { return underrunFrames_.load(); };
+
+  //! Decodes one chunk ahead of the play position, if needed.
+  /*!
+    This function is intended for use by the prefetch thread only.
+    Returns true if it did any work.
+  */
+  bool prefetch( void );
+
+ protected:
+
+  enum SampleType {
+    SAMPLE_INT8,
+    SAMPLE_UINT8,      // 8-bit WAV
+    SAMPLE_INT16,
+    SAMPLE_INT24,      // packed in 3 bytes
+    SAMPLE_INT24_LOW,  // lower 3 bytes of 4 (RTAUDIO_SINT24)
+    SAMPLE_INT32,
+    SAMPLE_FLOAT32,
+    SAMPLE_FLOAT64
+  };
+
+  void start( const std::string &filename, double aheadSeconds, double historySeconds );
+  bool readHeader( void );
+  bool readWav( unsigned long long fileSize );
+  bool readCaf( unsigned long long fileSize );
+  bool setSampleType( unsigned int bits, unsigned int bytes, bool isFloat );
+  unsigned int beginRead( unsigned int nFrames, unsigned long long &first );
+  void decode( const unsigned char *data, unsigned long long first, unsigned int nFrames );
+
+  int fd_;
+  std::atomic<bool> open_;
+  unsigned int fileChannels_;
+  unsigned int sampleRate_;
+  SampleType sampleType_;
+  unsigned int sampleBytes_;
+  bool bigEndian_;
+  unsigned long long dataOffset_;
+  std::atomic<unsigned long long> totalFrames_;
+
+  // The cache holds planar float frames in a power-of-two ring, indexed
+  // by file frame number.
+  std::vector< std::vector<float> > cache_;
+  unsigned long long cacheMask_;
+  unsigned long long aheadFrames_;
+  unsigned long long historyFrames_;
+  std::vector<unsigned char> chunk_;
+
+  // position_ is only changed by the thread calling process()/render();
+  // start_ and end_, the range of frames in the cache, are only
+  // changed by the prefetch thread.  A seek outside the cache
+  // increments seekGeneration_, and the cache is invalid until the
+  // prefetch thread has restarted at position_ and copied the
+  // generation into servedGeneration_.
+  std::atomic<unsigned long long> position_;
+  std::atomic<unsigned long long> start_;
+  std::atomic<unsigned long long> end_;
+  std::atomic<unsigned long long> seekRequest_;
+  std::atomic<unsigned long> seekGeneration_;
+  std::atomic<unsigned long> servedGeneration_;
+  std::atomic<unsigned long long> underrunFrames_;
+};
+
+#endif
@@ -0,0 +1,124 @@
+/************************************************************************/
+/*! \class RtFilterBank
+    \brief Bank of state-variable filters processed in parallel lanes.
+
+    RtFilterBank runs one second-order filter per lane.  A lane can
+    filter its own channel, or several lanes can filter the same
+    input channel as the bands of an equalizer or crossover.  The
+    filters are trapezoidal state-variable filters, which give the
+    usual biquad responses (low/high/band pass, notch, all pass, peak
+    and shelves) and stay well-behaved while their parameters change.
+
+    The filter state and parameters are stored as structures of
+    arrays and the lanes are processed in groups of
+    RTFILTERBANK_WIDTH.  The loop over the lanes of a group has no
+    dependencies, so the compiler turns each group into one or two
+    vector operations (e.g. with -mavx2 or -mavx512f), and the cost of
+    a lane is a fraction of the cost of a scalar filter.
+
+    setFilter() may be called from any thread while processing, but
+    from only one thread at a time.  The new parameters are picked up
+    by the next call of process() and ramped over that block, so
+    changes do not cause zipper noise.
+*/
+/************************************************************************/
+
+/*!
+  \file RtFilterBank.h
+ */
+
+#ifndef __RTFILTERBANK_H
+#define __RTFILTERBANK_H
+
+#include "RtGraph.h"
+#include <atomic>
+#include <vector>
+
+//! Number of lanes processed together.  A multiple of the vector width of the target.
+const unsigned int RTFILTERBANK_WIDTH = 8;
+
+class RtFilterBank : public RtGraphNode
+{
+ public:
+
+  //! Filter responses.
+  enum FilterType {
+    LOWPASS,     /*!< 12 dB/octave low pass. */
+    HIGHPASS,    /*!< 12 dB/octave high pass. */
+    BANDPASS,    /*!< Band pass with 0 dB peak gain. */
+    NOTCH,       /*!< Band reject. */
+    ALLPASS,     /*!< All pass (phase shift only). */
+    PEAK,        /*!< Peaking equalizer, \c gain dB at the center frequency. */
+    LOWSHELF,    /*!< Low shelf, \c gain dB below the frequency. */
+    HIGHSHELF    /*!< High shelf, \c gain dB above the frequency. */
+  };
+
+  //! The constructor.
+  /*!
+    Lane \e k filters input channel \e k % \c inputChannels into
+    output channel \e k; \c inputChannels = 0 gives every lane its
+    own input channel.  All lanes start as pass-through.  An RtError
+    (type = RtError::INVALID_PARAMETER) is thrown if \c lanes is
+    zero.
+  */
+  RtFilterBank( unsigned int lanes, double sampleRate, unsigned int inputChannels = 0 );
+
+  //! The destructor.
+  ~RtFilterBank( void );
+
+  //! Sets the filter of \c lane.  Safe to call while processing.
+  /*!
+    \c frequency is in Hz and is clamped below the Nyquist frequency.
+    \c q sets the bandwidth (0.7071 gives Butterworth low and high
+    passes), and \c gain (in dB) applies to the peak and shelf types.
+    An RtError (type = RtError::INVALID_PARAMETER) is thrown for an
+    invalid lane, frequency or q.
+  */
+  void setFilter( unsigned int lane, FilterType type, double frequency,
+                  double q = 0.7071, double gain = 0.0 );
+
+  //! Sets \c lane to pass its input through unchanged.  Safe to call while processing.
+  void setBypass( unsigned int lane );
+
+  //! Clears the filter state and jumps to the current parameters.
+  /*!
+    Must not be called while another thread is inside process().
+  */
+  void reset( void );
+
+  //! Filters \c nFrames of \c input into \c output (RtGraphNode interface).
+  /*!
+    \c input and \c output may be the same buffers when each lane has
+    its own input channel.
+  */
+  void process( float **input, float **output, unsigned int nFrames );
+
+  //! Returns the number of lanes.
+  unsigned int getLanes( void ) const { return lanes_; };
+
+ protected:
+
+  // Parameters written by setFilter() and read by process(), guarded
+  // by a sequence count which is odd while they are being written.
+  struct Target {
+    std::atomic<unsigned int> sequence;
+    std::atomic<float> g, k, m0, m1, m2;
+  };
+
+  void setParameters( unsigned int lane, double g, double k, double m0, double m1, double m2 );
+
+  unsigned int lanes_;
+  unsigned int paddedLanes_;
+  double sampleRate_;
+  Target *targets_;
+
+  // One entry per lane, padded to a multiple of RTFILTERBANK_WIDTH.
+  // g and k are the frequency and damping coefficients, m0, m1 and m2
+  // mix the input, band and low pass outputs, and s1 and s2 are the
+  // integrator states.
+  std::vector<float> g_, k_, m0_, m1_, m2_;
+  std::vector<float> nextG_, nextK_, nextM0_, nextM1_, nextM2_;
+  std::vector<float> s1_, s2_;
+};
+
+#endif
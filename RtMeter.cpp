@@ -0,0 +1,291 @@
+/************************************************************************/
+/*! \class RtMeter
+    \brief Peak, RMS and loudness meters for RtAudio streams.
+
+    See RtMeter.h for an overview.
+*/
+/************************************************************************/
+
+#include "RtMeter.h"
+#include <math.h>
+#include <algorithm>
+
+// Number of 100 ms blocks in the momentary and short-term windows.
+const unsigned int RTMETER_MOMENTARY_BLOCKS = 4;
+const unsigned int RTMETER_BLOCKS = 30;
+
+// Loudness histogram of the gating blocks, from the absolute gate up.
+const double RTMETER_ABSOLUTE_GATE = -70.0;
+const double RTMETER_RELATIVE_GATE = -10.0;
+const double RTMETER_HISTOGRAM_STEP = 0.1;
+const unsigned int RTMETER_HISTOGRAM_BINS = 1000;
+
+static float loudnessOf( double energy )
+{
+  return (float) ( -0.691 + 10.0 * log10( energy ) );
+}
+
+RtMeter :: RtMeter( unsigned int channels, unsigned int sampleRate )
+  : channels_( channels ), sampleRate_( sampleRate ), blockFrames_( 0 ), blockPosition_( 0 ),
+    blockIndex_( 0 ), blockCount_( 0 ), highestPeak_( 0.0 ), resetRequest_( false ), peak_( 0 ),
+    rms_( 0 ), loudness_( 0 ), updates_( 0 )
+{
+  if ( channels == 0 || sampleRate == 0 )
+    throw RtError( "RtMeter: invalid channel count or sample rate.", RtError::INVALID_PARAMETER );
+
+  blockFrames_ = std::max( sampleRate / 10, 1u );
+  weight_.assign( channels, 1.0 );
+
+  // The K-weighting filters of BS.1770 are specified at 48 kHz; these
+  // are their analog prototypes mapped to the actual sample rate.
+  double k = tan( M_PI * 1681.974450955533 / sampleRate );
+  double q = 0.7071752369554196;
+  double vh = pow( 10.0, 3.999843853973347 / 20.0 );
+  double vb = pow( vh, 0.4996667741545416 );
+  double a0 = 1.0 + k / q + k * k;
+  shelfB_[0] = (float) ( ( vh + vb * k / q + k * k ) / a0 );
+  shelfB_[1] = (float) ( 2.0 * ( k * k - vh ) / a0 );
+  shelfB_[2] = (float) ( ( vh - vb * k / q + k * k ) / a0 );
+  shelfA_[0] = (float) ( 2.0 * ( k * k - 1.0 ) / a0 );
+  shelfA_[1] = (float) ( ( 1.0 - k / q + k * k ) / a0 );
+
+  k = tan( M_PI * 38.13547087602444 / sampleRate );
+  q = 0.5003270373238773;
+  a0 = 1.0 + k / q + k * k;
+  passB_[0] = 1.0f;
+  passB_[1] = -2.0f;
+  passB_[2] = 1.0f;
+  passA_[0] = (float) ( 2.0 * ( k * k - 1.0 ) / a0 );
+  passA_[1] = (float) ( ( 1.0 - k / q + k * k ) / a0 );
+
+  peak_ = new std::atomic<float>[channels];
+  rms_ = new std::atomic<float>[channels];
+  loudness_ = new std::atomic<float>[channels];
+  histogramEnergy_.resize( RTMETER_HISTOGRAM_BINS );
+  histogramCount_.resize( RTMETER_HISTOGRAM_BINS );
+  clear();
+}
+
+RtMeter :: ~RtMeter( void )
+{
+  delete [] peak_;
+  delete [] rms_;
+  delete [] loudness_;
+}
+
+void RtMeter :: setChannelWeight( unsigned int channel, float weight )
+{
+  if ( channel >= channels_ )
+    throw RtError( "RtMeter::setChannelWeight: invalid channel.", RtError::INVALID_PARAMETER );
+  weight_[channel] = weight;
+}
+
+void RtMeter :: reset( void )
+{
+  resetRequest_.store( true, std::memory_order_release );
+}
+
+void RtMeter :: clear( void )
+{
+  shelf1_.assign( channels_, 0.0 );
+  shelf2_.assign( channels_, 0.0 );
+  pass1_.assign( channels_, 0.0 );
+  pass2_.assign( channels_, 0.0 );
+  currentPeak_.assign( channels_, 0.0 );
+  currentSquares_.assign( channels_, 0.0 );
+  currentWeighted_.assign( channels_, 0.0 );
+  blockPeak_.assign( RTMETER_BLOCKS * channels_, 0.0 );
+  blockSquares_.assign( RTMETER_BLOCKS * channels_, 0.0 );
+  blockWeighted_.assign( RTMETER_BLOCKS * channels_, 0.0 );
+  std::fill( histogramEnergy_.begin(), histogramEnergy_.end(), 0.0 );
+  std::fill( histogramCount_.begin(), histogramCount_.end(), 0 );
+  blockPosition_ = 0;
+  blockIndex_ = 0;
+  blockCount_ = 0;
+  highestPeak_ = 0.0;
+
+  for ( unsigned int c=0; c<channels_; c++ ) {
+    peak_[c].store( -HUGE_VALF );
+    rms_[c].store( -HUGE_VALF );
+    loudness_[c].store( -HUGE_VALF );
+  }
+  maxPeak_.store( -HUGE_VALF );
+  momentary_.store( -HUGE_VALF );
+  shortTerm_.store( -HUGE_VALF );
+  integrated_.store( -HUGE_VALF );
+}
+
+void RtMeter :: process( const void *buffer, unsigned int nFrames, RtAudioFormat format, bool interleaved )
+{
+  if ( format != RTAUDIO_FLOAT32 && format != RTAUDIO_FLOAT64 ) return;
+
+  // clear() only reassigns vectors of the same sizes, so it does not
+  // allocate.
+  if ( resetRequest_.exchange( false, std::memory_order_acquire ) ) clear();
+
+  unsigned int offset = 0;
+  while ( offset < nFrames ) {
+    unsigned int count = std::min( nFrames - offset, blockFrames_ - blockPosition_ );
+    if ( format == RTAUDIO_FLOAT32 ) {
+      const float *samples = (const float *) buffer;
+      if ( interleaved ) measureInterleaved( samples + offset * channels_, count );
+      else measurePlanar( samples + offset, count, nFrames );
+    }
+    else {
+      const double *samples = (const double *) buffer;
+      if ( interleaved ) measureInterleaved( samples + offset * channels_, count );
+      else measurePlanar( samples + offset, count, nFrames );
+    }
+    offset += count;
+    blockPosition_ += count;
+    if ( blockPosition_ == blockFrames_ ) {
+      endBlock();
+      blockPosition_ = 0;
+    }
+  }
+}
+
+template <class T>
+void RtMeter :: measureInterleaved( const T *buffer, unsigned int nFrames )
+{
+  unsigned int nChannels = channels_;
+  float *shelf1 = &shelf1_[0], *shelf2 = &shelf2_[0], *pass1 = &pass1_[0], *pass2 = &pass2_[0];
+  float *peak = &currentPeak_[0], *squares = &currentSquares_[0], *weighted = &currentWeighted_[0];
+  float sb0 = shelfB_[0], sb1 = shelfB_[1], sb2 = shelfB_[2], sa1 = shelfA_[0], sa2 = shelfA_[1];
+  float pa1 = passA_[0], pa2 = passA_[1];
+
+  // One frame at a time, all channels in the inner loop (transposed
+  // direct form II biquads; the high pass numerator is 1, -2, 1).
+  for ( unsigned int i=0; i<nFrames; i++ ) {
+    const T *frame = buffer + i * nChannels;
+    for ( unsigned int c=0; c<nChannels; c++ ) {
+      float x = (float) frame[c];
+      peak[c] = std::max( peak[c], fabsf( x ) );
+      squares[c] += x * x;
+      float y = sb0 * x + shelf1[c];
+      shelf1[c] = sb1 * x - sa1 * y + shelf2[c];
+      shelf2[c] = sb2 * x - sa2 * y;
+      float z = y + pass1[c];
+      pass1[c] = -2.0f * y - pa1 * z + pass2[c];
+      pass2[c] = y - pa2 * z;
+      weighted[c] += z * z;
+    }
+  }
+}
+
+template <class T>
+void RtMeter :: measurePlanar( const T *buffer, unsigned int nFrames, unsigned int stride )
+{
+  float sb0 = shelfB_[0], sb1 = shelfB_[1], sb2 = shelfB_[2], sa1 = shelfA_[0], sa2 = shelfA_[1];
+  float pa1 = passA_[0], pa2 = passA_[1];
+
+  // One channel at a time, with the state in registers.
+  for ( unsigned int c=0; c<channels_; c++ ) {
+    const T *in = buffer + (size_t) c * stride;
+    float peak = currentPeak_[c], squares = 0.0f, weighted = 0.0f;
+    float shelf1 = shelf1_[c], shelf2 = shelf2_[c], pass1 = pass1_[c], pass2 = pass2_[c];
+    for ( unsigned int i=0; i<nFrames; i++ ) {
+      float x = (float) in[i];
+      peak = std::max( peak, fabsf( x ) );
+      squares += x * x;
+      float y = sb0 * x + shelf1;
+      shelf1 = sb1 * x - sa1 * y + shelf2;
+      shelf2 = sb2 * x - sa2 * y;
+      float z = y + pass1;
+      pass1 = -2.0f * y - pa1 * z + pass2;
+      pass2 = y - pa2 * z;
+      weighted += z * z;
+    }
+    currentPeak_[c] = peak;
+    currentSquares_[c] += squares;
+    currentWeighted_[c] += weighted;
+    shelf1_[c] = shelf1;
+    shelf2_[c] = shelf2;
+    pass1_[c] = pass1;
+    pass2_[c] = pass2;
+  }
+}
+
+void RtMeter :: endBlock( void )
+{
+  unsigned int nChannels = channels_;
+  unsigned int c, b;
+
+  // Keep the block and start the next one.
+  unsigned int slot = blockIndex_ * nChannels;
+  for ( c=0; c<nChannels; c++ ) {
+    blockPeak_[slot + c] = currentPeak_[c];
+    blockSquares_[slot + c] = currentSquares_[c];
+    blockWeighted_[slot + c] = currentWeighted_[c];
+    currentPeak_[c] = currentSquares_[c] = currentWeighted_[c] = 0.0f;
+  }
+  blockIndex_ = ( blockIndex_ + 1 ) % RTMETER_BLOCKS;
+  blockCount_ = std::min( blockCount_ + 1, RTMETER_BLOCKS );
+
+  // Per channel and momentary values over the last (up to) 400 ms.
+  unsigned int momentaryBlocks = std::min( blockCount_, RTMETER_MOMENTARY_BLOCKS );
+  double frames = (double) momentaryBlocks * blockFrames_;
+  double momentary = 0.0;
+  for ( c=0; c<nChannels; c++ ) {
+    float peak = 0.0f;
+    double squares = 0.0, weighted = 0.0;
+    for ( b=0; b<momentaryBlocks; b++ ) {
+      unsigned int index = ( ( blockIndex_ + RTMETER_BLOCKS - 1 - b ) % RTMETER_BLOCKS ) * nChannels + c;
+      peak = std::max( peak, blockPeak_[index] );
+      squares += blockSquares_[index];
+      weighted += blockWeighted_[index];
+    }
+    highestPeak_ = std::max( highestPeak_, peak );
+    peak_[c].store( 20.0f * log10f( peak ), std::memory_order_relaxed );
+    rms_[c].store( (float) ( 10.0 * log10( squares / frames ) ), std::memory_order_relaxed );
+    loudness_[c].store( loudnessOf( weighted / frames ), std::memory_order_relaxed );
+    momentary += weight_[c] * weighted / frames;
+  }
+
+  double shortTerm = 0.0;
+  for ( b=0; b<blockCount_; b++ ) {
+    unsigned int index = ( ( blockIndex_ + RTMETER_BLOCKS - 1 - b ) % RTMETER_BLOCKS ) * nChannels;
+    for ( c=0; c<nChannels; c++ ) shortTerm += weight_[c] * blockWeighted_[index + c];
+  }
+  shortTerm /= (double) blockCount_ * blockFrames_;
+
+  // A complete momentary window is a gating block of 400 ms; one
+  // starts every 100 ms (75% overlap).
+  if ( blockCount_ >= RTMETER_MOMENTARY_BLOCKS ) {
+    double loudness = loudnessOf( momentary );
+    if ( loudness > RTMETER_ABSOLUTE_GATE ) {
+      unsigned int bin = (unsigned int) ( ( loudness - RTMETER_ABSOLUTE_GATE ) / RTMETER_HISTOGRAM_STEP );
+      bin = std::min( bin, RTMETER_HISTOGRAM_BINS - 1 );
+      histogramEnergy_[bin] += momentary;
+      histogramCount_[bin]++;
+    }
+  }
+
+  // Integrated loudness: the mean of the blocks above the absolute
+  // gate sets the relative gate, and the blocks above both are
+  // averaged.  Bins count as above the relative gate by their center.
+  double energy = 0.0;
+  unsigned long count = 0;
+  for ( b=0; b<RTMETER_HISTOGRAM_BINS; b++ ) {
+    energy += histogramEnergy_[b];
+    count += histogramCount_[b];
+  }
+  float integrated = -HUGE_VALF;
+  if ( count > 0 ) {
+    double gate = loudnessOf( energy / count ) + RTMETER_RELATIVE_GATE;
+    energy = 0.0;
+    count = 0;
+    for ( b=0; b<RTMETER_HISTOGRAM_BINS; b++ ) {
+      if ( RTMETER_ABSOLUTE_GATE + ( b + 0.5 ) * RTMETER_HISTOGRAM_STEP < gate ) continue;
+      energy += histogramEnergy_[b];
+      count += histogramCount_[b];
+    }
+    if ( count > 0 ) integrated = loudnessOf( energy / count );
+  }
+
+  maxPeak_.store( 20.0f * log10f( highestPeak_ ), std::memory_order_relaxed );
+  momentary_.store( loudnessOf( momentary ), std::memory_order_relaxed );
+  shortTerm_.store( loudnessOf( shortTerm ), std::memory_order_relaxed );
+  integrated_.store( integrated, std::memory_order_relaxed );
+  updates_.fetch_add( 1, std::memory_order_release );
+}
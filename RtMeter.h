@@ -0,0 +1,148 @@
+/************************************************************************/
+/*! \class RtMeter
+    \brief Peak, RMS and loudness meters for RtAudio streams.
+
+    RtMeter measures the buffers an audio callback produces or
+    receives.  The callback passes each buffer to process(), which
+    makes a single pass over it: for every channel it tracks the
+    sample peak and the sum of squares, and runs the K-weighting
+    filter of ITU-R BS.1770 (a high shelf followed by a high pass)
+    and sums its squares.  The filters are recursive, so each channel
+    is a serial chain; an interleaved buffer is measured frame by
+    frame with the channels in the inner loop, a non-interleaved one
+    channel by channel with the filter state in registers.
+
+    Every 100 ms the meter derives, per channel, the sample peak, the
+    RMS level and the momentary loudness over the last 400 ms, and for
+    the whole stream (the weighted sum of the channels) the momentary
+    (400 ms), short-term (3 s) and integrated loudness.  The
+    integrated loudness is gated as BS.1770-4 specifies, with an
+    absolute gate at -70 LUFS and a relative gate 10 LU below the
+    ungated level; the gating blocks are kept in a histogram with
+    0.1 LU resolution, so its memory does not grow with time.
+
+    The results are published as atomic values, so user interface or
+    monitoring threads may read them at any time without locks.
+    Levels are in dBFS and loudness in LUFS; silence reads
+    -infinity.
+*/
+/************************************************************************/
+
+/*!
+  \file RtMeter.h
+ */
+
+#ifndef __RTMETER_H
+#define __RTMETER_H
+
+#include "RtAudio.h"
+#include <atomic>
+#include <vector>
+
+class RtMeter
+{
+ public:
+
+  //! The constructor.
+  /*!
+    An RtError (type = RtError::INVALID_PARAMETER) is thrown if \c
+    channels or \c sampleRate is zero.
+  */
+  RtMeter( unsigned int channels, unsigned int sampleRate );
+
+  //! The destructor.
+  ~RtMeter( void );
+
+  //! Sets the weight of \c channel in the loudness of the stream.
+  /*!
+    BS.1770 uses 1.0 for the left, right and center channels, 1.41
+    for the surround channels and 0.0 for the LFE channel.  All
+    weights are 1.0 by default.  Must not be called while another
+    thread is inside process().
+  */
+  void setChannelWeight( unsigned int channel, float weight );
+
+  //! Measures \c nFrames of \c buffer.
+  /*!
+    Intended to be called from the audio callback: it never blocks,
+    allocates memory or makes system calls.  \c format must be
+    RTAUDIO_FLOAT32 or RTAUDIO_FLOAT64, and \c interleaved is false
+    for streams opened with RTAUDIO_NONINTERLEAVED.  Other formats are
+    ignored.
+  */
+  void process( const void *buffer, unsigned int nFrames, RtAudioFormat format, bool interleaved = true );
+
+  //! Clears all measurements, including the integrated loudness.
+  /*!
+    Safe to call while processing: the meter is cleared by the next
+    call of process().
+  */
+  void reset( void );
+
+  //! Returns the sample peak of \c channel over the last 400 ms, in dBFS.
+  float getPeak( unsigned int channel ) const { return peak_[channel].load( std::memory_order_relaxed ); };
+
+  //! Returns the RMS level of \c channel over the last 400 ms, in dBFS.
+  float getRms( unsigned int channel ) const { return rms_[channel].load( std::memory_order_relaxed ); };
+
+  //! Returns the momentary loudness of \c channel alone, in LUFS.
+  float getChannelLoudness( unsigned int channel ) const { return loudness_[channel].load( std::memory_order_relaxed ); };
+
+  //! Returns the highest sample peak of any channel since the last reset, in dBFS.
+  float getMaxPeak( void ) const { return maxPeak_.load( std::memory_order_relaxed ); };
+
+  //! Returns the momentary loudness (400 ms) of the stream, in LUFS.
+  float getMomentary( void ) const { return momentary_.load( std::memory_order_relaxed ); };
+
+  //! Returns the short-term loudness (3 s) of the stream, in LUFS.
+  float getShortTerm( void ) const { return shortTerm_.load( std::memory_order_relaxed ); };
+
+  //! Returns the gated integrated loudness of the stream since the last reset, in LUFS.
+  float getIntegrated( void ) const { return integrated_.load( std::memory_order_relaxed ); };
+
+  //! Returns the number of times the results have been updated.
+  unsigned long long getUpdateCount( void ) const { return updates_.load(); };
+
+  //! Returns the number of channels.
+  unsigned int getChannels( void ) const { return channels_; };
+
+ protected:
+
+  template <class T> void measureInterleaved( const T *buffer, unsigned int nFrames );
+  template <class T> void measurePlanar( const T *buffer, unsigned int nFrames, unsigned int stride );
+  void clear( void );
+  void endBlock( void );
+
+  unsigned int channels_;
+  unsigned int sampleRate_;
+  unsigned int blockFrames_;
+  unsigned int blockPosition_;
+  std::vector<float> weight_;
+
+  // K-weighting coefficients (normalized biquads: shelf, high pass)
+  // and per-channel filter states and 100 ms accumulators.
+  float shelfB_[3], shelfA_[2], passB_[3], passA_[2];
+  std::vector<float> shelf1_, shelf2_, pass1_, pass2_;
+  std::vector<float> currentPeak_, currentSquares_, currentWeighted_;
+
+  // The last 30 blocks of 100 ms [block][channel], and the histogram
+  // of the gating blocks: energy sum and count per 0.1 LU.
+  std::vector<float> blockPeak_, blockSquares_, blockWeighted_;
+  unsigned int blockIndex_;
+  unsigned int blockCount_;
+  std::vector<double> histogramEnergy_;
+  std::vector<unsigned long> histogramCount_;
+  float highestPeak_;
+
+  std::atomic<bool> resetRequest_;
+  std::atomic<float> *peak_;
+  std::atomic<float> *rms_;
+  std::atomic<float> *loudness_;
+  std::atomic<float> maxPeak_;
+  std::atomic<float> momentary_;
+  std::atomic<float> shortTerm_;
+  std::atomic<float> integrated_;
+  std::atomic<unsigned long long> updates_;
+};
+
+#endif
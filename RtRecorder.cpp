@@ -0,0 +1,353 @@
+/************************************************************************/
+/*! \class RtRecorder
+    \brief Asynchronous disk recorder for RtAudio streams.
+
+    See RtRecorder.h for an overview.
+*/
+/************************************************************************/
+
+#include "RtRecorder.h"
+#include "RtUtilities.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+
+// Size of the aligned blocks written to disk.
+const size_t RTRECORDER_BLOCK_BYTES = 1 << 20;
+
+// Alignment of the blocks in memory and in the file (O_DIRECT).
+const size_t RTRECORDER_ALIGNMENT = 4096;
+
+// How far ahead of the write position the file is preallocated.
+const double RTRECORDER_PREALLOCATE_SECONDS = 60.0;
+
+// Header fields are written byte by byte, so they come out right on
+// either host byte order.
+static void putLittle( unsigned char *p, unsigned long long value, int bytes )
+{
+  for ( int i=0; i<bytes; i++ ) p[i] = (unsigned char) ( value >> ( 8 * i ) );
+}
+
+static void putBig( unsigned char *p, unsigned long long value, int bytes )
+{
+  for ( int i=0; i<bytes; i++ ) p[i] = (unsigned char) ( value >> ( 8 * ( bytes - 1 - i ) ) );
+}
+
+RtRecorder :: RtRecorder( void )
+  : block_( 0 ), blockFill_( 0 ), fileOffset_( 0 ), dataBytes_( 0 ), allocated_( 0 ),
+    headerBytes_( 0 ), fd_( -1 ), direct_( false ), swap_( false ), type_( FILE_RAW ),
+    channels_( 0 ), sampleRate_( 0 ), format_( 0 ), sampleBytes_( 0 ), frameBytes_( 0 ),
+    sleepMicroseconds_( 0 ), open_( false ), stop_( false ), failed_( false ),
+    framesRecorded_( 0 ), droppedFrames_( 0 )
+{
+}
+
+RtRecorder :: ~RtRecorder( void )
+{
+  try {
+    close();
+  }
+  catch ( RtError &e ) {
+    e.printMessage();
+  }
+  free( block_ );
+}
+
+void RtRecorder :: open( const std::string &filename, unsigned int channels, unsigned int sampleRate,
+                         RtAudioFormat format, FileType type, double ringSeconds )
+{
+  if ( open_ )
+    throw RtError( "RtRecorder::open: a recording is already open.", RtError::INVALID_USE );
+
+  if ( format == RTAUDIO_SINT16 ) sampleBytes_ = 2;
+  else if ( format == RTAUDIO_SINT24_PACKED ) sampleBytes_ = 3;
+  else if ( format == RTAUDIO_SINT32 || format == RTAUDIO_FLOAT32 ) sampleBytes_ = 4;
+  else if ( format == RTAUDIO_FLOAT64 ) sampleBytes_ = 8;
+  else
+    throw RtError( "RtRecorder::open: unsupported sample format.", RtError::INVALID_PARAMETER );
+  if ( channels == 0 || sampleRate == 0 || ringSeconds <= 0.0 )
+    throw RtError( "RtRecorder::open: invalid channel count, sample rate or ring size.", RtError::INVALID_PARAMETER );
+
+  if ( type == FILE_AUTO ) {
+    std::string extension;
+    size_t dot = filename.rfind( '.' );
+    if ( dot != std::string::npos ) extension = filename.substr( dot + 1 );
+    for ( size_t i=0; i<extension.size(); i++ ) extension[i] = (char) tolower( extension[i] );
+    if ( extension == "wav" ) type = FILE_WAV;
+    else if ( extension == "caf" ) type = FILE_CAF;
+    else type = FILE_RAW;
+  }
+
+  type_ = type;
+  channels_ = channels;
+  sampleRate_ = sampleRate;
+  format_ = format;
+  frameBytes_ = channels * sampleBytes_;
+  swap_ = ( type == FILE_WAV && hostIsBigEndian() );
+
+  // The writer swaps whole samples within a block, and 3-byte samples
+  // do not divide the block size.
+  if ( swap_ && sampleBytes_ == 3 )
+    throw RtError( "RtRecorder::open: packed 24-bit WAV files cannot be written on a big-endian host.", RtError::INVALID_PARAMETER );
+
+  // The ring must hold a few blocks, or the writer could never
+  // collect a full one.
+  size_t ringBytes = (size_t) ( ringSeconds * sampleRate ) * frameBytes_;
+  if ( !ring_.resize( std::max( ringBytes, 4 * RTRECORDER_BLOCK_BYTES ) ) ||
+       ( !block_ && posix_memalign( (void **) &block_, RTRECORDER_ALIGNMENT, RTRECORDER_BLOCK_BYTES ) ) ) {
+    block_ = 0;
+    throw RtError( "RtRecorder::open: error allocating buffer memory.", RtError::MEMORY_ERROR );
+  }
+
+  // Let the writer wake up about eight times per ring length.
+  double seconds = (double) ring_.getSize() / ( (double) frameBytes_ * sampleRate ) / 8.0;
+  sleepMicroseconds_ = (unsigned int) ( 1000000.0 * std::min( std::max( seconds, 0.001 ), 0.1 ) );
+
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  direct_ = false;
+  fd_ = -1;
+#ifdef O_DIRECT
+  fd_ = ::open( filename.c_str(), flags | O_DIRECT, 0644 );
+  if ( fd_ >= 0 ) direct_ = true;
+#endif
+  // Some filesystems (e.g. tmpfs) do not support O_DIRECT.
+  if ( fd_ < 0 ) fd_ = ::open( filename.c_str(), flags, 0644 );
+  if ( fd_ < 0 ) {
+    std::string message = "RtRecorder::open: error creating file " + filename + " (" + strerror( errno ) + ").";
+    throw RtError( message, RtError::SYSTEM_ERROR );
+  }
+#ifdef F_NOCACHE
+  fcntl( fd_, F_NOCACHE, 1 );
+#endif
+
+  // The header goes at the start of the first block.
+  dataBytes_ = 0;
+  fileOffset_ = 0;
+  allocated_ = 0;
+  headerBytes_ = makeHeader( block_, 0, false );
+  blockFill_ = headerBytes_;
+  preallocate( RTRECORDER_BLOCK_BYTES );
+
+  errorText_.clear();
+  stop_ = false;
+  failed_ = false;
+  framesRecorded_ = 0;
+  droppedFrames_ = 0;
+  if ( pthread_create( &thread_, NULL, writerThread, this ) ) {
+    ::close( fd_ );
+    fd_ = -1;
+    throw RtError( "RtRecorder::open: error creating writer thread.", RtError::THREAD_ERROR );
+  }
+  open_ = true;
+}
+
+bool RtRecorder :: write( const void *buffer, unsigned int nFrames )
+{
+  if ( !open_ ) return false;
+
+  size_t bytes = (size_t) nFrames * frameBytes_;
+  if ( ring_.writeAvailable() < bytes ) {
+    droppedFrames_.fetch_add( nFrames, std::memory_order_relaxed );
+    return false;
+  }
+
+  ring_.write( buffer, bytes );
+  framesRecorded_.fetch_add( nFrames, std::memory_order_relaxed );
+  return true;
+}
+
+void RtRecorder :: close( void )
+{
+  if ( !open_ ) return;
+
+  open_ = false;
+  stop_ = true;
+  pthread_join( thread_, NULL );
+
+  if ( failed_ )
+    throw RtError( errorText_, RtError::SYSTEM_ERROR );
+}
+
+void *RtRecorder :: writerThread( void *ptr )
+{
+  ( (RtRecorder *) ptr )->writeLoop();
+  return 0;
+}
+
+void RtRecorder :: writeLoop( void )
+{
+  while ( true ) {
+    // Check before draining, so that everything queued before close()
+    // was called is written.
+    bool stopping = stop_.load();
+
+    size_t available;
+    while ( ( available = ring_.readAvailable() ) > 0 ) {
+      if ( failed_ ) {
+        // Nothing more can be written, keep the ring from filling up.
+        ring_.skip( available );
+        continue;
+      }
+
+      size_t count = std::min( available, RTRECORDER_BLOCK_BYTES - blockFill_ );
+      unsigned char *data = block_ + blockFill_;
+      ring_.read( data, count );
+
+      if ( swap_ ) {
+        for ( size_t i=0; i<count; i+=sampleBytes_ )
+          std::reverse( data + i, data + i + sampleBytes_ );
+      }
+      blockFill_ += count;
+      dataBytes_ += count;
+      if ( blockFill_ == RTRECORDER_BLOCK_BYTES && flushBlock( RTRECORDER_BLOCK_BYTES ) ) {
+        blockFill_ = 0;
+        preallocate( fileOffset_ + RTRECORDER_BLOCK_BYTES );
+      }
+    }
+
+    if ( stopping ) break;
+    usleep( sleepMicroseconds_ );
+  }
+
+  if ( !failed_ ) {
+    // The last block is partial, so it cannot be written with O_DIRECT.
+    if ( direct_ ) {
+      int flags = fcntl( fd_, F_GETFL );
+#ifdef O_DIRECT
+      flags &= ~O_DIRECT;
+#endif
+      fcntl( fd_, F_SETFL, flags );
+      direct_ = false;
+    }
+    if ( flushBlock( blockFill_ ) ) {
+      blockFill_ = 0;
+      // Release the preallocated space beyond the end of the file.
+      if ( ftruncate( fd_, (off_t) fileOffset_ ) )
+        setError( "error truncating file" );
+    }
+  }
+
+  if ( !failed_ && headerBytes_ > 0 ) {
+    unsigned char header[128];
+    size_t bytes = makeHeader( header, dataBytes_, true );
+    if ( pwrite( fd_, header, bytes, 0 ) != (ssize_t) bytes )
+      setError( "error writing file header" );
+  }
+
+  if ( ::close( fd_ ) && !failed_ )
+    setError( "error closing file" );
+  fd_ = -1;
+}
+
+bool RtRecorder :: flushBlock( size_t bytes )
+{
+  size_t done = 0;
+  while ( done < bytes ) {
+    ssize_t result = pwrite( fd_, block_ + done, bytes - done, (off_t) ( fileOffset_ + done ) );
+    if ( result < 0 && errno == EINTR ) continue;
+    if ( result <= 0 ) {
+      setError( "error writing file" );
+      return false;
+    }
+    done += result;
+  }
+
+  fileOffset_ += bytes;
+  return true;
+}
+
+void RtRecorder :: preallocate( unsigned long long end )
+{
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+  if ( allocated_ >= end ) return;
+
+  // Preallocate without changing the file size, so that an aborted
+  // recording still has a consistent length.
+  unsigned long long ahead = (unsigned long long) ( RTRECORDER_PREALLOCATE_SECONDS * sampleRate_ ) * frameBytes_;
+  ahead = ( ahead / RTRECORDER_BLOCK_BYTES + 1 ) * RTRECORDER_BLOCK_BYTES;
+  if ( fallocate( fd_, FALLOC_FL_KEEP_SIZE, (off_t) allocated_, (off_t) ahead ) == 0 )
+    allocated_ += ahead;
+  else
+    allocated_ = ULLONG_MAX; // Not supported by this filesystem, don't try again.
+#else
+  (void) end;
+#endif
+}
+
+size_t RtRecorder :: makeHeader( unsigned char *header, unsigned long long dataBytes, bool final )
+{
+  bool isFloat = ( format_ == RTAUDIO_FLOAT32 || format_ == RTAUDIO_FLOAT64 );
+  unsigned int bits = 8 * sampleBytes_;
+
+  if ( type_ == FILE_WAV ) {
+    // WAVE_FORMAT_EXTENSIBLE with a JUNK chunk reserving the space of
+    // an RF64 ds64 chunk.  The header is 104 bytes, a multiple of the
+    // sample size, so blocks always end on a sample boundary.
+    unsigned long long riffBytes = 96 + dataBytes;
+    bool rf64 = ( riffBytes > 0xFFFFFFFFULL );
+    memset( header, 0, 104 );
+    memcpy( header, rf64 ? "RF64" : "RIFF", 4 );
+    putLittle( header + 4, rf64 ? 0xFFFFFFFFULL : riffBytes, 4 );
+    memcpy( header + 8, "WAVE", 4 );
+    memcpy( header + 12, rf64 ? "ds64" : "JUNK", 4 );
+    putLittle( header + 16, 28, 4 );
+    if ( rf64 ) {
+      putLittle( header + 20, riffBytes, 8 );
+      putLittle( header + 28, dataBytes, 8 );
+      putLittle( header + 36, dataBytes / frameBytes_, 8 );
+    }
+    memcpy( header + 48, "fmt ", 4 );
+    putLittle( header + 52, 40, 4 );
+    putLittle( header + 56, 0xFFFE, 2 );
+    putLittle( header + 58, channels_, 2 );
+    putLittle( header + 60, sampleRate_, 4 );
+    putLittle( header + 64, (unsigned long long) sampleRate_ * frameBytes_, 4 );
+    putLittle( header + 68, frameBytes_, 2 );
+    putLittle( header + 70, bits, 2 );
+    putLittle( header + 72, 22, 2 );
+    putLittle( header + 74, bits, 2 );
+    static const unsigned char guid[12] = { 0x00, 0x00, 0x10, 0x00, 0x80, 0x00,
+                                            0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+    putLittle( header + 80, isFloat ? 3 : 1, 4 );
+    memcpy( header + 84, guid, 12 );
+    memcpy( header + 96, "data", 4 );
+    putLittle( header + 100, rf64 ? 0xFFFFFFFFULL : dataBytes, 4 );
+    return 104;
+  }
+
+  if ( type_ == FILE_CAF ) {
+    // Samples are stored in host byte order and flagged accordingly.
+    // The data chunk size is -1 (unknown) until the file is closed.
+    union { double value; unsigned long long bits; } rate;
+    rate.value = sampleRate_;
+    unsigned int flags = ( isFloat ? 1 : 0 ) | ( hostIsBigEndian() ? 0 : 2 );
+    memset( header, 0, 68 );
+    memcpy( header, "caff", 4 );
+    putBig( header + 4, 1, 2 );
+    memcpy( header + 8, "desc", 4 );
+    putBig( header + 12, 32, 8 );
+    putBig( header + 20, rate.bits, 8 );
+    memcpy( header + 28, "lpcm", 4 );
+    putBig( header + 32, flags, 4 );
+    putBig( header + 36, frameBytes_, 4 );
+    putBig( header + 40, 1, 4 );
+    putBig( header + 44, channels_, 4 );
+    putBig( header + 48, bits, 4 );
+    memcpy( header + 52, "data", 4 );
+    putBig( header + 56, final ? dataBytes + 4 : ~0ULL, 8 );
+    return 68;
+  }
+
+  return 0;
+}
+
+void RtRecorder :: setError( const char *message )
+{
+  if ( failed_ ) return;
+  errorText_ = std::string( "RtRecorder: " ) + message + " (" + strerror( errno ) + ").";
+  failed_ = true;
+}
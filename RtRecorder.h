@@ -0,0 +1,132 @@
+/************************************************************************/
+/*! \class RtRecorder
+    \brief Asynchronous disk recorder for RtAudio streams.
+
+    RtRecorder captures interleaved stream buffers to a WAV, CAF or
+    raw file without doing any file I/O in the audio callback.  The
+    callback passes each buffer to write(), which only copies it into
+    a lock-free ring.  A background writer thread empties the ring in
+    large blocks and writes them to disk.
+
+    The writer uses 4096-byte aligned blocks and opens the file with
+    O_DIRECT where available (F_NOCACHE on OS X), so long recordings
+    do not fill the page cache.  On Linux it also preallocates the
+    file with fallocate() ahead of the write position, which keeps the
+    file contiguous and avoids allocation stalls on the way.  WAV files
+    larger than 4 GB are promoted to RF64 when they are closed; CAF
+    files have no size limit.
+
+    If the writer falls behind by more than the ring size, whole
+    buffers are dropped and counted (see getDroppedFrames()).  The
+    callback never blocks.
+*/
+/************************************************************************/
+
+/*!
+  \file RtRecorder.h
+ */
+
+#ifndef __RTRECORDER_H
+#define __RTRECORDER_H
+
+#include "RtAudio.h"
+#include "RtRingBuffer.h"
+#include <pthread.h>
+#include <atomic>
+#include <string>
+
+class RtRecorder
+{
+ public:
+
+  //! Recorder file types.
+  enum FileType {
+    FILE_AUTO,  /*!< Choose by file name extension (.wav, .caf, else raw). */
+    FILE_WAV,   /*!< RIFF WAVE (WAVE_FORMAT_EXTENSIBLE, RF64 above 4 GB). */
+    FILE_CAF,   /*!< Apple Core Audio Format. */
+    FILE_RAW    /*!< Headerless interleaved samples in host byte order. */
+  };
+
+  //! The default constructor.
+  RtRecorder( void );
+
+  //! The destructor closes an open recording.
+  ~RtRecorder( void );
+
+  //! Creates \c filename and starts the writer thread.
+  /*!
+    \c format is the sample format of the buffers passed to write(),
+    one of RTAUDIO_SINT16, RTAUDIO_SINT24_PACKED, RTAUDIO_SINT32,
+    RTAUDIO_FLOAT32 or RTAUDIO_FLOAT64; the file stores the same
+    format.  \c ringSeconds
+    sets how far the writer may fall behind before buffers are
+    dropped.  An RtError is thrown if a recording is already open
+    (type = RtError::INVALID_USE), for invalid parameters (type =
+    RtError::INVALID_PARAMETER), if the file cannot be created (type
+    = RtError::SYSTEM_ERROR), or if the writer thread cannot be
+    started (type = RtError::THREAD_ERROR).
+  */
+  void open( const std::string &filename, unsigned int channels, unsigned int sampleRate,
+             RtAudioFormat format, FileType type = FILE_AUTO, double ringSeconds = 4.0 );
+
+  //! Queues \c nFrames interleaved frames for writing.
+  /*!
+    Intended to be called from the audio callback: it never blocks
+    and makes no system calls.  If the ring does not have room for
+    the whole buffer, the buffer is dropped and false is returned.
+    Nothing is done if no recording is open.
+  */
+  bool write( const void *buffer, unsigned int nFrames );
+
+  //! Writes the remaining data, completes the file header and closes the file.
+  /*!
+    An RtError (type = RtError::SYSTEM_ERROR) is thrown if the
+    writer thread failed to write the file at any point.
+  */
+  void close( void );
+
+  //! Returns true while a recording is open.
+  bool isOpen( void ) const { return open_; };
+
+  //! Returns the number of frames queued by write() so far.
+  unsigned long long getFramesRecorded( void ) const { return framesRecorded_.load(); };
+
+  //! Returns the number of frames dropped because the ring was full.
+  unsigned long long getDroppedFrames( void ) const { return droppedFrames_.load(); };
+
+ protected:
+
+  static void *writerThread( void *ptr );
+  void writeLoop( void );
+  bool flushBlock( size_t bytes );
+  void preallocate( unsigned long long end );
+  size_t makeHeader( unsigned char *header, unsigned long long dataBytes, bool final );
+  void setError( const char *message );
+
+  RtRingBuffer ring_;
+  unsigned char *block_;
+  size_t blockFill_;
+  unsigned long long fileOffset_;
+  unsigned long long dataBytes_;
+  unsigned long long allocated_;
+  size_t headerBytes_;
+  int fd_;
+  bool direct_;
+  bool swap_;
+  FileType type_;
+  unsigned int channels_;
+  unsigned int sampleRate_;
+  RtAudioFormat format_;
+  unsigned int sampleBytes_;
+  unsigned int frameBytes_;
+  unsigned int sleepMicroseconds_;
+  pthread_t thread_;
+  std::atomic<bool> open_;
+  std::atomic<bool> stop_;
+  std::atomic<bool> failed_;
+  std::atomic<unsigned long long> framesRecorded_;
+  std::atomic<unsigned long long> droppedFrames_;
+  std::string errorText_;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/************************************************************************/
+/*! \class RtRingBuffer
+    \brief Lock-free single-producer/single-consumer byte ring.
+
+    One thread may write while one other thread reads, without locks
+    and without system calls, so either side can be an RtAudio
+    callback.  The capacity is rounded up to a power of two.  resize()
+    and clear() must not be called while the ring is in use.
+*/
+/************************************************************************/
+
+/*!
+  \file RtRingBuffer.h
+ */
+
+#ifndef __RTRINGBUFFER_H
+#define __RTRINGBUFFER_H
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+class RtRingBuffer
+{
+ public:
+
+  //! The constructor creates an empty ring without storage.
+  RtRingBuffer( void ) : buffer_( 0 ), size_( 0 ), readIndex_( 0 ), writeIndex_( 0 ) {}
+
+  //! The destructor.
+  ~RtRingBuffer( void ) { free( buffer_ ); }
+
+  //! Allocates room for at least \c bytes bytes and empties the ring.
+  /*!
+    The storage is 64-byte aligned.  Returns false if the memory
+    could not be allocated.
+  */
+  bool resize( size_t bytes ) {
+    size_t size = 64;
+    while ( size < bytes ) size <<= 1;
+    void *buffer = 0;
+    if ( posix_memalign( &buffer, 64, size ) ) return false;
+    free( buffer_ );
+    buffer_ = (char *) buffer;
+    size_ = size;
+    clear();
+    return true;
+  }
+
+  //! Discards the contents of the ring.
+  void clear( void ) {
+    readIndex_.store( 0 );
+    writeIndex_.store( 0 );
+  }
+
+  //! Returns the capacity in bytes.
+  size_t getSize( void ) const { return size_; };
+
+  //! Returns the number of bytes which can be read.
+  size_t readAvailable( void ) const {
+    return writeIndex_.load( std::memory_order_acquire ) - readIndex_.load( std::memory_order_relaxed );
+  }
+
+  //! Returns the number of bytes which can be written.
+  size_t writeAvailable( void ) const {
+    return size_ - ( writeIndex_.load( std::memory_order_relaxed ) - readIndex_.load( std::memory_order_acquire ) );
+  }
+
+  //! Writes up to \c bytes bytes and returns the number written.
+  size_t write( const void *data, size_t bytes ) {
+    size_t count = writeAvailable();
+    if ( bytes < count ) count = bytes;
+    size_t index = writeIndex_.load( std::memory_order_relaxed );
+    size_t offset = index & ( size_ - 1 );
+    size_t first = ( count < size_ - offset ) ? count : size_ - offset;
+    memcpy( buffer_ + offset, data, first );
+    memcpy( buffer_, (const char *) data + first, count - first );
+    writeIndex_.store( index + count, std::memory_order_release );
+    return count;
+  }
+
+  //! Reads up to \c bytes bytes and returns the number read.
+  size_t read( void *data, size_t bytes ) {
+    size_t count = peek( data, bytes );
+    skip( count );
+    return count;
+  }
+
+  //! Copies up to \c bytes bytes without consuming them and returns the number copied.
+  size_t peek( void *data, size_t bytes ) const {
+    size_t count = readAvailable();
+    if ( bytes < count ) count = bytes;
+    size_t offset = readIndex_.load( std::memory_order_relaxed ) & ( size_ - 1 );
+    size_t first = ( count < size_ - offset ) ? count : size_ - offset;
+    memcpy( data, buffer_ + offset, first );
+    memcpy( (char *) data + first, buffer_, count - first );
+    return count;
+  }
+
+  //! Consumes \c bytes bytes, which must not exceed readAvailable().
+  void skip( size_t bytes ) {
+    readIndex_.store( readIndex_.load( std::memory_order_relaxed ) + bytes, std::memory_order_release );
+  }
+
+ private:
+
+  RtRingBuffer( const RtRingBuffer & );
+  RtRingBuffer &operator=( const RtRingBuffer & );
+
+  char *buffer_;
+  size_t size_;
+  std::atomic<size_t> readIndex_;
+  std::atomic<size_t> writeIndex_;
+};
+
+#endif
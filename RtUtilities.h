@@ -0,0 +1,63 @@
+/************************************************************************/
+/*! \file RtUtilities.h
+    \brief Small host helpers shared by the RtAudio extension classes.
+
+    Thread creation with optional realtime scheduling, used for the
+    RtGraph workers and the RtConvolver tail threads, and the host
+    byte order, used by the file readers and writers.
+*/
+/************************************************************************/
+
+#ifndef __RTUTILITIES_H
+#define __RTUTILITIES_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <iostream>
+
+//! Returns true if the host stores multi-byte values big-endian.
+inline bool hostIsBigEndian( void )
+{
+  unsigned short value = 1;
+  return *( (unsigned char *) &value ) == 0;
+}
+
+//! Creates a joinable thread, with SCHED_FIFO scheduling if \c priority is greater than zero.
+/*!
+  The priority is clamped to the range of SCHED_FIFO.  If realtime
+  scheduling is not granted, the thread is created with the default
+  policy instead, and \c warning is printed the first time this
+  happens (\c warned is then set).  Returns the pthread_create()
+  result.
+*/
+inline int createRealtimeThread( pthread_t *thread, void *(*function)( void * ), void *arg,
+                                 int priority, const char *warning, bool &warned )
+{
+  pthread_attr_t attr;
+  pthread_attr_init( &attr );
+  int result = -1;
+#ifdef SCHED_FIFO
+  if ( priority > 0 ) {
+    struct sched_param param;
+    int min = sched_get_priority_min( SCHED_FIFO );
+    int max = sched_get_priority_max( SCHED_FIFO );
+    param.sched_priority = std::min( std::max( priority, min ), max );
+    pthread_attr_setinheritsched( &attr, PTHREAD_EXPLICIT_SCHED );
+    pthread_attr_setschedpolicy( &attr, SCHED_FIFO );
+    pthread_attr_setschedparam( &attr, &param );
+    result = pthread_create( thread, &attr, function, arg );
+    if ( result ) {
+      if ( !warned ) std::cerr << "\n" << warning << "\n\n";
+      warned = true;
+      pthread_attr_destroy( &attr );
+      pthread_attr_init( &attr );
+    }
+  }
+#endif
+  if ( result ) result = pthread_create( thread, &attr, function, arg );
+  pthread_attr_destroy( &attr );
+  return result;
+}
+
+#endif
@@ -59,8 +59,8 @@
     internal routines will automatically take care of any necessary
     byte-swapping between the host format and the soundcard.  Thus,
     endian-ness is not a concern in the following format definitions.
-    Note that 24-bit data is expected to be encapsulated in a 32-bit
-    format.
+    Note that RTAUDIO_SINT24 data is expected to be encapsulated in a
+    32-bit format, while RTAUDIO_SINT24_PACKED samples take 3 bytes.
 
     - \e RTAUDIO_SINT8:   8-bit signed integer.
     - \e RTAUDIO_SINT16:  16-bit signed integer.
@@ -68,6 +68,7 @@
     - \e RTAUDIO_SINT32:  32-bit signed integer.
     - \e RTAUDIO_FLOAT32: Normalized between plus/minus 1.0.
     - \e RTAUDIO_FLOAT64: Normalized between plus/minus 1.0.
+    - \e RTAUDIO_SINT24_PACKED: 24-bit signed integer in 3 bytes.
 */
 typedef unsigned long RtAudioFormat;
 static const RtAudioFormat RTAUDIO_SINT8 = 0x1;    // 8-bit signed integer.
@@ -76,6 +77,7 @@ static const RtAudioFormat RTAUDIO_SINT24 = 0x4;   // Lower 3 bytes of 32-bit si
 static const RtAudioFormat RTAUDIO_SINT32 = 0x8;   // 32-bit signed integer.
 static const RtAudioFormat RTAUDIO_FLOAT32 = 0x10; // Normalized between plus/minus 1.0.
 static const RtAudioFormat RTAUDIO_FLOAT64 = 0x20; // Normalized between plus/minus 1.0.
+static const RtAudioFormat RTAUDIO_SINT24_PACKED = 0x40; // 24-bit signed integer in 3 bytes.
 
 /*! \typedef typedef unsigned long RtAudioStreamFlags;
     \brief RtAudio stream option flags.
@@ -87,6 +89,12 @@ static const RtAudioFormat RTAUDIO_FLOAT64 = 0x20; // Normalized between plus/mi
     - \e RTAUDIO_MINIMIZE_LATENCY: Attempt to set stream parameters for lowest possible latency.
     - \e RTAUDIO_HOG_DEVICE:       Attempt grab device for exclusive use.
     - \e RTAUDIO_ALSA_USE_DEFAULT: Use the "default" PCM device (ALSA only).
+    - \e RTAUDIO_ALSA_TIMER_SCHEDULING: Wake the callback thread from a timer instead of period interrupts (ALSA only).
+    - \e RTAUDIO_SHARED_THREAD:   Service the stream from a callback thread shared with other streams (ALSA only).
+    - \e RTAUDIO_LOCK_MEMORY:     Lock and pre-fault the stream memory so the callback does not page fault.
+    - \e RTAUDIO_ALIGN_DUPLEX:    Delay the input of a duplex stream so that it lines up with the output (ALSA only).
+    - \e RTAUDIO_DITHER:          Dither float output which is converted to 8, 16 or 24-bit integers.
+    - \e RTAUDIO_NOISE_SHAPING:   Dither as above, with first-order noise shaping.
 
     By default, RtAudio streams pass and receive audio data from the
     client in an interleaved format.  By passing the
@@ -118,6 +126,31 @@ static const RtAudioFormat RTAUDIO_FLOAT64 = 0x20; // Normalized between plus/mi
     If the RTAUDIO_ALSA_USE_DEFAULT flag is set, RtAudio will attempt to
     open the "default" PCM device when using the ALSA API. Note that this
     will override any specified input or output device id.
+
+    If the RTAUDIO_ALSA_TIMER_SCHEDULING flag is set, the ALSA callback
+    thread sleeps on a timer rather than on period interrupts and only
+    keeps about one buffer plus StreamOptions::wakeAheadFrames queued
+    on the device, leaving the rest of the hardware buffer as headroom.
+
+    If the RTAUDIO_LOCK_MEMORY flag is set, the stream buffers, the
+    regions listed in StreamOptions::lockRegions and the stack of the
+    callback thread are locked into memory and touched before they are
+    first used by the callback.
+
+    If the RTAUDIO_ALIGN_DUPLEX flag is set, the input of a duplex
+    stream is delayed by up to one buffer so that the duplex latency
+    (see RtAudio::getStreamDuplexLatency()) is a whole number of
+    buffers, \e m.  The input passed to a callback then holds, sample
+    for sample, what was captured while the output of the callback
+    \e m buffers earlier was played.
+
+    If the RTAUDIO_DITHER flag is set and RtAudio converts float
+    output to an 8, 16 or 24-bit integer device format, TPDF dither of
+    plus/minus one LSB is added before the samples are rounded, and
+    the result is clipped to the integer range.  RTAUDIO_NOISE_SHAPING
+    also feeds the error of each sample back into the next one, which
+    moves the noise towards high frequencies.  The flags have no effect
+    on other conversions.
 */
 typedef unsigned int RtAudioStreamFlags;
 static const RtAudioStreamFlags RTAUDIO_NONINTERLEAVED = 0x1;    // Use non-interleaved buffers (default = interleaved).
@@ -125,6 +158,12 @@ static const RtAudioStreamFlags RTAUDIO_MINIMIZE_LATENCY = 0x2;  // Attempt to s
 static const RtAudioStreamFlags RTAUDIO_HOG_DEVICE = 0x4;        // Attempt grab device and prevent use by others.
 static const RtAudioStreamFlags RTAUDIO_SCHEDULE_REALTIME = 0x8; // Try to select realtime scheduling for callback thread.
 static const RtAudioStreamFlags RTAUDIO_ALSA_USE_DEFAULT = 0x10; // Use the "default" PCM device (ALSA only).
+static const RtAudioStreamFlags RTAUDIO_ALSA_TIMER_SCHEDULING = 0x20; // Wake the callback thread from a timer (ALSA only).
+static const RtAudioStreamFlags RTAUDIO_SHARED_THREAD = 0x40;    // Share one callback thread between streams (ALSA only).
+static const RtAudioStreamFlags RTAUDIO_LOCK_MEMORY = 0x80;      // Lock and pre-fault the memory used by the callback.
+static const RtAudioStreamFlags RTAUDIO_ALIGN_DUPLEX = 0x100;    // Align the input of a duplex stream with its output (ALSA only).
+static const RtAudioStreamFlags RTAUDIO_DITHER = 0x200;          // Dither float output converted to 8, 16 or 24-bit integers.
+static const RtAudioStreamFlags RTAUDIO_NOISE_SHAPING = 0x400;   // Dither with first-order noise shaping.
 
 /*! \typedef typedef unsigned long RtAudioStreamStatus;
     \brief RtAudio stream status (over- or underflow) flags.
@@ -186,6 +225,54 @@ typedef int (*RtAudioCallback)( void *outputBuffer, void *inputBuffer,
                                 RtAudioStreamStatus status,
                                 void *userData );
 
+//! Maps a sample type to its RtAudioFormat at compile time.
+/*!
+  RtAudioFormatOf<T>::value is defined for signed char, signed short,
+  signed int (RTAUDIO_SINT32), float and double.  RTAUDIO_SINT24 has
+  no sample type of its own and cannot be deduced.
+*/
+template <class T> struct RtAudioFormatOf;
+template <> struct RtAudioFormatOf<signed char> { static const RtAudioFormat value = RTAUDIO_SINT8; };
+template <> struct RtAudioFormatOf<signed short> { static const RtAudioFormat value = RTAUDIO_SINT16; };
+template <> struct RtAudioFormatOf<signed int> { static const RtAudioFormat value = RTAUDIO_SINT32; };
+template <> struct RtAudioFormatOf<float> { static const RtAudioFormat value = RTAUDIO_FLOAT32; };
+template <> struct RtAudioFormatOf<double> { static const RtAudioFormat value = RTAUDIO_FLOAT64; };
+
+//! A view of an interleaved buffer of \c Channels channels of type \c T.
+/*!
+  This is the buffer type passed to the callbacks of the typed
+  RtAudio::openStream().  frames[i][j] is channel \e j of frame \e i.
+  The view of a direction the stream does not have is empty.
+*/
+template <class T, unsigned int Channels>
+class RtAudioFrames
+{
+ public:
+
+  //! The number of channels in each frame.
+  static const unsigned int channels = Channels;
+
+  RtAudioFrames( void *buffer, unsigned int nFrames )
+    : data_( (T *) buffer ), size_( buffer ? nFrames : 0 ) {}
+
+  //! Returns the number of frames in the buffer.
+  unsigned int size( void ) const { return size_; };
+
+  //! Returns true if the buffer holds no frames.
+  bool empty( void ) const { return size_ == 0; };
+
+  //! Returns the first sample of the buffer.
+  T *data( void ) const { return data_; };
+
+  //! Returns the samples of frame \c i.
+  T *operator[]( unsigned int i ) const { return data_ + i * Channels; };
+
+ private:
+
+  T *data_;
+  unsigned int size_;
+};
+
 
 // **************************************************************** //
 //
@@ -247,6 +334,38 @@ class RtAudio
       : deviceId(0), nChannels(0), firstChannel(0) {}
   };
 
+  //! A memory region used by the callback (see StreamOptions::lockRegions).
+  struct MemoryRegion {
+    void *address;        /*!< Start of the region. */
+    unsigned long bytes;  /*!< Size of the region in bytes. */
+
+    // Default constructor.
+    MemoryRegion( void *a = 0, unsigned long b = 0 )
+      : address(a), bytes(b) {}
+  };
+
+  //! Callback thread scheduling policies (see StreamOptions::schedulingPolicy).
+  enum SchedulingPolicy {
+    SCHEDULE_OTHER,  /*!< The normal time-sharing policy (SCHED_OTHER). */
+    SCHEDULE_RR,     /*!< Realtime round-robin (SCHED_RR). */
+    SCHEDULE_FIFO,   /*!< Realtime first-in first-out (SCHED_FIFO). */
+    SCHEDULE_DEADLINE /*!< Guaranteed CPU time in every buffer period (SCHED_DEADLINE, Linux only). */
+  };
+
+  //! The scheduling granted to a callback thread (see getStreamThreadInfo()).
+  struct ThreadInfo {
+    bool isValid;                   /*!< True if RtAudio created the callback thread (ALSA and OSS only). */
+    SchedulingPolicy policy;        /*!< Scheduling policy of the thread. */
+    int priority;                   /*!< Realtime priority of the thread (zero with SCHEDULE_OTHER). */
+    std::vector<unsigned int> cpus; /*!< CPUs the thread may run on (Linux only, empty otherwise). */
+    unsigned long long runtime;     /*!< CPU time reserved per period in nanoseconds (SCHEDULE_DEADLINE only). */
+    unsigned long long period;      /*!< Period and relative deadline in nanoseconds (SCHEDULE_DEADLINE only). */
+
+    // Default constructor.
+    ThreadInfo()
+      : isValid(false), policy(SCHEDULE_OTHER), priority(0), runtime(0), period(0) {}
+  };
+
   //! The structure for specifying stream options.
   /*!
     The following flags can be OR'ed together to allow a client to
@@ -257,6 +376,8 @@ class RtAudio
     - \e RTAUDIO_HOG_DEVICE:        Attempt grab device for exclusive use.
     - \e RTAUDIO_SCHEDULE_REALTIME: Attempt to select realtime scheduling for callback thread.
     - \e RTAUDIO_ALSA_USE_DEFAULT:  Use the "default" PCM device (ALSA only).
+    - \e RTAUDIO_ALSA_TIMER_SCHEDULING: Wake the callback thread from a timer (ALSA only).
+    - \e RTAUDIO_SHARED_THREAD:     Share one callback thread between streams (ALSA only).
 
     By default, RtAudio streams pass and receive audio data from the
     client in an interleaved format.  By passing the
@@ -285,12 +406,95 @@ class RtAudio
     If the RTAUDIO_SCHEDULE_REALTIME flag is set, RtAudio will attempt 
     to select realtime scheduling (round-robin) for the callback thread.
     The \c priority parameter will only be used if the RTAUDIO_SCHEDULE_REALTIME
-    flag is set. It defines the thread's realtime priority.
+    flag is set. It defines the thread's realtime priority.  The \c
+    schedulingPolicy parameter selects SCHEDULE_FIFO or
+    SCHEDULE_DEADLINE instead of the default SCHEDULE_RR, and is also
+    only used with this flag.
+
+    With SCHEDULE_DEADLINE (Linux ALSA and OSS), the callback thread
+    starts with SCHED_RR at \c priority and switches to SCHED_DEADLINE
+    after its first buffer.  The period and deadline are one buffer
+    (bufferFrames / sampleRate) and the reserved runtime is twice the
+    longest buffer measured so far, kept between 10% and 90% of the
+    period.  A buffer is measured as the CPU time the thread spends on
+    it: the user callback together with the format conversions and the
+    device transfers, but not the time it waits for the device.  The
+    runtime starts at half the period and is refined after 64 buffers,
+    and raised again whenever a buffer uses more than 80% of it.  If
+    the kernel refuses SCHED_DEADLINE (which requires CAP_SYS_NICE,
+    enough free bandwidth and, together with \c cpus, an exclusive
+    cpuset), the thread keeps SCHED_RR.  SCHEDULE_DEADLINE is not
+    available for streams using RTAUDIO_SHARED_THREAD, which get
+    SCHED_RR.
+
+    The \c cpus parameter restricts the callback thread to the listed
+    CPUs (Linux ALSA and OSS only), for example to cores isolated from
+    the rest of the system with the "isolcpus" kernel parameter.  An
+    empty list leaves the affinity unchanged.  If the scheduling or the
+    affinity cannot be set (realtime scheduling usually requires root
+    or the CAP_SYS_NICE capability), a warning is issued and the stream
+    is opened anyway.  The settings actually granted are returned by
+    RtAudio::getStreamThreadInfo().
 
     If the RTAUDIO_ALSA_USE_DEFAULT flag is set, RtAudio will attempt to
     open the "default" PCM device when using the ALSA API. Note that this
     will override any specified input or output device id.
 
+    If the RTAUDIO_ALSA_TIMER_SCHEDULING flag is set, the ALSA callback
+    thread is woken by a timer instead of by period interrupts.  It
+    renders the next buffer when the amount of output queued on the
+    device drops to one buffer plus \c wakeAheadFrames (default = one
+    buffer), so the latency stays low while the remaining hardware
+    buffer protects against scheduling delays.
+
+    If the RTAUDIO_SHARED_THREAD flag is set, the ALSA stream does not
+    get a callback thread of its own.  A single thread polls the
+    devices of every stream opened with this flag and runs the
+    callbacks of those that are ready, which keeps the thread count
+    down when many streams are open (see RtAudio::addStream()).  The
+    realtime priority of the shared thread is taken from the options of
+    the stream that started it.  Timer scheduling is not available for
+    such streams.  Other APIs ignore this flag.
+
+    The \c aggregateOutputs and \c aggregateInputs parameters combine
+    additional devices with the output and/or input device of the
+    stream (ALSA only).  Their channels are presented to the callback
+    after those of the main device, in the order listed, so the user
+    buffer carries the sum of all channel counts.  The main device
+    provides the clock and its callback thread also services the
+    additional devices.  Each additional device must support the
+    stream sample rate and buffer size exactly; the small clock drift
+    between devices is compensated by adaptive resampling, at the cost
+    of about 1.5 buffers of extra latency on those devices.  Xruns on
+    an additional device are reported through the callback status.
+
+    If the RTAUDIO_LOCK_MEMORY flag is set, the stream buffers and the
+    memory regions in \c lockRegions (wavetables, delay lines and
+    other data used by the callback) are locked into memory (mlock()
+    or VirtualLock()) and every page is touched when the stream is
+    opened.  The callback thread also locks and touches \c
+    lockStackBytes (default = 128 kB) of its stack before the first
+    buffer is processed.  Locking can fail when the memory lock limit
+    of the process is too low (see "ulimit -l"), in which case a
+    warning is issued and the pages are only touched.  The regions
+    stay locked after the stream is closed.
+
+    The \c outputRouting and \c inputRouting parameters set a gain
+    matrix between the channels of the user buffer and the \c
+    nChannels channels opened on the device.  It is applied while the
+    buffers are converted, so it costs no extra pass over the data.
+    Each matrix is stored row by row, with one row per destination
+    channel and one column per source channel.  For output, that is
+    \c nChannels rows of user channels; for input, one row per user
+    channel with \c nChannels columns.  The number of user channels
+    is the size of the matrix divided by \c nChannels.  For example,
+    an \c outputRouting of { 1.0, 1.0 } with \c nChannels = 2 plays
+    a mono callback on both channels, and an \c inputRouting of {
+    0.5, 0.5 } records a mono downmix of a stereo input.  A channel
+    fed by a single source is converted directly; a channel mixing
+    several sources goes through a scratch channel.  Integer samples
+    are clipped.  Routing cannot be combined with aggregate devices.
+
     The \c numberOfBuffers parameter can be used to control stream
     latency in the Windows DirectSound, Linux OSS, and Linux Alsa APIs
     only.  A value of two is usually the smallest allowed.  Larger
@@ -309,12 +513,30 @@ class RtAudio
     unsigned int numberOfBuffers;  /*!< Number of stream buffers. */
     std::string streamName;        /*!< A stream name (currently used only in Jack). */
     int priority;                  /*!< Scheduling priority of callback thread (only used with flag RTAUDIO_SCHEDULE_REALTIME). */
+    unsigned int wakeAheadFrames;  /*!< Output queued beyond one buffer when the callback thread wakes (only used with flag RTAUDIO_ALSA_TIMER_SCHEDULING). */
+    std::vector<RtAudio::StreamParameters> aggregateOutputs; /*!< Additional output devices whose channels follow those of the main output device (ALSA only). */
+    std::vector<RtAudio::StreamParameters> aggregateInputs;  /*!< Additional input devices whose channels follow those of the main input device (ALSA only). */
+    std::vector<RtAudio::MemoryRegion> lockRegions; /*!< User memory to lock and pre-fault (only used with flag RTAUDIO_LOCK_MEMORY). */
+    unsigned long lockStackBytes;  /*!< Callback thread stack to lock and pre-fault (only used with flag RTAUDIO_LOCK_MEMORY). */
+    RtAudio::SchedulingPolicy schedulingPolicy; /*!< Realtime policy of the callback thread (only used with flag RTAUDIO_SCHEDULE_REALTIME). */
+    std::vector<unsigned int> cpus; /*!< CPUs the callback thread may run on (Linux ALSA and OSS only). */
+    std::vector<double> outputRouting; /*!< Output gain matrix, device channel rows by user channel columns (empty = none). */
+    std::vector<double> inputRouting;  /*!< Input gain matrix, user channel rows by device channel columns (empty = none). */
 
     // Default constructor.
     StreamOptions()
-    : flags(0), numberOfBuffers(0), priority(0) {}
+    : flags(0), numberOfBuffers(0), priority(0), wakeAheadFrames(0), lockStackBytes(0),
+      schedulingPolicy(RtAudio::SCHEDULE_RR) {}
   };
 
+  //! Identifies one of the streams managed by an RtAudio instance.
+  /*!
+    The stream opened with openStream() has handle 0, which is also
+    the stream used by the functions that do not take a handle
+    argument.  Additional streams are opened with addStream().
+  */
+  typedef unsigned int StreamHandle;
+
   //! A static function to determine the available compiled audio APIs.
   /*!
     The values returned in the std::vector can be compared against
@@ -323,6 +545,22 @@ class RtAudio
   */
   static void getCompiledApi( std::vector<RtAudio::Api> &apis ) throw();
 
+  //! A static function to choose the user format which matches the devices best.
+  /*!
+    \c nativeFormats is the RtAudio::DeviceInfo::nativeFormats value
+    of the device (or the OR of the values of both devices of a duplex
+    stream), and \c formats is the set of formats the client can
+    process.  If \c formats includes native formats, the widest of
+    them (which may be RTAUDIO_FLOAT64) is returned, so that the
+    samples need no conversion.  Otherwise the function returns the
+    narrowest format in \c formats which is at least as wide as the
+    widest native format, so that convertBuffer() does not widen and
+    narrow every sample.  If no format is wide enough, the widest one
+    in \c formats is returned.  The return value is zero if \c
+    formats is empty.
+  */
+  static RtAudioFormat negotiateFormat( RtAudioFormat nativeFormats, RtAudioFormat formats ) throw();
+
   //! The class constructor.
   /*!
     The constructor performs minor initialization tasks.  No exceptions
@@ -429,6 +667,40 @@ class RtAudio
                    unsigned int *bufferFrames, RtAudioCallback callback,
                    void *userData = NULL, RtAudio::StreamOptions *options = NULL );
 
+  //! Opens a stream with a callback taking typed buffers.
+  /*!
+    The sample format is deduced from \c T (see RtAudioFormatOf), and
+    the user buffers are passed to \c callback as
+    RtAudioFrames<T, Channels> views instead of void pointers.  \c
+    callback may be a function, a functor or a lambda with the
+    signature
+
+    \code
+    int callback( RtAudioFrames<T, Channels> output,
+                  RtAudioFrames<T, Channels> input,
+                  double streamTime, RtAudioStreamStatus status );
+    \endcode
+
+    and the same return values as an RtAudioCallback.  A copy of it is
+    kept until the next typed stream is opened or the RtAudio instance
+    is destroyed.  The stream is called through a trampoline generated
+    for the type of \c callback, so the compiler can inline the body
+    of a functor or lambda into it.
+
+    The buffers are always interleaved.  Each direction of the stream
+    must carry \c Channels user channels: the \c nChannels value of
+    its parameters, or the number of columns (output) or rows (input)
+    of its routing matrix.  Otherwise, or if the
+    RTAUDIO_NONINTERLEAVED flag is set, an RtError (type =
+    RtError::INVALID_USE) is thrown.  The other parameters and errors
+    are the same as for the untyped openStream().
+  */
+  template <class T, unsigned int Channels, class Callback>
+  void openStream( RtAudio::StreamParameters *outputParameters,
+                   RtAudio::StreamParameters *inputParameters,
+                   unsigned int sampleRate, unsigned int *bufferFrames,
+                   Callback callback, RtAudio::StreamOptions *options = NULL );
+
   //! A function that closes a stream and frees any associated stream memory.
   /*!
     If a stream is not open, this function issues a warning and
@@ -494,13 +766,140 @@ class RtAudio
  */
   unsigned int getStreamSampleRate( void );
 
+  //! Returns the scheduling policy, priority and CPUs granted to the callback thread.
+  /*!
+    Only the ALSA and OSS APIs create their own callback thread; with
+    other APIs the \c isValid member of the result is false.  If a
+    stream is not open, an RtError (type = INVALID_USE) will be thrown.
+  */
+  RtAudio::ThreadInfo getStreamThreadInfo( void );
+
+  //! Returns the number of frames lost in the xrun reported to the current callback.
+  /*!
+    This function is meant to be called from the callback.  When the
+    callback is passed RTAUDIO_OUTPUT_UNDERFLOW or
+    RTAUDIO_INPUT_OVERFLOW, it returns the number of frames skipped
+    since the previous callback: input frames which were never
+    delivered, or for output-only streams, frames of silence played
+    in place of the stream.  The stream time passed to the callback
+    already includes them.  With input, they are reported to the
+    callback whose input buffer is the first one captured after the
+    gap, which comes one callback after a simultaneous output
+    underflow is reported.  Only the ALSA API measures xruns; with
+    other APIs the return value is zero.  If a stream is not open, an
+    RtError (type = INVALID_USE) will be thrown.
+  */
+  unsigned long getStreamDroppedFrames( void );
+
+  //! Returns the input-to-output latency of a duplex stream in sample frames.
+  /*!
+    This is the number of frames from the capture of an input frame
+    passed to the callback to the playback of the output frame which
+    the callback writes at the same position.  It is measured on the
+    devices while the stream runs, and includes any delay reported by
+    the driver.  The value is zero until it has been measured, for
+    other stream modes, and with APIs other than ALSA.  If a stream
+    is not open, an RtError (type = INVALID_USE) will be thrown.
+  */
+  long getStreamDuplexLatency( void );
+
+  //! Open an additional stream and return its handle.
+  /*!
+    The parameters and the errors thrown are the same as for
+    openStream().  Each additional stream uses its own instance of
+    the current API, so streams on different devices can run
+    concurrently from a single RtAudio instance.  Device queries are
+    shared with the primary stream where the API caches them (ALSA).
+    Closed handles are reused by later calls.  Streams opened with the
+    RTAUDIO_SHARED_THREAD flag share a single callback thread where the
+    API supports it.
+  */
+  StreamHandle addStream( RtAudio::StreamParameters *outputParameters,
+                          RtAudio::StreamParameters *inputParameters,
+                          RtAudioFormat format, unsigned int sampleRate,
+                          unsigned int *bufferFrames, RtAudioCallback callback,
+                          void *userData = NULL, RtAudio::StreamOptions *options = NULL );
+
+  //! Close the stream with the given handle and release the handle.
+  /*!
+    Closing handle 0 is the same as calling closeStream().  An invalid
+    handle causes a warning to be printed (no exception is thrown).
+  */
+  void closeStream( StreamHandle stream ) throw();
+
+  //! Start the stream with the given handle (see startStream()).
+  /*!
+    An RtError (type = INVALID_USE) is thrown if the handle is invalid.
+    The same applies to the other functions taking a handle argument.
+  */
+  void startStream( StreamHandle stream );
+
+  //! Stop the stream with the given handle (see stopStream()).
+  void stopStream( StreamHandle stream );
+
+  //! Abort the stream with the given handle (see abortStream()).
+  void abortStream( StreamHandle stream );
+
+  //! Returns true if the handle refers to an open stream.
+  bool isStreamOpen( StreamHandle stream ) const throw();
+
+  //! Returns true if the handle refers to a running stream.
+  bool isStreamRunning( StreamHandle stream ) const throw();
+
+  //! Returns the stream time of the stream with the given handle (see getStreamTime()).
+  double getStreamTime( StreamHandle stream );
+
+  //! Returns the latency of the stream with the given handle (see getStreamLatency()).
+  long getStreamLatency( StreamHandle stream );
+
+  //! Returns the sample rate of the stream with the given handle (see getStreamSampleRate()).
+  unsigned int getStreamSampleRate( StreamHandle stream );
+
+  //! Returns the callback thread information of the stream with the given handle (see getStreamThreadInfo()).
+  RtAudio::ThreadInfo getStreamThreadInfo( StreamHandle stream );
+
+  //! Returns the frames lost in the current xrun of the stream with the given handle (see getStreamDroppedFrames()).
+  unsigned long getStreamDroppedFrames( StreamHandle stream );
+
+  //! Returns the duplex latency of the stream with the given handle (see getStreamDuplexLatency()).
+  long getStreamDuplexLatency( StreamHandle stream );
+
   //! Specify whether warning messages should be printed to stderr.
   void showWarnings( bool value = true ) throw();
 
  protected:
 
+  static RtApi *createRtApi( RtAudio::Api api );
   void openRtApi( RtAudio::Api api );
+  RtApi *getStreamApi( StreamHandle stream ) const;
+  RtApi *verifyStreamHandle( StreamHandle stream );
+
+  // The callback of the last typed openStream(), with the trampoline
+  // passing it typed buffers.
+  struct TypedCallback {
+    virtual ~TypedCallback() {}
+  };
+
+  template <class T, unsigned int Channels, class Callback>
+  struct TypedCallbackImpl : public TypedCallback {
+    Callback callback;
+    TypedCallbackImpl( Callback c ) : callback( c ) {}
+    static int trampoline( void *outputBuffer, void *inputBuffer, unsigned int nFrames,
+                           double streamTime, RtAudioStreamStatus status, void *userData ) {
+      TypedCallbackImpl *self = (TypedCallbackImpl *) userData;
+      return self->callback( RtAudioFrames<T, Channels>( outputBuffer, nFrames ),
+                             RtAudioFrames<T, Channels>( inputBuffer, nFrames ),
+                             streamTime, status );
+    }
+  };
+
+  static unsigned int userChannels( RtAudio::StreamParameters *parameters,
+                                    const std::vector<double> &routing );
+
   RtApi *rtapi_;
+  std::vector<RtApi *> streams_;  // additional streams, indexed by handle - 1
+  bool showWarnings_;
+  TypedCallback *typedCallback_;
 };
 
 // Operating system dependent thread functionality.
@@ -584,6 +983,9 @@ public:
   virtual void abortStream( void ) = 0;
   long getStreamLatency( void );
   unsigned int getStreamSampleRate( void );
+  RtAudio::ThreadInfo getStreamThreadInfo( void );
+  unsigned long getStreamDroppedFrames( void );
+  long getStreamDuplexLatency( void );
   virtual double getStreamTime( void );
   bool isStreamOpen( void ) const { return stream_.state != STREAM_CLOSED; };
   bool isStreamRunning( void ) const { return stream_.state == STREAM_RUNNING; };
@@ -617,6 +1019,16 @@ protected:
     RtAudioFormat inFormat, outFormat;
     std::vector<int> inOffset;
     std::vector<int> outOffset;
+    unsigned int firstChannel;
+    int inChannels, outChannels;  // Routed channels on each side.
+    std::vector<double> gains;    // Routing matrix, outChannels rows by inChannels columns, or empty.
+    std::vector<double> mix;      // Scratch channel for routed mixes.
+    bool dither;                  // TPDF dither on float to integer output.
+    bool noiseShaping;            // First-order error feedback with the dither.
+    unsigned int ditherCounter;   // Sample counter hashed into the dither noise.
+    std::vector<double> ditherError; // Last quantization error of each output channel.
+    unsigned int inSamples, outSamples; // Samples in the input and output buffers.
+    std::vector<signed int> unpacked; // Packed 24-bit samples in the RTAUDIO_SINT24 layout.
   };
 
   // A protected structure for audio streams.
@@ -644,6 +1056,16 @@ protected:
     CallbackInfo callbackInfo;
     ConvertInfo convertInfo[2];
     double streamTime;         // Number of elapsed seconds since the stream started.
+    unsigned long droppedFrames; // Frames lost in the xrun reported to the current callback.
+    long duplexLatency;        // Input-to-output latency of a duplex stream, or zero.
+    std::vector<double> routing[2]; // Routing matrices (see StreamOptions), or empty.
+    unsigned long lockStackBytes; // Stack to lock in the callback thread (RTAUDIO_LOCK_MEMORY), or zero.
+    bool stackLocked;          // True once the callback thread has locked its stack.
+    RtAudio::ThreadInfo threadInfo; // Scheduling granted to the callback thread.
+    bool deadline;             // True while the callback thread manages SCHED_DEADLINE.
+    unsigned int deadlineBuffers; // Buffers measured for SCHED_DEADLINE.
+    double deadlineCost;       // Most CPU time used by one buffer, in seconds.
+    double deadlineRuntime;    // Runtime currently reserved, in seconds.
 
 #if defined(HAVE_GETTIMEOFDAY)
     struct timeval lastTickTimestamp;
@@ -696,6 +1118,16 @@ protected:
   */
   void convertBuffer( char *outBuffer, char *inBuffer, ConvertInfo &info );
 
+  /*!
+    Protected method used by convertBuffer() for plain copies and
+    float conversions, which are done one channel at a time.  Returns
+    false if the conversion is not handled.
+  */
+  bool convertBufferFast( char *outBuffer, char *inBuffer, ConvertInfo &info );
+
+  //! Protected method used by convertBuffer() to apply a routing matrix.
+  void routeBuffer( char *outBuffer, char *inBuffer, ConvertInfo &info );
+
   //! Protected common method used to perform byte-swapping on buffers.
   void byteSwapBuffer( char *buffer, unsigned int samples, RtAudioFormat format );
 
@@ -704,6 +1136,57 @@ protected:
 
   //! Protected common method that sets up the parameters for buffer conversion.
   void setConvertInfo( StreamMode mode, unsigned int firstChannel );
+
+  /*!
+    Protected common method, called after the devices are opened,
+    that resizes the user buffer for a routing matrix and sets up the
+    conversion which applies it.  Returns FAILURE if a buffer cannot
+    be allocated.
+  */
+  bool setRouting( StreamMode mode, const std::vector<double> &gains );
+
+  //! Enables dither on the output conversion, if it converts float to 8, 16 or 24-bit integers.
+  void setDither( bool noiseShaping );
+
+  //! Converts to or from RTAUDIO_SINT24_PACKED through the RTAUDIO_SINT24 layout.
+  void convertPacked( char *outBuffer, char *inBuffer, ConvertInfo &info );
+
+  /*!
+    Protected common method that returns a zeroed stream buffer, or
+    NULL.  On unix systems, buffers come from a shared pool of page
+    aligned, memory locked blocks which are reused after
+    freeBuffer().  Elsewhere they are 64-byte aligned.
+  */
+  char *allocateBuffer( size_t bytes );
+
+  //! Protected common method that returns a buffer from allocateBuffer() to the pool.
+  void freeBuffer( char *buffer );
+
+  //! Protected common method that locks a memory region and touches each of its pages.
+  bool lockMemoryRegion( void *address, unsigned long bytes );
+
+  //! Protected common method that locks the stream buffers and user regions (RTAUDIO_LOCK_MEMORY).
+  void lockStreamMemory( RtAudio::StreamOptions *options );
+
+  /*!
+    Protected common method, called by the callback thread before the
+    first buffer, that locks and touches the top of its stack.
+  */
+  void lockCallbackStack( void );
+
+  /*!
+    Protected common method that applies the scheduling policy,
+    priority and CPU affinity options to a callback thread created by
+    RtAudio, and records what was granted in stream_.threadInfo.
+  */
+  void setCallbackThreadAttributes( ThreadHandle thread, RtAudio::StreamOptions *options );
+
+  /*!
+    Protected common method, called by the callback thread after each
+    callback with its duration in seconds, that enters SCHED_DEADLINE
+    and adjusts the reserved runtime (SCHEDULE_DEADLINE only).
+  */
+  void updateDeadlineScheduling( double cost );
 };
 
 // **************************************************************** //
@@ -725,8 +1208,58 @@ inline bool RtAudio :: isStreamOpen( void ) const throw() { return rtapi_->isStr
 inline bool RtAudio :: isStreamRunning( void ) const throw() { return rtapi_->isStreamRunning(); }
 inline long RtAudio :: getStreamLatency( void ) { return rtapi_->getStreamLatency(); }
 inline unsigned int RtAudio :: getStreamSampleRate( void ) { return rtapi_->getStreamSampleRate(); };
+inline RtAudio::ThreadInfo RtAudio :: getStreamThreadInfo( void ) { return rtapi_->getStreamThreadInfo(); }
+inline unsigned long RtAudio :: getStreamDroppedFrames( void ) { return rtapi_->getStreamDroppedFrames(); }
+inline long RtAudio :: getStreamDuplexLatency( void ) { return rtapi_->getStreamDuplexLatency(); }
 inline double RtAudio :: getStreamTime( void ) { return rtapi_->getStreamTime(); }
-inline void RtAudio :: showWarnings( bool value ) throw() { rtapi_->showWarnings( value ); }
+inline void RtAudio :: startStream( StreamHandle stream ) { verifyStreamHandle( stream )->startStream(); }
+inline void RtAudio :: stopStream( StreamHandle stream ) { verifyStreamHandle( stream )->stopStream(); }
+inline void RtAudio :: abortStream( StreamHandle stream ) { verifyStreamHandle( stream )->abortStream(); }
+inline double RtAudio :: getStreamTime( StreamHandle stream ) { return verifyStreamHandle( stream )->getStreamTime(); }
+inline long RtAudio :: getStreamLatency( StreamHandle stream ) { return verifyStreamHandle( stream )->getStreamLatency(); }
+inline unsigned int RtAudio :: getStreamSampleRate( StreamHandle stream ) { return verifyStreamHandle( stream )->getStreamSampleRate(); }
+inline RtAudio::ThreadInfo RtAudio :: getStreamThreadInfo( StreamHandle stream ) { return verifyStreamHandle( stream )->getStreamThreadInfo(); }
+inline unsigned long RtAudio :: getStreamDroppedFrames( StreamHandle stream ) { return verifyStreamHandle( stream )->getStreamDroppedFrames(); }
+inline long RtAudio :: getStreamDuplexLatency( StreamHandle stream ) { return verifyStreamHandle( stream )->getStreamDuplexLatency(); }
+
+inline unsigned int RtAudio :: userChannels( RtAudio::StreamParameters *parameters,
+                                             const std::vector<double> &routing )
+{
+  if ( parameters == NULL ) return 0;
+  if ( routing.size() && parameters->nChannels ) return routing.size() / parameters->nChannels;
+  return parameters->nChannels;
+}
+
+template <class T, unsigned int Channels, class Callback>
+void RtAudio :: openStream( RtAudio::StreamParameters *outputParameters,
+                            RtAudio::StreamParameters *inputParameters,
+                            unsigned int sampleRate, unsigned int *bufferFrames,
+                            Callback callback, RtAudio::StreamOptions *options )
+{
+  RtAudio::StreamOptions defaults;
+  RtAudio::StreamOptions *o = options ? options : &defaults;
+  if ( o->flags & RTAUDIO_NONINTERLEAVED )
+    throw( RtError( "RtAudio::openStream: typed streams must be interleaved.", RtError::INVALID_USE ) );
+
+  if ( ( outputParameters && userChannels( outputParameters, o->outputRouting ) != Channels ) ||
+       ( inputParameters && userChannels( inputParameters, o->inputRouting ) != Channels ) )
+    throw( RtError( "RtAudio::openStream: the number of channels does not match the typed callback.", RtError::INVALID_USE ) );
+
+  TypedCallbackImpl<T, Channels, Callback> *typed = new TypedCallbackImpl<T, Channels, Callback>( callback );
+  try {
+    rtapi_->openStream( outputParameters, inputParameters, RtAudioFormatOf<T>::value, sampleRate,
+                        bufferFrames, &TypedCallbackImpl<T, Channels, Callback>::trampoline,
+                        (void *) typed, options );
+  }
+  catch ( RtError & ) {
+    delete typed;
+    throw;
+  }
+
+  // A successful open means no stream was using the previous callback.
+  delete typedCallback_;
+  typedCallback_ = typed;
+}
 
 // RtApi Subclass prototypes.
 
@@ -893,16 +1426,32 @@ public:
   void stopStream( void );
   void abortStream( void );
 
-  // This function is intended for internal use only.  It must be
-  // public because it is called by the internal callback handler,
-  // which is not a member of RtAudio.  External use of this function
+  // These functions are intended for internal use only.  They must be
+  // public because they are called by the internal callback handlers,
+  // which are not members of RtAudio.  External use of these functions
   // will most likely produce highly undesireable results!
   void callbackEvent( void );
+  bool waitForDevices( void );
+  long framesUntilReady( bool *waiting = 0 );
 
   private:
 
-  std::vector<RtAudio::DeviceInfo> devices_;
-  void saveDeviceInfo( void );
+  struct AggregateDevice;
+  std::vector<AggregateDevice *> aggregate_[2];
+
+  void scanDevices( void );
+  bool openAggregateDevices( StreamMode mode, unsigned int userOffset,
+                             RtAudio::StreamOptions *options );
+  void closeAggregateDevices( void );
+  int startAggregateDevices( void );
+  void stopAggregateDevices( void );
+  void restartAggregateDevice( AggregateDevice *aggregate, StreamMode mode );
+  void readAggregateDevices( void );
+  void writeAggregateDevices( void );
+  void recoverXruns( void );
+  int writeOutputSilence( void );
+  void updateDuplexLatency( void );
+  void alignInput( void );
   bool probeDeviceOpen( unsigned int device, StreamMode mode, unsigned int channels, 
                         unsigned int firstChannel, unsigned int sampleRate,
                         RtAudioFormat format, unsigned int *bufferSize,
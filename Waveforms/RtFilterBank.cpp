@@ -0,0 +1,237 @@
+/************************************************************************/
+/*! \class RtFilterBank
+    \brief Bank of state-variable filters processed in parallel lanes.
+
+    See RtFilterBank.h for an overview.
+*/
+/************************************************************************/
+
+#include "RtFilterBank.h"
+#include <math.h>
+#include <algorithm>
+
+// Number of frames gathered from the input buffers at a time.
+const unsigned int RTFILTERBANK_CHUNK = 64;
+
+// States below this magnitude are flushed to zero after each block, so
+// that decaying filters do not run on denormals.
+const float RTFILTERBANK_DENORMAL = 1e-15f;
+
+RtFilterBank :: RtFilterBank( unsigned int lanes, double sampleRate, unsigned int inputChannels )
+  : RtGraphNode( inputChannels ? inputChannels : lanes, lanes ), lanes_( lanes ),
+    paddedLanes_( 0 ), sampleRate_( sampleRate ), targets_( 0 )
+{
+  if ( lanes == 0 )
+    throw RtError( "RtFilterBank: the bank must have at least one lane.", RtError::INVALID_PARAMETER );
+
+  paddedLanes_ = ( lanes + RTFILTERBANK_WIDTH - 1 ) / RTFILTERBANK_WIDTH * RTFILTERBANK_WIDTH;
+  g_.assign( paddedLanes_, 0.0 );
+  k_.assign( paddedLanes_, 0.0 );
+  m0_.assign( paddedLanes_, 0.0 );
+  m1_.assign( paddedLanes_, 0.0 );
+  m2_.assign( paddedLanes_, 0.0 );
+  s1_.assign( paddedLanes_, 0.0 );
+  s2_.assign( paddedLanes_, 0.0 );
+
+  targets_ = new Target[lanes];
+  for ( unsigned int i=0; i<lanes; i++ ) {
+    targets_[i].sequence.store( 0 );
+    setParameters( i, 0.0, 0.0, 1.0, 0.0, 0.0 );
+  }
+  nextG_ = g_;
+  nextK_ = k_;
+  nextM0_ = m0_;
+  nextM1_ = m1_;
+  nextM2_ = m2_;
+  reset();
+}
+
+RtFilterBank :: ~RtFilterBank( void )
+{
+  delete [] targets_;
+}
+
+void RtFilterBank :: setParameters( unsigned int lane, double g, double k, double m0, double m1, double m2 )
+{
+  Target &target = targets_[lane];
+  unsigned int sequence = target.sequence.load( std::memory_order_relaxed );
+  target.sequence.store( sequence + 1, std::memory_order_relaxed );
+  std::atomic_thread_fence( std::memory_order_release );
+  target.g.store( (float) g, std::memory_order_relaxed );
+  target.k.store( (float) k, std::memory_order_relaxed );
+  target.m0.store( (float) m0, std::memory_order_relaxed );
+  target.m1.store( (float) m1, std::memory_order_relaxed );
+  target.m2.store( (float) m2, std::memory_order_relaxed );
+  target.sequence.store( sequence + 2, std::memory_order_release );
+}
+
+void RtFilterBank :: setFilter( unsigned int lane, FilterType type, double frequency, double q, double gain )
+{
+  if ( lane >= lanes_ )
+    throw RtError( "RtFilterBank::setFilter: invalid lane.", RtError::INVALID_PARAMETER );
+  if ( !( frequency > 0.0 ) || !( q > 0.0 ) )
+    throw RtError( "RtFilterBank::setFilter: the frequency and q must be positive.", RtError::INVALID_PARAMETER );
+
+  // Coefficients of the trapezoidal SVF (A. Simper, "Linear Trapezoidal
+  // Integrated State Variable Filter", 2013).
+  frequency = std::min( frequency, 0.49 * sampleRate_ );
+  double g = tan( M_PI * frequency / sampleRate_ );
+  double k = 1.0 / q;
+  double a = pow( 10.0, gain / 40.0 );
+
+  switch ( type ) {
+  case LOWPASS:
+    setParameters( lane, g, k, 0.0, 0.0, 1.0 );
+    break;
+  case HIGHPASS:
+    setParameters( lane, g, k, 1.0, -k, -1.0 );
+    break;
+  case BANDPASS:
+    setParameters( lane, g, k, 0.0, k, 0.0 );
+    break;
+  case NOTCH:
+    setParameters( lane, g, k, 1.0, -k, 0.0 );
+    break;
+  case ALLPASS:
+    setParameters( lane, g, k, 1.0, -2.0 * k, 0.0 );
+    break;
+  case PEAK:
+    k = 1.0 / ( q * a );
+    setParameters( lane, g, k, 1.0, k * ( a * a - 1.0 ), 0.0 );
+    break;
+  case LOWSHELF:
+    setParameters( lane, g / sqrt( a ), k, 1.0, k * ( a - 1.0 ), a * a - 1.0 );
+    break;
+  case HIGHSHELF:
+    setParameters( lane, g * sqrt( a ), k, a * a, k * ( 1.0 - a ) * a, 1.0 - a * a );
+    break;
+  }
+}
+
+void RtFilterBank :: setBypass( unsigned int lane )
+{
+  if ( lane >= lanes_ )
+    throw RtError( "RtFilterBank::setBypass: invalid lane.", RtError::INVALID_PARAMETER );
+
+  // Keep the frequency and damping, so that only the mix is ramped.
+  Target &target = targets_[lane];
+  setParameters( lane, target.g.load( std::memory_order_relaxed ), target.k.load( std::memory_order_relaxed ),
+                 1.0, 0.0, 0.0 );
+}
+
+void RtFilterBank :: reset( void )
+{
+  for ( unsigned int i=0; i<lanes_; i++ ) {
+    Target &target = targets_[i];
+    g_[i] = nextG_[i] = target.g.load();
+    k_[i] = nextK_[i] = target.k.load();
+    m0_[i] = nextM0_[i] = target.m0.load();
+    m1_[i] = nextM1_[i] = target.m1.load();
+    m2_[i] = nextM2_[i] = target.m2.load();
+  }
+  std::fill( s1_.begin(), s1_.end(), 0.0f );
+  std::fill( s2_.begin(), s2_.end(), 0.0f );
+}
+
+void RtFilterBank :: process( float **input, float **output, unsigned int nFrames )
+{
+  if ( nFrames == 0 ) return;
+
+  // Pick up the parameters which are not being written right now.
+  for ( unsigned int i=0; i<lanes_; i++ ) {
+    Target &target = targets_[i];
+    unsigned int sequence = target.sequence.load( std::memory_order_acquire );
+    if ( sequence & 1 ) continue;
+    float g = target.g.load( std::memory_order_relaxed );
+    float k = target.k.load( std::memory_order_relaxed );
+    float m0 = target.m0.load( std::memory_order_relaxed );
+    float m1 = target.m1.load( std::memory_order_relaxed );
+    float m2 = target.m2.load( std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_acquire );
+    if ( target.sequence.load( std::memory_order_relaxed ) != sequence ) continue;
+    nextG_[i] = g;
+    nextK_[i] = k;
+    nextM0_[i] = m0;
+    nextM1_[i] = m1;
+    nextM2_[i] = m2;
+  }
+
+  const unsigned int W = RTFILTERBANK_WIDTH;
+  float ramp = 1.0f / nFrames;
+  for ( unsigned int base=0; base<paddedLanes_; base+=W ) {
+    unsigned int active = std::min( W, lanes_ - std::min( base, lanes_ ) );
+    unsigned int w;
+
+    // The parameters of the group move linearly to their targets over
+    // the block.  g and k are ramped rather than the derived
+    // coefficients, so every intermediate filter is stable.
+    float g[W], k[W], m0[W], m1[W], m2[W], s1[W], s2[W];
+    float dg[W], dk[W], dm0[W], dm1[W], dm2[W];
+    for ( w=0; w<W; w++ ) {
+      unsigned int lane = base + w;
+      g[w] = g_[lane];
+      k[w] = k_[lane];
+      m0[w] = m0_[lane];
+      m1[w] = m1_[lane];
+      m2[w] = m2_[lane];
+      s1[w] = s1_[lane];
+      s2[w] = s2_[lane];
+      dg[w] = ( nextG_[lane] - g[w] ) * ramp;
+      dk[w] = ( nextK_[lane] - k[w] ) * ramp;
+      dm0[w] = ( nextM0_[lane] - m0[w] ) * ramp;
+      dm1[w] = ( nextM1_[lane] - m1[w] ) * ramp;
+      dm2[w] = ( nextM2_[lane] - m2[w] ) * ramp;
+    }
+
+    for ( unsigned int offset=0; offset<nFrames; offset+=RTFILTERBANK_CHUNK ) {
+      unsigned int i, n = std::min( RTFILTERBANK_CHUNK, nFrames - offset );
+
+      // Gather the chunk frame-major, so that the inner loop below
+      // runs over contiguous lanes.
+      float x[RTFILTERBANK_CHUNK][W];
+      for ( w=0; w<active; w++ ) {
+        const float *in = input[( base + w ) % inputChannels_] + offset;
+        for ( i=0; i<n; i++ ) x[i][w] = in[i];
+      }
+      for ( ; w<W; w++ )
+        for ( i=0; i<n; i++ ) x[i][w] = 0.0f;
+
+      for ( i=0; i<n; i++ ) {
+        for ( w=0; w<W; w++ ) {
+          g[w] += dg[w];
+          k[w] += dk[w];
+          m0[w] += dm0[w];
+          m1[w] += dm1[w];
+          m2[w] += dm2[w];
+          float a1 = 1.0f / ( 1.0f + g[w] * ( g[w] + k[w] ) );
+          float a2 = g[w] * a1;
+          float a3 = g[w] * a2;
+          float v0 = x[i][w];
+          float v3 = v0 - s2[w];
+          float v1 = a1 * s1[w] + a2 * v3;
+          float v2 = s2[w] + a2 * s1[w] + a3 * v3;
+          s1[w] = 2.0f * v1 - s1[w];
+          s2[w] = 2.0f * v2 - s2[w];
+          x[i][w] = m0[w] * v0 + m1[w] * v1 + m2[w] * v2;
+        }
+      }
+
+      for ( w=0; w<active; w++ ) {
+        float *out = output[base + w] + offset;
+        for ( i=0; i<n; i++ ) out[i] = x[i][w];
+      }
+    }
+
+    // Land exactly on the targets, whatever the rounding of the ramp.
+    for ( w=0; w<W; w++ ) {
+      unsigned int lane = base + w;
+      g_[lane] = nextG_[lane];
+      k_[lane] = nextK_[lane];
+      m0_[lane] = nextM0_[lane];
+      m1_[lane] = nextM1_[lane];
+      m2_[lane] = nextM2_[lane];
+      s1_[lane] = ( fabsf( s1[w] ) < RTFILTERBANK_DENORMAL ) ? 0.0f : s1[w];
+      s2_[lane] = ( fabsf( s2[w] ) < RTFILTERBANK_DENORMAL ) ? 0.0f : s2[w];
+    }
+  }
+}
@@ -0,0 +1,528 @@
+/************************************************************************/
+/*! \class RtGraph
+    \brief Realtime DSP graph of nodes, buses, gains and sends.
+
+    See RtGraph.h for an overview.
+*/
+/************************************************************************/
+
+#include "RtGraph.h"
+#include "RtUtilities.h"
+#include <unistd.h>
+#include <sched.h>
+#include <algorithm>
+#include <cstring>
+
+// Number of times an idle worker polls for the next block before it
+// goes to sleep on the condition variable.
+const int RTGRAPH_SPIN_COUNT = 4000;
+
+// Number of failed attempts to find work within a block after which
+// a worker yields its CPU (only matters with more threads than CPUs).
+const int RTGRAPH_YIELD_COUNT = 64;
+
+RtGraph :: RtGraph( unsigned int outputChannels, unsigned int inputChannels,
+                    unsigned int nThreads, int priority )
+  : queues_( 0 ), pending_( 0 ), remaining_( 0 ), generation_( 0 ), sleepers_( 0 ),
+    running_( true ), outputChannels_( outputChannels ), inputChannels_( inputChannels ),
+    maxFrames_( 0 ), blockFrames_( 0 ), format_( RTAUDIO_FLOAT64 ), interleaved_( true ),
+    inputBuffer_( 0 ), inputFrames_( 0 ), inputOffset_( 0 ), compiled_( false )
+{
+  if ( outputChannels == 0 )
+    throw RtError( "RtGraph: the output bus must have at least one channel.", RtError::INVALID_PARAMETER );
+
+  newNode( NODE_BUS, 0, outputChannels, outputChannels );
+  if ( inputChannels > 0 ) newNode( NODE_INPUT, 0, 0, inputChannels );
+
+  if ( nThreads == 0 ) {
+    long nCpus = sysconf( _SC_NPROCESSORS_ONLN );
+    nThreads = ( nCpus > 0 ) ? (unsigned int) nCpus : 1;
+  }
+
+  pthread_mutex_init( &mutex_, NULL );
+  pthread_cond_init( &wakeup_, NULL );
+  queues_ = new TaskQueue[nThreads];
+  workers_.resize( nThreads );
+  for ( unsigned int i=0; i<nThreads; i++ ) {
+    workers_[i].graph = this;
+    workers_[i].index = i;
+  }
+
+  // Worker 0 is the thread calling process(), the others get their own threads.
+  bool warned = false;
+  for ( unsigned int i=1; i<nThreads; i++ ) {
+    int result = createRealtimeThread( &workers_[i].thread, workerThread, &workers_[i], priority,
+                                       "RtGraph: realtime scheduling was not granted, worker threads use the default policy.",
+                                       warned );
+    if ( result ) {
+      stopWorkers( i );
+      clear();
+      throw RtError( "RtGraph: error creating worker thread.", RtError::THREAD_ERROR );
+    }
+  }
+}
+
+RtGraph :: ~RtGraph()
+{
+  stopWorkers( (unsigned int) workers_.size() );
+  clear();
+}
+
+void RtGraph :: stopWorkers( unsigned int nThreads )
+{
+  pthread_mutex_lock( &mutex_ );
+  running_ = false;
+  pthread_cond_broadcast( &wakeup_ );
+  pthread_mutex_unlock( &mutex_ );
+  for ( unsigned int i=1; i<nThreads; i++ )
+    pthread_join( workers_[i].thread, NULL );
+}
+
+void RtGraph :: clear( void )
+{
+  for ( unsigned int i=0; i<nodes_.size(); i++ ) delete nodes_[i];
+  for ( unsigned int i=0; i<connections_.size(); i++ ) delete connections_[i];
+  nodes_.clear();
+  connections_.clear();
+  if ( queues_ ) {
+    for ( unsigned int i=0; i<workers_.size(); i++ ) delete [] queues_[i].tasks;
+    delete [] queues_;
+    queues_ = 0;
+  }
+  delete [] pending_;
+  pending_ = 0;
+  pthread_cond_destroy( &wakeup_ );
+  pthread_mutex_destroy( &mutex_ );
+}
+
+RtGraph::NodeId RtGraph :: newNode( NodeType type, RtGraphNode *processor,
+                                    unsigned int inputChannels, unsigned int outputChannels )
+{
+  Node *node = new Node;
+  node->type = type;
+  node->processor = processor;
+  node->inputChannels = inputChannels;
+  node->outputChannels = outputChannels;
+  node->gain = 1.0;
+  node->currentGain = 1.0;
+  node->dependencies = 0;
+  nodes_.push_back( node );
+  compiled_ = false;
+  return (NodeId) ( nodes_.size() - 1 );
+}
+
+RtGraph::NodeId RtGraph :: addNode( RtGraphNode *node )
+{
+  if ( node == 0 || node->getOutputChannels() == 0 )
+    throw RtError( "RtGraph::addNode: a node must have at least one output channel.", RtError::INVALID_PARAMETER );
+
+  return newNode( NODE_PROCESSOR, node, node->getInputChannels(), node->getOutputChannels() );
+}
+
+RtGraph::NodeId RtGraph :: addBus( unsigned int channels )
+{
+  if ( channels == 0 )
+    throw RtError( "RtGraph::addBus: a bus must have at least one channel.", RtError::INVALID_PARAMETER );
+
+  return newNode( NODE_BUS, 0, channels, channels );
+}
+
+RtGraph::NodeId RtGraph :: getInput( void ) const
+{
+  if ( inputChannels_ == 0 )
+    throw RtError( "RtGraph::getInput: the graph has no input channels.", RtError::INVALID_USE );
+
+  return 1;
+}
+
+RtGraph::ConnectionId RtGraph :: connect( NodeId source, NodeId destination, float gain )
+{
+  if ( source >= nodes_.size() || destination >= nodes_.size() || source == destination )
+    throw RtError( "RtGraph::connect: invalid node identifier.", RtError::INVALID_PARAMETER );
+  if ( source == getOutput() )
+    throw RtError( "RtGraph::connect: the output bus cannot be connected to other nodes.", RtError::INVALID_PARAMETER );
+  if ( nodes_[destination]->inputChannels == 0 )
+    throw RtError( "RtGraph::connect: the destination node has no inputs.", RtError::INVALID_PARAMETER );
+
+  Connection *connection = new Connection;
+  connection->source = source;
+  connection->destination = destination;
+  connection->gain = gain;
+  connection->currentGain = gain;
+  connections_.push_back( connection );
+  ConnectionId id = (ConnectionId) ( connections_.size() - 1 );
+  nodes_[destination]->inputs.push_back( id );
+  compiled_ = false;
+  return id;
+}
+
+void RtGraph :: setConnectionGain( ConnectionId connection, float gain )
+{
+  if ( connection >= connections_.size() )
+    throw RtError( "RtGraph::setConnectionGain: invalid connection identifier.", RtError::INVALID_PARAMETER );
+
+  connections_[connection]->gain.store( gain, std::memory_order_relaxed );
+}
+
+void RtGraph :: setGain( NodeId node, float gain )
+{
+  if ( node >= nodes_.size() )
+    throw RtError( "RtGraph::setGain: invalid node identifier.", RtError::INVALID_PARAMETER );
+
+  nodes_[node]->gain.store( gain, std::memory_order_relaxed );
+}
+
+void RtGraph :: compile( unsigned int maxFrames, RtAudioFormat format, bool interleaved )
+{
+  if ( format != RTAUDIO_FLOAT32 && format != RTAUDIO_FLOAT64 )
+    throw RtError( "RtGraph::compile: only RTAUDIO_FLOAT32 and RTAUDIO_FLOAT64 are supported.", RtError::INVALID_PARAMETER );
+  if ( maxFrames == 0 )
+    throw RtError( "RtGraph::compile: maxFrames must be greater than zero.", RtError::INVALID_PARAMETER );
+
+  compiled_ = false;
+  unsigned int i, j, nNodes = (unsigned int) nodes_.size();
+
+  // Find the nodes which feed the output bus.
+  std::vector<bool> reached( nNodes, false );
+  std::vector<unsigned int> stack( 1, getOutput() );
+  reached[getOutput()] = true;
+  unsigned int nReached = 1;
+  while ( !stack.empty() ) {
+    Node *node = nodes_[stack.back()];
+    stack.pop_back();
+    for ( j=0; j<node->inputs.size(); j++ ) {
+      NodeId source = connections_[node->inputs[j]]->source;
+      if ( reached[source] ) continue;
+      reached[source] = true;
+      stack.push_back( source );
+      nReached++;
+    }
+  }
+
+  // Build the successor lists and dependency counts.  Several
+  // connections between the same two nodes are one dependency.
+  for ( i=0; i<nNodes; i++ ) {
+    nodes_[i]->successors.clear();
+    nodes_[i]->dependencies = 0;
+  }
+  for ( i=0; i<nNodes; i++ ) {
+    if ( !reached[i] ) continue;
+    for ( j=0; j<nodes_[i]->inputs.size(); j++ ) {
+      std::vector<NodeId> &successors = nodes_[connections_[nodes_[i]->inputs[j]]->source]->successors;
+      if ( std::find( successors.begin(), successors.end(), i ) != successors.end() ) continue;
+      successors.push_back( i );
+      nodes_[i]->dependencies++;
+    }
+  }
+
+  // Topological sort.  Nodes without dependencies start each block.
+  std::vector<int> count( nNodes, 0 );
+  schedule_.clear();
+  roots_.clear();
+  for ( i=0; i<nNodes; i++ ) {
+    if ( !reached[i] ) continue;
+    count[i] = nodes_[i]->dependencies;
+    if ( count[i] == 0 ) {
+      schedule_.push_back( i );
+      roots_.push_back( i );
+    }
+  }
+  for ( i=0; i<schedule_.size(); i++ ) {
+    Node *node = nodes_[schedule_[i]];
+    for ( j=0; j<node->successors.size(); j++ )
+      if ( --count[node->successors[j]] == 0 ) schedule_.push_back( node->successors[j] );
+  }
+  if ( schedule_.size() != nReached ) {
+    schedule_.clear();
+    roots_.clear();
+    throw RtError( "RtGraph::compile: the graph contains a cycle.", RtError::INVALID_USE );
+  }
+
+  // Allocate the node buffers.  A bus mixes its inputs directly into
+  // its output buffer.
+  for ( i=0; i<schedule_.size(); i++ ) {
+    Node *node = nodes_[schedule_[i]];
+    unsigned int nIn = ( node->type == NODE_PROCESSOR ) ? node->inputChannels : 0;
+    node->buffer.assign( ( nIn + node->outputChannels ) * maxFrames, 0.0f );
+    node->in.resize( node->inputChannels );
+    node->out.resize( node->outputChannels );
+    for ( j=0; j<node->outputChannels; j++ )
+      node->out[j] = &node->buffer[( nIn + j ) * maxFrames];
+    for ( j=0; j<node->inputChannels; j++ )
+      node->in[j] = ( node->type == NODE_PROCESSOR ) ? &node->buffer[j * maxFrames] : node->out[j];
+    node->currentGain = node->gain.load( std::memory_order_relaxed );
+  }
+  for ( i=0; i<connections_.size(); i++ )
+    connections_[i]->currentGain = connections_[i]->gain.load( std::memory_order_relaxed );
+
+  // Each node is queued at most once per block, so a queue never
+  // holds more than nNodes entries.
+  long capacity = 1;
+  while ( capacity <= (long) nNodes ) capacity <<= 1;
+  for ( i=0; i<workers_.size(); i++ ) {
+    delete [] queues_[i].tasks;
+    queues_[i].tasks = new std::atomic<int>[capacity];
+    queues_[i].mask = capacity - 1;
+  }
+  delete [] pending_;
+  pending_ = new std::atomic<int>[nNodes];
+
+  maxFrames_ = maxFrames;
+  format_ = format;
+  interleaved_ = interleaved;
+  compiled_ = true;
+}
+
+void RtGraph :: process( void *outputBuffer, void *inputBuffer, unsigned int nFrames )
+{
+  if ( !compiled_ ) return;
+
+  Node *output = nodes_[getOutput()];
+  unsigned int i, j, offset = 0;
+  inputBuffer_ = inputBuffer;
+  inputFrames_ = nFrames;
+  while ( offset < nFrames ) {
+    unsigned int frames = std::min( nFrames - offset, maxFrames_ );
+    inputOffset_ = offset;
+    runBlock( frames );
+
+    // Copy the output bus into the device buffer, interleaving if needed.
+    if ( !interleaved_ ) {
+      for ( j=0; j<outputChannels_; j++ ) {
+        float *bus = output->out[j];
+        if ( format_ == RTAUDIO_FLOAT32 )
+          memcpy( (float *) outputBuffer + j * nFrames + offset, bus, frames * sizeof( float ) );
+        else {
+          double *out = (double *) outputBuffer + j * nFrames + offset;
+          for ( i=0; i<frames; i++ ) out[i] = bus[i];
+        }
+      }
+    }
+    else if ( format_ == RTAUDIO_FLOAT32 ) {
+      float *out = (float *) outputBuffer + offset * outputChannels_;
+      for ( i=0; i<frames; i++ )
+        for ( j=0; j<outputChannels_; j++ )
+          *out++ = output->out[j][i];
+    }
+    else {
+      double *out = (double *) outputBuffer + offset * outputChannels_;
+      for ( i=0; i<frames; i++ )
+        for ( j=0; j<outputChannels_; j++ )
+          *out++ = output->out[j][i];
+    }
+    offset += frames;
+  }
+}
+
+int RtGraph :: callback( void *outputBuffer, void *inputBuffer, unsigned int nFrames,
+                         double /*streamTime*/, RtAudioStreamStatus /*status*/, void *userData )
+{
+  ( (RtGraph *) userData )->process( outputBuffer, inputBuffer, nFrames );
+  return 0;
+}
+
+void RtGraph :: runBlock( unsigned int nFrames )
+{
+  blockFrames_ = nFrames;
+  for ( unsigned int i=0; i<schedule_.size(); i++ )
+    pending_[schedule_[i]].store( nodes_[schedule_[i]]->dependencies, std::memory_order_relaxed );
+  remaining_.store( (int) schedule_.size(), std::memory_order_release );
+  for ( unsigned int i=0; i<roots_.size(); i++ )
+    queues_[0].push( roots_[i] );
+
+  // Wake the workers.  The condition variable is only signalled when
+  // a worker has actually gone to sleep.
+  if ( workers_.size() > 1 ) {
+    generation_.fetch_add( 1 );
+    if ( sleepers_.load() > 0 ) {
+      pthread_mutex_lock( &mutex_ );
+      pthread_cond_broadcast( &wakeup_ );
+      pthread_mutex_unlock( &mutex_ );
+    }
+  }
+
+  // Help with the block until every node has been rendered.
+  work( 0 );
+}
+
+void *RtGraph :: workerThread( void *ptr )
+{
+  Worker *worker = (Worker *) ptr;
+  RtGraph *graph = worker->graph;
+  unsigned long seen = graph->generation_.load();
+
+  while ( true ) {
+    unsigned long current = seen;
+    for ( int i=0; i<RTGRAPH_SPIN_COUNT && current == seen; i++ )
+      current = graph->generation_.load();
+
+    if ( current == seen ) {
+      pthread_mutex_lock( &graph->mutex_ );
+      graph->sleepers_++;
+      while ( graph->running_ && ( current = graph->generation_.load() ) == seen )
+        pthread_cond_wait( &graph->wakeup_, &graph->mutex_ );
+      graph->sleepers_--;
+      pthread_mutex_unlock( &graph->mutex_ );
+    }
+    if ( !graph->running_ ) break;
+
+    seen = current;
+    graph->work( worker->index );
+  }
+
+  return 0;
+}
+
+void RtGraph :: work( unsigned int self )
+{
+  unsigned int nQueues = (unsigned int) workers_.size();
+  int idle = 0;
+
+  while ( remaining_.load( std::memory_order_acquire ) > 0 ) {
+    int task = queues_[self].pop();
+    for ( unsigned int i=1; task < 0 && i<nQueues; i++ )
+      task = queues_[( self + i ) % nQueues].steal();
+    if ( task < 0 ) {
+      if ( ++idle >= RTGRAPH_YIELD_COUNT ) {
+        sched_yield();
+        idle = 0;
+      }
+      continue;
+    }
+    idle = 0;
+
+    renderNode( task, blockFrames_ );
+
+    // Successors whose last input has just been rendered become ready.
+    Node *node = nodes_[task];
+    for ( unsigned int i=0; i<node->successors.size(); i++ ) {
+      NodeId successor = node->successors[i];
+      if ( pending_[successor].fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+        queues_[self].push( successor );
+    }
+    remaining_.fetch_sub( 1, std::memory_order_acq_rel );
+  }
+}
+
+void RtGraph :: renderNode( unsigned int index, unsigned int nFrames )
+{
+  Node *node = nodes_[index];
+  unsigned int i, j, k;
+
+  // Mix the connections into the input buffers, ramping changed gains.
+  for ( i=0; i<node->inputChannels; i++ )
+    memset( node->in[i], 0, nFrames * sizeof( float ) );
+  for ( i=0; i<node->inputs.size(); i++ ) {
+    Connection *connection = connections_[node->inputs[i]];
+    Node *source = nodes_[connection->source];
+    float start = connection->currentGain;
+    float end = connection->gain.load( std::memory_order_relaxed );
+    connection->currentGain = end;
+    if ( start == 0.0f && end == 0.0f ) continue;
+    float step = ( end - start ) / nFrames;
+    unsigned int nMix = std::max( source->outputChannels, node->inputChannels );
+    for ( k=0; k<nMix; k++ ) {
+      float *in = source->out[k % source->outputChannels];
+      float *out = node->in[k % node->inputChannels];
+      if ( step == 0.0f ) {
+        for ( j=0; j<nFrames; j++ ) out[j] += start * in[j];
+      }
+      else {
+        float gain = start;
+        for ( j=0; j<nFrames; j++ ) {
+          out[j] += gain * in[j];
+          gain += step;
+        }
+      }
+    }
+  }
+
+  if ( node->type == NODE_PROCESSOR ) {
+    node->processor->process( node->in.empty() ? 0 : &node->in[0], &node->out[0], nFrames );
+  }
+  else if ( node->type == NODE_INPUT ) {
+    for ( k=0; k<node->outputChannels; k++ ) {
+      float *out = node->out[k];
+      if ( inputBuffer_ == 0 )
+        memset( out, 0, nFrames * sizeof( float ) );
+      else if ( !interleaved_ ) {
+        if ( format_ == RTAUDIO_FLOAT32 )
+          memcpy( out, (float *) inputBuffer_ + k * inputFrames_ + inputOffset_, nFrames * sizeof( float ) );
+        else {
+          double *in = (double *) inputBuffer_ + k * inputFrames_ + inputOffset_;
+          for ( j=0; j<nFrames; j++ ) out[j] = (float) in[j];
+        }
+      }
+      else if ( format_ == RTAUDIO_FLOAT32 ) {
+        float *in = (float *) inputBuffer_ + inputOffset_ * inputChannels_ + k;
+        for ( j=0; j<nFrames; j++, in += inputChannels_ ) out[j] = *in;
+      }
+      else {
+        double *in = (double *) inputBuffer_ + inputOffset_ * inputChannels_ + k;
+        for ( j=0; j<nFrames; j++, in += inputChannels_ ) out[j] = (float) *in;
+      }
+    }
+  }
+
+  // Apply the output gain.
+  float start = node->currentGain;
+  float end = node->gain.load( std::memory_order_relaxed );
+  node->currentGain = end;
+  if ( start == 1.0f && end == 1.0f ) return;
+  float step = ( end - start ) / nFrames;
+  for ( k=0; k<node->outputChannels; k++ ) {
+    float *out = node->out[k];
+    float gain = start;
+    for ( j=0; j<nFrames; j++ ) {
+      out[j] *= gain;
+      gain += step;
+    }
+  }
+}
+
+// The task queue is the Chase-Lev work-stealing deque with a fixed
+// ring of entries.  top and bottom only ever grow, so the queue never
+// needs to be reset between blocks.
+
+void RtGraph::TaskQueue :: push( int task )
+{
+  long b = bottom.load( std::memory_order_relaxed );
+  tasks[b & mask].store( task, std::memory_order_relaxed );
+  bottom.store( b + 1, std::memory_order_release );
+}
+
+int RtGraph::TaskQueue :: pop( void )
+{
+  long b = bottom.load( std::memory_order_relaxed ) - 1;
+  bottom.store( b, std::memory_order_relaxed );
+  std::atomic_thread_fence( std::memory_order_seq_cst );
+  long t = top.load( std::memory_order_relaxed );
+  if ( t > b ) {
+    bottom.store( b + 1, std::memory_order_relaxed );
+    return -1;
+  }
+
+  int task = tasks[b & mask].load( std::memory_order_relaxed );
+  if ( t == b ) {
+    // Last entry: race the thieves for it.
+    if ( !top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed ) )
+      task = -1;
+    bottom.store( b + 1, std::memory_order_relaxed );
+  }
+  return task;
+}
+
+int RtGraph::TaskQueue :: steal( void )
+{
+  long t = top.load( std::memory_order_acquire );
+  std::atomic_thread_fence( std::memory_order_seq_cst );
+  long b = bottom.load( std::memory_order_acquire );
+  if ( t >= b ) return -1;
+
+  int task = tasks[t & mask].load( std::memory_order_relaxed );
+  if ( !top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed ) )
+    return -1;
+  return task;
+}
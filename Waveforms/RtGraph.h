@@ -0,0 +1,265 @@
+/************************************************************************/
+/*! \class RtGraph
+    \brief Realtime DSP graph of nodes, buses, gains and sends.
+
+    RtGraph replaces a single hard-wired stream callback with a graph
+    of processing nodes.  Nodes are connected directly or through
+    buses; every connection carries its own gain, so a connection
+    from a node to a bus acts as a send.  Every node and bus also has
+    an output gain (fader).
+
+    Once the topology is complete, compile() sorts the graph into a
+    schedule.  Each call of process() then runs one block of the
+    schedule on a pool of worker threads.  A node becomes ready as
+    soon as all of its inputs have been rendered, and idle workers
+    steal ready nodes from each other, so independent branches of a
+    large mix run in parallel across cores.  The calling thread (the
+    RtAudio callback) helps with the work while it waits for the
+    graph to complete, and then writes the output bus to the device
+    buffer.
+
+    Gains may be changed at any time from any thread.  They are
+    ramped over one block to avoid zipper noise.  Topology changes
+    (addNode(), addBus(), connect(), compile()) must only be made
+    while no other thread is inside process(), e.g. while the stream
+    is stopped.
+*/
+/************************************************************************/
+
+/*!
+  \file RtGraph.h
+ */
+
+#ifndef __RTGRAPH_H
+#define __RTGRAPH_H
+
+#include "RtAudio.h"
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+/************************************************************************/
+/*! \class RtGraphNode
+    \brief Abstract processing node of an RtGraph.
+
+    Subclasses implement process(), which renders one block of
+    non-interleaved output from one block of non-interleaved input.
+    process() is called from one of the graph's worker threads, but
+    never concurrently for the same node.
+*/
+/************************************************************************/
+
+class RtGraphNode
+{
+ public:
+
+  //! The constructor.
+  RtGraphNode( unsigned int inputChannels, unsigned int outputChannels )
+    : inputChannels_( inputChannels ), outputChannels_( outputChannels ) {}
+
+  //! The destructor.
+  virtual ~RtGraphNode( void ) {}
+
+  //! Render \c nFrames of output.
+  /*!
+    \c input holds one buffer per input channel containing the sum of
+    all connections into this node, \c output holds one buffer per
+    output channel.  Both are valid for \c nFrames samples.  The
+    function must not block or allocate memory.
+  */
+  virtual void process( float **input, float **output, unsigned int nFrames ) = 0;
+
+  //! Returns the number of input channels.
+  unsigned int getInputChannels( void ) const { return inputChannels_; };
+
+  //! Returns the number of output channels.
+  unsigned int getOutputChannels( void ) const { return outputChannels_; };
+
+ protected:
+
+  unsigned int inputChannels_;
+  unsigned int outputChannels_;
+};
+
+class RtGraph
+{
+ public:
+
+  //! Node identifier returned by addNode() and addBus().
+  typedef unsigned int NodeId;
+
+  //! Connection identifier returned by connect().
+  typedef unsigned int ConnectionId;
+
+  //! The constructor.
+  /*!
+    The graph always contains an output bus with \c outputChannels
+    channels and, when \c inputChannels is not zero, an input node
+    providing the device input.  \c nThreads is the total number of
+    threads executing the graph, including the thread calling
+    process(); a value of zero uses one thread per online CPU.  When
+    \c priority is greater than zero, the worker threads request
+    SCHED_FIFO scheduling at that priority (a warning is printed to
+    stderr if it is not granted).  An RtError is thrown if the worker
+    threads cannot be created.
+  */
+  RtGraph( unsigned int outputChannels, unsigned int inputChannels = 0,
+           unsigned int nThreads = 0, int priority = 0 );
+
+  //! The destructor stops and joins the worker threads.
+  ~RtGraph( void );
+
+  //! Adds a processing node to the graph and returns its identifier.
+  /*!
+    The graph does not take ownership of \c node, which must outlive
+    the graph.  An RtError (type = RtError::INVALID_PARAMETER) is
+    thrown if \c node is NULL or has no output channels.
+  */
+  NodeId addNode( RtGraphNode *node );
+
+  //! Adds a mixing bus with \c channels channels and returns its identifier.
+  NodeId addBus( unsigned int channels );
+
+  //! Returns the identifier of the output bus.
+  NodeId getOutput( void ) const { return 0; };
+
+  //! Returns the identifier of the device input node.
+  /*!
+    An RtError (type = RtError::INVALID_USE) is thrown if the graph
+    was created without input channels.
+  */
+  NodeId getInput( void ) const;
+
+  //! Connects the output of \c source to the input of \c destination.
+  /*!
+    Channel \e k of the source is mixed into channel \e k of the
+    destination, scaled by \c gain.  A mono source is spread over all
+    destination channels and surplus source channels wrap around, so
+    a stereo source into a mono bus is summed.  A connection into a
+    bus that also feeds elsewhere is a send.  An RtError (type =
+    RtError::INVALID_PARAMETER) is thrown for invalid identifiers, for
+    connections into the input node, or out of the output bus.
+  */
+  ConnectionId connect( NodeId source, NodeId destination, float gain = 1.0 );
+
+  //! Sets the gain of a connection.  Safe to call while processing.
+  void setConnectionGain( ConnectionId connection, float gain );
+
+  //! Sets the output gain of a node or bus.  Safe to call while processing.
+  void setGain( NodeId node, float gain );
+
+  //! Sorts the graph into a schedule and allocates its buffers.
+  /*!
+    \c maxFrames is the largest block size passed to process(); larger
+    blocks are processed in several passes.  \c format is the sample
+    format of the device buffers, RTAUDIO_FLOAT32 or RTAUDIO_FLOAT64.
+    If \c interleaved is false, the device buffers are expected to be
+    non-interleaved (the stream was opened with
+    RTAUDIO_NONINTERLEAVED), and each channel is copied with a single
+    contiguous loop.  Nodes that do not reach the output bus are not scheduled.  An
+    RtError (type = RtError::INVALID_USE) is thrown if the graph
+    contains a cycle, and an RtError (type =
+    RtError::INVALID_PARAMETER) for an unsupported format.
+  */
+  void compile( unsigned int maxFrames, RtAudioFormat format, bool interleaved = true );
+
+  //! Renders \c nFrames of output from \c nFrames of input.
+  /*!
+    Runs one block of the compiled schedule and returns when the
+    whole graph has been rendered.  \c inputBuffer may be NULL, in
+    which case the input node produces silence.  Nothing is done if
+    the graph has not been compiled.
+  */
+  void process( void *outputBuffer, void *inputBuffer, unsigned int nFrames );
+
+  //! An RtAudioCallback which runs the RtGraph passed in \c userData.
+  static int callback( void *outputBuffer, void *inputBuffer, unsigned int nFrames,
+                       double streamTime, RtAudioStreamStatus status, void *userData );
+
+  //! Returns the total number of threads executing the graph.
+  unsigned int getThreadCount( void ) const { return (unsigned int) workers_.size(); };
+
+ protected:
+
+  enum NodeType {
+    NODE_PROCESSOR,
+    NODE_BUS,
+    NODE_INPUT
+  };
+
+  struct Connection {
+    NodeId source;
+    NodeId destination;
+    std::atomic<float> gain;
+    float currentGain;
+  };
+
+  struct Node {
+    NodeType type;
+    RtGraphNode *processor;
+    unsigned int inputChannels;
+    unsigned int outputChannels;
+    std::atomic<float> gain;
+    float currentGain;
+    std::vector<ConnectionId> inputs;
+    std::vector<NodeId> successors;
+    int dependencies;
+    std::vector<float> buffer;
+    std::vector<float *> in;
+    std::vector<float *> out;
+  };
+
+  // A fixed-size Chase-Lev work-stealing deque of node indices.
+  // Only its owner pushes and pops; any thread may steal.
+  struct TaskQueue {
+    std::atomic<long> top;
+    std::atomic<long> bottom;
+    std::atomic<int> *tasks;
+    long mask;
+    TaskQueue() : top( 0 ), bottom( 0 ), tasks( 0 ), mask( 0 ) {}
+    void push( int task );
+    int pop( void );
+    int steal( void );
+  };
+
+  struct Worker {
+    RtGraph *graph;
+    unsigned int index;
+    pthread_t thread;
+  };
+
+  static void *workerThread( void *ptr );
+  void stopWorkers( unsigned int nThreads );
+  void clear( void );
+  void work( unsigned int self );
+  void renderNode( unsigned int index, unsigned int nFrames );
+  void runBlock( unsigned int nFrames );
+  NodeId newNode( NodeType type, RtGraphNode *processor,
+                  unsigned int inputChannels, unsigned int outputChannels );
+
+  std::vector<Node *> nodes_;
+  std::vector<Connection *> connections_;
+  std::vector<unsigned int> schedule_;
+  std::vector<unsigned int> roots_;
+  std::vector<Worker> workers_;
+  TaskQueue *queues_;
+  std::atomic<int> *pending_;
+  std::atomic<int> remaining_;
+  std::atomic<unsigned long> generation_;
+  std::atomic<int> sleepers_;
+  std::atomic<bool> running_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t wakeup_;
+  unsigned int outputChannels_;
+  unsigned int inputChannels_;
+  unsigned int maxFrames_;
+  unsigned int blockFrames_;
+  RtAudioFormat format_;
+  bool interleaved_;
+  void *inputBuffer_;
+  unsigned int inputFrames_;
+  unsigned int inputOffset_;
+  bool compiled_;
+};
+
+#endif
@@ -0,0 +1,195 @@
+/************************************************************************/
+/*! \class RtLimiter
+    \brief Look-ahead brickwall limiter for the output of RtAudio streams.
+
+    See RtLimiter.h for an overview.
+*/
+/************************************************************************/
+
+#include "RtLimiter.h"
+#include <math.h>
+#include <algorithm>
+
+// Number of frames gathered from the input buffers at a time.
+const unsigned int RTLIMITER_CHUNK = 64;
+
+// Taps per phase of the true peak interpolator.
+const unsigned int RTLIMITER_TAPS = 8;
+
+// Largest oversampling factor of the true peak detector.
+const unsigned int RTLIMITER_MAX_OVERSAMPLING = 8;
+
+RtLimiter :: RtLimiter( unsigned int channels, double sampleRate, double lookahead,
+                        double ceiling, double release, unsigned int oversampling )
+  : RtGraphNode( channels, channels ), channels_( channels ), sampleRate_( sampleRate ),
+    oversampling_( oversampling ), window_( 0 ), delay_( 0 ), delayPosition_( 0 ), dequeFront_( 0 ),
+    dequeSize_( 0 ), frame_( 0 ), gain_( 1.0 ), averagePosition_( 0 ), averageSum_( 0.0 )
+{
+  if ( channels == 0 || !( sampleRate > 0.0 ) )
+    throw RtError( "RtLimiter: invalid channel count or sample rate.", RtError::INVALID_PARAMETER );
+  if ( !( lookahead >= 0.0 ) || lookahead > 1.0 )
+    throw RtError( "RtLimiter: the look-ahead must be between 0 and 1 second.", RtError::INVALID_PARAMETER );
+  if ( oversampling < 1 || oversampling > RTLIMITER_MAX_OVERSAMPLING )
+    throw RtError( "RtLimiter: the oversampling factor must be between 1 and 8.", RtError::INVALID_PARAMETER );
+
+  setCeiling( ceiling );
+  setRelease( release );
+
+  // The gain is averaged over the look-ahead and the frame about to
+  // play.  Peaks are held one frame longer, since a peak between two
+  // samples is detected with the first of them and limits both.  The
+  // interpolator adds half its length to the delay.
+  unsigned int lookaheadFrames = std::max( (unsigned int) ( lookahead * sampleRate + 0.5 ), 1u );
+  unsigned int phaseTaps = ( oversampling > 1 ) ? RTLIMITER_TAPS : 1;
+  window_ = lookaheadFrames + 1;
+  delay_ = lookaheadFrames + phaseTaps / 2;
+
+  // Blackman windowed sinc, taps_[tap * oversampling + phase].  Phase 0
+  // is the input sample itself; the other phases are normalized to
+  // unity gain at DC.
+  unsigned int length = phaseTaps * oversampling;
+  taps_.assign( length, 0.0 );
+  if ( oversampling == 1 ) taps_[0] = 1.0f;
+  else {
+    for ( unsigned int j=0; j<length; j++ ) {
+      double t = ( (double) j - length / 2 ) / oversampling;
+      double sinc = ( t == 0.0 ) ? 1.0 : sin( M_PI * t ) / ( M_PI * t );
+      double w = 0.42 - 0.5 * cos( 2.0 * M_PI * j / length ) + 0.08 * cos( 4.0 * M_PI * j / length );
+      taps_[j] = (float) ( sinc * w );
+    }
+    for ( unsigned int p=1; p<oversampling; p++ ) {
+      double sum = 0.0;
+      for ( unsigned int k=0; k<phaseTaps; k++ ) sum += taps_[k * oversampling + p];
+      for ( unsigned int k=0; k<phaseTaps; k++ ) taps_[k * oversampling + p] /= (float) sum;
+    }
+  }
+
+  history_.resize( (size_t) channels * ( phaseTaps - 1 + RTLIMITER_CHUNK ) );
+  peak_.resize( RTLIMITER_CHUNK );
+  delayLine_.resize( (size_t) delay_ * channels );
+  dequeFrame_.resize( window_ + 1 );
+  dequePeak_.resize( window_ + 1 );
+  average_.resize( window_ );
+  reset();
+}
+
+void RtLimiter :: setCeiling( double ceiling )
+{
+  if ( !( ceiling <= 0.0 ) || ceiling < -60.0 )
+    throw RtError( "RtLimiter::setCeiling: the ceiling must be between -60 and 0 dBFS.", RtError::INVALID_PARAMETER );
+  ceiling_.store( (float) pow( 10.0, ceiling / 20.0 ), std::memory_order_relaxed );
+}
+
+void RtLimiter :: setRelease( double release )
+{
+  if ( !( release >= 0.0 ) )
+    throw RtError( "RtLimiter::setRelease: the release time must not be negative.", RtError::INVALID_PARAMETER );
+  double coefficient = ( release > 0.0 ) ? exp( -1.0 / ( release * sampleRate_ ) ) : 0.0;
+  releaseCoefficient_.store( (float) coefficient, std::memory_order_relaxed );
+}
+
+void RtLimiter :: reset( void )
+{
+  std::fill( history_.begin(), history_.end(), 0.0f );
+  std::fill( delayLine_.begin(), delayLine_.end(), 0.0f );
+  delayPosition_ = 0;
+  dequeFront_ = 0;
+  dequeSize_ = 0;
+  frame_ = 0;
+  gain_ = 1.0;
+  std::fill( average_.begin(), average_.end(), 1.0f );
+  averagePosition_ = 0;
+  averageSum_ = window_;
+  reduction_.store( 0.0f );
+  limitedFrames_.store( 0 );
+}
+
+void RtLimiter :: detect( unsigned int nFrames )
+{
+  unsigned int phases = oversampling_;
+  unsigned int phaseTaps = taps_.size() / phases;
+  unsigned int stride = phaseTaps - 1 + RTLIMITER_CHUNK;
+  const float *taps = &taps_[0];
+
+  std::fill( peak_.begin(), peak_.begin() + nFrames, 0.0f );
+  for ( unsigned int c=0; c<channels_; c++ ) {
+    float *history = &history_[c * stride];
+    for ( unsigned int i=0; i<nFrames; i++ ) {
+      // All phases at once: the loop over the phases has no
+      // dependencies and vectorizes.
+      const float *x = history + phaseTaps - 1 + i;
+      float y[RTLIMITER_MAX_OVERSAMPLING] = { 0.0f };
+      for ( unsigned int k=0; k<phaseTaps; k++ ) {
+        float xk = x[-(int) k];
+        for ( unsigned int p=0; p<phases; p++ ) y[p] += taps[k * phases + p] * xk;
+      }
+      float peak = peak_[i];
+      for ( unsigned int p=0; p<phases; p++ ) peak = std::max( peak, fabsf( y[p] ) );
+      peak_[i] = peak;
+    }
+
+    // Keep the last taps of input for the next chunk.
+    std::copy( history + nFrames, history + nFrames + phaseTaps - 1, history );
+  }
+}
+
+void RtLimiter :: process( float **input, float **output, unsigned int nFrames )
+{
+  unsigned int phaseTaps = taps_.size() / oversampling_;
+  unsigned int stride = phaseTaps - 1 + RTLIMITER_CHUNK;
+  float ceiling = ceiling_.load( std::memory_order_relaxed );
+  double release = releaseCoefficient_.load( std::memory_order_relaxed );
+  unsigned int span = window_ + 1;
+  double lowest = 1.0;
+  unsigned long long limited = 0;
+
+  for ( unsigned int offset=0; offset<nFrames; offset+=RTLIMITER_CHUNK ) {
+    unsigned int count = std::min( nFrames - offset, RTLIMITER_CHUNK );
+    for ( unsigned int c=0; c<channels_; c++ )
+      std::copy( input[c] + offset, input[c] + offset + count, &history_[c * stride + phaseTaps - 1] );
+    detect( count );
+
+    for ( unsigned int i=0; i<count; i++ ) {
+      // Slide the window: expire the front, then drop the peaks the new
+      // one exceeds from the back.  The front is the window maximum.
+      if ( dequeSize_ > 0 && dequeFrame_[dequeFront_] + span <= frame_ ) {
+        dequeFront_ = ( dequeFront_ + 1 ) % span;
+        dequeSize_--;
+      }
+      float peak = peak_[i];
+      while ( dequeSize_ > 0 && dequePeak_[( dequeFront_ + dequeSize_ - 1 ) % span] <= peak )
+        dequeSize_--;
+      unsigned int back = ( dequeFront_ + dequeSize_ ) % span;
+      dequeFrame_[back] = frame_;
+      dequePeak_[back] = peak;
+      dequeSize_++;
+      frame_++;
+
+      // Attack at once to the gain the window requires, release
+      // exponentially, and average over the window.
+      float highest = dequePeak_[dequeFront_];
+      double required = ( highest > ceiling ) ? ceiling / highest : 1.0;
+      if ( required < gain_ ) gain_ = required;
+      else gain_ = required + ( gain_ - required ) * release;
+      float held = (float) gain_;
+      averageSum_ += held - average_[averagePosition_];
+      average_[averagePosition_] = held;
+      averagePosition_ = ( averagePosition_ + 1 ) % window_;
+      double gain = averageSum_ / window_;
+      lowest = std::min( lowest, gain );
+      if ( gain < 0.99999 ) limited++;
+
+      float *delayed = &delayLine_[delayPosition_ * channels_];
+      for ( unsigned int c=0; c<channels_; c++ ) {
+        float x = input[c][offset + i];
+        float y = (float) ( delayed[c] * gain );
+        delayed[c] = x;
+        output[c][offset + i] = std::min( std::max( y, -ceiling ), ceiling );
+      }
+      delayPosition_ = ( delayPosition_ + 1 ) % delay_;
+    }
+  }
+
+  reduction_.store( (float) ( -20.0 * log10( lowest ) ), std::memory_order_relaxed );
+  if ( limited ) limitedFrames_.fetch_add( limited, std::memory_order_relaxed );
+}
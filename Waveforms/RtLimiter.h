@@ -0,0 +1,124 @@
+/************************************************************************/
+/*! \class RtLimiter
+    \brief Look-ahead brickwall limiter for the output of RtAudio streams.
+
+    RtLimiter keeps the output of a stream below a ceiling without
+    clipping it.  The signal is delayed by a short look-ahead, so the
+    limiter sees each peak before it plays and has the whole
+    look-ahead to turn the gain down smoothly; afterwards the gain
+    recovers with an exponential release.  The gain is common to all
+    channels, so the stereo image does not move.
+
+    The peaks are true peaks: the detector interpolates each channel
+    by the oversampling factor with a windowed sinc (polyphase, 8 taps
+    per phase) and takes the largest magnitude of the interpolated
+    samples, so peaks between samples, which a digital to analog
+    converter would reproduce, are limited as well.
+
+    The largest peak over the look-ahead window is kept with a
+    monotonic deque: each new peak drops the older peaks it exceeds
+    from the back, and the peak at the front leaves the window when it
+    expires, so the maximum costs O(1) per frame whatever the window
+    length.  The gain this maximum requires is smoothed by a moving
+    average over the look-ahead, which reaches the required gain
+    exactly when the peak plays.  A final clamp keeps floating point
+    rounding from ever exceeding the ceiling.
+
+    The limiter delays the signal by getLatency() frames.
+*/
+/************************************************************************/
+
+/*!
+  \file RtLimiter.h
+ */
+
+#ifndef __RTLIMITER_H
+#define __RTLIMITER_H
+
+#include "RtGraph.h"
+#include <atomic>
+#include <vector>
+
+class RtLimiter : public RtGraphNode
+{
+ public:
+
+  //! The constructor.
+  /*!
+    \c lookahead and \c release are in seconds and \c ceiling is in
+    dBFS.  \c oversampling is the interpolation factor of the true
+    peak detector, from 1 (sample peaks only) to 8.  An RtError (type
+    = RtError::INVALID_PARAMETER) is thrown for invalid parameters.
+  */
+  RtLimiter( unsigned int channels, double sampleRate, double lookahead = 0.005,
+             double ceiling = -1.0, double release = 0.1, unsigned int oversampling = 4 );
+
+  //! Sets the ceiling in dBFS.  Safe to call while processing.
+  void setCeiling( double ceiling );
+
+  //! Sets the release time in seconds.  Safe to call while processing.
+  void setRelease( double release );
+
+  //! Clears the look-ahead and the detector, and resets the gain.
+  /*!
+    Must not be called while another thread is inside process().
+  */
+  void reset( void );
+
+  //! Limits \c nFrames of \c input into \c output (RtGraphNode interface).
+  /*!
+    \c input and \c output may be the same buffers.
+  */
+  void process( float **input, float **output, unsigned int nFrames );
+
+  //! Returns the delay of the limiter in frames.
+  unsigned int getLatency( void ) const { return delay_; };
+
+  //! Returns the largest gain reduction of the last block, in dB (zero or positive).
+  float getGainReduction( void ) const { return reduction_.load( std::memory_order_relaxed ); };
+
+  //! Returns the number of frames played with reduced gain since the last reset.
+  unsigned long long getLimitedFrames( void ) const { return limitedFrames_.load(); };
+
+ protected:
+
+  void detect( unsigned int nFrames );
+
+  unsigned int channels_;
+  double sampleRate_;
+  unsigned int oversampling_;
+  unsigned int window_;
+  unsigned int delay_;
+  std::atomic<float> ceiling_;
+  std::atomic<float> releaseCoefficient_;
+
+  // Interpolation filter [tap][phase], and per channel the last taps
+  // of input followed by the current chunk.  peak_ receives the true
+  // peak of each frame of the chunk over all channels.
+  std::vector<float> taps_;
+  std::vector<float> history_;
+  std::vector<float> peak_;
+
+  // The look-ahead delay [frame][channel] as a ring.
+  std::vector<float> delayLine_;
+  unsigned int delayPosition_;
+
+  // The monotonic deque of (frame, peak), a ring of window_ + 1
+  // entries whose peaks decrease from front to back.
+  std::vector<unsigned long long> dequeFrame_;
+  std::vector<float> dequePeak_;
+  unsigned int dequeFront_;
+  unsigned int dequeSize_;
+  unsigned long long frame_;
+
+  // The released gain, and the moving average of it over the window.
+  double gain_;
+  std::vector<float> average_;
+  unsigned int averagePosition_;
+  double averageSum_;
+
+  std::atomic<float> reduction_;
+  std::atomic<unsigned long long> limitedFrames_;
+};
+
+#endif
@@ -17,16 +17,21 @@
 
 
 #include "RtAudio.h"
+#include "RtGraph.h"
+#include "RtFilterBank.h"
+#include "RtLimiter.h"
 #include <math.h>
+#include <time.h>
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 #include <sstream>
 using namespace std;
 
-// datatype:
-#define SAMPLE double
+// datatype: float, as most devices are 32-bit
+#define SAMPLE float
 // corresponding format for RtAudio
-#define MY_FORMAT RTAUDIO_FLOAT64
+#define MY_FORMAT RTAUDIO_FLOAT32
 // sample rate
 #define MY_SRATE 44100
 // number of channels
@@ -36,11 +41,17 @@ using namespace std;
 
 
 // global for frequency
-SAMPLE g_freq;
-// global sample number variable
-SAMPLE g_t = 0;
+double g_freq;
+// global sample number variable (double, so it keeps counting exactly)
+double g_t = 0;
 // global for width
-SAMPLE g_width;
+double g_width;
+// cutoff of the low pass which softens the raw (aliasing) waves
+#define MY_TONE 6000.0
+// the low pass itself, one lane for the one channel we render
+RtFilterBank g_tone( 1, MY_SRATE );
+// keeps spikes of the single waves out of the speakers (5 ms look-ahead)
+RtLimiter g_limiter( 1, MY_SRATE );
 
 
 
@@ -83,6 +94,46 @@ double getDouble(string message, double min, double  max) {
 }
 
 
+/* void benchmarkFilters();
+ *
+ * Measures how many samples per second RtFilterBank filters, for a few
+ * numbers of lanes.  The cutoffs change every block, so the parameter
+ * smoothing is included.  No audio device is needed.
+ */
+void benchmarkFilters() {
+    unsigned int lanes[] = { 1, 8, 64 };
+    unsigned int frames = 512;
+    for (int b = 0; b < 3; b++) {
+        RtFilterBank bank(lanes[b], MY_SRATE);
+        vector< vector<float> > buffers(lanes[b], vector<float>(frames));
+        vector<float *> pointers(lanes[b]);
+        for (unsigned int l = 0; l < lanes[b]; l++) {
+            for (unsigned int i = 0; i < frames; i++)
+                buffers[l][i] = (float) (rand() % 128 - 64) / 64;
+            pointers[l] = &buffers[l][0];
+        }
+
+        struct timespec start, now;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        double seconds = 0;
+        unsigned long blocks = 0;
+        while (seconds < 0.5) {
+            for (int k = 0; k < 16; k++, blocks++) {
+                for (unsigned int l = 0; l < lanes[b]; l++)
+                    bank.setFilter(l, RtFilterBank::LOWPASS, 500.0 + 100.0 * ((blocks + l) % 50), 2.0);
+                bank.process(&pointers[0], &pointers[0], frames);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            seconds = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+        }
+
+        double rate = (double) blocks * frames * lanes[b] / seconds;
+        cout << lanes[b] << " lanes: " << rate / 1e6 << " million samples/s, "
+             << rate / MY_SRATE << " channels in real time" << endl;
+    }
+}
+
+
 
 
 //-----------------------------------------------------------------------------
@@ -113,16 +164,12 @@ int callmeSine( void * outputBuffer, void * inputBuffer, unsigned int numFrames,
     for( int i = 0; i < numFrames; i++ )
     {
         // generate signal
-        buffy[i*MY_CHANNELS] = sin( 2 * MY_PIE * g_freq * g_t / MY_SRATE );
+        buffy[i] = sin( 2 * MY_PIE * g_freq * g_t / MY_SRATE );
         
-        // copy into other channels
-        for( int j = 1; j < MY_CHANNELS; j++ )
-            buffy[i*MY_CHANNELS+j] = buffy[i*MY_CHANNELS];
-            
         // increment sample number
         g_t += 1.0;
     }
-    
+
     return 0;
 }
 
@@ -139,7 +186,7 @@ int callmeSaw( void * outputBuffer, void * inputBuffer, unsigned int numFrames,
     
     SAMPLE curS = -1.0;
 
-    SAMPLE prd = MY_SRATE / g_freq; // prd = period, which stays constant over the loop
+    double prd = MY_SRATE / g_freq; // prd = period, which stays constant over the loop
     // fill
     for( int i = 0; i < numFrames; i++ )
     {
@@ -150,20 +197,16 @@ int callmeSaw( void * outputBuffer, void * inputBuffer, unsigned int numFrames,
         } else {
             curS = 1.0 - 2.0 * (g_t - g_width * prd) / (prd * (1-g_width));
         }
-        if (curS >= -1.0 && curS <= 1.0) { // just in case!
-            buffy[i*MY_CHANNELS] = curS;
-
-            // copy into other channels
-            for( int j = 1; j < MY_CHANNELS; j++ )
-                buffy[i*MY_CHANNELS+j] = buffy[i*MY_CHANNELS];
-        } else {
-            cerr << "warning: amplitude spike" << endl;
-            exit(1);
-        }
+        buffy[i] = curS; // spikes are caught by the limiter below
         // increment sample number
         g_t += 1.0;   
     }
-    
+
+    // soften the aliasing
+    g_tone.process( &buffy, &buffy, numFrames );
+    // and protect the output
+    g_limiter.process( &buffy, &buffy, numFrames );
+
     return 0;
 }
 
@@ -176,7 +219,7 @@ int callmePulse( void * outputBuffer, void * inputBuffer, unsigned int numFrames
     // cast!
     SAMPLE * buffy = (SAMPLE *)outputBuffer;
 
-    SAMPLE prd = MY_SRATE / g_freq;
+    double prd = MY_SRATE / g_freq;
     
     // fill
     for( int i = 0; i < numFrames; i++ )
@@ -184,18 +227,19 @@ int callmePulse( void * outputBuffer, void * inputBuffer, unsigned int numFrames
         if (g_t > prd) g_t -= (int) prd;
         // generate signal
 	if (g_t <= g_width * MY_SRATE / g_freq) {
-            buffy[i*MY_CHANNELS] = 1.0;
+            buffy[i] = 1.0;
         } else {
-            buffy[i*MY_CHANNELS] = 0.0;
+            buffy[i] = 0.0;
         }
-        // copy into other channels
-        for( int j = 1; j < MY_CHANNELS; j++ )
-            buffy[i*MY_CHANNELS+j] = buffy[i*MY_CHANNELS];
-            
         // increment sample number
         g_t += 1.0;   
     }
-  
+
+    // soften the aliasing
+    g_tone.process( &buffy, &buffy, numFrames );
+    // and protect the output
+    g_limiter.process( &buffy, &buffy, numFrames );
+
     return 0;
 }
 
@@ -212,13 +256,14 @@ int callmeNoise( void * outputBuffer, void * inputBuffer, unsigned int numFrames
     for( int i = 0; i < numFrames; i++ )
     {
         // generate signal
-        buffy[i*MY_CHANNELS] = (double) (rand() % 128 - 64) / 64 ;
-        
-        // copy into other channels
-        for( int j = 1; j < MY_CHANNELS; j++ )
-            buffy[i*MY_CHANNELS+j] = buffy[i*MY_CHANNELS];
+        buffy[i] = (double) (rand() % 128 - 64) / 64 ;
     }
-    
+
+    // take the hiss off
+    g_tone.process( &buffy, &buffy, numFrames );
+    // and protect the output
+    g_limiter.process( &buffy, &buffy, numFrames );
+
     return 0;
 }
 
@@ -233,29 +278,153 @@ int callmeImpulse( void * outputBuffer, void * inputBuffer, unsigned int numFram
     // fill
     for( int i = 0; i < numFrames; i++ )
     {
-        SAMPLE prd = MY_SRATE / g_freq;
+        double prd = MY_SRATE / g_freq;
         
         // generate signal
 	if (g_t > prd) {
-            buffy[i*MY_CHANNELS] = 1.0;
+            buffy[i] = 1.0;
             g_t -= (int) prd;
         } else
-            buffy[i*MY_CHANNELS] = 0.0;
+            buffy[i] = 0.0;
         
-        // copy into other channels
-        for( int j = 1; j < MY_CHANNELS; j++ )
-            buffy[i*MY_CHANNELS+j] = buffy[i*MY_CHANNELS];
-            
         // increment sample number
         g_t += 1.0;
     }
-    
+
+    // soften the aliasing
+    g_tone.process( &buffy, &buffy, numFrames );
+    // and protect the output
+    g_limiter.process( &buffy, &buffy, numFrames );
+
     return 0;
 }
 
 
 
 
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+//  ~*~*~  Graph Nodes  ~*~**~
+
+// The same waves as RtGraph nodes, so that several of them can be mixed
+//   (--mix).  Each node keeps its own sample counter instead of g_t.
+
+
+/* name: SineNode
+ * desc: graph node.  Makes a plain, basic sine wave.
+ */
+class SineNode : public RtGraphNode {
+public:
+    SineNode( double freq ) : RtGraphNode( 0, 1 ), m_freq( freq ), m_t( 0 ) { }
+
+    void process( float ** input, float ** output, unsigned int numFrames ) {
+        for( unsigned int i = 0; i < numFrames; i++ ) {
+            output[0][i] = sin( 2 * MY_PIE * m_freq * m_t / MY_SRATE );
+            m_t += 1.0;
+        }
+    }
+
+private:
+    double m_freq, m_t;
+};
+
+/* name: SawNode
+ * desc: graph node.  Makes a saw wave (width 0.5 gives a triangle).
+ */
+class SawNode : public RtGraphNode {
+public:
+    SawNode( double freq, double width )
+        : RtGraphNode( 0, 1 ), m_prd( MY_SRATE / freq ), m_width( width ), m_t( 0 ) { }
+
+    void process( float ** input, float ** output, unsigned int numFrames ) {
+        for( unsigned int i = 0; i < numFrames; i++ ) {
+            if (m_t > m_prd) m_t -= (int) m_prd;
+            if (m_t < m_width * m_prd)
+                output[0][i] = -1.0 + 2.0 * m_t / (m_prd * m_width);
+            else
+                output[0][i] = 1.0 - 2.0 * (m_t - m_width * m_prd) / (m_prd * (1-m_width));
+            m_t += 1.0;
+        }
+    }
+
+private:
+    double m_prd, m_width, m_t;
+};
+
+/* name: PulseNode
+ * desc: graph node.  Makes a pulse wave.
+ */
+class PulseNode : public RtGraphNode {
+public:
+    PulseNode( double freq, double width )
+        : RtGraphNode( 0, 1 ), m_prd( MY_SRATE / freq ), m_width( width ), m_t( 0 ) { }
+
+    void process( float ** input, float ** output, unsigned int numFrames ) {
+        for( unsigned int i = 0; i < numFrames; i++ ) {
+            if (m_t > m_prd) m_t -= (int) m_prd;
+            output[0][i] = (m_t <= m_width * m_prd) ? 1.0 : 0.0;
+            m_t += 1.0;
+        }
+    }
+
+private:
+    double m_prd, m_width, m_t;
+};
+
+/* name: NoiseNode
+ * desc: graph node.  Makes white noise (with its own generator, since
+ *       rand() is not meant to be shared between threads).
+ */
+class NoiseNode : public RtGraphNode {
+public:
+    NoiseNode() : RtGraphNode( 0, 1 ), m_seed( 22222 ) { }
+
+    void process( float ** input, float ** output, unsigned int numFrames ) {
+        for( unsigned int i = 0; i < numFrames; i++ ) {
+            m_seed = m_seed * 1664525 + 1013904223;
+            output[0][i] = (float) (int) m_seed / 2147483648.0;
+        }
+    }
+
+private:
+    unsigned int m_seed;
+};
+
+/* name: Mix
+ * desc: a small mix of the nodes above.  The sine goes straight to the
+ *       output; saw and pulse share a synth bus, and the sine and the
+ *       noise are sent to it as well.  The synth bus is low passed.
+ */
+struct Mix {
+    SineNode sine;
+    SawNode saw;
+    PulseNode pulse;
+    NoiseNode noise;
+    RtFilterBank tone;
+    RtGraph graph;
+
+    Mix( double freq )
+        : sine( freq ), saw( 1.5 * freq, 0.5 ), pulse( 2.0 * freq, 0.25 ),
+          tone( MY_CHANNELS, MY_SRATE ), graph( MY_CHANNELS ) {
+        for( unsigned int j = 0; j < MY_CHANNELS; j++ )
+            tone.setFilter( j, RtFilterBank::LOWPASS, MY_TONE );
+        RtGraph::NodeId synth = graph.addBus( MY_CHANNELS );
+        RtGraph::NodeId sineId = graph.addNode( &sine );
+        graph.connect( sineId, graph.getOutput(), 0.4 );
+        graph.connect( sineId, synth, 0.5 );
+        graph.connect( graph.addNode( &saw ), synth, 0.6 );
+        graph.connect( graph.addNode( &pulse ), synth, 0.3 );
+        graph.connect( graph.addNode( &noise ), synth, 0.05 );
+        RtGraph::NodeId toneId = graph.addNode( &tone );
+        graph.connect( synth, toneId );
+        graph.connect( toneId, graph.getOutput(), 0.3 );
+    }
+};
+
+
+
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 
@@ -274,6 +443,12 @@ int main(int argc, char* argv[]) {
     // frame size
     unsigned int bufferFrames = 512;
 
+    // no device needed for this one
+    if (argc == 2 && strcmp(argv[1],"--bench") == 0) {
+        benchmarkFilters();
+        return 0;
+    }
+
     if (adac.getDeviceCount() < 1) {
 	std::cout << "seeing no speakers, man" << std::endl;
 	exit(1);
@@ -293,6 +468,15 @@ int main(int argc, char* argv[]) {
 
     // create stream options
     RtAudio::StreamOptions options;
+    // non-interleaved buffers: one contiguous block per channel
+    options.flags |= RTAUDIO_NONINTERLEAVED;
+    // the callbacks render one channel, which RtAudio copies to all
+    // of the output channels
+    options.outputRouting.assign( MY_CHANNELS, 1.0 );
+    // graph for --mix
+    Mix * mix = NULL;
+    // tone of the single waves
+    g_tone.setFilter( 0, RtFilterBank::LOWPASS, MY_TONE );
 
 
 
@@ -318,6 +502,16 @@ int main(int argc, char* argv[]) {
         if (strcmp(argv[1],"--noise") == 0) {
             adac.openStream( &oParams, &iParams, MY_FORMAT, MY_SRATE, &bufferFrames,
                              &callmeNoise, (void *)&bufferBytes, &options );
+        } else if (strcmp(argv[1],"--mix") == 0) {
+            g_freq = getDouble("Enter frequency (>0.1 Hz, <20k Hz):  ", 0.1, 20000.0);
+            mix = new Mix( g_freq );
+            // the graph renders all of the channels itself
+            options.outputRouting.clear();
+            adac.openStream( &oParams, &iParams, MY_FORMAT, MY_SRATE, &bufferFrames,
+                             &RtGraph::callback, (void *)&mix->graph, &options );
+            // the graph's buffers follow the block size we actually got
+            mix->graph.compile( bufferFrames, MY_FORMAT, false );
+            cout << "mixing on " << mix->graph.getThreadCount() << " threads" << endl;
         } else {
             g_freq = getDouble("Enter frequency (>0.1 Hz, <20k Hz):  ", 0.1, 20000.0);        
             if ( strcmp(argv[1],"--sine") == 0) {
@@ -407,6 +601,7 @@ int main(int argc, char* argv[]) {
     }
 
     if (adac.isStreamOpen()) adac.closeStream();
+    delete mix;
 
 
     return 0;